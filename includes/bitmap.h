@@ -0,0 +1,24 @@
+#ifndef BWFS_BITMAP_H
+#define BWFS_BITMAP_H
+
+#include "../includes/bwfs.h"
+
+// Asignador de bloques e inodos sobre bitsets empaquetados en memoria.
+// En disco los bitmaps siguen siendo un byte por entrada al final del
+// bloque de bitmaps; solo se reescriben las palabras modificadas.
+// Todas las funciones toman el lock del asignador.
+int bitmap_init(const char *folder, const bwfs_geometry_t *geometry);
+int bitmap_sync(const char *folder);
+
+int alloc_inode(void);
+void free_inode(int ino);
+
+int alloc_blocks(int count, int *out);
+void free_block(int block);
+void bitmap_restore(int is_inode, int index, int used);
+int bitmap_test(int is_inode, int index);
+
+int bitmap_free_blocks(void);
+int bitmap_free_inodes(void);
+
+#endif // BWFS_BITMAP_H
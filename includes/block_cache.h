@@ -0,0 +1,68 @@
+#ifndef BWFS_BLOCK_CACHE_H
+#define BWFS_BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BWFS_CACHE_DEFAULT_MB 16
+#define BWFS_DIRTY_EXPIRE_DEFAULT_MS 5000
+#define BWFS_PREFETCH_THREADS 2
+#define BWFS_PREFETCH_QUEUE 256
+#define BWFS_READAHEAD_MIN 2
+#define BWFS_READAHEAD_MAX 32
+#define BWFS_EVICT_BATCH 8
+
+// Caché LRU de payloads decodificados (125000 bytes por bloque) sobre el
+// block store. Las escrituras quedan sucias en memoria; con el hilo de
+// write-back en marcha se codifican y escriben en segundo plano al vencer
+// o al pasar la mitad del límite de sucios, y un escritor solo espera si
+// se supera el límite. Sin el hilo se escriben al desalojar o en
+// block_cache_flush(). Todas las funciones son seguras entre hilos: las
+// lecturas de un bloque corren en paralelo y las escrituras se serializan
+// con el lock de ese bloque.
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    size_t   capacity;      // bloques que entran en el presupuesto
+    size_t   resident;      // bloques cargados ahora
+    size_t   dirty;         // bloques de datos sucios ahora
+    uint64_t throttled;     // escrituras que esperaron al write-back
+    uint64_t prefetched;    // bloques cargados por el prefetch
+    uint64_t corrupt;       // lecturas de bloques que no coincidieron con su CRC
+} block_cache_stats_t;
+
+int block_cache_init(size_t budget_bytes);
+void block_cache_destroy(void);
+
+int block_cache_read(int block, size_t offset, size_t len, unsigned char *out);
+// Una escritura del payload entero no lee ni decodifica lo que había
+int block_cache_write(int block, size_t offset, size_t len, const unsigned char *in);
+void block_cache_invalidate(int block);
+// Bloque de datos recién asignado: en cero sin leer el store
+int block_cache_zero(int block);
+
+// Metadatos: pasan por el journal y solo se escriben en block_cache_checkpoint;
+// block_cache_flush baja únicamente los bloques de datos
+int block_cache_write_meta(int block, size_t offset, size_t len, const unsigned char *in);
+int block_cache_zero_meta(int block);
+int block_cache_flush(void);
+int block_cache_sync_blocks(const int *blocks, int count);
+int block_cache_contains(int block);
+int block_cache_checkpoint(void);
+
+// dirty_limit_bytes: sucios permitidos antes de frenar a los escritores;
+// expire_ms: edad máxima de un bloque sucio (0 = por defecto)
+int block_cache_writeback_start(size_t dirty_limit_bytes, unsigned expire_ms);
+void block_cache_writeback_stop(void);
+
+// Readahead: los hilos de prefetch decodifican por adelantado los bloques
+// pedidos con block_cache_prefetch, que no bloquea
+int block_cache_prefetch_start(int threads);
+void block_cache_prefetch_stop(void);
+void block_cache_prefetch(const int *blocks, int count);
+
+void block_cache_get_stats(block_cache_stats_t *stats);
+
+#endif // BWFS_BLOCK_CACHE_H
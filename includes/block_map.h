@@ -0,0 +1,38 @@
+#ifndef BWFS_BLOCK_MAP_H
+#define BWFS_BLOCK_MAP_H
+
+#include <stdint.h>
+#include "../includes/bwfs.h"
+#include "../includes/pbm.h"
+
+// Mapa de bloques de un archivo: 12 punteros directos en el inodo y un
+// bloque índice simple (inode_t.index_block) cuyo payload es un arreglo de
+// uint32_t con los bloques siguientes. 0 = sin bloque (el 0 es el superbloque).
+#define BWFS_DIRECT_BLOCKS   12
+#define BWFS_PTRS_PER_INDEX  (pbm_payload_size() / sizeof(uint32_t))
+#define BWFS_MAX_FILE_BLOCKS (BWFS_DIRECT_BLOCKS + BWFS_PTRS_PER_INDEX)
+
+// Índice cubierto por un cluster comprimido (ver compress.h): no tiene
+// bloque propio. block_map_get lo devuelve como BWFS_MAP_COMPRESSED y
+// cualquier valor negativo sigue siendo "sin bloque" para quien no lo mire.
+#define BWFS_BLOCK_COMPRESSED ((uint32_t)-2)
+#define BWFS_MAP_COMPRESSED   (-2)
+
+int block_map_get(const inode_t *inode, int idx);
+int block_map_get_range(const inode_t *inode, int first, int count, int *out);
+int block_map_reserve(inode_t *inode, int first, int last);
+// Reemplaza `count` punteros: bloque, -1 (hueco) o BWFS_MAP_COMPRESSED.
+// Los índices del bloque índice necesitan que el inodo ya lo tenga.
+int block_map_set_range(inode_t *inode, int first, int count, const int *blocks);
+void block_map_free(inode_t *inode);
+// Suelta un puntero a un bloque de datos: se libera si era el último
+// (los bloques deduplicados tienen varios, ver dedup.h)
+void block_map_release(int blk);
+// Igual, pero recién cuando la transacción actual sea durable: quien cambia
+// el mapa deja los bloques viejos acá y el que cierra la operación llama a
+// block_map_release_deferred después de journal_commit(1) (por hilo)
+void block_map_defer_release(int blk);
+int block_map_deferred(void);
+void block_map_release_deferred(void);
+
+#endif // BWFS_BLOCK_MAP_H
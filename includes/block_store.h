@@ -0,0 +1,15 @@
+#ifndef BWFS_BLOCK_STORE_H
+#define BWFS_BLOCK_STORE_H
+
+#include <stddef.h>
+
+// Capa de acceso a los bloques de datos: cada archivo de bloque se mapea
+// con mmap la primera vez que se usa y el mapeo se conserva hasta desmontar
+int block_store_init(const char *folder);
+void block_store_close(void);
+
+int block_store_read(int block, size_t offset, size_t len, unsigned char *out);
+int block_store_write(int block, size_t offset, size_t len, const unsigned char *in);
+int block_store_sync(void);
+
+#endif // BWFS_BLOCK_STORE_H
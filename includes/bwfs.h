@@ -2,13 +2,32 @@
 #define BWFS_H
 #define BWFS_MAGIC      0x42574653  // 'BWFS' en ASCII
 #define BWFS_BLOCK_SIZE 1024        // 1 KB por bloque lógico
-#define BWFS_MAX_BLOCKS 1024        // Hasta 1024 bloques (ajustable)
-#define BWFS_INODES     128         // Cantidad máxima de inodos
 #define BWFS_FILENAME   255         // Longitud máxima de nombre
 #define BWFS_SIGNATURE  "BWFSv1"    // Firma opcional para el inicio del FS
+
+// Geometría fija de los volúmenes anteriores a bwfs_geometry_t; para los
+// nuevos son solo los valores por omisión de mkfs.bwfs
+#define BWFS_MAX_BLOCKS 1024        // Entradas del bitmap de bloques en disco
+#define BWFS_INODES     128         // Entradas del bitmap de inodos en disco
 #define BLOCK_COUNT     128         // Bloques totales del FS
 #define INODE_BLOCKS    4           // Bloques reservados para inodos
 #define BITMAP_BLOCK    1           // Bloque único para ambos bitmaps
+#define BWFS_P1_META_OFFSET 2000000 // Datos binarios tras la imagen P1
+#define BWFS_P4_META_OFFSET 131072  // Datos binarios tras la imagen P4
+
+#define BWFS_INODES_PER_BLOCK 256   // Inodos por bloque en volúmenes nuevos
+#define BWFS_SHARD_SIZE 1024        // Bloques por subcarpeta en volúmenes grandes
+#define BWFS_MAX_VOLUME_BLOCKS (1 << 24)
+
+// superblock_t.features
+#define BWFS_FEATURE_DIRS 0x1       // directorios jerárquicos desde root_inode
+#define BWFS_FEATURE_CRC  0x2       // tabla de CRC32C por bloque (ver checksum.h)
+#define BWFS_FEATURE_COMPRESS 0x4   // puede haber clusters comprimidos (ver compress.h)
+#define BWFS_FEATURE_DEDUP 0x8      // bloques compartidos con referencias en dedup.bwfs (ver dedup.h)
+#define BWFS_ROOT_INODE   0         // raíz de los volúmenes nuevos
+
+// superblock_t.state
+#define BWFS_STATE_CLEAN  0x1       // desmontado sin nada pendiente: fsck puede saltear el análisis
 #include <stdint.h>
 // Estructura del superbloque (se guarda en el primer bloque)
 typedef struct {
@@ -18,8 +37,36 @@ typedef struct {
     uint32_t data_block_start;   // Posición de inicio de bloques de datos
     uint32_t free_block_bitmap;  // Posición del bitmap de bloques libres
     uint32_t free_inode_bitmap;  // Posición del bitmap de inodos libres
+    uint32_t block_format;       // BWFS_FORMAT_P1 o BWFS_FORMAT_P4 (ver pbm.h)
+    // Geometría; en volúmenes anteriores total_inodes es 0 y rigen los valores fijos
+    uint32_t total_inodes;       // Inodos de la tabla
+    uint32_t inodes_per_block;   // Inodos por bloque de la tabla
+    uint32_t image_width;        // Dimensiones de la imagen portadora
+    uint32_t image_height;
+    uint32_t shard_size;         // Bloques por subcarpeta (0 = todos en la raíz)
+    uint32_t meta_offset;        // Offset de los metadatos binarios en un bloque
+    uint32_t features;           // BWFS_FEATURE_*; 0 = espacio de nombres plano
+    uint32_t root_inode;         // Directorio raíz (con BWFS_FEATURE_DIRS)
+    uint32_t state;              // BWFS_STATE_*; mount lo borra y lo vuelve a poner al desmontar
 } superblock_t;
 
+// Geometría del volumen montado, derivada del superbloque: todas las tablas
+// y bitmaps en memoria se dimensionan con esto
+typedef struct {
+    uint32_t total_blocks;
+    uint32_t total_inodes;
+    uint32_t inode_blocks;       // bloques 1..inode_blocks
+    uint32_t inodes_per_block;
+    uint32_t bitmap_block;       // bloque con ambos bitmaps, al final del archivo
+    uint32_t data_block_start;
+    uint32_t block_bitmap_len;   // entradas (bytes) de cada bitmap en disco
+    uint32_t inode_bitmap_len;
+    uint32_t image_width;
+    uint32_t image_height;
+    uint32_t shard_size;
+    uint32_t meta_offset;
+} bwfs_geometry_t;
+
 // Estructura de un inodo (archivo o directorio)
 typedef struct {
     uint8_t  used;                         // 1 = ocupado, 0 = libre
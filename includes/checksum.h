@@ -0,0 +1,64 @@
+#ifndef BWFS_CHECKSUM_H
+#define BWFS_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../includes/bwfs.h"
+
+// CRC32C (Castagnoli) del payload de cada bloque, en una tabla de uint32_t
+// por bloque dentro del bloque de bitmaps: empieza en meta_offset y los
+// bitmaps siguen al final del archivo. 0 = desconocido (no se verifica);
+// un CRC que da 0 se guarda como 1.
+//
+// En disco cada entrada vale 0 o el CRC de lo que ya está en disco: antes
+// de escribir un bloque su entrada se pone en 0 (con fdatasync, una vez por
+// bloque entre checkpoints), y el CRC nuevo se guarda recién en el
+// checkpoint, después de block_store_sync. Así un corte nunca deja un CRC
+// que no coincida con su bloque.
+
+// Verificación al leer (bwfs_config.verify)
+enum {
+    BWFS_VERIFY_LOAD = 0,   // al decodificar el bloque desde el store (por defecto)
+    BWFS_VERIFY_OFF,
+    BWFS_VERIFY_ALWAYS,     // además en cada acierto de caché sobre un bloque limpio
+};
+
+// La implementación (SSE4.2 o escalar) se elige una vez según la CPU; la
+// variable de entorno BWFS_CRC32C=sse42|scalar fuerza una
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+const char *crc32c_impl_name(void);
+
+// Sin tabla (volumen sin BWFS_FEATURE_CRC) el resto no hace nada.
+// checksum_init devuelve -1 si el volumen dice tener tabla y no la tiene.
+int checksum_init(const char *folder, const bwfs_geometry_t *g);
+void checksum_close(void);
+int checksum_enabled(void);
+// Agrega la tabla vacía a un volumen que no la tiene (reescribe el bloque
+// de bitmaps con un temporal); después hay que marcar la feature
+int checksum_create(const char *folder, const bwfs_geometry_t *g);
+
+void checksum_set_verify(int mode);
+int checksum_verify_mode(void);
+
+uint32_t checksum_of(const unsigned char *payload);
+uint32_t checksum_get(int block);
+// 0 si coincide, si no hay CRC guardado o si la verificación está apagada
+int checksum_verify(int block, const unsigned char *payload);
+
+// Escritura de un bloque al store: write_begin (0 = se puede escribir)
+// y después write_end con el CRC de lo escrito, o 0 si quedó desconocido.
+// checksum_invalidate prepara varios bloques con un solo fdatasync.
+int checksum_invalidate(const int *blocks, int count);
+int checksum_write_begin(int block);
+void checksum_write_end(int block, uint32_t crc);
+// Bloque liberado: su CRC deja de importar
+void checksum_forget(int block);
+// Para fsck: el bloque ya está en disco y nadie lo escribe
+void checksum_set(int block, uint32_t crc);
+
+// Checkpoint: sync_begin antes de block_store_sync y checksum_sync después.
+// Los bloques escritos entre los dos quedan en 0 hasta el próximo.
+void checksum_sync_begin(void);
+int checksum_sync(void);
+
+#endif // BWFS_CHECKSUM_H
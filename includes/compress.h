@@ -0,0 +1,72 @@
+#ifndef BWFS_COMPRESS_H
+#define BWFS_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../includes/bwfs.h"
+
+// Compresión transparente de los datos de los archivos, por clusters de
+// BWFS_CLUSTER_BLOCKS índices consecutivos (alineados). Un cluster que
+// comprimido entra en menos bloques de los que ocupa se guarda así: sus
+// primeros punteros nombran los bloques con el flujo comprimido y los
+// demás quedan en BWFS_BLOCK_COMPRESSED (el último siempre, así se
+// reconoce sin leer nada). El primer bloque empieza con un
+// bwfs_cluster_header_t; los datos incompresibles quedan en crudo.
+//
+// Los clusters se comprimen al cerrar el archivo (compress_range sobre lo
+// escrito) y se expanden a crudo antes de escribir en ellos. Los bloques
+// nuevos se escriben siempre en bloques recién asignados: un corte deja
+// el mapa viejo o el nuevo, nunca un cluster a medio reescribir.
+#define BWFS_CLUSTER_BLOCKS 4
+#define BWFS_CLUSTER_MAGIC  0x315a5742  // 'BWZ1'
+#define BWFS_ZCACHE_SLOTS   8           // clusters descomprimidos en memoria
+
+#define BWFS_COMPRESS_LZ    1           // lz_codec.h (formato de bloque LZ4)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t raw_len;       // bytes del cluster sin comprimir
+    uint32_t packed_len;    // bytes comprimidos tras la cabecera
+    uint32_t raw_crc;       // CRC32C de los raw_len bytes
+    uint16_t algo;          // BWFS_COMPRESS_*
+    uint16_t blocks;        // bloques que ocupa, cabecera incluida
+} bwfs_cluster_header_t;
+
+typedef struct {
+    uint64_t compressed;    // clusters guardados comprimidos
+    uint64_t incompressible; // clusters que quedaron en crudo
+    uint64_t expanded;      // clusters devueltos a crudo para escribirlos
+    uint64_t raw_bytes;     // bytes de los clusters comprimidos...
+    uint64_t packed_bytes;  // ...y lo que ocupan comprimidos
+    int64_t blocks_saved;   // bloques liberados al comprimir, neto de las expansiones
+    uint64_t decompressed;  // clusters descomprimidos para leerlos
+} compress_stats_t;
+
+// present: el volumen puede tener clusters comprimidos (BWFS_FEATURE_COMPRESS);
+// enabled: se comprime lo que se escribe
+void compress_init(int present, int enabled);
+void compress_shutdown(void);
+int compress_enabled(void);
+
+// Lectura de `len` bytes del índice `idx` desde `offset`: crudo, hueco o
+// comprimido. Con el lock del inodo tomado (lectura alcanza).
+int compress_read(const inode_t *inode, int idx, size_t offset, size_t len, unsigned char *out);
+
+// Con el lock de escritura del inodo. compress_expand deja en crudo los
+// clusters comprimidos que tocan [first, last]; compress_range comprime
+// los de [first, last] que lo valgan. Devuelven los clusters que
+// cambiaron (hay que guardar el inodo) o un errno negativo.
+int compress_expand(inode_t *inode, int first, int last);
+int compress_range(inode_t *inode, int first, int last);
+
+// El bloque se liberó: los clusters cacheados que lo usaban se descartan
+void compress_forget(int block);
+
+void compress_get_stats(compress_stats_t *stats);
+
+// Para fsck: 0 si el cluster que empieza en c0 está en crudo o se
+// descomprime bien (en `out`, de BWFS_CLUSTER_BLOCKS payloads); si no, -1
+// y `why` dice qué falló
+int compress_check(const inode_t *inode, int c0, unsigned char *out, const char **why);
+
+#endif // BWFS_COMPRESS_H
@@ -0,0 +1,67 @@
+#ifndef BWFS_DEDUP_H
+#define BWFS_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../includes/bwfs.h"
+
+// Deduplicación de bloques de datos por contenido. <carpeta>/dedup.bwfs
+// guarda por bloque las referencias extra (punteros además del primero) y
+// la huella del payload (CRC32C; 0 = no es candidato). En memoria un
+// índice huella → bloque, armado al montar a partir de la tabla.
+//
+// Al cerrar un archivo escrito, cada bloque propio sin huella se busca en
+// el índice; si otro bloque tiene la misma huella y el mismo contenido
+// (se comparan los bytes), el puntero pasa a ese bloque y el propio se
+// libera cuando el cambio de mapa es durable. Un bloque compartido nunca
+// se escribe en el lugar: antes de escribir, dedup_unshare le da una copia
+// propia, ya en disco antes de que el mapa apunte a ella.
+//
+// Los cambios de la tabla van al journal en la transacción que cambia los
+// punteros y llegan al archivo en el checkpoint (dedup_sync).
+#define BWFS_DEDUP_FILE  "dedup.bwfs"
+#define BWFS_DEDUP_MAGIC 0x44574642    // 'BFWD'
+#define BWFS_DEDUP_WAYS  4              // bloques por cubeta del índice
+
+typedef struct {
+    uint32_t refs;          // punteros además del primero
+    uint32_t fingerprint;   // checksum_of() del payload; 0 = sin huella
+} bwfs_dedup_entry_t;
+
+typedef struct {
+    uint64_t deduped;       // bloques escritos que pasaron a uno existente
+    uint64_t unique;        // bloques que entraron al índice
+    uint64_t mismatched;    // misma huella y distinto contenido
+    uint64_t copied;        // bloques compartidos copiados antes de escribirlos
+    uint64_t shared;        // bloques con más de un puntero ahora
+    uint64_t saved;         // bloques ahorrados ahora (suma de refs)
+} dedup_stats_t;
+
+// enabled: se deduplica lo que se escribe. Con la tabla cargada las
+// referencias se respetan aunque no. Devuelve -1 si no está o no cierra.
+int dedup_init(const char *folder, const bwfs_geometry_t *g, int enabled);
+// Tabla vacía para un volumen que no la tiene; después hay que marcar la feature
+int dedup_create(const char *folder, const bwfs_geometry_t *g);
+void dedup_close(void);
+int dedup_present(void);
+int dedup_enabled(void);
+
+// Suelta un puntero al bloque: 1 si otro lo sigue usando (no se libera)
+int dedup_put(int block);
+uint32_t dedup_refs(int block);
+uint32_t dedup_fingerprint(int block);
+// Replay del journal y fsck: deja la entrada tal cual, sin journal
+void dedup_restore(int block, uint32_t refs, uint32_t fingerprint);
+
+// Con el lock de escritura del inodo. dedup_unshare prepara
+// [offset, offset + len) para escribir en el lugar; dedup_range busca
+// duplicados en los índices [first, last]. Devuelven los punteros que
+// cambiaron (hay que guardar el inodo) o un errno negativo.
+int dedup_unshare(inode_t *inode, uint64_t offset, size_t len);
+int dedup_range(inode_t *inode, int first, int last);
+
+// Checkpoint: escribe las páginas de la tabla que cambiaron
+int dedup_sync(void);
+void dedup_get_stats(dedup_stats_t *stats);
+
+#endif // BWFS_DEDUP_H
@@ -0,0 +1,38 @@
+#ifndef BWFS_DIR_H
+#define BWFS_DIR_H
+
+#include "../includes/bwfs.h"
+
+// Contenido de un directorio: sus bloques de datos (vía block_map) forman
+// una tabla hash de 2^k bloques. Cada entrada va al bloque
+// hash(nombre) & (2^k - 1); si está lleno pasa al siguiente y lo marca con
+// overflow para que las búsquedas sigan de largo. La tabla se duplica al
+// pasar el 75% de ocupación. En el inodo del directorio, size = entradas.
+//
+// Cada bloque: dir_block_header_t, luego las ranuras (ino + hash) y al
+// final los nombres, así una búsqueda lee la cabecera y las ranuras de un
+// solo bloque y compara solo los nombres cuyo hash coincide.
+#define BWFS_DIR_NAME_SIZE 256
+
+typedef struct {
+    uint32_t used;          // ranuras ocupadas en este bloque
+    uint32_t overflow;      // alguna entrada de otro bloque pasó por acá
+} dir_block_header_t;
+
+typedef struct {
+    uint32_t ino;           // número de inodo + 1; 0 = ranura libre
+    uint32_t hash;
+} dir_slot_t;
+
+// `next` es la posición desde la que sigue el listado después de esta
+// entrada (ranura global + 1); se devuelve como offset de readdir
+typedef int (*dir_filler_t)(void *ctx, const char *name, int ino, long next);
+
+// Quien llama tiene el inodo del directorio bloqueado (lectura para
+// lookup/list, escritura para add/remove) y guarda el inodo después
+int dir_lookup(const inode_t *dir, const char *name);
+int dir_add(inode_t *dir, const char *name, int ino);
+int dir_remove(inode_t *dir, const char *name);
+int dir_list(const inode_t *dir, long from, dir_filler_t fn, void *ctx);
+
+#endif // BWFS_DIR_H
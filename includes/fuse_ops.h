@@ -2,28 +2,44 @@
 #define FUSE_OPS_H
 
 #define FUSE_USE_VERSION 31
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
+
+// Timeouts de atributos y entradas con la caché del kernel activa, salvo
+// que se indiquen al montar
+#define BWFS_KERNEL_CACHE_TIMEOUT 60.0
+// Sin caché del kernel: atributos y entradas se revalidan cada segundo
+#define BWFS_DEFAULT_TIMEOUT 1.0
+
+// Lecturas que tienen que decodificar bloques: las termina un pool propio
+// y responden después, sin ocupar el hilo de libfuse
+#define BWFS_READ_WORKERS 4
+#define BWFS_READ_QUEUE 256
+
+// SEEK_DATA/SEEK_HOLE: punteros del mapa que se leen por vez
+#define BWFS_SEEK_BATCH 64
+
+// Directorio virtual de solo lectura en la raíz: stats (métricas en JSON)
+// y log (las últimas líneas del log)
+#define BWFS_CTL_NAME ".bwfs"
+
 struct bwfs_config {
     const char *folder;
+    size_t cache_mb;        // presupuesto de la caché de bloques (0 = por defecto)
+    size_t dirty_mb;        // sucios antes de frenar escrituras (0 = mitad de la caché)
+    unsigned dirty_expire_ms; // edad máxima de un bloque sucio (0 = por defecto)
+    int kernel_cache;       // el kernel conserva páginas y atributos entre aperturas
+    int auto_cache;         // ...salvo que cambien mtime o tamaño al reabrir
+    double attr_timeout;    // segundos; < 0 = por defecto
+    double entry_timeout;
+    double negative_timeout;
+    int log_level;          // BWFS_LOG_* que se imprime (0 = BWFS_LOG_INFO)
+    int verify;             // BWFS_VERIFY_* de checksum.h (0 = al decodificar)
+    int compress;           // comprimir los datos al cerrar cada archivo (compress.h)
+    int dedup;              // deduplicar los bloques al cerrar cada archivo (dedup.h)
 };
-void *bwfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
-int bwfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi);
-int bwfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                 off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags);
-int bwfs_mkdir(const char *path, mode_t mode);
-int bwfs_create(const char *path, mode_t mode, struct fuse_file_info *fi);
-int bwfs_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi);
-int bwfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
-int bwfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
-int bwfs_unlink(const char *path);
-int bwfs_rename(const char *from, const char *to, unsigned int flags);
-int bwfs_rmdir(const char *path);
-int bwfs_opendir(const char *path, struct fuse_file_info *fi);
-int bwfs_statfs(const char *path, struct statvfs *stbuf);
-int bwfs_access(const char *path, int mask);
-off_t bwfs_lseek(const char *path, off_t offset, int whence, struct fuse_file_info *fi);
-int bwfs_open(const char *path, struct fuse_file_info *fi);
-int bwfs_flush(const char *path, struct fuse_file_info *fi);
-int bwfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi);
+
+// Operaciones por número de inodo (API de bajo nivel de libfuse); el
+// userdata de la sesión es la struct bwfs_config
+extern const struct fuse_lowlevel_ops bwfs_ll_ops;
 
 #endif
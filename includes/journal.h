@@ -0,0 +1,65 @@
+#ifndef BWFS_JOURNAL_H
+#define BWFS_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../includes/bwfs.h"
+
+// Journal de metadatos (redo físico) en <carpeta>/journal.bwfs.
+// Cada operación junta sus registros en un buffer propio del hilo entre
+// journal_begin y journal_end, que los agrega como una transacción entera
+// a la cola compartida; journal_commit escribe la cola de una sola vez
+// (group commit) y con durable = 1 además hace fdatasync.
+//
+// Los metadatos solo llegan a su lugar en un checkpoint, con el journal ya
+// en disco; después el journal se vacía. Al montar se rehacen las
+// transacciones completas que haya.
+#define BWFS_JOURNAL_FILE "journal.bwfs"
+#define BWFS_JOURNAL_CHECKPOINT_BYTES (8 * 1024 * 1024)
+
+enum {
+    JREC_INODE = 1,         // target = inodo; datos = inode_t
+    JREC_BLOCK_BIT,         // target = bloque; offset = 1 ocupado, 0 libre
+    JREC_INODE_BIT,         // target = inodo; offset = 1 ocupado, 0 libre
+    JREC_BLOCK,             // target = bloque; datos = payload[offset, offset + len)
+    JREC_ZERO,              // target = bloque; payload entero en cero
+    JREC_DEDUP,             // target = bloque; offset = referencias extra; datos = huella (dedup.h)
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t target;
+    uint32_t offset;
+    uint32_t len;           // bytes de datos que siguen al registro
+} journal_rec_t;
+
+// Sin journal_open (herramientas, replay) los registros se descartan
+int journal_open(const char *folder);
+void journal_close(void);
+
+void journal_begin(void);
+// 1 si el hilo agregó una transacción a la cola
+int journal_end(void);
+
+void journal_log_inode(int ino, const inode_t *inode);
+void journal_log_bit(int type, int index, int used);
+void journal_log_block(int block, size_t offset, size_t len, const void *data);
+void journal_log_zero(int block);
+void journal_log_dedup(int block, uint32_t refs, uint32_t fingerprint);
+
+int journal_commit(int durable);
+int journal_needs_checkpoint(void);
+int journal_reset(void);
+
+// Rehace las transacciones completas en orden. Los registros de un bloque
+// que se liberó en una transacción posterior se saltan: el bloque pudo
+// volver a usarse para datos, que no pasan por el journal.
+typedef void (*journal_apply_t)(const journal_rec_t *rec, const void *data, void *ctx);
+int journal_replay(const char *folder, journal_apply_t fn, void *ctx);
+
+// Aplicador para journal_replay sobre el volumen cargado (tabla de inodos
+// residente, bitmaps y caché de bloques); ctx = carpeta del volumen.
+// Quedan sucios en memoria hasta el próximo checkpoint.
+void journal_apply(const journal_rec_t *rec, const void *data, void *ctx);
+
+#endif // BWFS_JOURNAL_H
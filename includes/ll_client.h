@@ -0,0 +1,32 @@
+#ifndef BWFS_LL_CLIENT_H
+#define BWFS_LL_CLIENT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "../includes/fuse_ops.h"
+
+// Cliente de bwfs_ll_ops sin kernel ni libfuse, para bench.bwfs y las
+// pruebas de tests/: ll_client.c pone el lado del kernel y cada ll_* hace
+// la operación como la pediría el kernel y espera la respuesta. No va en
+// mount.bwfs (choca con libfuse).
+//
+// Devuelven 0 o -errno; ll_write y ll_read, los bytes o -errno; ll_lseek,
+// la posición o -errno; ll_readdir, las entradas sin . ni .. o -errno.
+int ll_create(fuse_ino_t parent, const char *name, fuse_ino_t *ino, uint64_t *fh);
+int ll_mkdir(fuse_ino_t parent, const char *name, fuse_ino_t *ino);
+int ll_lookup(fuse_ino_t parent, const char *name, fuse_ino_t *ino);
+void ll_forget(fuse_ino_t ino, uint64_t nlookup);
+int ll_getattr(fuse_ino_t ino, struct stat *st);
+int ll_open(fuse_ino_t ino, int flags, uint64_t *fh);
+int ll_release(fuse_ino_t ino, uint64_t fh);
+int ll_fsync(fuse_ino_t ino, uint64_t fh);
+long ll_write(fuse_ino_t ino, uint64_t fh, const char *buf, size_t size, off_t off);
+long ll_read(fuse_ino_t ino, uint64_t fh, char *buf, size_t size, off_t off);
+off_t ll_lseek(fuse_ino_t ino, uint64_t fh, off_t off, int whence);
+int ll_unlink(fuse_ino_t parent, const char *name);
+int ll_rmdir(fuse_ino_t parent, const char *name);
+int ll_rename(fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname,
+              unsigned int flags);
+long ll_readdir(fuse_ino_t ino);
+
+#endif // BWFS_LL_CLIENT_H
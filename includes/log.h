@@ -0,0 +1,32 @@
+#ifndef BWFS_LOG_H
+#define BWFS_LOG_H
+
+#include <stddef.h>
+
+// Log por niveles del daemon. Cada mensaje queda en un anillo en memoria
+// (se lee en /.bwfs/log); solo los que llegan al nivel de salida se
+// imprimen, los errores y avisos en stderr y el resto en stdout.
+enum {
+    BWFS_LOG_ERROR = 1,
+    BWFS_LOG_WARN,
+    BWFS_LOG_INFO,          // montaje, desmontaje y resúmenes (por defecto)
+    BWFS_LOG_DEBUG,         // una línea por operación
+};
+
+#define BWFS_LOG_RING_LINES 1024
+#define BWFS_LOG_LINE_SIZE  256
+
+// 0 = BWFS_LOG_INFO
+void bwfs_log_set_level(int level);
+void bwfs_log(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Copia las últimas líneas del anillo, de la más vieja a la más nueva.
+// Devuelve los bytes que ocupa el contenido entero, como snprintf.
+size_t bwfs_log_dump(char *out, size_t size);
+
+#define LOG_ERROR(...) bwfs_log(BWFS_LOG_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  bwfs_log(BWFS_LOG_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  bwfs_log(BWFS_LOG_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) bwfs_log(BWFS_LOG_DEBUG, __VA_ARGS__)
+
+#endif // BWFS_LOG_H
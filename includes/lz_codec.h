@@ -0,0 +1,19 @@
+#ifndef BWFS_LZ_CODEC_H
+#define BWFS_LZ_CODEC_H
+
+#include <stddef.h>
+
+// Compresor LZ rápido con el formato de bloque de LZ4: secuencias de
+// token (largo de literales | largo del match - 4), literales y offset de
+// 16 bits; la última secuencia son solo literales. Sin estado entre
+// llamadas: cada buffer se comprime por separado.
+
+// Comprime `len` bytes en `out`. Devuelve el largo comprimido, o 0 si no
+// entra en `cap` (así los datos incompresibles se descartan sin terminar)
+size_t lz_compress(const unsigned char *in, size_t len, unsigned char *out, size_t cap);
+
+// Devuelve los bytes descomprimidos, o -1 si `in` no es un bloque válido
+// o no entra en `cap`. Nunca lee ni escribe fuera de los buffers.
+long lz_decompress(const unsigned char *in, size_t len, unsigned char *out, size_t cap);
+
+#endif // BWFS_LZ_CODEC_H
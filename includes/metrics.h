@@ -0,0 +1,67 @@
+#ifndef BWFS_METRICS_H
+#define BWFS_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Métricas del daemon: contadores e histogramas de latencia por operación
+// y del codec de bloques, actualizados con operaciones atómicas (sin
+// locks). El bucket k del histograma cuenta las latencias en
+// [2^(k-1), 2^k) µs; el 0, las de menos de 1 µs.
+#define BWFS_HIST_BUCKETS 32
+
+typedef enum {
+    BWFS_OP_LOOKUP,
+    BWFS_OP_FORGET,
+    BWFS_OP_GETATTR,
+    BWFS_OP_SETATTR,
+    BWFS_OP_READDIR,
+    BWFS_OP_MKDIR,
+    BWFS_OP_CREATE,
+    BWFS_OP_OPEN,
+    BWFS_OP_READ,
+    BWFS_OP_WRITE,
+    BWFS_OP_UNLINK,
+    BWFS_OP_RMDIR,
+    BWFS_OP_RENAME,
+    BWFS_OP_OPENDIR,
+    BWFS_OP_STATFS,
+    BWFS_OP_ACCESS,
+    BWFS_OP_LSEEK,
+    BWFS_OP_FLUSH,
+    BWFS_OP_FSYNC,
+    BWFS_OP_RELEASE,
+    BWFS_OP_COUNT
+} bwfs_op_t;
+
+// Decodificar (leer) y codificar (escribir) bloques del store
+enum { BWFS_CODEC_DECODE, BWFS_CODEC_ENCODE, BWFS_CODEC_COUNT };
+
+// Pone todo en cero; al montar, antes de atender operaciones
+void metrics_reset(void);
+
+// Nanosegundos de un reloj monotónico, para medir con metrics_op/metrics_codec
+uint64_t metrics_now(void);
+
+// Una operación que empezó en `start`; err != 0 la cuenta como fallida
+void metrics_op(bwfs_op_t op, uint64_t start, int err);
+void metrics_bytes(bwfs_op_t op, size_t bytes);
+
+// `payload` bytes del bloque, `backing` bytes del archivo de imagen
+void metrics_codec(int kind, uint64_t start, size_t payload, size_t backing);
+
+// Latencia en µs bajo la que queda la fracción q (0..1) de las operaciones,
+// con la resolución del histograma
+uint64_t metrics_percentile_us(bwfs_op_t op, double q);
+
+// Para quien arma su propio informe (bench): nombre y cantidad de una
+// operación, y bytes acumulados de un sentido del codec
+const char *metrics_op_name(bwfs_op_t op);
+uint64_t metrics_op_count(bwfs_op_t op);
+void metrics_codec_bytes(int kind, uint64_t *payload, uint64_t *backing);
+
+// Todas las métricas (también caché y asignador) en JSON. Devuelve los
+// bytes que ocupa el JSON entero, como snprintf.
+size_t metrics_json(char *out, size_t size);
+
+#endif // BWFS_METRICS_H
@@ -0,0 +1,24 @@
+#ifndef BWFS_P1_CODEC_H
+#define BWFS_P1_CODEC_H
+
+#include <stddef.h>
+
+// Codec del texto de los bloques P1. La implementación (AVX2, SSE2 o
+// escalar) se elige una vez en tiempo de ejecución según la CPU; la
+// variable de entorno BWFS_P1_CODEC=avx2|sse2|scalar fuerza una.
+
+// Texto P1 canónico: dígito + separador, salto de línea cada 100 píxeles.
+// Codifica los bytes [offset, offset + len) del payload; `text` recibe
+// exactamente len * PBM_P1_CHARS_PER_BYTE caracteres
+void p1_encode_range(const unsigned char *in, size_t offset, size_t len, char *text);
+
+// Inversa de p1_encode_range sobre texto canónico ('0' = 0x30, '1' = 0x31)
+void p1_decode_range(const char *text, size_t len, unsigned char *out);
+
+// Texto P1 con cualquier separador: toma los '0'/'1' en orden e ignora el
+// resto. Llena `out` (out_len bytes, el resto en cero); devuelve los píxeles leídos
+size_t p1_decode_text(const char *text, size_t len, unsigned char *out, size_t out_len);
+
+const char *p1_codec_name(void);
+
+#endif // BWFS_P1_CODEC_H
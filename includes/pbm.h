@@ -0,0 +1,46 @@
+#ifndef BWFS_PBM_H
+#define BWFS_PBM_H
+
+#include <stddef.h>
+
+// Imagen portadora por omisión; la del volumen montado sale del superbloque
+// (pbm_set_image_size). El ancho tiene que ser múltiplo de 8.
+#define PBM_WIDTH           1000
+#define PBM_HEIGHT          1000
+
+// Formatos de bloque (se guardan en superblock_t.block_format)
+#define BWFS_FORMAT_P1      1   // PBM de texto: un carácter '0'/'1' por bit
+#define BWFS_FORMAT_P4      4   // PBM binario: el payload va crudo tras la cabecera
+
+// P1: cada píxel ocupa 2 caracteres (dígito + separador); ver p1_codec.h
+#define PBM_P1_PIXELS_PER_LINE 100
+#define PBM_P1_CHARS_PER_BYTE  16
+#define PBM_P1_HEADER_FMT      "P1\n# Bloque BWFS %d\n%d %d\n"
+
+// P4: el número de bloque tiene ancho fijo, así dentro de un volumen el
+// payload queda en un offset constante (29 con la imagen de 1000x1000)
+#define PBM_P4_HEADER_FMT   "P4\n# BWFS %08d\n%d %d\n"
+#define PBM_HEADER_MAX      64
+
+void pbm_set_format(int format);
+int pbm_get_format(void);
+
+void pbm_set_image_size(int width, int height);
+size_t pbm_payload_size(void);      // bytes útiles por bloque (125000 por omisión)
+size_t pbm_p1_text_size(void);      // caracteres de píxeles de un P1 canónico
+size_t pbm_p4_data_offset(void);
+int pbm_detect_format(const char *path);
+
+// Cabecera del bloque `block_num`; devuelve su largo (el cuerpo empieza ahí)
+int pbm_header(char *out, size_t size, int format, int block_num);
+
+int pbm_write_blank(const char *path, int format, int block_num);
+int pbm_read_block(const char *path, int format, unsigned char *data);
+int pbm_write_block(const char *path, int format, int block_num, const unsigned char *data);
+
+// Acceso parcial a un bloque con el formato del volumen montado
+int pbm_read_range(const char *path, size_t offset, size_t len, unsigned char *out);
+int pbm_write_range(const char *path, int block_num, size_t offset, size_t len,
+                    const unsigned char *in);
+
+#endif // BWFS_PBM_H
@@ -1,11 +1,36 @@
 #ifndef BWFS_UTILS_H
 #define BWFS_UTILS_H
 
+#include <stddef.h>
 #include "../includes/bwfs.h"
+
+// Geometría del volumen: la activa dimensiona tablas, bitmaps y rutas
+void geometry_from_superblock(const superblock_t *sb, bwfs_geometry_t *g);
+int geometry_new(bwfs_geometry_t *g, int format, uint32_t blocks, uint32_t inodes,
+                 uint32_t width, uint32_t height);
+void geometry_to_superblock(const bwfs_geometry_t *g, int format, superblock_t *sb);
+uint32_t geometry_meta_offset(int format, uint32_t width, uint32_t height);
+void volume_set_geometry(const bwfs_geometry_t *g);
+const bwfs_geometry_t *volume_geometry(void);
+
+// Volúmenes grandes: <folder>/<bloque / shard_size>/block_N.pbm
+void block_path(char *out, size_t size, const char *folder, int block);
+void shard_path(char *out, size_t size, const char *folder, int shard);
+long metadata_offset(void);
+int read_superblock(const char *folder, superblock_t *sb);
+int update_superblock(const char *folder, const superblock_t *sb);
 int load_inodes(const char *folder, inode_t *inodes);
 int save_inode(const char *folder, int index, const inode_t *inode);
-int find_free_inode(const char *folder);
-int find_free_block(const char *folder);
-void update_bitmap_block(const char *folder, int block, int used);
+
+// Tabla de inodos residente en memoria durante todo el montaje
+int inode_table_init(const char *folder);
+inode_t *inode_table_get(int *count);
+int inode_table_sync(const char *folder);
+int volume_sync(const char *folder);
+
+// Locks por inodo sobre la tabla residente
+void inode_rdlock(int index);
+void inode_wrlock(int index);
+void inode_unlock(int index);
 
 #endif
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+#include "../includes/fuse_ops.h"
+#include "../includes/ll_client.h"
+#include "../includes/metrics.h"
+#include "../includes/log.h"
+
+// Banco de pruebas sin kernel: llama directo a bwfs_ll_ops sobre un volumen
+// recién creado con mkfs.bwfs y escribe los resultados en JSON por stdout.
+//
+// No se enlaza con libfuse: el lado del kernel lo pone ll_client.c.
+//
+// Se compila con `make bench` (build/bench.bwfs): todos los src/*.c salvo
+// los otros programas (mkfs, fsck, mount y convert), sin -lfuse3.
+// `make run-bench BENCH_ARGS=...` lo corre con el mkfs de la misma build.
+
+#define BENCH_DEFAULT_BLOCKS 512
+#define BENCH_DEFAULT_INODES 4096
+#define BENCH_DEFAULT_FILE_MB 16
+#define BENCH_DEFAULT_META_FILES 2000
+#define BENCH_DEFAULT_THREADS 4
+#define BENCH_MAX_THREADS 64
+#define BENCH_MIXED_OPS 2000    // por hilo
+
+static struct bwfs_config conf;
+static struct fuse_conn_info conn;
+
+/* ---------- Volumen ---------- */
+
+static int run_mkfs(const char *mkfs, const char *folder, const char *format,
+                    unsigned long blocks, unsigned long inodes, int lazy) {
+    char b[32], i[32];
+    snprintf(b, sizeof(b), "%lu", blocks);
+    snprintf(i, sizeof(i), "%lu", inodes);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        // La salida de mkfs no se mezcla con el JSON
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, STDOUT_FILENO);
+        if (lazy)
+            execl(mkfs, mkfs, "-l", "-f", format, "-b", b, "-i", i, folder, (char *)NULL);
+        else
+            execl(mkfs, mkfs, "-f", format, "-b", b, "-i", i, folder, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void mount_volume(void) {
+    bwfs_ll_ops.init(&conf, &conn);
+}
+
+// Desmontar y volver a montar: la próxima fase empieza con la caché vacía
+static void remount_volume(void) {
+    bwfs_ll_ops.destroy(&conf);
+    bwfs_ll_ops.init(&conf, &conn);
+}
+
+/* ---------- Informe ---------- */
+
+static int first_result = 1;
+
+// Una fase: las métricas del daemon desde el último metrics_reset más lo
+// que midió el banco (operaciones, bytes de usuario y tiempo)
+static void report(const char *name, size_t req_size, int threads, uint64_t ops, uint64_t errors,
+                   uint64_t payload, uint64_t start) {
+    double seconds = (metrics_now() - start) / 1e9;
+    uint64_t backing = 0;
+    for (int k = 0; k < BWFS_CODEC_COUNT; ++k) {
+        uint64_t p, b;
+        metrics_codec_bytes(k, &p, &b);
+        backing += b;
+    }
+
+    printf("%s    {\"name\": \"%s\", \"req_size\": %zu, \"threads\": %d, \"ops\": %llu, "
+           "\"errors\": %llu, \"seconds\": %.4f, \"ops_per_s\": %.1f, \"mb_per_s\": %.2f, "
+           "\"backing_bytes\": %llu, \"backing_per_payload\": %.3f, \"latency_us\": {",
+           first_result ? "" : ",\n", name, req_size, threads, (unsigned long long)ops,
+           (unsigned long long)errors, seconds, seconds > 0 ? ops / seconds : 0.0,
+           seconds > 0 ? payload / seconds / (1024.0 * 1024.0) : 0.0,
+           (unsigned long long)backing, payload ? (double)backing / payload : 0.0);
+    first_result = 0;
+
+    // Solo las operaciones que hubo en la fase
+    int first_op = 1;
+    for (int op = 0; op < BWFS_OP_COUNT; ++op) {
+        if (metrics_op_count(op) == 0)
+            continue;
+        printf("%s\"%s\": {\"count\": %llu, \"p50\": %llu, \"p99\": %llu}", first_op ? "" : ", ",
+               metrics_op_name(op), (unsigned long long)metrics_op_count(op),
+               (unsigned long long)metrics_percentile_us(op, 0.50),
+               (unsigned long long)metrics_percentile_us(op, 0.99));
+        first_op = 0;
+    }
+    printf("}}");
+    fflush(stdout);
+}
+
+/* ---------- Fases ---------- */
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64*: barato y reproducible por hilo
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static void fill_pattern(char *buf, size_t size, uint64_t seed) {
+    for (size_t k = 0; k < size; ++k)
+        buf[k] = (char)(seed + k * 131);
+}
+
+// Escritura y lectura secuencial y aleatoria de un archivo con pedidos de
+// `req_size` bytes
+static void bench_io(size_t file_bytes, size_t req_size) {
+    char name[64];
+    snprintf(name, sizeof(name), "io_%zu", req_size);
+    char *buf = malloc(req_size);
+    if (!buf)
+        return;
+    fill_pattern(buf, req_size, req_size);
+
+    uint64_t nreq = file_bytes / req_size;
+    uint64_t errors = 0;
+    fuse_ino_t ino;
+    uint64_t fh;
+
+    // Escritura secuencial, hasta que fsync deja todo en los bloques
+    metrics_reset();
+    uint64_t t0 = metrics_now();
+    if (ll_create(FUSE_ROOT_ID, name, &ino, &fh) != 0) {
+        LOG_ERROR("❌ bench: no se pudo crear %s", name);
+        free(buf);
+        return;
+    }
+    for (uint64_t k = 0; k < nreq; ++k) {
+        if (ll_write(ino, fh, buf, req_size, k * req_size) != (long)req_size)
+            errors++;
+    }
+    if (ll_fsync(ino, fh) != 0)
+        errors++;
+    ll_release(ino, fh);
+    report("seq_write", req_size, 1, nreq, errors, nreq * req_size, t0);
+
+    // Lectura secuencial en frío
+    remount_volume();
+    errors = 0;
+    t0 = metrics_now();
+    ll_open(ino, O_RDONLY, &fh);
+    for (uint64_t k = 0; k < nreq; ++k) {
+        if (ll_read(ino, fh, buf, req_size, k * req_size) != (long)req_size)
+            errors++;
+    }
+    ll_release(ino, fh);
+    report("seq_read", req_size, 1, nreq, errors, nreq * req_size, t0);
+
+    // Lectura aleatoria en frío: el readahead no debería dispararse
+    remount_volume();
+    uint64_t seed = 0x9E3779B97F4A7C15ull ^ req_size;
+    errors = 0;
+    t0 = metrics_now();
+    ll_open(ino, O_RDONLY, &fh);
+    for (uint64_t k = 0; k < nreq; ++k) {
+        off_t off = (off_t)(next_random(&seed) % nreq) * req_size;
+        if (ll_read(ino, fh, buf, req_size, off) != (long)req_size)
+            errors++;
+    }
+    ll_release(ino, fh);
+    report("rand_read", req_size, 1, nreq, errors, nreq * req_size, t0);
+
+    // Escritura aleatoria sobre el archivo ya escrito
+    metrics_reset();
+    errors = 0;
+    t0 = metrics_now();
+    ll_open(ino, O_RDWR, &fh);
+    for (uint64_t k = 0; k < nreq; ++k) {
+        off_t off = (off_t)(next_random(&seed) % nreq) * req_size;
+        if (ll_write(ino, fh, buf, req_size, off) != (long)req_size)
+            errors++;
+    }
+    if (ll_fsync(ino, fh) != 0)
+        errors++;
+    ll_release(ino, fh);
+    report("rand_write", req_size, 1, nreq, errors, nreq * req_size, t0);
+
+    // El kernel olvida el inodo cuando ya no lo usa
+    ll_unlink(FUSE_ROOT_ID, name);
+    ll_forget(ino, 1);
+    free(buf);
+}
+
+// Tormenta de metadatos: crear, stat, lookup, listar y borrar `count`
+// archivos vacíos en un directorio
+static void bench_meta(int count) {
+    fuse_ino_t dir;
+    if (ll_mkdir(FUSE_ROOT_ID, "meta", &dir) != 0) {
+        LOG_ERROR("❌ bench: no se pudo crear el directorio meta");
+        return;
+    }
+    fuse_ino_t *inos = calloc(count, sizeof(fuse_ino_t));
+    if (!inos)
+        return;
+
+    char name[64];
+    uint64_t errors = 0;
+    metrics_reset();
+    uint64_t t0 = metrics_now();
+    for (int k = 0; k < count; ++k) {
+        uint64_t fh;
+        snprintf(name, sizeof(name), "f_%06d", k);
+        if (ll_create(dir, name, &inos[k], &fh) != 0) {
+            errors++;
+            continue;
+        }
+        ll_release(inos[k], fh);
+    }
+    report("create", 0, 1, count, errors, 0, t0);
+
+    errors = 0;
+    metrics_reset();
+    t0 = metrics_now();
+    for (int k = 0; k < count; ++k) {
+        if (!inos[k] || ll_getattr(inos[k], NULL) != 0)
+            errors++;
+    }
+    report("stat", 0, 1, count, errors, 0, t0);
+
+    errors = 0;
+    metrics_reset();
+    t0 = metrics_now();
+    for (int k = 0; k < count; ++k) {
+        fuse_ino_t ino;
+        snprintf(name, sizeof(name), "f_%06d", k);
+        if (ll_lookup(dir, name, &ino) != 0)
+            errors++;
+    }
+    report("lookup", 0, 1, count, errors, 0, t0);
+
+    metrics_reset();
+    t0 = metrics_now();
+    long listed = ll_readdir(dir);
+    report("readdir", 0, 1, listed > 0 ? listed : 0, listed != count, 0, t0);
+
+    // Cada archivo quedó con dos lookups: el de create y el de lookup
+    errors = 0;
+    metrics_reset();
+    t0 = metrics_now();
+    for (int k = 0; k < count; ++k) {
+        snprintf(name, sizeof(name), "f_%06d", k);
+        if (ll_unlink(dir, name) != 0)
+            errors++;
+        if (inos[k])
+            ll_forget(inos[k], 2);
+    }
+    report("unlink", 0, 1, count, errors, 0, t0);
+
+    ll_rmdir(FUSE_ROOT_ID, "meta");
+    ll_forget(dir, 1);
+    free(inos);
+}
+
+typedef struct {
+    int id;
+    size_t file_bytes;
+    fuse_ino_t ino;
+    uint64_t fh;
+    uint64_t payload;
+    uint64_t errors;
+    pthread_barrier_t *start;
+} mixed_ctx_t;
+
+// Cada hilo con su archivo: 60% lecturas, 30% escrituras y 10% getattr de
+// 4 KiB en lugares al azar
+static void *mixed_main(void *arg) {
+    mixed_ctx_t *mc = arg;
+    char buf[4096];
+    uint64_t seed = 0xD1B54A32D192ED03ull * (mc->id + 1);
+    uint64_t nreq = mc->file_bytes / sizeof(buf);
+    fill_pattern(buf, sizeof(buf), mc->id);
+
+    pthread_barrier_wait(mc->start);
+    for (int k = 0; k < BENCH_MIXED_OPS; ++k) {
+        uint64_t pick = next_random(&seed);
+        off_t off = (off_t)((pick >> 8) % nreq) * sizeof(buf);
+        long r;
+        switch (pick % 10) {
+            case 0:
+                r = ll_getattr(mc->ino, NULL);
+                break;
+            case 1:
+            case 2:
+            case 3:
+                r = ll_write(mc->ino, mc->fh, buf, sizeof(buf), off);
+                if (r > 0)
+                    mc->payload += r;
+                break;
+            default:
+                r = ll_read(mc->ino, mc->fh, buf, sizeof(buf), off);
+                if (r > 0)
+                    mc->payload += r;
+        }
+        if (r < 0)
+            mc->errors++;
+    }
+    return NULL;
+}
+
+static void bench_mixed(size_t file_bytes, int threads) {
+    mixed_ctx_t ctx[BENCH_MAX_THREADS];
+    pthread_t tid[BENCH_MAX_THREADS];
+    pthread_barrier_t start;
+    size_t per_thread = file_bytes / threads;
+    if (per_thread < 4096)
+        per_thread = 4096;
+
+    // Archivos ya escritos antes de medir
+    char *fill = malloc(per_thread);
+    if (!fill)
+        return;
+    fill_pattern(fill, per_thread, 7);
+    for (int t = 0; t < threads; ++t) {
+        char name[64];
+        snprintf(name, sizeof(name), "mixed_%02d", t);
+        ctx[t] = (mixed_ctx_t){ .id = t, .file_bytes = per_thread, .start = &start };
+        if (ll_create(FUSE_ROOT_ID, name, &ctx[t].ino, &ctx[t].fh) != 0 ||
+            ll_write(ctx[t].ino, ctx[t].fh, fill, per_thread, 0) != (long)per_thread)
+            ctx[t].errors++;
+        ll_fsync(ctx[t].ino, ctx[t].fh);
+    }
+    free(fill);
+
+    pthread_barrier_init(&start, NULL, threads + 1);
+    int started = 0;
+    for (; started < threads; ++started) {
+        if (pthread_create(&tid[started], NULL, mixed_main, &ctx[started]) != 0)
+            break;
+    }
+    if (started < threads) {
+        // Sin todos los hilos la barrera no se abre: se aborta la fase
+        LOG_ERROR("❌ bench: no se pudieron crear los hilos");
+        exit(1);
+    }
+
+    metrics_reset();
+    uint64_t t0 = metrics_now();
+    pthread_barrier_wait(&start);
+    uint64_t payload = 0, errors = 0;
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(tid[t], NULL);
+        payload += ctx[t].payload;
+        errors += ctx[t].errors;
+    }
+    report("mixed", 4096, threads, (uint64_t)threads * BENCH_MIXED_OPS, errors, payload, t0);
+    pthread_barrier_destroy(&start);
+
+    for (int t = 0; t < threads; ++t) {
+        char name[64];
+        snprintf(name, sizeof(name), "mixed_%02d", t);
+        ll_release(ctx[t].ino, ctx[t].fh);
+        ll_unlink(FUSE_ROOT_ID, name);
+        ll_forget(ctx[t].ino, 1);
+    }
+}
+
+/* ---------- main ---------- */
+
+static void usage(void) {
+    fprintf(stderr,
+            "Uso: bench.bwfs [-f p1|p4] [-l] [-b bloques] [-i inodos] [-s archivo_mb] "
+            "[-n archivos] [-t hilos] [-c cache_mb] [-m mkfs.bwfs] [-d carpeta] [-k] [-z] [-D]\n"
+            "  -s  tamaño del archivo de las fases de I/O (por omisión %d MiB)\n"
+            "  -n  archivos de la tormenta de metadatos (por omisión %d)\n"
+            "  -t  hilos de la fase mixta (por omisión %d, máximo %d)\n"
+            "  -m  ejecutable de mkfs (por omisión el mkfs.bwfs junto a bench.bwfs)\n"
+            "  -d  dónde crear el volumen temporal (por omisión /tmp)\n"
+            "  -k  no borrar el volumen al terminar\n"
+            "  -z  montar con compresión (mount.bwfs -z)\n"
+            "  -D  montar con deduplicación (mount.bwfs -D)\n"
+            "Resultados en JSON por stdout\n",
+            BENCH_DEFAULT_FILE_MB, BENCH_DEFAULT_META_FILES, BENCH_DEFAULT_THREADS,
+            BENCH_MAX_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *format = "p4";
+    const char *mkfs = NULL;
+    const char *parent = "/tmp";
+    unsigned long blocks = BENCH_DEFAULT_BLOCKS, inodes = BENCH_DEFAULT_INODES;
+    int file_mb = BENCH_DEFAULT_FILE_MB, meta_files = BENCH_DEFAULT_META_FILES;
+    int threads = BENCH_DEFAULT_THREADS;
+    int lazy = 0, keep = 0, opt;
+
+    while ((opt = getopt(argc, argv, "f:lb:i:s:n:t:c:m:d:kzD")) != -1) {
+        if (opt == 'f' && (strcmp(optarg, "p1") == 0 || strcmp(optarg, "p4") == 0)) {
+            format = optarg;
+        } else if (opt == 'l') {
+            lazy = 1;
+        } else if (opt == 'b' && atol(optarg) > 0) {
+            blocks = atol(optarg);
+        } else if (opt == 'i' && atol(optarg) > 0) {
+            inodes = atol(optarg);
+        } else if (opt == 's' && atoi(optarg) > 0) {
+            file_mb = atoi(optarg);
+        } else if (opt == 'n' && atoi(optarg) > 0) {
+            meta_files = atoi(optarg);
+        } else if (opt == 't' && atoi(optarg) > 0 && atoi(optarg) <= BENCH_MAX_THREADS) {
+            threads = atoi(optarg);
+        } else if (opt == 'c' && atoi(optarg) > 0) {
+            conf.cache_mb = atoi(optarg);
+        } else if (opt == 'm') {
+            mkfs = optarg;
+        } else if (opt == 'd') {
+            parent = optarg;
+        } else if (opt == 'k') {
+            keep = 1;
+        } else if (opt == 'z') {
+            conf.compress = 1;
+        } else if (opt == 'D') {
+            conf.dedup = 1;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (optind != argc) {
+        usage();
+        return 1;
+    }
+
+    // El mkfs de la misma build: el de la raíz del repo es el original
+    static char sibling[PATH_MAX];
+    if (!mkfs) {
+        const char *slash = strrchr(argv[0], '/');
+        snprintf(sibling, sizeof(sibling), "%.*smkfs.bwfs",
+                 slash ? (int)(slash - argv[0] + 1) : 0, argv[0]);
+        mkfs = slash ? sibling : "./mkfs.bwfs";
+    }
+
+    static char folder[PATH_MAX];
+    snprintf(folder, sizeof(folder), "%s/bwfs-bench-XXXXXX", parent);
+    if (!mkdtemp(folder)) {
+        perror("Error al crear la carpeta del volumen");
+        return 1;
+    }
+    if (run_mkfs(mkfs, folder, format, blocks, inodes, lazy) != 0) {
+        fprintf(stderr, "❌ Falló %s sobre %s\n", mkfs, folder);
+        if (!keep)
+            nftw(folder, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+
+    // Solo errores y avisos: stdout es del JSON
+    conf.folder = folder;
+    conf.log_level = BWFS_LOG_WARN;
+    conf.attr_timeout = conf.entry_timeout = conf.negative_timeout = -1;
+    mount_volume();
+
+    size_t file_bytes = (size_t)file_mb * 1024 * 1024;
+    printf("{\n  \"config\": {\"format\": \"%s\", \"lazy\": %s, \"blocks\": %lu, \"inodes\": %lu, "
+           "\"file_mb\": %d, \"meta_files\": %d, \"threads\": %d, \"cache_mb\": %zu, "
+           "\"compress\": %s, \"dedup\": %s},\n"
+           "  \"results\": [\n",
+           format, lazy ? "true" : "false", blocks, inodes, file_mb, meta_files, threads,
+           conf.cache_mb, conf.compress ? "true" : "false", conf.dedup ? "true" : "false");
+
+    static const size_t req_sizes[] = { 4096, 65536, 1048576 };
+    for (size_t k = 0; k < sizeof(req_sizes) / sizeof(req_sizes[0]); ++k) {
+        fprintf(stderr, "⏱️ I/O de %zu bytes...\n", req_sizes[k]);
+        bench_io(file_bytes, req_sizes[k]);
+    }
+    fprintf(stderr, "⏱️ Metadatos (%d archivos)...\n", meta_files);
+    bench_meta(meta_files);
+    fprintf(stderr, "⏱️ Mixto (%d hilos)...\n", threads);
+    bench_mixed(file_bytes, threads);
+    printf("\n  ]\n}\n");
+
+    bwfs_ll_ops.destroy(&conf);
+    if (!keep)
+        nftw(folder, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    else
+        fprintf(stderr, "📁 Volumen conservado en %s\n", folder);
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../includes/bitmap.h"
+#include "../includes/bwfs.h"
+#include "../includes/utils.h"
+#include "../includes/journal.h"
+
+// Bit en 1 = ocupado. Solo se asignan posiciones en [first, limit).
+typedef struct {
+    uint64_t *words;
+    uint8_t *dirty;         // palabra modificada desde el último sync
+    int disk_bits;          // entradas del bitmap en disco
+    int first;
+    int limit;
+    int cursor;             // next-fit: la próxima búsqueda arranca acá
+    int free;
+    long disk_offset;       // desde el final del bloque de bitmaps (negativo)
+} bitset_t;
+
+// Dimensionados en bitmap_init con la geometría del volumen
+static bitset_t blocks;
+static bitset_t inodes;
+static int bitmap_block = 1 + INODE_BLOCKS;
+
+// Un solo lock para ambos bitsets: cada operación es corta y sin I/O,
+// salvo init y sync
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int test_bit(const bitset_t *b, int i) {
+    return (b->words[i / 64] >> (i % 64)) & 1;
+}
+
+static void set_bit(bitset_t *b, int i, int used) {
+    uint64_t mask = 1ULL << (i % 64);
+    if (used)
+        b->words[i / 64] |= mask;
+    else
+        b->words[i / 64] &= ~mask;
+    b->dirty[i / 64] = 1;
+}
+
+// Primer bit con valor `used` en [from, limit), o -1
+static int next_bit(const bitset_t *b, int from, int used) {
+    if (from < b->first)
+        from = b->first;
+    for (int w = from / 64; w * 64 < b->limit; ++w) {
+        uint64_t bits = used ? b->words[w] : ~b->words[w];
+        if (w == from / 64)
+            bits &= ~0ULL << (from % 64);
+        if (bits) {
+            int i = w * 64 + __builtin_ctzll(bits);
+            return i < b->limit ? i : -1;
+        }
+    }
+    return -1;
+}
+
+// Primer libre desde el cursor, dando la vuelta una vez
+static int find_free(const bitset_t *b) {
+    int i = next_bit(b, b->cursor, 0);
+    if (i < 0)
+        i = next_bit(b, b->first, 0);
+    return i;
+}
+
+// Inicio de una racha de `n` libres consecutivos a partir de `from`, o -1
+static int find_run(const bitset_t *b, int from, int n) {
+    int pos = from;
+    while (pos < b->limit) {
+        int start = next_bit(b, pos, 0);
+        if (start < 0)
+            return -1;
+        int end = next_bit(b, start, 1);
+        if (end < 0)
+            end = b->limit;
+        if (end - start >= n)
+            return start;
+        pos = end;
+    }
+    return -1;
+}
+
+static void count_free(bitset_t *b) {
+    b->free = 0;
+    for (int i = b->first; i < b->limit; ++i)
+        b->free += !test_bit(b, i);
+}
+
+static int load_bitset(FILE *f, bitset_t *b, int disk_bits, long disk_offset,
+                       int first, int limit) {
+    int nwords = (disk_bits + 63) / 64;
+    free(b->words);
+    free(b->dirty);
+    b->words = calloc(nwords ? nwords : 1, sizeof(uint64_t));
+    b->dirty = calloc(nwords ? nwords : 1, 1);
+    b->disk_bits = disk_bits;
+    b->disk_offset = disk_offset;
+
+    uint8_t *bytes = malloc(disk_bits ? disk_bits : 1);
+    if (!b->words || !b->dirty || !bytes ||
+        fseek(f, b->disk_offset, SEEK_END) != 0 ||
+        fread(bytes, 1, b->disk_bits, f) != (size_t)b->disk_bits) {
+        free(bytes);
+        return -1;
+    }
+
+    for (int i = 0; i < b->disk_bits; ++i) {
+        if (bytes[i])
+            b->words[i / 64] |= 1ULL << (i % 64);
+    }
+    free(bytes);
+
+    b->first = first;
+    b->limit = limit < b->disk_bits ? limit : b->disk_bits;
+    b->cursor = first;
+    count_free(b);
+    return 0;
+}
+
+int bitmap_init(const char *folder, const bwfs_geometry_t *g) {
+    char path[256];
+    bitmap_block = g->bitmap_block;
+    block_path(path, sizeof(path), folder, bitmap_block);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("❌ No se pudo abrir el archivo de bitmaps");
+        return -1;
+    }
+
+    pthread_mutex_lock(&alloc_lock);
+    // En disco: un byte por bloque y luego uno por inodo, al final del archivo
+    long bytes = (long)g->block_bitmap_len + g->inode_bitmap_len;
+    int r = load_bitset(f, &blocks, g->block_bitmap_len, -bytes,
+                        g->data_block_start, g->total_blocks);
+    if (r == 0)
+        r = load_bitset(f, &inodes, g->inode_bitmap_len, -(long)g->inode_bitmap_len,
+                        0, g->total_inodes);
+    pthread_mutex_unlock(&alloc_lock);
+    fclose(f);
+    return r;
+}
+
+// Reescribe en disco solo los bytes de las palabras sucias
+static int sync_bitset(FILE *f, bitset_t *b) {
+    for (int w = 0; w * 64 < b->disk_bits; ++w) {
+        if (!b->dirty[w])
+            continue;
+
+        uint8_t bytes[64];
+        int n = b->disk_bits - w * 64 < 64 ? b->disk_bits - w * 64 : 64;
+        for (int k = 0; k < n; ++k)
+            bytes[k] = (b->words[w] >> k) & 1;
+
+        if (fseek(f, b->disk_offset + w * 64, SEEK_END) != 0 ||
+            fwrite(bytes, 1, n, f) != (size_t)n)
+            return -1;
+        b->dirty[w] = 0;
+    }
+    return 0;
+}
+
+int bitmap_sync(const char *folder) {
+    char path[256];
+    block_path(path, sizeof(path), folder, bitmap_block);
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+        return -1;
+
+    pthread_mutex_lock(&alloc_lock);
+    int r = sync_bitset(f, &blocks);
+    if (r == 0)
+        r = sync_bitset(f, &inodes);
+    pthread_mutex_unlock(&alloc_lock);
+    if (fclose(f) != 0)
+        r = -1;
+    return r;
+}
+
+int alloc_inode(void) {
+    pthread_mutex_lock(&alloc_lock);
+    int i = find_free(&inodes);
+    if (i >= 0) {
+        set_bit(&inodes, i, 1);
+        inodes.free--;
+        inodes.cursor = i + 1;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    if (i >= 0)
+        journal_log_bit(JREC_INODE_BIT, i, 1);
+    return i;
+}
+
+void free_inode(int ino) {
+    pthread_mutex_lock(&alloc_lock);
+    if (ino >= inodes.first && ino < inodes.limit && test_bit(&inodes, ino)) {
+        set_bit(&inodes, ino, 0);
+        inodes.free++;
+        journal_log_bit(JREC_INODE_BIT, ino, 0);
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// Reserva `count` bloques, contiguos si hay una racha libre que alcance.
+// Devuelve count, o -1 sin reservar nada si no hay espacio suficiente.
+int alloc_blocks(int count, int *out) {
+    if (count <= 0)
+        return 0;
+
+    pthread_mutex_lock(&alloc_lock);
+    if (count > blocks.free) {
+        pthread_mutex_unlock(&alloc_lock);
+        return -1;
+    }
+
+    int start = find_run(&blocks, blocks.cursor, count);
+    if (start < 0)
+        start = find_run(&blocks, blocks.first, count);
+
+    for (int k = 0; k < count; ++k) {
+        int i = start >= 0 ? start + k : find_free(&blocks);
+        set_bit(&blocks, i, 1);
+        blocks.cursor = i + 1;
+        out[k] = i;
+    }
+    blocks.free -= count;
+    pthread_mutex_unlock(&alloc_lock);
+    for (int k = 0; k < count; ++k)
+        journal_log_bit(JREC_BLOCK_BIT, out[k], 1);
+    return count;
+}
+
+void free_block(int block) {
+    pthread_mutex_lock(&alloc_lock);
+    if (block >= blocks.first && block < blocks.limit && test_bit(&blocks, block)) {
+        set_bit(&blocks, block, 0);
+        blocks.free++;
+        journal_log_bit(JREC_BLOCK_BIT, block, 0);
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// Replay del journal: deja el bit como quedó en la transacción
+void bitmap_restore(int is_inode, int index, int used) {
+    bitset_t *b = is_inode ? &inodes : &blocks;
+    pthread_mutex_lock(&alloc_lock);
+    if (index >= 0 && index < b->disk_bits && test_bit(b, index) != !!used) {
+        set_bit(b, index, used);
+        if (index >= b->first && index < b->limit)
+            b->free += used ? -1 : 1;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// 1 si la entrada está ocupada (fsck compara contra lo que usan los inodos)
+int bitmap_test(int is_inode, int index) {
+    bitset_t *b = is_inode ? &inodes : &blocks;
+    pthread_mutex_lock(&alloc_lock);
+    int used = index >= 0 && index < b->disk_bits && test_bit(b, index);
+    pthread_mutex_unlock(&alloc_lock);
+    return used;
+}
+
+int bitmap_free_blocks(void) {
+    pthread_mutex_lock(&alloc_lock);
+    int n = blocks.free;
+    pthread_mutex_unlock(&alloc_lock);
+    return n;
+}
+
+int bitmap_free_inodes(void) {
+    pthread_mutex_lock(&alloc_lock);
+    int n = inodes.free;
+    pthread_mutex_unlock(&alloc_lock);
+    return n;
+}
@@ -0,0 +1,783 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include "../includes/block_cache.h"
+#include "../includes/block_store.h"
+#include "../includes/bwfs.h"
+#include "../includes/pbm.h"
+#include "../includes/utils.h"
+#include "../includes/journal.h"
+#include "../includes/checksum.h"
+
+typedef struct cache_entry {
+    int block;
+    int dirty;
+    int valid;                      // payload cargado desde el store
+    int corrupt;                    // el payload no coincidió con su CRC
+    int refs;                       // usuarios activos fuera de cache_lock
+    int detached;                   // fuera del índice: se libera con refs == 0
+    int meta;                       // metadatos en el journal: fijo hasta el checkpoint
+    uint64_t dirtied_at;            // ms (monotónico) en que pasó a sucio
+    pthread_rwlock_t lock;          // protege data, dirty y valid
+    pthread_mutex_t io_lock;        // una sola escritura al store a la vez
+    unsigned char *data;            // payload completo decodificado
+    struct cache_entry *prev;       // lista LRU: head = más reciente
+    struct cache_entry *next;
+} cache_entry_t;
+
+// cache_lock protege el índice, la lista LRU, refs y las estadísticas.
+// Orden: cache_lock → lock de la entrada → io_lock, nunca al revés.
+// dirty, meta y dirtied_at se escriben con el lock de la entrada y se leen
+// con cargas atómicas al elegir qué escribir en segundo plano.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t **entry_of = NULL;   // uno por bloque del volumen
+static int entry_count = 0;
+static cache_entry_t *lru_head = NULL;
+static cache_entry_t *lru_tail = NULL;
+static block_cache_stats_t stats;
+static size_t dirty_count = 0;            // bloques de datos sucios (atómico)
+
+// Write-back en segundo plano: wb_lock protege el estado del hilo
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_cond = PTHREAD_COND_INITIALIZER;   // despierta al hilo
+static pthread_cond_t wb_done = PTHREAD_COND_INITIALIZER;   // terminó una pasada
+static pthread_t wb_thread;
+static int wb_running = 0;
+static int wb_kick = 0;
+static uint64_t wb_passes = 0;
+static size_t wb_limit = 0;               // bloques sucios permitidos
+static unsigned wb_expire_ms = BWFS_DIRTY_EXPIRE_DEFAULT_MS;
+
+// Prefetch: cola circular de bloques a cargar y un pool de hilos que solo
+// los traen a la caché; pf_lock protege la cola
+static pthread_mutex_t pf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t pf_threads[BWFS_PREFETCH_THREADS];
+static int pf_nthreads = 0;
+static int pf_running = 0;
+static int pf_queue[BWFS_PREFETCH_QUEUE];
+static int pf_head = 0, pf_len = 0;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void throttle(void);
+static int write_batch(cache_entry_t **batch, size_t n, int meta);
+
+int block_cache_init(size_t budget_bytes) {
+    pthread_mutex_lock(&cache_lock);
+    memset(&stats, 0, sizeof(stats));
+    lru_head = lru_tail = NULL;
+
+    free(entry_of);
+    entry_count = volume_geometry()->total_blocks;
+    entry_of = calloc(entry_count ? entry_count : 1, sizeof(cache_entry_t *));
+    if (!entry_of) {
+        entry_count = 0;
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+
+    stats.capacity = budget_bytes / pbm_payload_size();
+    if (stats.capacity < 1)
+        stats.capacity = 1;
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+static void lru_unlink(cache_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(cache_entry_t *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+// Con el lock de escritura de la entrada tomado
+static void mark_dirty(cache_entry_t *e, int meta) {
+    if (e->dirty && !e->meta && meta)
+        __atomic_sub_fetch(&dirty_count, 1, __ATOMIC_RELAXED);   // pasa a fijo
+    else if (!e->dirty && !meta)
+        __atomic_add_fetch(&dirty_count, 1, __ATOMIC_RELAXED);
+    if (!e->dirty)
+        __atomic_store_n(&e->dirtied_at, now_ms(), __ATOMIC_RELAXED);
+    if (meta)
+        __atomic_store_n(&e->meta, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->dirty, 1, __ATOMIC_RELAXED);
+}
+
+// Llamar con el lock de la entrada tomado, o con refs == 0. io_lock evita
+// que dos escrituras del mismo bloque se crucen y que una entrada ya
+// invalidada pise el bloque después de que se reasignó.
+static int write_back(cache_entry_t *e) {
+    int r = 0;
+    pthread_mutex_lock(&e->io_lock);
+    if (e->dirty && !e->detached) {
+        if (checksum_write_begin(e->block) != 0) {
+            r = -1;
+        } else if (block_store_write(e->block, 0, pbm_payload_size(), e->data) != 0) {
+            checksum_write_end(e->block, 0);
+            r = -1;
+        } else {
+            checksum_write_end(e->block, checksum_of(e->data));
+            if (!e->meta)
+                __atomic_sub_fetch(&dirty_count, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&e->dirty, 0, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats.writebacks, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&e->io_lock);
+    return r;
+}
+
+static void free_entry(cache_entry_t *e) {
+    if (e->dirty && !e->meta)
+        __atomic_sub_fetch(&dirty_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_destroy(&e->io_lock);
+    pthread_rwlock_destroy(&e->lock);
+    free(e->data);
+    free(e);
+}
+
+// Saca la entrada del índice y del LRU; con cache_lock tomado
+static void detach_entry(cache_entry_t *e) {
+    lru_unlink(e);
+    entry_of[e->block] = NULL;
+    e->detached = 1;
+    stats.resident--;
+}
+
+static void wb_wake(void) {
+    pthread_mutex_lock(&wb_lock);
+    wb_kick = 1;
+    pthread_cond_signal(&wb_cond);
+    pthread_mutex_unlock(&wb_lock);
+}
+
+// Desaloja la limpia menos usada que nadie esté usando; 0 si no hay
+// ninguna. Con cache_lock tomado.
+static int evict_clean(void) {
+    for (cache_entry_t *victim = lru_tail; victim; victim = victim->prev) {
+        if (victim->refs > 0 || victim->dirty)
+            continue;
+        detach_entry(victim);
+        free_entry(victim);
+        stats.evictions++;
+        return 1;
+    }
+    return 0;
+}
+
+// Sin limpias: hasta BWFS_EVICT_BATCH sucias de datos del final del LRU,
+// con una referencia tomada, para escribirlas juntas sin cache_lock (las
+// entradas de CRC en disco se ponen en 0 con un solo fdatasync). Un bloque
+// de metadatos sucio no puede llegar a disco antes que su registro en el
+// journal: espera al checkpoint.
+static size_t pick_dirty(cache_entry_t **batch) {
+    size_t n = 0;
+    for (cache_entry_t *victim = lru_tail; victim && n < BWFS_EVICT_BATCH; victim = victim->prev) {
+        if (victim->refs > 0 || victim->meta || !victim->dirty)
+            continue;
+        victim->refs++;
+        batch[n++] = victim;
+    }
+    return n;
+}
+
+// Cómo se llena una entrada que no estaba: leyendo el store o, si el
+// payload entero se va a pisar, sin leerlo (en cero o con una copia de src)
+enum { FILL_LOAD, FILL_ZERO, FILL_COPY };
+
+// Devuelve la entrada del bloque con una referencia tomada (soltar con
+// put_entry). Un fallo se decodifica fuera de cache_lock: la entrada nueva
+// se publica con su lock de escritura tomado y quien la pida espera ahí.
+static cache_entry_t *get_entry(int block, int fill, const unsigned char *src) {
+    if (block < 0 || block >= entry_count)
+        return NULL;
+
+    // Con la caché llena se desaloja una limpia. Si solo quedan sucias se
+    // escribe un lote sin cache_lock (las sucias las va escribiendo el hilo
+    // de write-back) y se vuelve a buscar, porque mientras tanto otro hilo
+    // pudo cargar el bloque. Una sola vez: si no alcanza, la caché queda
+    // momentáneamente por encima del presupuesto.
+    cache_entry_t *e, *victims[BWFS_EVICT_BATCH];
+    int wrote = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (;;) {
+        e = entry_of[block];
+        if (e) {
+            stats.hits++;
+            e->refs++;
+            lru_unlink(e);
+            lru_push_front(e);
+            pthread_mutex_unlock(&cache_lock);
+            return e;
+        }
+        if (stats.resident < stats.capacity || evict_clean())
+            break;
+        size_t n = wrote ? 0 : pick_dirty(victims);
+        if (n == 0)
+            break;
+        wrote = 1;
+        pthread_mutex_unlock(&cache_lock);
+        write_batch(victims, n, 0);
+        if (__atomic_load_n(&wb_running, __ATOMIC_ACQUIRE))
+            wb_wake();
+        pthread_mutex_lock(&cache_lock);
+    }
+    stats.misses++;
+
+    e = calloc(1, sizeof(cache_entry_t));
+    if (e)
+        e->data = malloc(pbm_payload_size());
+    if (!e || !e->data || pthread_rwlock_init(&e->lock, NULL) != 0) {
+        if (e)
+            free(e->data);
+        free(e);
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+    pthread_mutex_init(&e->io_lock, NULL);
+
+    pthread_rwlock_wrlock(&e->lock);
+    e->block = block;
+    e->refs = 1;
+    entry_of[block] = e;
+    lru_push_front(e);
+    stats.resident++;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (fill != FILL_LOAD) {
+        if (fill == FILL_COPY)
+            memcpy(e->data, src, pbm_payload_size());
+        else
+            memset(e->data, 0, pbm_payload_size());
+        e->valid = 1;
+        pthread_rwlock_unlock(&e->lock);
+        return e;
+    }
+    e->valid = block_store_read(block, 0, pbm_payload_size(), e->data) == 0;
+    if (e->valid && checksum_verify(block, e->data) != 0) {
+        e->valid = 0;
+        e->corrupt = 1;
+        __atomic_add_fetch(&stats.corrupt, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&e->lock);
+    return e;
+}
+
+static void put_entry(cache_entry_t *e) {
+    pthread_mutex_lock(&cache_lock);
+    e->refs--;
+    if (!e->valid && !e->detached)
+        detach_entry(e);            // carga fallida: el próximo acceso reintenta
+    if (e->detached && e->refs == 0)
+        free_entry(e);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int block_cache_read(int block, size_t offset, size_t len, unsigned char *out) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    cache_entry_t *e = get_entry(block, FILL_LOAD, NULL);
+    if (!e)
+        return block_store_read(block, offset, len, out);
+
+    // Lectores del mismo bloque en paralelo. Con BWFS_VERIFY_ALWAYS los
+    // aciertos sobre bloques limpios también se comparan con su CRC.
+    pthread_rwlock_rdlock(&e->lock);
+    int valid = e->valid, corrupt = e->corrupt;
+    if (valid && !__atomic_load_n(&e->dirty, __ATOMIC_RELAXED) &&
+        checksum_verify_mode() == BWFS_VERIFY_ALWAYS &&
+        checksum_verify(block, e->data) != 0) {
+        valid = 0;
+        corrupt = 1;
+        __atomic_add_fetch(&stats.corrupt, 1, __ATOMIC_RELAXED);
+    }
+    if (valid)
+        memcpy(out, e->data + offset, len);
+    pthread_rwlock_unlock(&e->lock);
+    put_entry(e);
+
+    if (corrupt)
+        return -1;
+    return valid ? 0 : block_store_read(block, offset, len, out);
+}
+
+// Escritura directa al store, sin la caché: el bloque queda con CRC desconocido
+static int store_write(int block, size_t offset, size_t len, const unsigned char *in) {
+    if (checksum_write_begin(block) != 0)
+        return -1;
+    int r = block_store_write(block, offset, len, in);
+    checksum_write_end(block, 0);
+    return r;
+}
+
+int block_cache_write(int block, size_t offset, size_t len, const unsigned char *in) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    // Si se pisa el payload entero no hace falta decodificar lo que había
+    int whole = offset == 0 && len == pbm_payload_size();
+    cache_entry_t *e = get_entry(block, whole ? FILL_COPY : FILL_LOAD, in);
+    if (!e)
+        return store_write(block, offset, len, in);
+
+    // Un bloque dañado no se completa con datos nuevos: la escritura falla
+    pthread_rwlock_wrlock(&e->lock);
+    int valid = e->valid, corrupt = e->corrupt;
+    if (valid) {
+        memcpy(e->data + offset, in, len);
+        mark_dirty(e, 0);
+    }
+    pthread_rwlock_unlock(&e->lock);
+    put_entry(e);
+
+    if (corrupt)
+        return -1;
+    if (!valid)
+        return store_write(block, offset, len, in);
+    throttle();
+    return 0;
+}
+
+// Bloque recién asignado: lo que había en el store es de otro archivo, que
+// no se lee ni se decodifica. Queda en cero y sucio, como si se hubiera
+// escrito entero.
+int block_cache_zero(int block) {
+    // Si ya estaba (un prefetch viejo) se pisa igual; si su carga falló,
+    // los ceros van directo al store
+    cache_entry_t *e = get_entry(block, FILL_ZERO, NULL);
+    int valid = 0;
+    if (e) {
+        pthread_rwlock_wrlock(&e->lock);
+        valid = e->valid;
+        if (valid) {
+            memset(e->data, 0, pbm_payload_size());
+            mark_dirty(e, 0);
+        }
+        pthread_rwlock_unlock(&e->lock);
+        put_entry(e);
+    }
+    if (valid) {
+        throttle();
+        return 0;
+    }
+
+    unsigned char *zero = calloc(1, pbm_payload_size());
+    int r = zero ? store_write(block, 0, pbm_payload_size(), zero) : -1;
+    free(zero);
+    return r;
+}
+
+// Escritura de metadatos (directorios, bloques índice): se registra en la
+// transacción del hilo y el bloque queda fijo en la caché hasta el próximo
+// checkpoint. `in` NULL pone el payload entero en cero.
+static int write_meta(int block, size_t offset, size_t len, const unsigned char *in) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    if (in)
+        journal_log_block(block, offset, len, in);
+    else
+        journal_log_zero(block);
+
+    int whole = !in || (offset == 0 && len == pbm_payload_size());
+    cache_entry_t *e = get_entry(block, !whole ? FILL_LOAD : in ? FILL_COPY : FILL_ZERO, in);
+    if (!e)
+        return in ? store_write(block, offset, len, in) : -1;
+
+    pthread_rwlock_wrlock(&e->lock);
+    int valid = e->valid, corrupt = e->corrupt;
+    if (valid) {
+        if (in)
+            memcpy(e->data + offset, in, len);
+        else
+            memset(e->data, 0, pbm_payload_size());
+        mark_dirty(e, 1);
+    }
+    pthread_rwlock_unlock(&e->lock);
+    put_entry(e);
+
+    if (corrupt)
+        return -1;
+    return valid ? 0 : (in ? store_write(block, offset, len, in) : -1);
+}
+
+int block_cache_write_meta(int block, size_t offset, size_t len, const unsigned char *in) {
+    return write_meta(block, offset, len, in);
+}
+
+int block_cache_zero_meta(int block) {
+    return write_meta(block, 0, pbm_payload_size(), NULL);
+}
+
+// Para bloques liberados: su contenido ya no importa
+void block_cache_invalidate(int block) {
+    if (block < 0 || block >= entry_count)
+        return;
+    checksum_forget(block);
+
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t *e = entry_of[block];
+    if (e) {
+        // Espera una escritura en curso de la entrada: después de esto ya
+        // no puede llegar al store
+        pthread_mutex_lock(&e->io_lock);
+        detach_entry(e);
+        pthread_mutex_unlock(&e->io_lock);
+        if (e->refs == 0)
+            free_entry(e);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Antes de escribir varios bloques: sus entradas de CRC en disco se ponen
+// en 0 con un solo fdatasync, no uno por bloque
+static void prepare_writes(cache_entry_t **batch, size_t n) {
+    int *blocks = malloc((n ? n : 1) * sizeof(int));
+    if (!blocks)
+        return;     // write_back lo hace bloque por bloque
+    for (size_t k = 0; k < n; ++k)
+        blocks[k] = batch[k]->block;
+    checksum_invalidate(blocks, (int)n);
+    free(blocks);
+}
+
+static int cmp_block(const void *a, const void *b) {
+    const cache_entry_t *x = *(cache_entry_t *const *)a, *y = *(cache_entry_t *const *)b;
+    return x->block - y->block;
+}
+
+// Escribe entradas elegidas con cache_lock (con una referencia tomada) sin
+// él, en orden de bloque, y suelta las referencias: los demás hilos siguen
+// usando la caché mientras se codifica y se escribe. meta = 0 escribe las
+// de datos; meta = 1 las de metadatos, que dejan de estar fijas.
+static int write_batch(cache_entry_t **batch, size_t n, int meta) {
+    int errors = 0;
+    qsort(batch, n, sizeof(cache_entry_t *), cmp_block);
+    if (checksum_enabled())
+        prepare_writes(batch, n);
+    for (size_t k = 0; k < n; ++k) {
+        cache_entry_t *e = batch[k];
+        // Lock de lectura: excluye a los escritores del bloque, no a los lectores
+        pthread_rwlock_rdlock(&e->lock);
+        if (e->valid && e->meta == meta) {
+            if (write_back(e) != 0)
+                errors++;
+            else if (meta)
+                __atomic_store_n(&e->meta, 0, __ATOMIC_RELAXED);
+        }
+        pthread_rwlock_unlock(&e->lock);
+        put_entry(e);
+    }
+    return errors ? -1 : 0;
+}
+
+// Escribe los bloques sucios de datos (meta = 0) o los de metadatos
+// (meta = 1)
+static int flush_entries(int meta) {
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t **batch = malloc((stats.resident ? stats.resident : 1) * sizeof(cache_entry_t *));
+    size_t n = 0;
+    for (cache_entry_t *e = lru_head; batch && e; e = e->next) {
+        if (__atomic_load_n(&e->dirty, __ATOMIC_RELAXED) &&
+            __atomic_load_n(&e->meta, __ATOMIC_RELAXED) == meta) {
+            e->refs++;
+            batch[n++] = e;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (!batch)
+        return -1;
+
+    int r = write_batch(batch, n, meta);
+    free(batch);
+    return r;
+}
+
+int block_cache_flush(void) {
+    return flush_entries(0);
+}
+
+// Escribe los que estén cacheados y sucios, en un solo lote (no los de
+// metadatos, que esperan al checkpoint); los negativos se saltan
+int block_cache_sync_blocks(const int *blocks, int count) {
+    cache_entry_t **batch = malloc((count > 0 ? count : 1) * sizeof(cache_entry_t *));
+    if (!batch)
+        return -1;
+
+    size_t n = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int k = 0; k < count; ++k) {
+        if (blocks[k] < 0 || blocks[k] >= entry_count)
+            continue;
+        // Un bloque repetido (deduplicado) entra dos veces: la segunda
+        // escritura no encuentra nada sucio
+        cache_entry_t *e = entry_of[blocks[k]];
+        if (e && __atomic_load_n(&e->dirty, __ATOMIC_RELAXED) &&
+            !__atomic_load_n(&e->meta, __ATOMIC_RELAXED)) {
+            e->refs++;
+            batch[n++] = e;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    int r = write_batch(batch, n, 0);
+    free(batch);
+    return r;
+}
+
+// Si el bloque ya está en la caché (o cargándose): leerlo no decodifica
+int block_cache_contains(int block) {
+    if (block < 0 || block >= entry_count)
+        return 0;
+
+    pthread_mutex_lock(&cache_lock);
+    int r = entry_of[block] != NULL;
+    pthread_mutex_unlock(&cache_lock);
+    return r;
+}
+
+// Una pasada del hilo: los sucios vencidos, o todos si se pasó la mitad
+// del límite. Se eligen con cache_lock y se escriben sin él, en orden de
+// bloque; los escritores de otros bloques no esperan.
+static void writeback_pass(void) {
+    uint64_t now = now_ms();
+    int all = __atomic_load_n(&dirty_count, __ATOMIC_RELAXED) * 2 > wb_limit;
+
+    pthread_mutex_lock(&cache_lock);
+    cache_entry_t **batch = malloc((stats.resident ? stats.resident : 1) * sizeof(cache_entry_t *));
+    size_t n = 0;
+    for (cache_entry_t *e = lru_head; batch && e && n < stats.resident; e = e->next) {
+        if (!__atomic_load_n(&e->dirty, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&e->meta, __ATOMIC_RELAXED))
+            continue;
+        if (!all && now - __atomic_load_n(&e->dirtied_at, __ATOMIC_RELAXED) < wb_expire_ms)
+            continue;
+        e->refs++;
+        batch[n++] = e;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (!batch)
+        return;
+
+    write_batch(batch, n, 0);
+    free(batch);
+}
+
+static void *writeback_main(void *arg) {
+    (void)arg;
+    // Se revisan los vencimientos cinco veces por período de expiración
+    unsigned interval = wb_expire_ms / 5 ? wb_expire_ms / 5 : 1;
+
+    pthread_mutex_lock(&wb_lock);
+    while (wb_running) {
+        if (!wb_kick) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += interval / 1000;
+            ts.tv_nsec += (long)(interval % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&wb_cond, &wb_lock, &ts);
+        }
+        wb_kick = 0;
+        pthread_mutex_unlock(&wb_lock);
+
+        writeback_pass();
+
+        pthread_mutex_lock(&wb_lock);
+        wb_passes++;
+        pthread_cond_broadcast(&wb_done);
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return NULL;
+}
+
+// Por encima del límite de sucios el escritor espera una pasada completa
+// del hilo (o dos, si la que estaba en curso empezó antes de su escritura)
+static void throttle(void) {
+    if (!__atomic_load_n(&wb_running, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&dirty_count, __ATOMIC_RELAXED) <= wb_limit)
+        return;
+
+    pthread_mutex_lock(&wb_lock);
+    uint64_t target = wb_passes + 2;
+    wb_kick = 1;
+    pthread_cond_signal(&wb_cond);
+    while (wb_running && wb_passes < target &&
+           __atomic_load_n(&dirty_count, __ATOMIC_RELAXED) > wb_limit)
+        pthread_cond_wait(&wb_done, &wb_lock);
+    pthread_mutex_unlock(&wb_lock);
+
+    pthread_mutex_lock(&cache_lock);
+    stats.throttled++;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int block_cache_writeback_start(size_t dirty_limit_bytes, unsigned expire_ms) {
+    pthread_mutex_lock(&wb_lock);
+    if (wb_running) {
+        pthread_mutex_unlock(&wb_lock);
+        return 0;
+    }
+    wb_limit = dirty_limit_bytes / pbm_payload_size();
+    if (wb_limit < 1)
+        wb_limit = 1;
+    wb_expire_ms = expire_ms ? expire_ms : BWFS_DIRTY_EXPIRE_DEFAULT_MS;
+    wb_kick = 0;
+    __atomic_store_n(&wb_running, 1, __ATOMIC_RELEASE);
+    int r = pthread_create(&wb_thread, NULL, writeback_main, NULL);
+    if (r != 0)
+        __atomic_store_n(&wb_running, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&wb_lock);
+    return r == 0 ? 0 : -1;
+}
+
+// Los sucios que queden los escribe block_cache_flush o el desmontaje
+void block_cache_writeback_stop(void) {
+    pthread_mutex_lock(&wb_lock);
+    if (!wb_running) {
+        pthread_mutex_unlock(&wb_lock);
+        return;
+    }
+    __atomic_store_n(&wb_running, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&wb_cond);
+    pthread_cond_broadcast(&wb_done);
+    pthread_mutex_unlock(&wb_lock);
+    pthread_join(wb_thread, NULL);
+}
+
+// Con el journal ya en disco y sin operaciones en curso
+int block_cache_checkpoint(void) {
+    return flush_entries(1);
+}
+
+static void *prefetch_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pf_lock);
+    while (pf_running) {
+        if (pf_len == 0) {
+            pthread_cond_wait(&pf_cond, &pf_lock);
+            continue;
+        }
+        int block = pf_queue[pf_head];
+        pf_head = (pf_head + 1) % BWFS_PREFETCH_QUEUE;
+        pf_len--;
+        pthread_mutex_unlock(&pf_lock);
+
+        // Un lector que pida el bloque mientras se decodifica espera en el
+        // lock de la entrada, no lo decodifica dos veces. Si la carga la
+        // hace otro hilo, put_entry tiene que esperar a que termine.
+        cache_entry_t *e = get_entry(block, FILL_LOAD, NULL);
+        if (e) {
+            pthread_rwlock_rdlock(&e->lock);
+            pthread_rwlock_unlock(&e->lock);
+            put_entry(e);
+            pthread_mutex_lock(&cache_lock);
+            stats.prefetched++;
+            pthread_mutex_unlock(&cache_lock);
+        }
+        pthread_mutex_lock(&pf_lock);
+    }
+    pthread_mutex_unlock(&pf_lock);
+    return NULL;
+}
+
+int block_cache_prefetch_start(int threads) {
+    if (threads > BWFS_PREFETCH_THREADS)
+        threads = BWFS_PREFETCH_THREADS;
+
+    pthread_mutex_lock(&pf_lock);
+    if (pf_running) {
+        pthread_mutex_unlock(&pf_lock);
+        return 0;
+    }
+    pf_running = 1;
+    pf_head = pf_len = 0;
+    for (pf_nthreads = 0; pf_nthreads < threads; ++pf_nthreads) {
+        if (pthread_create(&pf_threads[pf_nthreads], NULL, prefetch_main, NULL) != 0)
+            break;
+    }
+    if (pf_nthreads == 0)
+        pf_running = 0;
+    pthread_mutex_unlock(&pf_lock);
+    return pf_nthreads > 0 ? 0 : -1;
+}
+
+void block_cache_prefetch_stop(void) {
+    pthread_mutex_lock(&pf_lock);
+    pf_running = 0;
+    pf_len = 0;
+    pthread_cond_broadcast(&pf_cond);
+    pthread_mutex_unlock(&pf_lock);
+    for (int k = 0; k < pf_nthreads; ++k)
+        pthread_join(pf_threads[k], NULL);
+    pf_nthreads = 0;
+}
+
+// Encola los que no están cargados ni pedidos; con la cola llena el resto
+// se descarta (el lector los decodifica al llegar)
+void block_cache_prefetch(const int *blocks, int count) {
+    int missing[BWFS_PREFETCH_QUEUE];
+    int n = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    for (int k = 0; k < count && n < BWFS_PREFETCH_QUEUE; ++k) {
+        if (blocks[k] >= 0 && blocks[k] < entry_count && !entry_of[blocks[k]])
+            missing[n++] = blocks[k];
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (n == 0)
+        return;
+
+    pthread_mutex_lock(&pf_lock);
+    for (int k = 0; pf_running && k < n && pf_len < BWFS_PREFETCH_QUEUE; ++k) {
+        int queued = 0;
+        for (int q = 0; q < pf_len && !queued; ++q)
+            queued = pf_queue[(pf_head + q) % BWFS_PREFETCH_QUEUE] == missing[k];
+        if (!queued)
+            pf_queue[(pf_head + pf_len++) % BWFS_PREFETCH_QUEUE] = missing[k];
+    }
+    pthread_cond_broadcast(&pf_cond);
+    pthread_mutex_unlock(&pf_lock);
+}
+
+void block_cache_destroy(void) {
+    block_cache_prefetch_stop();
+    block_cache_writeback_stop();
+    block_cache_flush();
+    block_cache_checkpoint();
+    pthread_mutex_lock(&cache_lock);
+    while (lru_head) {
+        cache_entry_t *e = lru_head;
+        detach_entry(e);
+        free_entry(e);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void block_cache_get_stats(block_cache_stats_t *out) {
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    out->writebacks = __atomic_load_n(&stats.writebacks, __ATOMIC_RELAXED);
+    out->dirty = __atomic_load_n(&dirty_count, __ATOMIC_RELAXED);
+    out->corrupt = __atomic_load_n(&stats.corrupt, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../includes/block_map.h"
+#include "../includes/block_cache.h"
+#include "../includes/bitmap.h"
+#include "../includes/compress.h"
+#include "../includes/dedup.h"
+#include "../includes/utils.h"
+
+static int valid_block(uint32_t blk) {
+    return blk != 0 && blk != (uint32_t)-1 && blk < (uint32_t)volume_geometry()->total_blocks;
+}
+
+static int has_index(const inode_t *inode) {
+    return inode->index_block > 0 &&
+           (uint32_t)inode->index_block < volume_geometry()->total_blocks;
+}
+
+static int decode_ptr(uint32_t blk) {
+    if (valid_block(blk))
+        return (int)blk;
+    return blk == BWFS_BLOCK_COMPRESSED ? BWFS_MAP_COMPRESSED : -1;
+}
+
+static uint32_t encode_ptr(int blk) {
+    if (blk >= 0)
+        return (uint32_t)blk;
+    return blk == BWFS_MAP_COMPRESSED ? BWFS_BLOCK_COMPRESSED : 0;
+}
+
+int block_map_get(const inode_t *inode, int idx) {
+    int blk;
+    if (block_map_get_range(inode, idx, 1, &blk) != 0)
+        return -1;
+    return blk;
+}
+
+// Resuelve `count` índices consecutivos; los huecos quedan en -1.
+// La parte indirecta se lee con una sola consulta a la caché.
+int block_map_get_range(const inode_t *inode, int first, int count, int *out) {
+    if (first < 0 || count < 0 || first + count > (int)BWFS_MAX_FILE_BLOCKS)
+        return -1;
+
+    int k = 0;
+    for (; k < count && first + k < BWFS_DIRECT_BLOCKS; ++k) {
+        out[k] = decode_ptr(inode->blocks[first + k]);
+    }
+    if (k == count)
+        return 0;
+
+    if (!has_index(inode)) {
+        for (; k < count; ++k)
+            out[k] = -1;
+        return 0;
+    }
+
+    int n = count - k;
+    uint32_t *ptrs = malloc(n * sizeof(uint32_t));
+    if (!ptrs)
+        return -1;
+    if (block_cache_read(inode->index_block, (first + k - BWFS_DIRECT_BLOCKS) * sizeof(uint32_t),
+                         n * sizeof(uint32_t), (unsigned char *)ptrs) != 0) {
+        free(ptrs);
+        return -1;
+    }
+    for (int j = 0; j < n; ++j)
+        out[k + j] = decode_ptr(ptrs[j]);
+    free(ptrs);
+    return 0;
+}
+
+int block_map_set_range(inode_t *inode, int first, int count, const int *blocks) {
+    if (first < 0 || count < 0 || first + count > (int)BWFS_MAX_FILE_BLOCKS)
+        return -EINVAL;
+
+    // Directos en el inodo, el resto de corrido en el bloque índice
+    int k = 0;
+    for (; k < count && first + k < BWFS_DIRECT_BLOCKS; ++k)
+        inode->blocks[first + k] = encode_ptr(blocks[k]);
+    if (k == count)
+        return 0;
+    if (!has_index(inode))
+        return -EIO;
+
+    int n = count - k;
+    uint32_t *ptrs = malloc(n * sizeof(uint32_t));
+    if (!ptrs)
+        return -ENOMEM;
+    for (int j = 0; j < n; ++j)
+        ptrs[j] = encode_ptr(blocks[k + j]);
+    int r = 0;
+    if (block_cache_write_meta(inode->index_block, (first + k - BWFS_DIRECT_BLOCKS) * sizeof(uint32_t),
+                               n * sizeof(uint32_t), (const unsigned char *)ptrs) != 0)
+        r = -EIO;
+    free(ptrs);
+    return r;
+}
+
+// Asigna los bloques que falten en [first, last], más el bloque índice si
+// el rango lo necesita. Todo sale de una sola llamada a alloc_blocks.
+int block_map_reserve(inode_t *inode, int first, int last) {
+    if (first < 0 || last < first || last >= (int)BWFS_MAX_FILE_BLOCKS)
+        return -EFBIG;
+
+    int count = last - first + 1;
+    int *map = malloc(count * sizeof(int));
+    if (!map)
+        return -ENOMEM;
+    if (block_map_get_range(inode, first, count, map) != 0) {
+        free(map);
+        return -EIO;
+    }
+
+    // Los clusters comprimidos se expanden antes de escribir en ellos
+    int need_index = last >= BWFS_DIRECT_BLOCKS && !has_index(inode);
+    int need = need_index;
+    for (int k = 0; k < count; ++k) {
+        if (map[k] == BWFS_MAP_COMPRESSED) {
+            free(map);
+            return -EIO;
+        }
+        need += map[k] < 0;
+    }
+    if (need == 0) {
+        free(map);
+        return 0;
+    }
+
+    int *fresh = malloc(need * sizeof(int));
+    if (!fresh || alloc_blocks(need, fresh) < 0) {
+        free(fresh);
+        free(map);
+        return -ENOSPC;
+    }
+
+    int next = 0;
+    if (need_index) {
+        inode->index_block = fresh[next++];
+        block_cache_zero_meta(inode->index_block);
+    }
+    // Los bloques nuevos arrancan en cero: lo que no se escriba del bloque
+    // no puede mostrar los datos de un archivo borrado
+    for (int k = 0; k < count; ++k) {
+        if (map[k] < 0) {
+            map[k] = fresh[next++];
+            block_cache_zero(map[k]);
+        }
+    }
+    free(fresh);
+
+    int r = block_map_set_range(inode, first, count, map);
+    free(map);
+    return r;
+}
+
+void block_map_release(int blk) {
+    if (dedup_put(blk))
+        return;     // otro puntero lo sigue usando
+    free_block(blk);
+    block_cache_invalidate(blk);
+    compress_forget(blk);
+}
+
+// Bloques que un cambio de mapa dejó sin puntero: siguen ocupados hasta que
+// la transacción que los saca del mapa esté en disco, si no un corte podría
+// dejar el mapa viejo apuntando a un bloque ya reusado
+static __thread int *deferred = NULL;
+static __thread size_t deferred_len = 0, deferred_cap = 0;
+
+void block_map_defer_release(int blk) {
+    if (deferred_len == deferred_cap) {
+        size_t cap = deferred_cap ? deferred_cap * 2 : 16;
+        int *grown = realloc(deferred, cap * sizeof(int));
+        if (!grown) {
+            block_map_release(blk);
+            return;
+        }
+        deferred = grown;
+        deferred_cap = cap;
+    }
+    deferred[deferred_len++] = blk;
+}
+
+int block_map_deferred(void) {
+    return deferred_len > 0;
+}
+
+void block_map_release_deferred(void) {
+    for (size_t k = 0; k < deferred_len; ++k)
+        block_map_release(deferred[k]);
+    free(deferred);
+    deferred = NULL;
+    deferred_len = deferred_cap = 0;
+}
+
+void block_map_free(inode_t *inode) {
+    for (int b = 0; b < BWFS_DIRECT_BLOCKS; ++b) {
+        if (valid_block(inode->blocks[b]))
+            block_map_release(inode->blocks[b]);
+        inode->blocks[b] = (uint32_t)-1;
+    }
+
+    if (!has_index(inode))
+        return;
+
+    uint32_t *ptrs = malloc(pbm_payload_size());
+    if (ptrs && block_cache_read(inode->index_block, 0, pbm_payload_size(),
+                                 (unsigned char *)ptrs) == 0) {
+        for (size_t j = 0; j < BWFS_PTRS_PER_INDEX; ++j) {
+            if (valid_block(ptrs[j]))
+                block_map_release(ptrs[j]);
+        }
+    }
+    free(ptrs);
+
+    block_map_release(inode->index_block);
+    inode->index_block = 0;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../includes/block_store.h"
+#include "../includes/bwfs.h"
+#include "../includes/pbm.h"
+#include "../includes/p1_codec.h"
+#include "../includes/utils.h"
+#include "../includes/metrics.h"
+
+typedef struct {
+    unsigned char *map;     // archivo de bloque completo, MAP_SHARED
+    size_t map_len;
+    size_t data_off;        // primer píxel (P1) o primer byte del payload (P4)
+    int dirty;              // hay cambios sin msync
+    int failed;             // no se pudo mapear: usar el codec por archivo
+} mapped_block_t;
+
+// Tope de mapeos vivos: en volúmenes grandes el resto de los bloques se
+// atiende con E/S por rango en lugar de agotar vm.max_map_count
+#define BWFS_MAX_LIVE_MAPS 32768
+
+static const char *store_folder = NULL;
+static mapped_block_t *mapped = NULL;  // uno por bloque del volumen
+static int mapped_count = 0;
+static int live_maps = 0;               // mapeos activos, bajo map_lock
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int block_store_init(const char *folder) {
+    store_folder = folder;
+    free(mapped);
+    mapped_count = volume_geometry()->total_blocks;
+    mapped = calloc(mapped_count ? mapped_count : 1, sizeof(mapped_block_t));
+    live_maps = 0;
+    if (!mapped) {
+        mapped_count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Offset del primer píxel de un P1: tras la tercera línea de cabecera
+static long p1_data_offset(const unsigned char *map, size_t len) {
+    int lines = 0;
+    for (size_t i = 0; i < len && i < 256; ++i) {
+        if (map[i] == '\n' && ++lines == 3)
+            return (long)i + 1;
+    }
+    return -1;
+}
+
+// Un P1 es direccionable en el lugar si cada píxel ocupa exactamente dos
+// caracteres (dígito + separador); los bloques escritos con el layout viejo
+// de bwfs_write se reescriben en el layout canónico antes de mapearlos
+static int p1_is_fixed_width(const unsigned char *map, size_t len, size_t off) {
+    if (len < off + pbm_p1_text_size())
+        return 0;
+    const unsigned char *p = map + off;
+    for (size_t i = 0; i < pbm_p1_text_size(); i += 2) {
+        if ((p[i] != '0' && p[i] != '1') || (p[i + 1] != ' ' && p[i + 1] != '\n'))
+            return 0;
+    }
+    return 1;
+}
+
+static int map_file(const char *path, mapped_block_t *mb) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    mb->map = map;
+    mb->map_len = st.st_size;
+    return 0;
+}
+
+// Mapea y valida un bloque en `mb`, que todavía no es visible para otros hilos
+static int open_block(int block, mapped_block_t *mb) {
+    char path[256];
+    block_path(path, sizeof(path), store_folder, block);
+
+    if (map_file(path, mb) != 0)
+        return -1;
+
+    if (pbm_get_format() == BWFS_FORMAT_P4) {
+        if (mb->map_len < pbm_p4_data_offset() + pbm_payload_size())
+            goto fail;
+        mb->data_off = pbm_p4_data_offset();
+        return 0;
+    }
+
+    long off = p1_data_offset(mb->map, mb->map_len);
+    if (off >= 0 && p1_is_fixed_width(mb->map, mb->map_len, off)) {
+        mb->data_off = off;
+        return 0;
+    }
+
+    // Normalizar el bloque y volver a mapearlo
+    munmap(mb->map, mb->map_len);
+    mb->map = NULL;
+
+    unsigned char *data = malloc(pbm_payload_size());
+    if (!data)
+        return -1;
+    int r = pbm_read_block(path, BWFS_FORMAT_P1, data);
+    if (r == 0)
+        r = pbm_write_block(path, BWFS_FORMAT_P1, block, data);
+    free(data);
+
+    if (r != 0 || map_file(path, mb) != 0)
+        return -1;
+    off = p1_data_offset(mb->map, mb->map_len);
+    if (off >= 0 && p1_is_fixed_width(mb->map, mb->map_len, off)) {
+        mb->data_off = off;
+        return 0;
+    }
+
+fail:
+    munmap(mb->map, mb->map_len);
+    mb->map = NULL;
+    return -1;
+}
+
+// En volúmenes creados con mkfs -l los bloques de datos libres no tienen
+// archivo todavía: se leen como ceros y se crean en la primera escritura
+static int block_missing(const char *path) {
+    return access(path, F_OK) != 0 && errno == ENOENT;
+}
+
+// Un bloque ya mapeado se resuelve sin lock; el primer acceso lo mapea
+// bajo map_lock y lo publica con el puntero como último campo escrito
+static mapped_block_t *get_block(int block, int create) {
+    if (!store_folder || block < 0 || block >= mapped_count)
+        return NULL;
+
+    mapped_block_t *mb = &mapped[block];
+    if (__atomic_load_n(&mb->map, __ATOMIC_ACQUIRE))
+        return mb;
+
+    pthread_mutex_lock(&map_lock);
+    if (!mb->map && !mb->failed) {
+        char path[256];
+        block_path(path, sizeof(path), store_folder, block);
+        if (block_missing(path) && (!create || pbm_write_blank(path, pbm_get_format(), block) != 0)) {
+            pthread_mutex_unlock(&map_lock);
+            return NULL;
+        }
+
+        mapped_block_t fresh = {0};
+        if (live_maps >= BWFS_MAX_LIVE_MAPS) {
+            pthread_mutex_unlock(&map_lock);
+            return NULL;
+        }
+        if (open_block(block, &fresh) == 0) {
+            mb->map_len = fresh.map_len;
+            mb->data_off = fresh.data_off;
+            live_maps++;
+            __atomic_store_n(&mb->map, fresh.map, __ATOMIC_RELEASE);
+        } else {
+            mb->failed = 1;
+        }
+    }
+    if (!mb->map)
+        mb = NULL;
+    pthread_mutex_unlock(&map_lock);
+    return mb;
+}
+
+// Bytes de la imagen que representan `len` bytes de payload
+static size_t backing_bytes(size_t len) {
+    return pbm_get_format() == BWFS_FORMAT_P4 ? len : len * PBM_P1_CHARS_PER_BYTE;
+}
+
+int block_store_read(int block, size_t offset, size_t len, unsigned char *out) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    uint64_t start = metrics_now();
+    mapped_block_t *mb = get_block(block, 0);
+    if (!mb) {
+        char path[256];
+        block_path(path, sizeof(path), store_folder, block);
+        if (block_missing(path)) {
+            memset(out, 0, len);
+            return 0;
+        }
+        int r = pbm_read_range(path, offset, len, out);
+        metrics_codec(BWFS_CODEC_DECODE, start, len, backing_bytes(len));
+        return r;
+    }
+
+    if (pbm_get_format() == BWFS_FORMAT_P4) {
+        memcpy(out, mb->map + mb->data_off + offset, len);
+    } else {
+        // P1: el bit k del byte b está en el carácter 16*b + 2*k
+        p1_decode_range((const char *)mb->map + mb->data_off +
+                        offset * PBM_P1_CHARS_PER_BYTE, len, out);
+    }
+    metrics_codec(BWFS_CODEC_DECODE, start, len, backing_bytes(len));
+    return 0;
+}
+
+int block_store_write(int block, size_t offset, size_t len, const unsigned char *in) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    uint64_t start = metrics_now();
+    mapped_block_t *mb = get_block(block, 1);
+    if (!mb) {
+        char path[256];
+        block_path(path, sizeof(path), store_folder, block);
+        int r = pbm_write_range(path, block, offset, len, in);
+        metrics_codec(BWFS_CODEC_ENCODE, start, len, backing_bytes(len));
+        return r;
+    }
+
+    if (pbm_get_format() == BWFS_FORMAT_P4) {
+        memcpy(mb->map + mb->data_off + offset, in, len);
+    } else {
+        p1_encode_range(in, offset, len, (char *)mb->map + mb->data_off +
+                        offset * PBM_P1_CHARS_PER_BYTE);
+    }
+    __atomic_store_n(&mb->dirty, 1, __ATOMIC_RELAXED);
+    metrics_codec(BWFS_CODEC_ENCODE, start, len, backing_bytes(len));
+    return 0;
+}
+
+int block_store_sync(void) {
+    int errors = 0;
+    for (int i = 0; i < mapped_count; ++i) {
+        if (!__atomic_load_n(&mapped[i].map, __ATOMIC_ACQUIRE) ||
+            !__atomic_exchange_n(&mapped[i].dirty, 0, __ATOMIC_ACQ_REL))
+            continue;
+        if (msync(mapped[i].map, mapped[i].map_len, MS_SYNC) != 0) {
+            __atomic_store_n(&mapped[i].dirty, 1, __ATOMIC_RELAXED);
+            errors++;
+        }
+    }
+    return errors ? -1 : 0;
+}
+
+void block_store_close(void) {
+    block_store_sync();
+    for (int i = 0; i < mapped_count; ++i) {
+        if (mapped[i].map)
+            munmap(mapped[i].map, mapped[i].map_len);
+    }
+    free(mapped);
+    mapped = NULL;
+    mapped_count = 0;
+    live_maps = 0;
+    store_folder = NULL;
+}
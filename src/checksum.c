@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../includes/checksum.h"
+#include "../includes/pbm.h"
+#include "../includes/utils.h"
+#include "../includes/log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_HAVE_X86 1
+#endif
+
+// --- CRC32C ---
+// Las variantes trabajan sobre el CRC sin invertir; crc32c() invierte al
+// entrar y al salir, como el CRC32C estándar (iSCSI, ext4, btrfs)
+
+#define CRC32C_POLY 0x82f63b78u     // reflejado
+#define CRC_STREAM 8192             // bytes por flujo en la versión intercalada
+
+static uint32_t crc_table[8][256];  // slicing-by-8
+static uint32_t x2n_table[32];      // x^(2^n) mod P
+static uint32_t shift_stream;       // x^(8 * CRC_STREAM) mod P
+static uint32_t shift_2stream;
+
+// a * b mod P, en la representación reflejada
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^(8n) mod P: multiplicar un CRC por esto equivale a pasarle n bytes en cero
+static uint32_t x8nmodp(size_t n) {
+    uint32_t xp = 1u << 31;     // x^0
+    int k = 3;
+    while (n) {
+        if (n & 1)
+            xp = multmodp(x2n_table[k & 31], xp);
+        n >>= 1;
+        k++;
+    }
+    return xp;
+}
+
+static uint32_t update_scalar(uint32_t c, const unsigned char *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+        len--;
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= c;
+        c = crc_table[7][w & 0xff] ^ crc_table[6][(w >> 8) & 0xff] ^
+            crc_table[5][(w >> 16) & 0xff] ^ crc_table[4][(w >> 24) & 0xff] ^
+            crc_table[3][(w >> 32) & 0xff] ^ crc_table[2][(w >> 40) & 0xff] ^
+            crc_table[1][(w >> 48) & 0xff] ^ crc_table[0][w >> 56];
+    }
+#endif
+    while (len--)
+        c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+#ifdef CRC_HAVE_X86
+// La instrucción crc32 tiene latencia 3 y rinde una por ciclo: tres flujos
+// independientes de CRC_STREAM bytes y después se combinan con multmodp
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c0 = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+        len--;
+    }
+
+    for (; len >= 3 * CRC_STREAM; len -= 3 * CRC_STREAM, p += 3 * CRC_STREAM) {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t i = 0; i < CRC_STREAM; i += 8) {
+            uint64_t a, b, d;
+            memcpy(&a, p + i, 8);
+            memcpy(&b, p + CRC_STREAM + i, 8);
+            memcpy(&d, p + 2 * CRC_STREAM + i, 8);
+            c0 = _mm_crc32_u64(c0, a);
+            c1 = _mm_crc32_u64(c1, b);
+            c2 = _mm_crc32_u64(c2, d);
+        }
+        c0 = multmodp(shift_2stream, (uint32_t)c0) ^ multmodp(shift_stream, (uint32_t)c1) ^ c2;
+    }
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        c0 = _mm_crc32_u64(c0, w);
+    }
+    while (len--)
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+    return (uint32_t)c0;
+}
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t (*update)(uint32_t crc, const unsigned char *p, size_t len);
+} crc_impl_t;
+
+static const crc_impl_t impl_scalar = { "scalar", update_scalar };
+#ifdef CRC_HAVE_X86
+static const crc_impl_t impl_sse42 = { "sse42", update_sse42 };
+#endif
+
+static const crc_impl_t *impl = &impl_scalar;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static void select_impl(void) {
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; ++n)
+        for (int k = 1; k < 8; ++k)
+            crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xff];
+
+    uint32_t p = 1u << 30;      // x^1
+    for (int n = 0; n < 32; ++n) {
+        x2n_table[n] = p;
+        p = multmodp(p, p);
+    }
+    shift_stream = x8nmodp(CRC_STREAM);
+    shift_2stream = x8nmodp(2 * CRC_STREAM);
+
+    const char *forced = getenv("BWFS_CRC32C");
+    impl = &impl_scalar;
+#ifdef CRC_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && (!forced || strcmp(forced, "sse42") == 0))
+        impl = &impl_sse42;
+#endif
+}
+
+static const crc_impl_t *crc_impl(void) {
+    pthread_once(&impl_once, select_impl);
+    return impl;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    return ~crc_impl()->update(~crc, buf, len);
+}
+
+const char *crc32c_impl_name(void) {
+    return crc_impl()->name;
+}
+
+// --- Tabla de CRC por bloque ---
+
+#define CRC_PAGE_ENTRIES 1024       // entradas por escritura de la tabla (4 KB)
+
+// Estado de cada entrada, bajo crc_lock
+#define CRC_DISK_ZERO 0x1           // la entrada en disco es 0 (o está por serlo)
+#define CRC_CHANGED   0x2           // escrito desde el último checksum_sync_begin
+
+static int enabled = 0;
+static int table_fd = -1;
+static long table_off = 0;
+static uint32_t entries = 0;
+static uint32_t *crcs = NULL;       // CRC del contenido actual de cada bloque
+static uint8_t *state = NULL;
+static uint8_t *dirty_pages = NULL;
+static uint32_t page_count = 0;
+static int verify_mode = BWFS_VERIFY_LOAD;
+
+// crc_lock protege state, dirty_pages y las escrituras de crcs. gate
+// separa las escrituras de bloques (lectura) del inicio de un checkpoint
+// (escritura): checksum_sync_begin espera a las que estén en curso.
+static pthread_mutex_t crc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t gate = PTHREAD_RWLOCK_INITIALIZER;
+
+void checksum_close(void) {
+    if (table_fd >= 0)
+        close(table_fd);
+    free(crcs);
+    free(state);
+    free(dirty_pages);
+    table_fd = -1;
+    crcs = NULL;
+    state = NULL;
+    dirty_pages = NULL;
+    entries = page_count = 0;
+    enabled = 0;
+}
+
+int checksum_init(const char *folder, const bwfs_geometry_t *g) {
+    checksum_close();
+
+    char path[256];
+    block_path(path, sizeof(path), folder, g->bitmap_block);
+    size_t len = (size_t)g->total_blocks * sizeof(uint32_t);
+    long off = metadata_offset();
+    struct stat st;
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < off + len + g->block_bitmap_len + g->inode_bitmap_len) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    uint32_t pages = (g->total_blocks + CRC_PAGE_ENTRIES - 1) / CRC_PAGE_ENTRIES;
+    crcs = malloc(len ? len : 1);
+    state = malloc(g->total_blocks ? g->total_blocks : 1);
+    dirty_pages = calloc(pages ? pages : 1, 1);
+    if (!crcs || !state || !dirty_pages || pread(fd, crcs, len, off) != (ssize_t)len) {
+        close(fd);
+        checksum_close();
+        return -1;
+    }
+    for (uint32_t b = 0; b < g->total_blocks; ++b)
+        state[b] = crcs[b] ? 0 : CRC_DISK_ZERO;
+
+    table_fd = fd;
+    table_off = off;
+    entries = g->total_blocks;
+    page_count = pages;
+    enabled = 1;
+    return 0;
+}
+
+int checksum_enabled(void) {
+    return enabled;
+}
+
+int checksum_create(const char *folder, const bwfs_geometry_t *g) {
+    char path[256], tmp[300];
+    block_path(path, sizeof(path), folder, g->bitmap_block);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    size_t bitmaps = (size_t)g->block_bitmap_len + g->inode_bitmap_len;
+    size_t table = (size_t)g->total_blocks * sizeof(uint32_t);
+    long off = metadata_offset();
+
+    int in = open(path, O_RDONLY);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0 || (size_t)st.st_size < bitmaps) {
+        if (in >= 0)
+            close(in);
+        return -1;
+    }
+
+    // La imagen se copia tal cual; entre ella y meta_offset queda en cero
+    size_t keep = st.st_size - bitmaps < (size_t)off ? st.st_size - bitmaps : (size_t)off;
+    unsigned char *buf = malloc(keep + bitmaps);
+    int ok = buf && pread(in, buf, keep, 0) == (ssize_t)keep &&
+             pread(in, buf + keep, bitmaps, st.st_size - bitmaps) == (ssize_t)bitmaps;
+    close(in);
+
+    int out = ok ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    ok = out >= 0 && pwrite(out, buf, keep, 0) == (ssize_t)keep &&
+         ftruncate(out, off + table) == 0 &&
+         pwrite(out, buf + keep, bitmaps, off + table) == (ssize_t)bitmaps && fsync(out) == 0;
+    if (out >= 0 && close(out) != 0)
+        ok = 0;
+    free(buf);
+
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void checksum_set_verify(int mode) {
+    verify_mode = mode;
+}
+
+int checksum_verify_mode(void) {
+    return enabled ? verify_mode : BWFS_VERIFY_OFF;
+}
+
+uint32_t checksum_of(const unsigned char *payload) {
+    uint32_t c = crc32c(0, payload, pbm_payload_size());
+    return c ? c : 1;
+}
+
+uint32_t checksum_get(int block) {
+    if (!enabled || (uint32_t)block >= entries)
+        return 0;
+    return __atomic_load_n(&crcs[block], __ATOMIC_RELAXED);
+}
+
+int checksum_verify(int block, const unsigned char *payload) {
+    if (checksum_verify_mode() == BWFS_VERIFY_OFF)
+        return 0;
+    uint32_t want = checksum_get(block);
+    if (!want)
+        return 0;
+    uint32_t got = checksum_of(payload);
+    if (got == want)
+        return 0;
+    LOG_ERROR("❌ Bloque %d dañado: CRC %08x, se esperaba %08x", block, got, want);
+    return -1;
+}
+
+static void mark_page(int block) {
+    dirty_pages[block / CRC_PAGE_ENTRIES] = 1;
+}
+
+// Pone en 0 las entradas en disco que no lo estén, con un solo fdatasync
+static int zero_on_disk(const int *blocks, int count) {
+    int *need = malloc((count ? count : 1) * sizeof(int));
+    if (!need)
+        return -1;
+
+    int n = 0;
+    pthread_mutex_lock(&crc_lock);
+    for (int k = 0; k < count; ++k) {
+        int b = blocks[k];
+        if ((uint32_t)b >= entries)
+            continue;
+        state[b] |= CRC_CHANGED;
+        mark_page(b);
+        if (!(state[b] & CRC_DISK_ZERO)) {
+            state[b] |= CRC_DISK_ZERO;
+            need[n++] = b;
+        }
+    }
+    pthread_mutex_unlock(&crc_lock);
+
+    const uint32_t zero = 0;
+    int ok = 1;
+    for (int k = 0; k < n && ok; ++k)
+        ok = pwrite(table_fd, &zero, sizeof(zero), table_off + (long)need[k] * sizeof(uint32_t)) ==
+             sizeof(zero);
+    if (n && ok)
+        ok = fdatasync(table_fd) == 0;
+
+    if (!ok) {
+        // No se sabe qué quedó en disco: la próxima escritura lo reintenta
+        pthread_mutex_lock(&crc_lock);
+        for (int k = 0; k < n; ++k)
+            state[need[k]] &= ~CRC_DISK_ZERO;
+        pthread_mutex_unlock(&crc_lock);
+    }
+    free(need);
+    return ok ? 0 : -1;
+}
+
+int checksum_invalidate(const int *blocks, int count) {
+    if (!enabled || count <= 0)
+        return 0;
+    return zero_on_disk(blocks, count);
+}
+
+int checksum_write_begin(int block) {
+    if (!enabled)
+        return 0;
+    pthread_rwlock_rdlock(&gate);
+    if (zero_on_disk(&block, 1) != 0) {
+        pthread_rwlock_unlock(&gate);
+        return -1;
+    }
+    return 0;
+}
+
+void checksum_write_end(int block, uint32_t crc) {
+    if (!enabled)
+        return;
+    if ((uint32_t)block < entries) {
+        pthread_mutex_lock(&crc_lock);
+        __atomic_store_n(&crcs[block], crc, __ATOMIC_RELAXED);
+        state[block] |= CRC_CHANGED;
+        mark_page(block);
+        pthread_mutex_unlock(&crc_lock);
+    }
+    pthread_rwlock_unlock(&gate);
+}
+
+void checksum_set(int block, uint32_t crc) {
+    if (!enabled || (uint32_t)block >= entries)
+        return;
+    pthread_mutex_lock(&crc_lock);
+    __atomic_store_n(&crcs[block], crc, __ATOMIC_RELAXED);
+    mark_page(block);
+    pthread_mutex_unlock(&crc_lock);
+}
+
+void checksum_forget(int block) {
+    checksum_set(block, 0);
+}
+
+void checksum_sync_begin(void) {
+    if (!enabled)
+        return;
+    pthread_rwlock_wrlock(&gate);
+    pthread_mutex_lock(&crc_lock);
+    for (uint32_t p = 0; p < page_count; ++p) {
+        if (!dirty_pages[p])
+            continue;
+        uint32_t last = (p + 1) * CRC_PAGE_ENTRIES < entries ? (p + 1) * CRC_PAGE_ENTRIES : entries;
+        for (uint32_t b = p * CRC_PAGE_ENTRIES; b < last; ++b)
+            state[b] &= ~CRC_CHANGED;
+    }
+    pthread_mutex_unlock(&crc_lock);
+    pthread_rwlock_unlock(&gate);
+}
+
+int checksum_sync(void) {
+    if (!enabled)
+        return 0;
+
+    uint32_t page[CRC_PAGE_ENTRIES];
+    int errors = 0;
+    pthread_mutex_lock(&crc_lock);
+    for (uint32_t p = 0; p < page_count; ++p) {
+        if (!dirty_pages[p])
+            continue;
+        uint32_t first = p * CRC_PAGE_ENTRIES;
+        uint32_t n = entries - first < CRC_PAGE_ENTRIES ? entries - first : CRC_PAGE_ENTRIES;
+
+        // Lo escrito después de sync_begin puede no estar en disco todavía:
+        // su entrada sigue en 0 y la página queda para el próximo checkpoint
+        int again = 0;
+        for (uint32_t k = 0; k < n; ++k) {
+            int changed = state[first + k] & CRC_CHANGED;
+            page[k] = changed ? 0 : crcs[first + k];
+            again |= changed;
+        }
+        if (pwrite(table_fd, page, n * sizeof(uint32_t), table_off + (long)first * sizeof(uint32_t)) !=
+            (ssize_t)(n * sizeof(uint32_t))) {
+            // No se sabe qué quedó: cada entrada se vuelve a poner en 0
+            // antes de la próxima escritura de su bloque
+            for (uint32_t k = 0; k < n; ++k)
+                state[first + k] &= ~CRC_DISK_ZERO;
+            errors++;
+            continue;
+        }
+        for (uint32_t k = 0; k < n; ++k) {
+            if (page[k])
+                state[first + k] &= ~CRC_DISK_ZERO;
+            else
+                state[first + k] |= CRC_DISK_ZERO;
+        }
+        dirty_pages[p] = again;
+    }
+    pthread_mutex_unlock(&crc_lock);
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "../includes/compress.h"
+#include "../includes/lz_codec.h"
+#include "../includes/block_map.h"
+#include "../includes/block_cache.h"
+#include "../includes/block_store.h"
+#include "../includes/bitmap.h"
+#include "../includes/checksum.h"
+#include "../includes/log.h"
+
+static int present = 0;
+static int enabled = 0;
+static compress_stats_t stats;
+static int64_t blocks_saved = 0;
+
+// Clusters descomprimidos, por sus bloques: con deduplicación dos clusters
+// pueden compartir el primero. Un slot con referencias no se reemplaza;
+// mientras se carga, los demás lectores del mismo cluster esperan en zcond.
+typedef struct {
+    int block;              // primer bloque del cluster; -1 = libre
+    int map[BWFS_CLUSTER_BLOCKS];
+    int refs;
+    int loading;
+    int temporary;          // no entró en la caché: se libera al soltarlo
+    uint64_t used;
+    size_t len;             // bytes válidos (raw_len); el resto está en cero
+    unsigned char *data;    // BWFS_CLUSTER_BLOCKS payloads
+} zslot_t;
+
+static zslot_t zcache[BWFS_ZCACHE_SLOTS];
+static pthread_mutex_t zlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zcond = PTHREAD_COND_INITIALIZER;
+static uint64_t ztick = 0;
+
+static size_t cluster_bytes(void) {
+    return BWFS_CLUSTER_BLOCKS * pbm_payload_size();
+}
+
+void compress_init(int has_clusters, int enable) {
+    present = has_clusters || enable;
+    enabled = enable;
+    memset(&stats, 0, sizeof(stats));
+    blocks_saved = 0;
+    for (int k = 0; k < BWFS_ZCACHE_SLOTS; ++k)
+        zcache[k].block = -1;
+}
+
+void compress_shutdown(void) {
+    pthread_mutex_lock(&zlock);
+    for (int k = 0; k < BWFS_ZCACHE_SLOTS; ++k) {
+        free(zcache[k].data);
+        memset(&zcache[k], 0, sizeof(zslot_t));
+        zcache[k].block = -1;
+    }
+    pthread_mutex_unlock(&zlock);
+    present = enabled = 0;
+}
+
+int compress_enabled(void) {
+    return enabled;
+}
+
+// Punteros del cluster que empieza en c0; los que pasan del máximo de un
+// archivo quedan como huecos
+static int cluster_map(const inode_t *inode, int c0, int *map) {
+    int count = BWFS_CLUSTER_BLOCKS;
+    if (c0 + count > (int)BWFS_MAX_FILE_BLOCKS)
+        count = (int)BWFS_MAX_FILE_BLOCKS - c0;
+    for (int k = count; k < BWFS_CLUSTER_BLOCKS; ++k)
+        map[k] = -1;
+    return block_map_get_range(inode, c0, count, map);
+}
+
+static int is_compressed(const int *map) {
+    return map[BWFS_CLUSTER_BLOCKS - 1] == BWFS_MAP_COMPRESSED;
+}
+
+// Lee y descomprime el cluster en `out` (cluster_bytes(), el resto en
+// cero). Devuelve raw_len o -1 con `why` si la cabecera o los datos no cierran.
+static long decode_cluster(const int *map, unsigned char *out, const char **why) {
+    size_t payload = pbm_payload_size();
+    bwfs_cluster_header_t hdr;
+    *why = "ilegible";
+    if (block_cache_read(map[0], 0, sizeof(hdr), (unsigned char *)&hdr) != 0)
+        return -1;
+
+    int ok = hdr.magic == BWFS_CLUSTER_MAGIC && hdr.algo == BWFS_COMPRESS_LZ &&
+             hdr.blocks >= 1 && hdr.blocks < BWFS_CLUSTER_BLOCKS &&
+             hdr.raw_len <= cluster_bytes() &&
+             sizeof(hdr) + hdr.packed_len <= hdr.blocks * payload;
+    for (int k = 0; ok && k < BWFS_CLUSTER_BLOCKS; ++k)
+        ok = k < hdr.blocks ? map[k] >= 0 : map[k] == BWFS_MAP_COMPRESSED;
+    if (!ok) {
+        *why = "inválido";
+        return -1;
+    }
+
+    unsigned char *packed = malloc(hdr.blocks * payload);
+    if (!packed)
+        return -1;
+    long n = 0;
+    for (int k = 0; n == 0 && k < hdr.blocks; ++k)
+        if (block_cache_read(map[k], 0, payload, packed + k * payload) != 0)
+            n = -1;
+    if (n == 0)
+        n = lz_decompress(packed + sizeof(hdr), hdr.packed_len, out, cluster_bytes());
+    free(packed);
+
+    if (n != (long)hdr.raw_len || crc32c(0, out, n) != hdr.raw_crc) {
+        *why = "dañado";
+        return -1;
+    }
+    memset(out + n, 0, cluster_bytes() - n);
+    return n;
+}
+
+static long load_cluster(const int *map, unsigned char *out) {
+    const char *why;
+    long n = decode_cluster(map, out, &why);
+    if (n < 0) {
+        LOG_ERROR("❌ Cluster comprimido %s en el bloque %d", why, map[0]);
+        return -1;
+    }
+    __atomic_add_fetch(&stats.decompressed, 1, __ATOMIC_RELAXED);
+    return n;
+}
+
+int compress_check(const inode_t *inode, int c0, unsigned char *out, const char **why) {
+    int map[BWFS_CLUSTER_BLOCKS];
+    *why = "ilegible";
+    if (cluster_map(inode, c0, map) != 0)
+        return -1;
+    if (!is_compressed(map))
+        return 0;
+    return decode_cluster(map, out, why) < 0 ? -1 : 0;
+}
+
+// Cluster descomprimido con una referencia tomada; put_cluster la suelta
+static zslot_t *get_cluster(const int *map) {
+    zslot_t *s = NULL;
+
+    pthread_mutex_lock(&zlock);
+    for (;;) {
+        zslot_t *hit = NULL, *victim = NULL;
+        for (int k = 0; k < BWFS_ZCACHE_SLOTS; ++k) {
+            zslot_t *z = &zcache[k];
+            if (z->block == map[0] && memcmp(z->map, map, sizeof(z->map)) == 0) {
+                hit = z;
+                break;
+            }
+            if (z->refs == 0 && (!victim || (victim->block >= 0 && (z->block < 0 || z->used < victim->used))))
+                victim = z;
+        }
+        if (hit && hit->loading) {
+            pthread_cond_wait(&zcond, &zlock);
+            continue;
+        }
+        if (hit) {
+            hit->refs++;
+            hit->used = ++ztick;
+            pthread_mutex_unlock(&zlock);
+            return hit;
+        }
+        s = victim;
+        break;
+    }
+
+    if (s) {
+        s->block = map[0];
+        memcpy(s->map, map, sizeof(s->map));
+        s->refs = 1;
+        s->loading = 1;
+        s->used = ++ztick;
+    }
+    pthread_mutex_unlock(&zlock);
+
+    // Todos los slots en uso: uno propio que no queda en la caché
+    if (!s) {
+        s = calloc(1, sizeof(zslot_t));
+        if (!s)
+            return NULL;
+        s->block = -1;
+        s->refs = 1;
+        s->temporary = 1;
+    }
+
+    if (!s->data)
+        s->data = malloc(cluster_bytes());
+    long n = s->data ? load_cluster(map, s->data) : -1;
+    s->len = n > 0 ? (size_t)n : 0;
+    if (s->temporary) {
+        if (n >= 0)
+            return s;
+        free(s->data);
+        free(s);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&zlock);
+    s->loading = 0;
+    if (n < 0) {
+        s->block = -1;
+        s->refs = 0;
+    }
+    pthread_cond_broadcast(&zcond);
+    pthread_mutex_unlock(&zlock);
+    return n < 0 ? NULL : s;
+}
+
+static void put_cluster(zslot_t *s) {
+    if (s->temporary) {
+        free(s->data);
+        free(s);
+        return;
+    }
+    pthread_mutex_lock(&zlock);
+    s->refs--;
+    pthread_mutex_unlock(&zlock);
+}
+
+void compress_forget(int block) {
+    if (!present)
+        return;
+    pthread_mutex_lock(&zlock);
+    for (int k = 0; k < BWFS_ZCACHE_SLOTS; ++k)
+        for (int j = 0; zcache[k].block >= 0 && j < BWFS_CLUSTER_BLOCKS; ++j)
+            if (zcache[k].map[j] == block)
+                zcache[k].block = -1;
+    pthread_mutex_unlock(&zlock);
+}
+
+int compress_read(const inode_t *inode, int idx, size_t offset, size_t len, unsigned char *out) {
+    int map[BWFS_CLUSTER_BLOCKS];
+    int c0 = idx - idx % BWFS_CLUSTER_BLOCKS;
+    int blk;
+
+    if (!present) {
+        blk = block_map_get(inode, idx);
+    } else {
+        if (cluster_map(inode, c0, map) != 0)
+            return -1;
+        blk = is_compressed(map) ? BWFS_MAP_COMPRESSED : map[idx - c0];
+    }
+
+    if (blk >= 0)
+        return block_cache_read(blk, offset, len, out);
+    if (blk != BWFS_MAP_COMPRESSED) {
+        memset(out, 0, len);
+        return 0;
+    }
+
+    zslot_t *s = get_cluster(map);
+    if (!s)
+        return -1;
+    memcpy(out, s->data + (size_t)(idx - c0) * pbm_payload_size() + offset, len);
+    put_cluster(s);
+    return 0;
+}
+
+// Bloques nuevos de un cluster: en disco antes de que el mapa apunte a ellos
+static int store_fresh(const int *fresh, int n) {
+    if (block_cache_sync_blocks(fresh, n) != 0 || block_store_sync() != 0)
+        return -EIO;
+    return 0;
+}
+
+// Pone el cluster en crudo en bloques nuevos; los comprimidos se liberan
+// cuando el cambio de mapa sea durable (block_map_defer_release)
+static int expand_cluster(inode_t *inode, int c0, const int *map) {
+    size_t payload = pbm_payload_size();
+    zslot_t *s = get_cluster(map);
+    if (!s)
+        return -EIO;
+
+    int n = (s->len + payload - 1) / payload;
+    int fresh[BWFS_CLUSTER_BLOCKS], r = 0;
+    if (n > 0 && alloc_blocks(n, fresh) < 0) {
+        put_cluster(s);
+        return -ENOSPC;
+    }
+    for (int k = 0; r == 0 && k < n; ++k)
+        if (block_cache_write(fresh[k], 0, payload, s->data + k * payload) != 0)
+            r = -EIO;
+    put_cluster(s);
+    if (r == 0)
+        r = store_fresh(fresh, n);
+
+    int next[BWFS_CLUSTER_BLOCKS];
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k)
+        next[k] = k < n ? fresh[k] : -1;
+    if (r == 0)
+        r = block_map_set_range(inode, c0, BWFS_CLUSTER_BLOCKS, next);
+    if (r != 0) {
+        for (int k = 0; k < n; ++k)
+            block_map_release(fresh[k]);
+        return r;
+    }
+
+    int old = 0;
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k) {
+        if (map[k] >= 0) {
+            block_map_defer_release(map[k]);
+            old++;
+        }
+    }
+    __atomic_add_fetch(&stats.expanded, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&blocks_saved, n - old, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int compress_expand(inode_t *inode, int first, int last) {
+    if (!present)
+        return 0;
+
+    int changed = 0;
+    for (int c0 = first - first % BWFS_CLUSTER_BLOCKS; c0 <= last; c0 += BWFS_CLUSTER_BLOCKS) {
+        int map[BWFS_CLUSTER_BLOCKS];
+        if (cluster_map(inode, c0, map) != 0)
+            return -EIO;
+        if (!is_compressed(map))
+            continue;
+        int r = expand_cluster(inode, c0, map);
+        if (r < 0)
+            return r;
+        changed += r;
+    }
+    return changed;
+}
+
+// 1 si el cluster quedó comprimido, 0 si conviene dejarlo en crudo.
+// `raw` y `packed` son buffers de cluster_bytes().
+static int compress_cluster(inode_t *inode, int c0, const int *map, unsigned char *raw,
+                            unsigned char *packed) {
+    size_t payload = pbm_payload_size();
+
+    // Comprimido tiene que ocupar al menos un bloque menos que en crudo
+    int used = 0;
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k)
+        used += map[k] >= 0;
+    if (used < 2)
+        return 0;
+
+    size_t raw_len = inode->size - (size_t)c0 * payload;
+    if (raw_len > cluster_bytes())
+        raw_len = cluster_bytes();
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k) {
+        if (map[k] < 0)
+            memset(raw + k * payload, 0, payload);
+        else if (block_cache_read(map[k], 0, payload, raw + k * payload) != 0)
+            return -EIO;
+    }
+
+    bwfs_cluster_header_t hdr = {
+        .magic = BWFS_CLUSTER_MAGIC,
+        .raw_len = raw_len,
+        .algo = BWFS_COMPRESS_LZ,
+    };
+    size_t room = (used - 1) * payload - sizeof(hdr);
+    hdr.packed_len = lz_compress(raw, raw_len, packed + sizeof(hdr), room);
+    if (hdr.packed_len == 0) {
+        __atomic_add_fetch(&stats.incompressible, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    hdr.blocks = (sizeof(hdr) + hdr.packed_len + payload - 1) / payload;
+    hdr.raw_crc = crc32c(0, raw, raw_len);
+    memcpy(packed, &hdr, sizeof(hdr));
+    memset(packed + sizeof(hdr) + hdr.packed_len, 0,
+           hdr.blocks * payload - sizeof(hdr) - hdr.packed_len);
+
+    // Sin espacio para los bloques nuevos el cluster queda como estaba
+    int fresh[BWFS_CLUSTER_BLOCKS], r = 0;
+    if (alloc_blocks(hdr.blocks, fresh) < 0)
+        return 0;
+    for (int k = 0; r == 0 && k < hdr.blocks; ++k)
+        if (block_cache_write(fresh[k], 0, payload, packed + k * payload) != 0)
+            r = -EIO;
+    if (r == 0)
+        r = store_fresh(fresh, hdr.blocks);
+
+    int next[BWFS_CLUSTER_BLOCKS];
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k)
+        next[k] = k < hdr.blocks ? fresh[k] : BWFS_MAP_COMPRESSED;
+    if (r == 0)
+        r = block_map_set_range(inode, c0, BWFS_CLUSTER_BLOCKS, next);
+    if (r != 0) {
+        for (int k = 0; k < hdr.blocks; ++k)
+            block_map_release(fresh[k]);
+        return r;
+    }
+
+    for (int k = 0; k < BWFS_CLUSTER_BLOCKS; ++k)
+        if (map[k] >= 0)
+            block_map_defer_release(map[k]);
+    __atomic_add_fetch(&stats.compressed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.raw_bytes, raw_len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.packed_bytes, hdr.packed_len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&blocks_saved, used - hdr.blocks, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int compress_range(inode_t *inode, int first, int last) {
+    if (!enabled || first < 0)
+        return 0;
+
+    size_t payload = pbm_payload_size();
+    int nblocks = (inode->size + payload - 1) / payload;
+    if (last >= nblocks)
+        last = nblocks - 1;
+    if (first > last)
+        return 0;
+
+    unsigned char *raw = malloc(cluster_bytes());
+    unsigned char *packed = malloc(cluster_bytes());
+    int changed = 0;
+    if (!raw || !packed)
+        changed = -ENOMEM;
+
+    int c0 = first - first % BWFS_CLUSTER_BLOCKS;
+    for (; changed >= 0 && c0 <= last; c0 += BWFS_CLUSTER_BLOCKS) {
+        int map[BWFS_CLUSTER_BLOCKS];
+        if (c0 + BWFS_CLUSTER_BLOCKS > (int)BWFS_MAX_FILE_BLOCKS || cluster_map(inode, c0, map) != 0)
+            break;
+        if (is_compressed(map))
+            continue;
+        int r = compress_cluster(inode, c0, map, raw, packed);
+        changed = r < 0 ? r : changed + r;
+    }
+    free(raw);
+    free(packed);
+    return changed;
+}
+
+void compress_get_stats(compress_stats_t *out) {
+    out->compressed = __atomic_load_n(&stats.compressed, __ATOMIC_RELAXED);
+    out->incompressible = __atomic_load_n(&stats.incompressible, __ATOMIC_RELAXED);
+    out->expanded = __atomic_load_n(&stats.expanded, __ATOMIC_RELAXED);
+    out->raw_bytes = __atomic_load_n(&stats.raw_bytes, __ATOMIC_RELAXED);
+    out->packed_bytes = __atomic_load_n(&stats.packed_bytes, __ATOMIC_RELAXED);
+    out->decompressed = __atomic_load_n(&stats.decompressed, __ATOMIC_RELAXED);
+    out->blocks_saved = __atomic_load_n(&blocks_saved, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "../includes/bwfs.h"
+#include "../includes/pbm.h"
+#include "../includes/utils.h"
+
+// Convierte en el lugar un volumen P1 (texto) a P4 (binario).
+// Cada bloque se reescribe en un archivo temporal y se renombra encima del
+// original; el bloque 0 (superbloque) va último, así que si la conversión se
+// interrumpe basta con volver a ejecutarla: los bloques ya en P4 se saltan.
+
+// Offset de la tabla de inodos en cada formato: fijo en los volúmenes
+// anteriores, derivado de la imagen en los que tienen geometría
+static long meta_offset_for(const superblock_t *sb, int format) {
+    if (sb->total_inodes)
+        return geometry_meta_offset(format, sb->image_width, sb->image_height);
+    return format == BWFS_FORMAT_P4 ? BWFS_P4_META_OFFSET : BWFS_P1_META_OFFSET;
+}
+
+// Lee los bytes binarios de un bloque de metadatos: en offset fijo, o los
+// últimos `len` bytes si offset < 0
+static int read_meta(const char *path, long offset, void *out, size_t len) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    int ok = (offset >= 0 ? fseek(f, offset, SEEK_SET) : fseek(f, -(long)len, SEEK_END)) == 0 &&
+             fread(out, 1, len, f) == len;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+// Escribe un bloque P4 vacío en `tmp`, le agrega los metadatos y lo renombra
+static int replace_meta_block(const char *path, const char *tmp, int block_num,
+                              long offset, const void *meta, size_t len) {
+    if (pbm_write_blank(tmp, BWFS_FORMAT_P4, block_num) != 0)
+        return -1;
+
+    FILE *f = fopen(tmp, offset >= 0 ? "r+b" : "ab");
+    if (!f)
+        return -1;
+    if (offset >= 0)
+        fseek(f, offset, SEEK_SET);
+    int ok = fwrite(meta, 1, len, f) == len;
+    if (fclose(f) != 0)
+        ok = 0;
+
+    return (ok && rename(tmp, path) == 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Uso: convert.bwfs <carpeta_fs>\n");
+        return 1;
+    }
+
+    const char *folder = argv[1];
+    superblock_t sb;
+
+    if (read_superblock(folder, &sb) != 0) {
+        printf("❌ Magic inválido. No es un sistema BWFS válido.\n");
+        return 1;
+    }
+    if (sb.block_format == BWFS_FORMAT_P4) {
+        printf("✅ El volumen ya está en formato P4\n");
+        return 0;
+    }
+
+    bwfs_geometry_t g;
+    geometry_from_superblock(&sb, &g);
+    volume_set_geometry(&g);
+
+    char path[256], tmp[300];
+    unsigned char *data = malloc(pbm_payload_size());
+    inode_t *inodes = malloc(g.inodes_per_block * sizeof(inode_t));
+
+    // Bitmaps: al final del bloque de bitmaps, sirve para saltar bloques libres
+    size_t bitmaps_len = g.block_bitmap_len + g.inode_bitmap_len;
+    uint8_t *bitmaps = malloc(bitmaps_len);
+    if (!data || !inodes || !bitmaps)
+        return 1;
+    block_path(path, sizeof(path), folder, g.bitmap_block);
+    if (read_meta(path, -1, bitmaps, bitmaps_len) != 0) {
+        fprintf(stderr, "❌ No se pudieron leer los bitmaps\n");
+        return 1;
+    }
+
+    int converted = 0;
+
+    for (int i = (int)sb.total_blocks - 1; i >= 0; --i) {
+        block_path(path, sizeof(path), folder, i);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        remove(tmp);
+
+        // Bloque de datos de un volumen perezoso (mkfs -l) sin materializar
+        if (i > (int)g.bitmap_block && access(path, F_OK) != 0)
+            continue;
+
+        int format = pbm_detect_format(path);
+        if (format == BWFS_FORMAT_P4)
+            continue;  // ya convertido en una pasada anterior
+
+        int r;
+        if (i == 0) {
+            // Se escribe completo: total_inodes en 0 sigue marcando la
+            // geometría fija, y features/root_inode no se pierden
+            superblock_t nsb = sb;
+            nsb.block_format = BWFS_FORMAT_P4;
+            // La tabla de CRC no se copia: el montaje crea una vacía
+            nsb.features &= ~BWFS_FEATURE_CRC;
+            if (sb.total_inodes)
+                nsb.meta_offset = meta_offset_for(&sb, BWFS_FORMAT_P4);
+            r = replace_meta_block(path, tmp, i, -1, &nsb, sizeof(nsb));
+        } else if (i <= (int)g.inode_blocks) {
+            uint32_t first = (i - 1) * g.inodes_per_block;
+            uint32_t n = g.total_inodes - first < g.inodes_per_block ?
+                         g.total_inodes - first : g.inodes_per_block;
+            memset(inodes, 0, n * sizeof(inode_t));
+            read_meta(path, meta_offset_for(&sb, BWFS_FORMAT_P1), inodes, n * sizeof(inode_t));
+            r = replace_meta_block(path, tmp, i, meta_offset_for(&sb, BWFS_FORMAT_P4),
+                                   inodes, n * sizeof(inode_t));
+        } else if (i == (int)g.bitmap_block) {
+            r = replace_meta_block(path, tmp, i, -1, bitmaps, bitmaps_len);
+        } else {
+            // Bloque de datos: solo los ocupados necesitan decodificarse
+            if ((uint32_t)i < g.block_bitmap_len && bitmaps[i]) {
+                if (pbm_read_block(path, BWFS_FORMAT_P1, data) != 0) {
+                    fprintf(stderr, "❌ Bloque %d ilegible\n", i);
+                    free(data);
+                    return 1;
+                }
+            } else {
+                memset(data, 0, pbm_payload_size());
+            }
+            r = pbm_write_block(tmp, BWFS_FORMAT_P4, i, data);
+            if (r == 0)
+                r = rename(tmp, path);
+        }
+
+        if (r != 0) {
+            perror("❌ Error convirtiendo bloque");
+            remove(tmp);
+            free(data);
+            return 1;
+        }
+        converted++;
+    }
+
+    free(data);
+    free(inodes);
+    free(bitmaps);
+    printf("✅ Volumen convertido a P4 (%d bloques reescritos)\n", converted);
+    return 0;
+}
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../includes/dedup.h"
+#include "../includes/block_map.h"
+#include "../includes/block_cache.h"
+#include "../includes/block_store.h"
+#include "../includes/bitmap.h"
+#include "../includes/checksum.h"
+#include "../includes/journal.h"
+#include "../includes/pbm.h"
+
+#define DEDUP_PAGE_ENTRIES 512      // entradas por escritura de la tabla (4 KB)
+#define DEDUP_BATCH 64              // índices del mapa por consulta
+
+// Cabecera del archivo; la tabla sigue con una entrada por bloque
+typedef struct {
+    uint32_t magic;
+    uint32_t entries;
+} dedup_header_t;
+
+static int present = 0;
+static int enabled = 0;
+static int table_fd = -1;
+static uint32_t entries = 0;
+static bwfs_dedup_entry_t *table = NULL;
+static uint32_t *gen = NULL;        // cambia cada vez que un bloque pierde su huella
+static uint8_t *dirty_pages = NULL;
+static uint32_t page_count = 0;
+static int32_t *slots = NULL;       // índice: cubetas de BWFS_DEDUP_WAYS bloques, -1 = vacío
+static uint32_t bucket_mask = 0;
+static dedup_stats_t stats;
+
+// dedup_lock protege la tabla, gen, el índice y las estadísticas. Nunca
+// se hace I/O de bloques con él tomado.
+static pthread_mutex_t dedup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void table_path(char *out, size_t size, const char *folder) {
+    snprintf(out, size, "%s/%s", folder, BWFS_DEDUP_FILE);
+}
+
+// --- Índice huella → bloque. No se limpia: una entrada cuyo bloque ya no
+// tiene esa huella se ignora al buscar y se pisa al agregar.
+
+static int32_t *bucket_of(uint32_t fp) {
+    return &slots[(size_t)(fp & bucket_mask) * BWFS_DEDUP_WAYS];
+}
+
+static int stale(int32_t block, uint32_t fp) {
+    return block < 0 || table[block].fingerprint == 0 ||
+           (table[block].fingerprint & bucket_mask) != (fp & bucket_mask);
+}
+
+static int index_find(uint32_t fp) {
+    int32_t *b = bucket_of(fp);
+    for (int w = 0; w < BWFS_DEDUP_WAYS; ++w)
+        if (b[w] >= 0 && table[b[w]].fingerprint == fp)
+            return b[w];
+    return -1;
+}
+
+// Al frente de la cubeta; si está llena sale el más viejo
+static void index_add(uint32_t fp, int block) {
+    int32_t *b = bucket_of(fp);
+    int w = 0;
+    while (w < BWFS_DEDUP_WAYS - 1 && b[w] != block && !stale(b[w], fp))
+        w++;
+    memmove(&b[1], &b[0], w * sizeof(int32_t));
+    b[0] = block;
+}
+
+// Con dedup_lock: cambia la entrada y la anota para el checkpoint y, si
+// `log`, en el journal
+static void set_entry(int block, uint32_t refs, uint32_t fp, int log) {
+    bwfs_dedup_entry_t *e = &table[block];
+    if (e->refs == refs && e->fingerprint == fp)
+        return;
+    stats.saved = stats.saved - e->refs + refs;
+    stats.shared = stats.shared - (e->refs > 0) + (refs > 0);
+    if (e->fingerprint && e->fingerprint != fp)
+        gen[block]++;
+    e->refs = refs;
+    e->fingerprint = fp;
+    dirty_pages[block / DEDUP_PAGE_ENTRIES] = 1;
+    if (log)
+        journal_log_dedup(block, refs, fp);
+}
+
+void dedup_close(void) {
+    pthread_mutex_lock(&dedup_lock);
+    if (table_fd >= 0)
+        close(table_fd);
+    free(table);
+    free(gen);
+    free(dirty_pages);
+    free(slots);
+    table_fd = -1;
+    table = NULL;
+    gen = NULL;
+    dirty_pages = NULL;
+    slots = NULL;
+    entries = page_count = bucket_mask = 0;
+    present = enabled = 0;
+    pthread_mutex_unlock(&dedup_lock);
+}
+
+int dedup_init(const char *folder, const bwfs_geometry_t *g, int enable) {
+    dedup_close();
+
+    char path[256];
+    table_path(path, sizeof(path), folder);
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    // El índice tiene lugar para el doble de los bloques del volumen
+    uint32_t total = g->total_blocks;
+    uint32_t buckets = 1;
+    while ((uint64_t)buckets * BWFS_DEDUP_WAYS < 2ULL * total)
+        buckets <<= 1;
+    uint32_t pages = (total + DEDUP_PAGE_ENTRIES - 1) / DEDUP_PAGE_ENTRIES;
+    size_t len = (size_t)total * sizeof(bwfs_dedup_entry_t);
+
+    size_t nslots = (size_t)buckets * BWFS_DEDUP_WAYS;
+    bwfs_dedup_entry_t *t = malloc(len ? len : 1);
+    uint32_t *gens = calloc(total ? total : 1, sizeof(uint32_t));
+    uint8_t *dirty = calloc(pages ? pages : 1, 1);
+    int32_t *index = malloc(nslots * sizeof(int32_t));
+    dedup_header_t hdr;
+    if (!t || !gens || !dirty || !index || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != BWFS_DEDUP_MAGIC || hdr.entries != total ||
+        pread(fd, t, len, sizeof(hdr)) != (ssize_t)len) {
+        free(t);
+        free(gens);
+        free(dirty);
+        free(index);
+        close(fd);
+        return -1;
+    }
+    memset(index, 0xff, nslots * sizeof(int32_t));
+
+    pthread_mutex_lock(&dedup_lock);
+    table = t;
+    gen = gens;
+    dirty_pages = dirty;
+    slots = index;
+    bucket_mask = buckets - 1;
+    memset(&stats, 0, sizeof(stats));
+    for (uint32_t b = 0; b < total; ++b) {
+        if (table[b].refs) {
+            stats.shared++;
+            stats.saved += table[b].refs;
+        }
+        if (table[b].fingerprint)
+            index_add(table[b].fingerprint, b);
+    }
+    table_fd = fd;
+    entries = total;
+    page_count = pages;
+    present = 1;
+    enabled = enable;
+    pthread_mutex_unlock(&dedup_lock);
+    return 0;
+}
+
+int dedup_create(const char *folder, const bwfs_geometry_t *g) {
+    char path[256], tmp[300];
+    table_path(path, sizeof(path), folder);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    dedup_header_t hdr = { BWFS_DEDUP_MAGIC, g->total_blocks };
+    off_t len = sizeof(hdr) + (off_t)g->total_blocks * sizeof(bwfs_dedup_entry_t);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0 && pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+             ftruncate(fd, len) == 0 && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int dedup_present(void) {
+    return present;
+}
+
+int dedup_enabled(void) {
+    return enabled;
+}
+
+int dedup_put(int block) {
+    if (!present || block < 0 || (uint32_t)block >= entries)
+        return 0;
+    pthread_mutex_lock(&dedup_lock);
+    bwfs_dedup_entry_t e = table[block];
+    int kept = e.refs > 0;
+    // Sin otros punteros el bloque se libera y deja de ser candidato
+    set_entry(block, kept ? e.refs - 1 : 0, kept ? e.fingerprint : 0, 1);
+    pthread_mutex_unlock(&dedup_lock);
+    return kept;
+}
+
+uint32_t dedup_refs(int block) {
+    if (!present || block < 0 || (uint32_t)block >= entries)
+        return 0;
+    pthread_mutex_lock(&dedup_lock);
+    uint32_t r = table[block].refs;
+    pthread_mutex_unlock(&dedup_lock);
+    return r;
+}
+
+uint32_t dedup_fingerprint(int block) {
+    if (!present || block < 0 || (uint32_t)block >= entries)
+        return 0;
+    pthread_mutex_lock(&dedup_lock);
+    uint32_t fp = table[block].fingerprint;
+    pthread_mutex_unlock(&dedup_lock);
+    return fp;
+}
+
+void dedup_restore(int block, uint32_t refs, uint32_t fp) {
+    if (!present || block < 0 || (uint32_t)block >= entries)
+        return;
+    pthread_mutex_lock(&dedup_lock);
+    set_entry(block, refs, fp, 0);
+    if (fp)
+        index_add(fp, block);
+    pthread_mutex_unlock(&dedup_lock);
+}
+
+// --- Escrituras
+
+// Bloques a los que el mapa va a apuntar: en disco antes del cambio de mapa
+static int store_blocks(const int *blocks, int count) {
+    if (block_cache_sync_blocks(blocks, count) != 0 || block_store_sync() != 0)
+        return -EIO;
+    return 0;
+}
+
+int dedup_unshare(inode_t *inode, uint64_t offset, size_t len) {
+    if (!present || len == 0)
+        return 0;
+
+    size_t payload = pbm_payload_size();
+    int first = offset / payload;
+    int last = (offset + len - 1) / payload;
+    if (last >= (int)BWFS_MAX_FILE_BLOCKS)
+        last = (int)BWFS_MAX_FILE_BLOCKS - 1;   // block_map_reserve da EFBIG
+    if (first > last)
+        return 0;
+
+    int count = last - first + 1;
+    int *map = malloc(count * sizeof(int));
+    if (!map)
+        return -ENOMEM;
+    if (block_map_get_range(inode, first, count, map) != 0) {
+        free(map);
+        return -EIO;
+    }
+
+    unsigned char *buf = NULL;
+    int changed = 0;
+    for (int k = 0; changed >= 0 && k < count; ++k) {
+        int blk = map[k];
+        if (blk < 0 || (uint32_t)blk >= entries)
+            continue;
+
+        // Propio: deja de ser candidato antes de cambiar en el lugar
+        pthread_mutex_lock(&dedup_lock);
+        uint32_t refs = table[blk].refs;
+        if (!refs && table[blk].fingerprint)
+            set_entry(blk, 0, 0, 1);
+        pthread_mutex_unlock(&dedup_lock);
+        if (!refs)
+            continue;
+
+        // Compartido: una copia propia, salvo que la escritura lo tape
+        // entero (queda un hueco y block_map_reserve pone un bloque nuevo)
+        uint64_t start = (uint64_t)(first + k) * payload;
+        int fresh = -1, r = 0;
+        if (start < offset || start + payload > offset + len) {
+            if (!buf && !(buf = malloc(payload)))
+                r = -ENOMEM;
+            else if (alloc_blocks(1, &fresh) < 0)
+                r = -ENOSPC;
+            else if (block_cache_read(blk, 0, payload, buf) != 0 ||
+                     block_cache_write(fresh, 0, payload, buf) != 0 ||
+                     store_blocks(&fresh, 1) != 0)
+                r = -EIO;
+        }
+        if (r == 0)
+            r = block_map_set_range(inode, first + k, 1, &fresh);
+        if (r != 0) {
+            if (fresh >= 0)
+                block_map_release(fresh);
+            changed = r;
+            break;
+        }
+
+        // La referencia se suelta cuando el mapa nuevo sea durable; si los
+        // demás dueños lo soltaron mientras tanto, ahí se libera
+        block_map_defer_release(blk);
+        pthread_mutex_lock(&dedup_lock);
+        stats.copied++;
+        pthread_mutex_unlock(&dedup_lock);
+        changed++;
+    }
+    free(buf);
+    free(map);
+    return changed;
+}
+
+// Bloque con el mismo contenido que `blk`, con una referencia más ya
+// tomada, o -1; en ese caso `blk` entra al índice con su huella. Los
+// bloques ya compartidos o ya en el índice no se vuelven a mirar.
+static int find_duplicate(int blk, unsigned char *data, unsigned char *other) {
+    size_t payload = pbm_payload_size();
+    if (blk < 0 || (uint32_t)blk >= entries)
+        return -1;
+
+    pthread_mutex_lock(&dedup_lock);
+    int seen = table[blk].refs || table[blk].fingerprint;
+    pthread_mutex_unlock(&dedup_lock);
+    if (seen || block_cache_read(blk, 0, payload, data) != 0)
+        return -1;
+
+    uint32_t fp = checksum_of(data);
+    pthread_mutex_lock(&dedup_lock);
+    int cand = index_find(fp);
+    uint32_t cand_gen = cand >= 0 ? gen[cand] : 0;
+    pthread_mutex_unlock(&dedup_lock);
+
+    // Los bytes se comparan sin el lock. Si mientras tanto el candidato
+    // perdió la huella (su dueño lo escribió o lo liberó) no se usa: con
+    // la referencia tomada, lo próximo que lo escriba hace una copia.
+    int same = cand >= 0 && block_cache_read(cand, 0, payload, other) == 0 &&
+               memcmp(data, other, payload) == 0;
+
+    pthread_mutex_lock(&dedup_lock);
+    if (same && gen[cand] == cand_gen && table[cand].fingerprint == fp) {
+        set_entry(cand, table[cand].refs + 1, fp, 1);
+    } else {
+        if (cand >= 0 && !same)
+            stats.mismatched++;
+        same = 0;
+        set_entry(blk, 0, fp, 1);
+        index_add(fp, blk);
+        stats.unique++;
+    }
+    pthread_mutex_unlock(&dedup_lock);
+    return same ? cand : -1;
+}
+
+int dedup_range(inode_t *inode, int first, int last) {
+    if (!enabled || first < 0)
+        return 0;
+
+    size_t payload = pbm_payload_size();
+    int nblocks = (inode->size + payload - 1) / payload;
+    if (last >= nblocks)
+        last = nblocks - 1;
+    if (first > last)
+        return 0;
+
+    unsigned char *data = malloc(payload);
+    unsigned char *other = malloc(payload);
+    int changed = 0;
+    if (!data || !other)
+        changed = -ENOMEM;
+
+    for (int b0 = first; changed >= 0 && b0 <= last; b0 += DEDUP_BATCH) {
+        int n = last - b0 + 1 < DEDUP_BATCH ? last - b0 + 1 : DEDUP_BATCH;
+        int map[DEDUP_BATCH], old[DEDUP_BATCH], dups[DEDUP_BATCH];
+        if (block_map_get_range(inode, b0, n, map) != 0) {
+            changed = -EIO;
+            break;
+        }
+        memcpy(old, map, n * sizeof(int));
+
+        int found = 0;
+        for (int k = 0; k < n; ++k) {
+            int dup = find_duplicate(map[k], data, other);
+            if (dup >= 0) {
+                map[k] = dup;
+                dups[found++] = dup;
+            }
+        }
+        if (!found)
+            continue;
+
+        // Los candidatos en disco antes de que el mapa apunte a ellos; los
+        // bloques propios se liberan cuando el mapa nuevo sea durable. Si
+        // el mapa no cambió se devuelven las referencias tomadas.
+        int r = store_blocks(dups, found);
+        if (r == 0)
+            r = block_map_set_range(inode, b0, n, map);
+        for (int k = 0; k < n; ++k) {
+            if (map[k] == old[k])
+                continue;
+            if (r == 0)
+                block_map_defer_release(old[k]);
+            else
+                block_map_release(map[k]);
+        }
+        if (r != 0) {
+            changed = r;
+            break;
+        }
+        pthread_mutex_lock(&dedup_lock);
+        stats.deduped += found;
+        pthread_mutex_unlock(&dedup_lock);
+        changed += found;
+    }
+    free(data);
+    free(other);
+    return changed;
+}
+
+int dedup_sync(void) {
+    if (!present)
+        return 0;
+
+    int errors = 0;
+    pthread_mutex_lock(&dedup_lock);
+    for (uint32_t p = 0; p < page_count; ++p) {
+        if (!dirty_pages[p])
+            continue;
+        uint32_t first = p * DEDUP_PAGE_ENTRIES;
+        uint32_t n = entries - first < DEDUP_PAGE_ENTRIES ? entries - first : DEDUP_PAGE_ENTRIES;
+        size_t len = n * sizeof(bwfs_dedup_entry_t);
+        if (pwrite(table_fd, &table[first], len,
+                   sizeof(dedup_header_t) + (off_t)first * sizeof(bwfs_dedup_entry_t)) != (ssize_t)len) {
+            errors++;
+            continue;
+        }
+        dirty_pages[p] = 0;
+    }
+    pthread_mutex_unlock(&dedup_lock);
+    return errors ? -1 : 0;
+}
+
+void dedup_get_stats(dedup_stats_t *out) {
+    pthread_mutex_lock(&dedup_lock);
+    *out = stats;
+    pthread_mutex_unlock(&dedup_lock);
+}
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "../includes/dir.h"
+#include "../includes/block_map.h"
+#include "../includes/block_cache.h"
+#include "../includes/pbm.h"
+
+typedef struct {
+    dir_slot_t slot;
+    char name[BWFS_DIR_NAME_SIZE];
+} dir_entry_t;
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int slots_per_block(void) {
+    return (pbm_payload_size() - sizeof(dir_block_header_t)) /
+           (sizeof(dir_slot_t) + BWFS_DIR_NAME_SIZE);
+}
+
+// Cabecera + ranuras: lo que se lee en cada paso de una búsqueda
+static size_t table_len(int n) {
+    return sizeof(dir_block_header_t) + n * sizeof(dir_slot_t);
+}
+
+static size_t name_offset(int n, int k) {
+    return table_len(n) + (size_t)k * BWFS_DIR_NAME_SIZE;
+}
+
+static size_t slot_offset(int k) {
+    return sizeof(dir_block_header_t) + k * sizeof(dir_slot_t);
+}
+
+// Bloques de la tabla: los índices lógicos 0..2^k-1 están todos asignados
+static int dir_blocks(const inode_t *dir) {
+    if (block_map_get(dir, 0) < 0)
+        return 0;
+    int b = 1;
+    while ((size_t)b * 2 <= BWFS_MAX_FILE_BLOCKS && block_map_get(dir, b * 2 - 1) >= 0)
+        b *= 2;
+    return b;
+}
+
+// Devuelve el inodo y dónde está la entrada, o -ENOENT/-EIO
+static int find_entry(const inode_t *dir, const char *name, uint32_t h,
+                      int *blk_out, int *slot_out) {
+    int nblocks = dir_blocks(dir);
+    if (nblocks == 0)
+        return -ENOENT;
+
+    int n = slots_per_block();
+    size_t len = strlen(name);
+    unsigned char *table = malloc(table_len(n));
+    char *candidate = malloc(len + 1);
+    if (!table || !candidate) {
+        free(table);
+        free(candidate);
+        return -ENOMEM;
+    }
+    dir_block_header_t *hdr = (dir_block_header_t *)table;
+    dir_slot_t *slots = (dir_slot_t *)(table + sizeof(dir_block_header_t));
+
+    int r = -ENOENT;
+    for (int probe = 0; probe < nblocks && r == -ENOENT; ++probe) {
+        int blk = block_map_get(dir, (h + probe) & (nblocks - 1));
+        if (blk < 0 || block_cache_read(blk, 0, table_len(n), table) != 0) {
+            r = -EIO;
+            break;
+        }
+
+        for (int k = 0; k < n; ++k) {
+            if (!slots[k].ino || slots[k].hash != h)
+                continue;
+            if (block_cache_read(blk, name_offset(n, k), len + 1, (unsigned char *)candidate) != 0) {
+                r = -EIO;
+                break;
+            }
+            if (memcmp(candidate, name, len + 1) == 0) {
+                if (blk_out)
+                    *blk_out = blk;
+                if (slot_out)
+                    *slot_out = k;
+                r = slots[k].ino - 1;
+                break;
+            }
+        }
+
+        if (!hdr->overflow)
+            break;
+    }
+
+    free(table);
+    free(candidate);
+    return r;
+}
+
+// Primera ranura libre desde el bloque de la entrada, marcando overflow en
+// los llenos que se saltan
+static int insert_entry(inode_t *dir, int nblocks, const char *name, uint32_t h, int ino) {
+    int n = slots_per_block();
+    unsigned char *table = malloc(table_len(n));
+    if (!table)
+        return -ENOMEM;
+    dir_block_header_t *hdr = (dir_block_header_t *)table;
+    dir_slot_t *slots = (dir_slot_t *)(table + sizeof(dir_block_header_t));
+
+    int r = -ENOSPC;
+    for (int probe = 0; probe < nblocks; ++probe) {
+        int blk = block_map_get(dir, (h + probe) & (nblocks - 1));
+        if (blk < 0 || block_cache_read(blk, 0, table_len(n), table) != 0) {
+            r = -EIO;
+            break;
+        }
+
+        if (hdr->used < (uint32_t)n) {
+            int k = 0;
+            while (slots[k].ino)
+                k++;
+            dir_slot_t slot = { (uint32_t)ino + 1, h };
+            hdr->used++;
+            r = (block_cache_write_meta(blk, name_offset(n, k), strlen(name) + 1,
+                                        (const unsigned char *)name) != 0 ||
+                 block_cache_write_meta(blk, slot_offset(k), sizeof(slot),
+                                        (const unsigned char *)&slot) != 0 ||
+                 block_cache_write_meta(blk, 0, sizeof(*hdr), (const unsigned char *)hdr) != 0)
+                ? -EIO : 0;
+            break;
+        }
+
+        if (!hdr->overflow) {
+            hdr->overflow = 1;
+            if (block_cache_write_meta(blk, 0, sizeof(*hdr), (const unsigned char *)hdr) != 0) {
+                r = -EIO;
+                break;
+            }
+        }
+    }
+
+    free(table);
+    return r;
+}
+
+// Duplica la tabla (o crea el primer bloque) y reinserta todas las entradas
+static int grow(inode_t *dir) {
+    int old = dir_blocks(dir);
+    int nblocks = old ? old * 2 : 1;
+    if ((size_t)nblocks > BWFS_MAX_FILE_BLOCKS)
+        return -ENOSPC;
+
+    int n = slots_per_block();
+    size_t payload = pbm_payload_size();
+    unsigned char *block = malloc(payload);
+    dir_entry_t *entries = malloc(((size_t)old * n + 1) * sizeof(dir_entry_t));
+    if (!block || !entries) {
+        free(block);
+        free(entries);
+        return -ENOMEM;
+    }
+
+    int count = 0, r = 0;
+    dir_slot_t *slots = (dir_slot_t *)(block + sizeof(dir_block_header_t));
+    for (int b = 0; b < old && r == 0; ++b) {
+        int blk = block_map_get(dir, b);
+        if (blk < 0 || block_cache_read(blk, 0, payload, block) != 0) {
+            r = -EIO;
+            break;
+        }
+        for (int k = 0; k < n; ++k) {
+            if (!slots[k].ino)
+                continue;
+            entries[count].slot = slots[k];
+            memcpy(entries[count].name, block + name_offset(n, k), BWFS_DIR_NAME_SIZE);
+            entries[count].name[BWFS_DIR_NAME_SIZE - 1] = '\0';
+            count++;
+        }
+    }
+
+    if (r == 0)
+        r = block_map_reserve(dir, old, nblocks - 1);
+
+    // Cabeceras y ranuras en cero; los nombres viejos quedan sin referencia
+    if (r == 0) {
+        memset(block, 0, table_len(n));
+        for (int b = 0; b < nblocks && r == 0; ++b) {
+            int blk = block_map_get(dir, b);
+            if (blk < 0 || block_cache_write_meta(blk, 0, table_len(n), block) != 0)
+                r = -EIO;
+        }
+    }
+    for (int e = 0; e < count && r == 0; ++e)
+        r = insert_entry(dir, nblocks, entries[e].name, entries[e].slot.hash,
+                         entries[e].slot.ino - 1);
+
+    free(block);
+    free(entries);
+    return r;
+}
+
+int dir_lookup(const inode_t *dir, const char *name) {
+    return find_entry(dir, name, name_hash(name), NULL, NULL);
+}
+
+int dir_add(inode_t *dir, const char *name, int ino) {
+    size_t len = strlen(name);
+    if (len == 0)
+        return -EINVAL;
+    if (len >= BWFS_FILENAME)
+        return -ENAMETOOLONG;
+
+    int n = slots_per_block();
+    if (n < 1)
+        return -ENOSPC;
+
+    uint32_t h = name_hash(name);
+    int r = find_entry(dir, name, h, NULL, NULL);
+    if (r >= 0)
+        return -EEXIST;
+    if (r != -ENOENT)
+        return r;
+
+    // Se duplica al superar el 75% de las ranuras
+    int nblocks = dir_blocks(dir);
+    if ((uint64_t)(dir->size + 1) * 4 > (uint64_t)nblocks * n * 3) {
+        r = grow(dir);
+        if (r < 0)
+            return r;
+        nblocks = dir_blocks(dir);
+    }
+
+    r = insert_entry(dir, nblocks, name, h, ino);
+    if (r == 0)
+        dir->size++;
+    return r;
+}
+
+// Libera la ranura; solo se escribe el bloque que tenía la entrada
+int dir_remove(inode_t *dir, const char *name) {
+    int blk, k;
+    int ino = find_entry(dir, name, name_hash(name), &blk, &k);
+    if (ino < 0)
+        return ino;
+
+    dir_block_header_t hdr;
+    dir_slot_t empty = {0, 0};
+    if (block_cache_read(blk, 0, sizeof(hdr), (unsigned char *)&hdr) != 0)
+        return -EIO;
+    hdr.used--;
+    if (block_cache_write_meta(blk, slot_offset(k), sizeof(empty), (const unsigned char *)&empty) != 0 ||
+        block_cache_write_meta(blk, 0, sizeof(hdr), (const unsigned char *)&hdr) != 0)
+        return -EIO;
+
+    dir->size--;
+    return ino;
+}
+
+// Recorre solo los bloques de este directorio, desde la ranura global
+// `from` (bloque * ranuras por bloque + ranura); fn != 0 corta el listado
+int dir_list(const inode_t *dir, long from, dir_filler_t fn, void *ctx) {
+    int nblocks = dir_blocks(dir);
+    int n = slots_per_block();
+    size_t payload = pbm_payload_size();
+    unsigned char *block = malloc(payload);
+    if (!block)
+        return -ENOMEM;
+
+    int r = 0;
+    dir_slot_t *slots = (dir_slot_t *)(block + sizeof(dir_block_header_t));
+    for (int b = from < 0 ? 0 : from / n; b < nblocks; ++b) {
+        int blk = block_map_get(dir, b);
+        if (blk < 0 || block_cache_read(blk, 0, payload, block) != 0) {
+            r = -EIO;
+            break;
+        }
+        for (int k = (long)b * n < from ? from % n : 0; k < n; ++k) {
+            if (!slots[k].ino)
+                continue;
+            char *name = (char *)block + name_offset(n, k);
+            name[BWFS_DIR_NAME_SIZE - 1] = '\0';
+            if (fn(ctx, name, slots[k].ino - 1, (long)b * n + k + 1) != 0)
+                goto done;
+        }
+    }
+
+done:
+    free(block);
+    return r;
+}
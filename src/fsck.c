@@ -1,84 +1,878 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../includes/bwfs.h"
+#include "../includes/pbm.h"
+#include "../includes/utils.h"
+#include "../includes/bitmap.h"
+#include "../includes/block_map.h"
+#include "../includes/block_cache.h"
+#include "../includes/block_store.h"
+#include "../includes/dir.h"
+#include "../includes/journal.h"
+#include "../includes/checksum.h"
+#include "../includes/compress.h"
+#include "../includes/dedup.h"
+#include "../includes/metrics.h"
 
-void read_superblock(const char *path, superblock_t *sb) {
-    char filename[256];
-    snprintf(filename, sizeof(filename), "%s/block_000.pbm", path);
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        perror("Error abriendo superblock");
-        exit(1);
+// Chequeo completo: punteros de los inodos contra el área de datos y entre
+// sí (ningún bloque con dos dueños, salvo los de datos deduplicados, que
+// tienen que coincidir con sus referencias), árbol de directorios,
+// huérfanos, bitmaps contra lo que de verdad está en uso, cada cluster
+// comprimido descomprimido entero y cada archivo de bloque como PBM válido
+// y contra su CRC32C. Los inodos y los bloques se
+// recorren en paralelo.
+
+#define FSCK_MAX_THREADS 64
+#define FSCK_CHUNK 64           // inodos o bloques que toma un hilo por vez
+#define FSCK_MAX_REPORTS 20     // mensajes por tipo de problema; el resto solo se cuenta
+
+enum {
+    P_BAD_PTR,
+    P_DUP_BLOCK,
+    P_BAD_SIZE,
+    P_NO_ROOT,
+    P_BAD_DIR,
+    P_DANGLING,
+    P_EXTRA_LINK,
+    P_DIR_COUNT,
+    P_ORPHAN,
+    P_INODE_BITMAP,
+    P_BLOCK_LEAK,
+    P_BLOCK_UNMARKED,
+    P_BAD_PBM,
+    P_BAD_CRC,
+    P_DEDUP,
+    P_BAD_CLUSTER,
+    P_COUNT,
+};
+
+static const char *const problem_names[P_COUNT] = {
+    "punteros fuera del área de datos",
+    "bloques con más de un dueño",
+    "tamaños mayores que el mapa de bloques",
+    "raíz inválida",
+    "directorios ilegibles",
+    "entradas a inodos libres",
+    "entradas repetidas",
+    "cuentas de entradas",
+    "inodos huérfanos",
+    "bitmap de inodos",
+    "bloques ocupados sin dueño",
+    "bloques en uso marcados libres",
+    "bloques PBM inválidos",
+    "bloques con CRC distinto",
+    "referencias de bloques deduplicados",
+    "clusters comprimidos que no se descomprimen",
+};
+
+static const char *folder;
+static int repair = 0;
+static int threads = 1;
+static int has_clusters = 0;    // BWFS_FEATURE_COMPRESS
+static int has_dedup = 0;       // BWFS_FEATURE_DEDUP
+static const bwfs_geometry_t *g;
+static inode_t *inodes;
+static int inode_count;
+static uint32_t *owner;         // por bloque: inodo dueño + 1 (el menor que lo reclama)
+static uint32_t *uses;          // por bloque: punteros de datos de archivos (con dedup)
+static uint8_t *pinned;         // por bloque: índice o datos de un directorio (nunca compartido)
+static uint8_t *refs;           // por inodo: ya apareció en algún directorio
+
+static unsigned crc_checked = 0;    // bloques comparados con su CRC
+static unsigned crc_unknown = 0;    // bloques en uso sin CRC guardado
+static unsigned problems[P_COUNT];
+static unsigned fixed[P_COUNT];
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void problem(int kind, int was_fixed, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void problem(int kind, int was_fixed, const char *fmt, ...) {
+    unsigned n = __atomic_add_fetch(&problems[kind], 1, __ATOMIC_RELAXED);
+    if (was_fixed)
+        __atomic_add_fetch(&fixed[kind], 1, __ATOMIC_RELAXED);
+    if (n > FSCK_MAX_REPORTS)
+        return;
+
+    char msg[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    pthread_mutex_lock(&report_lock);
+    printf("%s %s%s\n", was_fixed ? "🔧" : "❌", msg, was_fixed ? " (corregido)" : "");
+    if (n == FSCK_MAX_REPORTS)
+        printf("   ... (los siguientes de este tipo solo se cuentan)\n");
+    pthread_mutex_unlock(&report_lock);
+}
+
+// Reparto de [0, total) entre los hilos, de a FSCK_CHUNK; cada hilo tiene
+// su propio buffer de `scratch` bytes
+typedef void (*fsck_task_t)(int index, void *scratch);
+
+typedef struct {
+    fsck_task_t fn;
+    int total;
+    int next;
+    size_t scratch;
+    int failed;
+} fsck_pool_t;
+
+static void *pool_worker(void *arg) {
+    fsck_pool_t *p = arg;
+    void *scratch = p->scratch ? malloc(p->scratch) : NULL;
+    if (p->scratch && !scratch) {
+        __atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
     }
 
-    fseek(f, -sizeof(superblock_t), SEEK_END);  // Se encuentra al final del bloque
-    fread(sb, sizeof(superblock_t), 1, f);
-    fclose(f);
+    for (;;) {
+        int first = __atomic_fetch_add(&p->next, FSCK_CHUNK, __ATOMIC_RELAXED);
+        if (first >= p->total)
+            break;
+        int last = first + FSCK_CHUNK < p->total ? first + FSCK_CHUNK : p->total;
+        for (int i = first; i < last; ++i)
+            p->fn(i, scratch);
+    }
+    free(scratch);
+    return NULL;
 }
 
-void read_bitmaps(const char *path, uint8_t *block_bitmap, uint8_t *inode_bitmap) {
-    char filename[256];
-    snprintf(filename, sizeof(filename), "%s/block_%03d.pbm", path, 1 + INODE_BLOCKS);
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        perror("Error leyendo bitmaps");
-        exit(1);
+static int parallel_for(int total, size_t scratch, fsck_task_t fn) {
+    fsck_pool_t pool = { fn, total, 0, scratch, 0 };
+    pthread_t tids[FSCK_MAX_THREADS];
+    int started = 0;
+
+    for (; started < threads - 1; ++started)
+        if (pthread_create(&tids[started], NULL, pool_worker, &pool) != 0)
+            break;
+    pool_worker(&pool);
+    for (int t = 0; t < started; ++t)
+        pthread_join(tids[t], NULL);
+
+    // Si ningún hilo consiguió su buffer quedó trabajo sin hacer
+    return pool.next < total ? -1 : 0;
+}
+
+static int data_block(uint32_t blk) {
+    return blk >= g->data_block_start && blk < g->total_blocks;
+}
+
+static int no_block(uint32_t blk) {
+    return blk == 0 || blk == (uint32_t)-1;
+}
+
+// Índice cubierto por un cluster comprimido: nunca el primero del cluster
+static int cluster_slot(long idx, uint32_t blk) {
+    return has_clusters && blk == BWFS_BLOCK_COMPRESSED && idx % BWFS_CLUSTER_BLOCKS != 0;
+}
+
+static void claim(int ino, uint32_t blk) {
+    uint32_t want = ino + 1;
+    uint32_t cur = __atomic_load_n(&owner[blk], __ATOMIC_RELAXED);
+    while ((cur == 0 || cur > want) &&
+           !__atomic_compare_exchange_n(&owner[blk], &cur, want, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+// --- Fase 1: cada bloque de datos se lo queda el inodo de menor número que
+// lo reclama; después cada inodo revisa sus punteros contra ese dueño. Con
+// dedup los datos de archivos pueden tener varios punteros: se cuentan.
+
+// `data`: puntero a datos de un archivo, que puede ser compartido
+static void claim_ptr(int ino, uint32_t blk, int data) {
+    claim(ino, blk);
+    if (!has_dedup)
+        return;
+    if (data)
+        __atomic_add_fetch(&uses[blk], 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&pinned[blk], 1, __ATOMIC_RELAXED);
+}
+
+static void claim_inode(int i, void *scratch) {
+    const inode_t *inode = &inodes[i];
+    if (!inode->used)
+        return;
+    int data = !inode->is_directory;
+
+    for (int k = 0; k < BWFS_DIRECT_BLOCKS; ++k)
+        if (data_block(inode->blocks[k]))
+            claim_ptr(i, inode->blocks[k], data);
+
+    if (inode->index_block <= 0 || !data_block(inode->index_block))
+        return;
+    claim_ptr(i, inode->index_block, 0);
+    uint32_t *ptrs = scratch;
+    if (block_cache_read(inode->index_block, 0, pbm_payload_size(), (unsigned char *)ptrs) != 0)
+        return;
+    for (size_t j = 0; j < BWFS_PTRS_PER_INDEX; ++j)
+        if (data_block(ptrs[j]))
+            claim_ptr(i, ptrs[j], data);
+}
+
+static void claim_all(void) {
+    memset(owner, 0, (size_t)g->total_blocks * sizeof(uint32_t));
+    if (has_dedup) {
+        memset(uses, 0, (size_t)g->total_blocks * sizeof(uint32_t));
+        memset(pinned, 0, g->total_blocks);
     }
+    parallel_for(inode_count, pbm_payload_size(), claim_inode);
+}
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    long offset = size - (BWFS_MAX_BLOCKS + BWFS_INODES);
-    if (offset < 0) {
-        fprintf(stderr, "❌ El archivo %s es demasiado pequeño para contener bitmaps\n", filename);
-        fclose(f);
+// 1 si el puntero hay que sacarlo del inodo. `data` como en claim_ptr.
+static int bad_pointer(int i, const char *what, long pos, uint32_t blk, int data) {
+    if (!data_block(blk)) {
+        problem(P_BAD_PTR, repair, "inodo %d: %s %ld apunta al bloque %u, fuera del área de datos",
+                i, what, pos, blk);
+        return 1;
+    }
+    uint32_t o = __atomic_load_n(&owner[blk], __ATOMIC_RELAXED);
+    int shared = has_dedup && data && !__atomic_load_n(&pinned[blk], __ATOMIC_RELAXED);
+    if (o != (uint32_t)i + 1 && !shared) {
+        problem(P_DUP_BLOCK, repair, "inodo %d: %s %ld usa el bloque %u, que ya es del inodo %u",
+                i, what, pos, blk, o - 1);
+        return 1;
+    }
+    return 0;
+}
+
+// Cada cluster comprimido se descomprime (cabecera, flujo LZ y CRC del
+// resultado). Al reparar, uno dañado queda como hueco: sus bloques se
+// liberan en la fase 4. Devuelve 1 si cambió el mapa del inodo.
+static int check_clusters(int i, inode_t *inode, unsigned char *out) {
+    size_t payload = pbm_payload_size();
+    long nblocks = ((uint64_t)inode->size + payload - 1) / payload;
+    if (nblocks > (long)BWFS_MAX_FILE_BLOCKS)
+        nblocks = BWFS_MAX_FILE_BLOCKS;
+
+    int changed = 0;
+    for (long c0 = 0; c0 < nblocks; c0 += BWFS_CLUSTER_BLOCKS) {
+        const char *why;
+        if (compress_check(inode, c0, out, &why) == 0)
+            continue;
+        problem(P_BAD_CLUSTER, repair, "inodo %d: cluster comprimido %s en el índice %ld", i, why, c0);
+        if (!repair)
+            continue;
+        int holes[BWFS_CLUSTER_BLOCKS];
+        int count = c0 + BWFS_CLUSTER_BLOCKS > (long)BWFS_MAX_FILE_BLOCKS ?
+                    (int)(BWFS_MAX_FILE_BLOCKS - c0) : BWFS_CLUSTER_BLOCKS;
+        for (int k = 0; k < count; ++k)
+            holes[k] = -1;
+        if (block_map_set_range(inode, c0, count, holes) == 0)
+            changed = 1;
+    }
+    return changed;
+}
+
+static void verify_inode(int i, void *scratch) {
+    inode_t *inode = &inodes[i];
+    if (!inode->used)
+        return;
+    int dirty = 0;
+    int data = !inode->is_directory;
+
+    for (int k = 0; k < BWFS_DIRECT_BLOCKS; ++k) {
+        uint32_t blk = inode->blocks[k];
+        if (no_block(blk) || cluster_slot(k, blk) || !bad_pointer(i, "puntero directo", k, blk, data))
+            continue;
+        if (repair) {
+            inode->blocks[k] = (uint32_t)-1;
+            dirty = 1;
+        }
+    }
+
+    if (inode->index_block != 0 && inode->index_block != -1) {
+        if (bad_pointer(i, "bloque índice", 0, (uint32_t)inode->index_block, 0)) {
+            // Sin índice propio se pierden los bloques que nombraba; si
+            // eran de este inodo quedan sin dueño y se liberan en la fase 4
+            if (repair) {
+                inode->index_block = 0;
+                dirty = 1;
+            }
+        } else {
+            uint32_t *ptrs = scratch;
+            int index_dirty = 0;
+            if (block_cache_read(inode->index_block, 0, pbm_payload_size(), (unsigned char *)ptrs) == 0) {
+                for (size_t j = 0; j < BWFS_PTRS_PER_INDEX; ++j) {
+                    if (no_block(ptrs[j]) || cluster_slot(BWFS_DIRECT_BLOCKS + (long)j, ptrs[j]) ||
+                        !bad_pointer(i, "puntero indirecto", (long)j, ptrs[j], data))
+                        continue;
+                    ptrs[j] = 0;
+                    index_dirty = 1;
+                }
+            }
+            if (repair && index_dirty)
+                block_cache_write_meta(inode->index_block, 0, pbm_payload_size(),
+                                       (const unsigned char *)ptrs);
+        }
+    }
+
+    uint64_t max_size = (uint64_t)BWFS_MAX_FILE_BLOCKS * pbm_payload_size();
+    if (!inode->is_directory && inode->size > max_size) {
+        problem(P_BAD_SIZE, repair, "inodo %d: %u bytes, el máximo es %llu", i, inode->size,
+                (unsigned long long)max_size);
+        if (repair) {
+            inode->size = (uint32_t)max_size;
+            dirty = 1;
+        }
+    }
+
+    if (has_clusters && data && check_clusters(i, inode, scratch))
+        dirty = 1;
+
+    if (dirty)
+        save_inode(folder, i, inode);
+}
+
+// --- Fase 2: recorrido del árbol desde la raíz. Cada inodo puede aparecer
+// en un solo directorio (no hay enlaces duros); las entradas a inodos
+// libres o repetidas se borran al reparar
+
+typedef struct {
+    int dir;
+    uint32_t entries;
+    char (*drop)[BWFS_DIR_NAME_SIZE];   // nombres a borrar al reparar
+    int drops;
+    int drop_cap;
+    int *queue;                         // directorios por recorrer
+    int *queue_len;
+} walk_ctx_t;
+
+static void drop_entry(walk_ctx_t *w, const char *name) {
+    if (!repair)
+        return;
+    if (w->drops == w->drop_cap) {
+        int cap = w->drop_cap ? w->drop_cap * 2 : 16;
+        void *p = realloc(w->drop, (size_t)cap * BWFS_DIR_NAME_SIZE);
+        if (!p)
+            return;
+        w->drop = p;
+        w->drop_cap = cap;
+    }
+    snprintf(w->drop[w->drops++], BWFS_DIR_NAME_SIZE, "%s", name);
+}
+
+static int walk_entry(void *ctx, const char *name, int ino, long next) {
+    (void)next;
+    walk_ctx_t *w = ctx;
+    w->entries++;
+
+    if (ino < 0 || ino >= inode_count || !inodes[ino].used) {
+        problem(P_DANGLING, repair, "directorio %d: \"%s\" apunta al inodo libre %d", w->dir, name, ino);
+        drop_entry(w, name);
+        return 0;
+    }
+    if (refs[ino]) {
+        problem(P_EXTRA_LINK, repair, "directorio %d: \"%s\" repite el inodo %d, que ya tiene entrada",
+                w->dir, name, ino);
+        drop_entry(w, name);
+        return 0;
+    }
+
+    refs[ino] = 1;
+    if (inodes[ino].is_directory)
+        w->queue[(*w->queue_len)++] = ino;
+    return 0;
+}
+
+static void walk_tree(int root) {
+    int *queue = malloc((size_t)inode_count * sizeof(int));
+    if (!queue) {
+        perror("❌ Sin memoria para recorrer el árbol");
         exit(1);
     }
+    int len = 0;
+    refs[root] = 1;
+    queue[len++] = root;
+
+    walk_ctx_t w = {0};
+    w.queue = queue;
+    w.queue_len = &len;
+    for (int q = 0; q < len; ++q) {
+        inode_t *dir = &inodes[queue[q]];
+        w.dir = queue[q];
+        w.entries = 0;
+        w.drops = 0;
 
-    fseek(f, offset, SEEK_SET);
-    fread(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
-    fread(inode_bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    fclose(f);
+        if (dir_list(dir, 0, walk_entry, &w) != 0) {
+            problem(P_BAD_DIR, 0, "directorio %d: no se pudo leer su tabla de entradas", w.dir);
+            continue;
+        }
+
+        // dir_remove descuenta cada entrada que borra del size del directorio
+        uint32_t kept = w.entries;
+        for (int k = 0; k < w.drops; ++k)
+            if (dir_remove(dir, w.drop[k]) >= 0)
+                kept--;
+        if (kept != w.entries)
+            save_inode(folder, w.dir, dir);
+        if (dir->size != kept) {
+            problem(P_DIR_COUNT, repair, "directorio %d: dice tener %u entradas y tiene %u",
+                    w.dir, dir->size, kept);
+            if (repair) {
+                dir->size = kept;
+                save_inode(folder, w.dir, dir);
+            }
+        }
+    }
+    free(w.drop);
+    free(queue);
 }
 
+// --- Fase 3: inodos en uso que ningún directorio nombra (p. ej. archivos
+// borrados mientras seguían abiertos cuando se cortó el montaje)
 
-void print_bitmap(const char *label, const uint8_t *bitmap, int size) {
-    printf("🧾 %s:\n", label);
-    for (int i = 0; i < size; ++i) {
-        if (bitmap[i])
-            printf(" [%d]", i);
+static int free_orphans(int root) {
+    int freed = 0;
+    for (int i = 0; i < inode_count; ++i) {
+        if (!inodes[i].used || refs[i] || i == root)
+            continue;
+        problem(P_ORPHAN, repair, "inodo %d (%s, %u bytes) no aparece en ningún directorio", i,
+                inodes[i].is_directory ? "directorio" : "archivo", inodes[i].size);
+        if (repair) {
+            memset(&inodes[i], 0, sizeof(inode_t));
+            save_inode(folder, i, &inodes[i]);
+            freed++;
+        }
     }
-    printf("\n");
+    return freed;
+}
+
+// --- Fase 4: bitmaps contra inode_t.used y contra los dueños de la fase 1
+
+static void check_bitmaps(void) {
+    for (uint32_t i = 0; i < g->total_inodes; ++i) {
+        int used = (int)i < inode_count && inodes[i].used;
+        if (bitmap_test(1, i) == used)
+            continue;
+        problem(P_INODE_BITMAP, repair, "inodo %u: el bitmap lo marca %s y el inodo está %s", i,
+                used ? "libre" : "ocupado", used ? "en uso" : "libre");
+        if (repair)
+            bitmap_restore(1, i, used);
+    }
+
+    for (uint32_t b = g->data_block_start; b < g->total_blocks; ++b) {
+        int owned = owner[b] != 0;
+        int bit = bitmap_test(0, b);
+        if (bit && !owned)
+            problem(P_BLOCK_LEAK, repair, "bloque %u: ocupado en el bitmap y ningún inodo lo usa", b);
+        else if (!bit && owned)
+            problem(P_BLOCK_UNMARKED, repair, "bloque %u: es del inodo %u y el bitmap lo marca libre",
+                    b, owner[b] - 1);
+        else
+            continue;
+        if (repair)
+            bitmap_restore(0, b, owned);
+    }
+}
+
+// --- Fase 4b: referencias de dedup contra los punteros contados en la
+// fase 1. Solo los datos de archivos pueden tener huella: un bloque índice
+// o de directorio con huella podría terminar compartido.
+
+static void check_dedup(void) {
+    for (uint32_t b = g->data_block_start; b < g->total_blocks; ++b) {
+        int data = !pinned[b] && uses[b] > 0;
+        uint32_t want = data ? uses[b] - 1 : 0;
+        uint32_t refs = dedup_refs(b);
+        uint32_t fp = dedup_fingerprint(b);
+        if (refs != want)
+            problem(P_DEDUP, repair, "bloque %u: %u referencias extra en la tabla y %u en los inodos",
+                    b, refs, want);
+        else if (fp && !data)
+            problem(P_DEDUP, repair, "bloque %u: tiene huella y no es un bloque de datos de archivo", b);
+        else
+            continue;
+        if (repair)
+            dedup_restore(b, want, data ? fp : 0);
+    }
+}
+
+// --- Fase 5: cada archivo de bloque, en paralelo. P4: cabecera exacta y
+// tamaño; P1: cabecera y exactamente ancho x alto dígitos antes de los
+// metadatos. En los bloques de metadatos de volúmenes anteriores los
+// metadatos pisan el final de la imagen P1 (meta_offset fijo): ahí solo se
+// miran la cabecera y los píxeles antes de meta_offset. Un bloque de datos
+// que falta es válido (volumen perezoso).
+// Los bloques de datos legibles se comparan además con su CRC.
+
+// `clipped`: el texto se cortó en meta_offset y la imagen puede seguir debajo
+static const char *check_p1(const char *text, size_t len, int clipped) {
+    if (len < 2 || text[0] != 'P' || text[1] != '1')
+        return "no empieza con P1";
+
+    size_t pos = 2;
+    uint32_t dims[2];
+    for (int k = 0; k < 2;) {
+        while (pos < len && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' ||
+                             text[pos] == '\n'))
+            pos++;
+        if (pos < len && text[pos] == '#') {
+            while (pos < len && text[pos] != '\n')
+                pos++;
+            continue;
+        }
+        if (pos >= len || text[pos] < '0' || text[pos] > '9')
+            return "cabecera inválida";
+        uint32_t v = 0;
+        while (pos < len && text[pos] >= '0' && text[pos] <= '9')
+            v = v * 10 + (text[pos++] - '0');
+        dims[k++] = v;
+    }
+    if (dims[0] != g->image_width || dims[1] != g->image_height)
+        return "dimensiones distintas a las del volumen";
+
+    size_t want = (size_t)dims[0] * dims[1], got = 0;
+    for (; pos < len && got < want; ++pos) {
+        char c = text[pos];
+        if (c == '0' || c == '1')
+            got++;
+        else if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+            return "carácter inválido entre los píxeles";
+    }
+    return got < want && !clipped ? "imagen truncada" : NULL;
+}
+
+// Un CRC distinto en un bloque en uso se acepta al reparar (los datos ya
+// no se pueden recuperar y así se vuelven a leer); en uno libre se descarta
+static void scrub_block(int b, unsigned char *payload) {
+    uint32_t want = checksum_get(b);
+    int owned = __atomic_load_n(&owner[b], __ATOMIC_RELAXED) != 0;
+    if (!want && !owned)
+        return;
+    if (!want && !repair) {
+        __atomic_add_fetch(&crc_unknown, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (block_store_read(b, 0, pbm_payload_size(), payload) != 0)
+        return;
+
+    uint32_t got = checksum_of(payload);
+    __atomic_add_fetch(&crc_checked, 1, __ATOMIC_RELAXED);
+    if (want && got != want)
+        problem(P_BAD_CRC, repair, "bloque %d: CRC %08x, se esperaba %08x%s", b, got, want,
+                owned ? "" : " (libre)");
+    if (repair && got != want)
+        checksum_set(b, owned ? got : 0);
+}
+
+static void check_block_file(int b, void *scratch) {
+    char path[256];
+    block_path(path, sizeof(path), folder, b);
+    int meta = (uint32_t)b < g->data_block_start;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0) {
+        if (errno != ENOENT || meta)
+            problem(P_BAD_PBM, 0, "bloque %d: %s", b, strerror(errno));
+        return;
+    }
+
+    int format = pbm_get_format();
+    const char *why = NULL;
+    char *buf = scratch;
+    buf[0] = buf[1] = '\0';
+    if (fstat(fd, &st) != 0) {
+        why = strerror(errno);
+    } else if (format == BWFS_FORMAT_P4) {
+        char header[PBM_HEADER_MAX];
+        int hlen = pbm_header(header, sizeof(header), format, b);
+        if (pread(fd, buf, hlen, 0) != hlen || memcmp(buf, header, hlen) != 0)
+            why = buf[0] == 'P' && buf[1] == '1' ? "formato P1 en un volumen P4" : "cabecera P4 inválida";
+        else if ((size_t)st.st_size < (size_t)hlen + pbm_payload_size())
+            why = "imagen truncada";
+    } else {
+        // Los metadatos binarios que siguen a la imagen no se miran
+        size_t cap = pbm_p1_text_size() + 256;
+        int clipped = meta && g->meta_offset && g->meta_offset < cap;
+        if (clipped)
+            cap = g->meta_offset;
+        ssize_t n = pread(fd, buf, cap, 0);
+        if (n < 0)
+            why = strerror(errno);
+        else if (n >= 2 && buf[0] == 'P' && buf[1] == '4')
+            why = "formato P4 en un volumen P1";
+        else
+            why = check_p1(buf, n, clipped && (size_t)n == cap);
+    }
+    close(fd);
+    if (!why) {
+        if (!meta && checksum_enabled())
+            scrub_block(b, scratch);
+        return;
+    }
+
+    // Solo se rehacen bloques de datos que nadie usa: uno con dueño perdería
+    // lo que quedara legible, y los de metadatos no se pueden inventar
+    int fixable = repair && !meta && __atomic_load_n(&owner[b], __ATOMIC_RELAXED) == 0;
+    if (fixable && pbm_write_blank(path, format, b) != 0)
+        fixable = 0;
+    if (fixable)
+        checksum_set(b, 0);
+    problem(P_BAD_PBM, fixable, "bloque %d: %s%s", b, why,
+            !fixable && !meta && owner[b] ? " (es de un inodo: revisar a mano)" : "");
+}
+
+// --- Journal: en modo chequeo solo se cuentan las transacciones pendientes
+
+static void count_record(const journal_rec_t *rec, const void *data, void *ctx) {
+    (void)rec;
+    (void)data;
+    (void)ctx;
+}
+
+static int finish_repair(superblock_t *sb, int consistent) {
+    int r = 0;
+    if (block_cache_checkpoint() != 0 || block_cache_flush() != 0)
+        r = -1;
+    checksum_sync_begin();
+    if (r != 0 || block_store_sync() != 0 || inode_table_sync(folder) != 0 ||
+        bitmap_sync(folder) != 0 || dedup_sync() != 0 || checksum_sync() != 0) {
+        fprintf(stderr, "❌ No se pudieron escribir las correcciones\n");
+        return -1;
+    }
+
+    // Lo que tenía el journal ya quedó aplicado y escrito
+    if (journal_open(folder) == 0) {
+        r = journal_reset();
+        journal_close();
+    }
+
+    if (consistent)
+        sb->state |= BWFS_STATE_CLEAN;
+    else
+        sb->state &= ~BWFS_STATE_CLEAN;
+    if (r != 0 || update_superblock(folder, sb) != 0 || volume_sync(folder) != 0) {
+        fprintf(stderr, "❌ No se pudo actualizar el superbloque\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(void) {
+    printf("Uso: fsck.bwfs [-r|--repair] [-f|--force] [-j hilos] <carpeta_fs>\n");
+    printf("  -r  corrige lo que encuentre: rehace los bitmaps, libera huérfanos\n");
+    printf("      y quita punteros y entradas inválidas\n");
+    printf("  -f  revisa a fondo aunque el volumen se haya desmontado limpio\n");
+    printf("  -j  hilos para revisar inodos y bloques (por omisión, uno por CPU)\n");
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Uso: fsck.bwfs <carpeta_fs>\n");
+    static const struct option long_opts[] = {
+        { "repair", no_argument, NULL, 'r' },
+        { "force", no_argument, NULL, 'f' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int force = 0, opt;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (int)cpus : 1;
+
+    while ((opt = getopt_long(argc, argv, "rfj:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            repair = 1;
+            break;
+        case 'f':
+            force = 1;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
         return 1;
     }
+    if (threads < 1)
+        threads = 1;
+    if (threads > FSCK_MAX_THREADS)
+        threads = FSCK_MAX_THREADS;
 
-    const char *folder = argv[1];
+    folder = argv[optind];
     superblock_t sb;
-    uint8_t block_bitmap[BWFS_MAX_BLOCKS] = {0};
-    uint8_t inode_bitmap[BWFS_INODES] = {0};
-
-    read_superblock(folder, &sb);
 
-    if (sb.magic != BWFS_MAGIC) {
+    if (read_superblock(folder, &sb) != 0) {
         printf("❌ Magic inválido. No es un sistema BWFS válido.\n");
         return 1;
     }
 
+    bwfs_geometry_t geometry;
+    geometry_from_superblock(&sb, &geometry);
+    volume_set_geometry(&geometry);
+    pbm_set_format(sb.block_format);
+    g = volume_geometry();
+
     printf("✅ Superblock OK\n");
     printf("  Total de bloques: %u\n", sb.total_blocks);
     printf("  Bloques de datos desde: %u\n", sb.data_block_start);
     printf("  Tabla de inodos desde bloque: %u\n", sb.inode_table_start);
+    printf("  Formato de bloques: %s\n", sb.block_format == BWFS_FORMAT_P4 ? "P4" : "P1");
+    printf("  Inodos: %u (%u por bloque)\n", geometry.total_inodes, geometry.inodes_per_block);
+    printf("  Imagen por bloque: %ux%u\n", geometry.image_width, geometry.image_height);
+    if (geometry.shard_size)
+        printf("  Subcarpetas de %u bloques\n", geometry.shard_size);
+    if (sb.features & BWFS_FEATURE_DIRS)
+        printf("  Directorios jerárquicos, raíz en el inodo %u\n", sb.root_inode);
+    else
+        printf("  Espacio de nombres plano (se convierte al montar)\n");
+    has_clusters = (sb.features & BWFS_FEATURE_COMPRESS) != 0;
+    if (has_clusters)
+        printf("  Datos comprimidos por clusters de %d bloques\n", BWFS_CLUSTER_BLOCKS);
+    has_dedup = (sb.features & BWFS_FEATURE_DEDUP) != 0;
+    if (has_dedup)
+        printf("  Bloques deduplicados, con referencias en %s\n", BWFS_DEDUP_FILE);
 
-    read_bitmaps(folder, block_bitmap, inode_bitmap);
-    print_bitmap("Bloques usados", block_bitmap, BWFS_MAX_BLOCKS);
-    print_bitmap("Inodos usados", inode_bitmap, BWFS_INODES);
+    char journal_path[512];
+    struct stat st;
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", folder, BWFS_JOURNAL_FILE);
+    int journal_pending = stat(journal_path, &st) == 0 && st.st_size > 0;
 
-    printf("✅ fsck finalizado sin errores (fase básica).\n");
-    return 0;
+    if ((sb.state & BWFS_STATE_CLEAN) && !journal_pending && !force) {
+        printf("✅ Desmontado limpio: no hace falta revisar a fondo (-f para forzarlo)\n");
+        return 0;
+    }
+    printf("🔍 %s, revisando a fondo con %d hilos%s\n",
+           force ? "Revisión forzada" : "El volumen no se desmontó limpio", threads,
+           repair ? " (modo reparación)" : "");
+    uint64_t start = metrics_now();
+
+    if (block_store_init(folder) != 0 ||
+        block_cache_init((size_t)BWFS_CACHE_DEFAULT_MB * 1024 * 1024) != 0 ||
+        inode_table_init(folder) < 0 || bitmap_init(folder, g) != 0) {
+        fprintf(stderr, "❌ No se pudo cargar el volumen\n");
+        return 1;
+    }
+    // Los CRC se revisan en la fase 5; la caché no descarta bloques dañados
+    // (un índice ilegible haría parecer libres a sus bloques)
+    checksum_set_verify(BWFS_VERIFY_OFF);
+    if ((sb.features & BWFS_FEATURE_CRC) && checksum_init(folder, g) != 0)
+        printf("⚠️  El volumen no tiene la tabla de CRC: el próximo montaje la crea vacía\n");
+    // Sin la tabla de dedup las referencias se rehacen con lo que cuente la fase 1
+    if (has_dedup && dedup_init(folder, g, 0) != 0) {
+        if (repair && dedup_create(folder, g) == 0 && dedup_init(folder, g, 0) == 0)
+            printf("🔧 Tabla de deduplicación recreada: las referencias salen de los inodos\n");
+        else
+            printf("⚠️  El volumen no tiene la tabla de deduplicación (-r la rehace)\n");
+    }
+
+    if (journal_pending) {
+        if (repair) {
+            int n = journal_replay(folder, journal_apply, (void *)folder);
+            if (n < 0) {
+                fprintf(stderr, "❌ No se pudo rehacer el journal\n");
+                return 1;
+            }
+            printf("🔁 Journal: %d transacciones rehechas\n", n);
+        } else {
+            int n = journal_replay(folder, count_record, NULL);
+            if (n > 0)
+                printf("⚠️  Journal: %d transacciones sin aplicar; se rehacen al montar o con -r "
+                       "y esta revisión no las ve\n", n);
+        }
+    }
+
+    inodes = inode_table_get(&inode_count);
+    owner = calloc(g->total_blocks, sizeof(uint32_t));
+    refs = calloc(inode_count > 0 ? inode_count : 1, 1);
+    if (has_dedup) {
+        uses = calloc(g->total_blocks, sizeof(uint32_t));
+        pinned = calloc(g->total_blocks, 1);
+    }
+    if (!inodes || !owner || !refs || (has_dedup && (!uses || !pinned))) {
+        perror("❌ Sin memoria para la revisión");
+        return 1;
+    }
+
+    // Fase 1
+    claim_all();
+    size_t verify_scratch = pbm_payload_size() * (has_clusters ? BWFS_CLUSTER_BLOCKS : 1);
+    if (parallel_for(inode_count, verify_scratch, verify_inode) != 0) {
+        perror("❌ Sin memoria para revisar los inodos");
+        return 1;
+    }
+    if (repair && (problems[P_BAD_PTR] || problems[P_DUP_BLOCK] || problems[P_BAD_CLUSTER]))
+        claim_all();
+
+    // Fases 2 y 3; sin directorios (volumen plano) no hay árbol que recorrer
+    int root = sb.root_inode;
+    if (sb.features & BWFS_FEATURE_DIRS) {
+        if (root < 0 || root >= inode_count || !inodes[root].used || !inodes[root].is_directory) {
+            problem(P_NO_ROOT, 0, "el inodo raíz %d no es un directorio en uso", root);
+        } else {
+            walk_tree(root);
+            if (free_orphans(root) > 0)
+                claim_all();
+        }
+    }
+
+    // Fases 4 y 5
+    check_bitmaps();
+    if (has_dedup)
+        check_dedup();
+    if (parallel_for(g->total_blocks, pbm_p1_text_size() + 256, check_block_file) != 0) {
+        perror("❌ Sin memoria para revisar los bloques");
+        return 1;
+    }
+
+    unsigned total = 0, total_fixed = 0;
+    for (int k = 0; k < P_COUNT; ++k) {
+        total += problems[k];
+        total_fixed += fixed[k];
+    }
+
+    int files = 0, dirs = 0;
+    for (int i = 0; i < inode_count; ++i)
+        if (inodes[i].used && inodes[i].is_directory)
+            dirs++;
+        else if (inodes[i].used)
+            files++;
+    uint32_t used_blocks = 0, shared_blocks = 0;
+    for (uint32_t b = g->data_block_start; b < g->total_blocks; ++b) {
+        used_blocks += owner[b] != 0;
+        shared_blocks += has_dedup && uses[b] > 1;
+    }
+
+    int consistent = total == total_fixed;
+    if (repair && finish_repair(&sb, consistent) != 0)
+        return 1;
+
+    printf("📊 %d archivos, %d directorios, %u de %u bloques de datos en uso\n", files, dirs,
+           used_blocks, g->total_blocks - g->data_block_start);
+    for (int k = 0; k < P_COUNT; ++k)
+        if (problems[k])
+            printf("  %s: %u%s\n", problem_names[k], problems[k],
+                   fixed[k] ? (fixed[k] == problems[k] ? " (corregidos)" : " (algunos corregidos)") : "");
+    if (shared_blocks)
+        printf("🔗 %u bloques de datos compartidos entre varios punteros\n", shared_blocks);
+    if (checksum_enabled())
+        printf("🧮 CRC32C (%s): %u bloques verificados%s\n", crc32c_impl_name(), crc_checked,
+               crc_unknown ? ", algunos en uso todavía sin CRC (-r los calcula)" : "");
+    printf("⏱️  %.2f s\n", (metrics_now() - start) / 1e9);
+
+    if (total == 0)
+        printf("✅ fsck finalizado sin errores.\n");
+    else if (consistent)
+        printf("🔧 fsck corrigió %u problemas; el volumen quedó consistente.\n", total);
+    else
+        printf("❌ fsck encontró %u problemas%s.\n", total,
+               repair ? " y algunos no se pueden corregir" : " (-r para corregirlos)");
+    return consistent ? 0 : 1;
 }
@@ -1,793 +1,1940 @@
 #define FUSE_USE_VERSION 31
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
-#include <sys/types.h>  
+#include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <linux/stat.h>
-#include <fuse3/fuse.h>
-#include <fcntl.h> 
+#include <linux/fs.h>
+#include <fuse3/fuse_lowlevel.h>
+#include <fcntl.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "../includes/fuse_ops.h"
 #include "../includes/bwfs.h"
 #include "../includes/utils.h"
+#include "../includes/pbm.h"
+#include "../includes/block_store.h"
+#include "../includes/block_cache.h"
+#include "../includes/dir.h"
+#include "../includes/bitmap.h"
+#include "../includes/block_map.h"
+#include "../includes/journal.h"
+#include "../includes/checksum.h"
+#include "../includes/compress.h"
+#include "../includes/dedup.h"
+#include "../includes/log.h"
+#include "../includes/metrics.h"
 
 
 static const char *bwfs_folder = NULL;
+static superblock_t volume_sb;          // leído una vez en bwfs_init
+static int root_ino = -1;
+
+// Concurrencia (libfuse atiende cada petición en un hilo de su pool, y las
+// lecturas lentas terminan en el pool de lectura):
+//  - ns_lock: de escritura en create/mkdir/unlink/rmdir/rename, de lectura en
+//    el resto. Protege el contenido de los directorios (solo cambia con el
+//    de escritura, así las búsquedas no bloquean el inodo del directorio).
+//  - inode_rdlock/inode_wrlock: contenido de cada inodo (tamaño, mapa de bloques).
+//  - lookup_lock: cuentas de lookup del kernel y estado por inodo en memoria.
+//  - el asignador, la caché y el block store tienen sus propios locks.
+// Orden: ns_lock → inodo → lookup_lock/asignador/caché → block store.
+//
+// Un inodo no se libera mientras el kernel lo conozca (cuenta de lookup
+// distinta de 0): unlink/rmdir solo sacan la entrada y el último forget
+// libera el inodo. Así un número de inodo recibido del kernel siempre
+// apunta al archivo que el kernel cree.
+//
+// Cada operación es una transacción del journal entre ns_*lock y
+// ns_unlock: se encola antes de soltar ns_lock, así un checkpoint (con el
+// de escritura) nunca ve cambios en memoria que no estén en el journal.
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Lleva a su lugar todo lo que está en el journal y lo vacía. Con ns_lock
+// de escritura tomado, o antes de atender operaciones.
+static int checkpoint(void) {
+    if (journal_commit(1) != 0 || block_cache_checkpoint() != 0)
+        return -1;
+    // Los CRC que se guardan son solo los de bloques que block_store_sync
+    // deja en disco
+    checksum_sync_begin();
+    if (block_store_sync() != 0 || inode_table_sync(bwfs_folder) != 0 ||
+        bitmap_sync(bwfs_folder) != 0 || dedup_sync() != 0 || checksum_sync() != 0 ||
+        volume_sync(bwfs_folder) != 0)
+        return -1;
+    return journal_reset();
+}
 
-void *bwfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
-    (void) conn;
-    cfg->kernel_cache = 0;
-
-    const struct bwfs_config *conf = fuse_get_context()->private_data;
-    bwfs_folder = conf->folder;
+// Marca de desmontaje limpio: se borra al montar, antes del primer
+// checkpoint, y vuelve cuando el último terminó bien
+static int set_clean(int clean) {
+    if (volume_sb.magic != BWFS_MAGIC)
+        return 0;   // volumen sin superbloque: no hay dónde guardarla
+    if (clean)
+        volume_sb.state |= BWFS_STATE_CLEAN;
+    else
+        volume_sb.state &= ~BWFS_STATE_CLEAN;
+    if (update_superblock(bwfs_folder, &volume_sb) != 0 || volume_sync(bwfs_folder) != 0)
+        return -1;
+    return 0;
+}
 
-    printf("BWFS montado correctamente\n");
-    return NULL;
+static void maybe_checkpoint(void) {
+    if (!journal_needs_checkpoint())
+        return;
+    pthread_rwlock_wrlock(&ns_lock);
+    if (journal_needs_checkpoint() && checkpoint() != 0)
+        LOG_ERROR("❌ Falló el checkpoint del journal");
+    pthread_rwlock_unlock(&ns_lock);
 }
 
+static void ns_rdlock(void) {
+    pthread_rwlock_rdlock(&ns_lock);
+    journal_begin();
+}
 
-int bwfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
-    (void) fi;
-    memset(stbuf, 0, sizeof(struct stat));
+static void ns_wrlock(void) {
+    pthread_rwlock_wrlock(&ns_lock);
+    journal_begin();
+}
 
-    if (!bwfs_folder) {
-        fprintf(stderr, "Error: bwfs_folder es NULL en getattr\n");
-        return -EIO;
+// Las operaciones que modificaron algo escriben el journal sin fdatasync
+// (group commit: una sola escritura para todos los hilos que terminan
+// juntos); fsync es el que espera a que sea durable
+static void ns_unlock(void) {
+    int logged = journal_end();
+    pthread_rwlock_unlock(&ns_lock);
+    if (logged) {
+        journal_commit(0);
+        maybe_checkpoint();
     }
+}
 
-    if (strcmp(path, "/") == 0) {
-        stbuf->st_mode = S_IFDIR | 0755;
-        stbuf->st_nlink = 2;
-        return 0;
+// Bloques que la operación sacó del mapa (clusters y copias de dedup): se
+// liberan en una transacción aparte, recién con la anterior ya durable
+static void release_deferred(void) {
+    if (!block_map_deferred())
+        return;
+    if (journal_commit(1) != 0) {
+        LOG_WARN("⚠️ Journal sin fdatasync: los bloques reemplazados quedan ocupados");
+        return;
     }
+    ns_rdlock();
+    block_map_release_deferred();
+    ns_unlock();
+}
 
-    // Extraer nombre sin slash
-    const char *name = path + 1;
-
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
-
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            if (inodes[i].is_directory) {
-                stbuf->st_mode = S_IFDIR | 0755;
-                stbuf->st_nlink = 2;
-            } else {
-                stbuf->st_mode = S_IFREG | 0644;
-                stbuf->st_nlink = 1;
-                stbuf->st_size = inodes[i].size;
-            }
+// Estado por apertura, guardado en fi->fh entre open/create y release
+typedef struct {
+    int ino;                // inodo ya resuelto: read/write no buscan por nombre
+    int flags;              // flags de apertura
+    pthread_mutex_t lock;   // pos, last_block y ra_*: los lectores del mismo
+                            // handle corren en paralelo con el lock de lectura
+    int last_block;         // último índice de bloque accedido
+    int ra_window;          // bloques a leer por adelantado (0 = sin readahead)
+    int ra_next;            // primer índice que todavía no se pidió al prefetch
+    int write_first;        // índices escritos por esta apertura (-1 = ninguno):
+    int write_last;         // se comprimen y deduplican al cerrarla
+    char *snapshot;         // archivos de control: contenido fijado al abrir
+    size_t snapshot_len;
+} bwfs_handle_t;
+
+// Ventana máxima de readahead: un cuarto de la caché, hasta BWFS_READAHEAD_MAX
+static int ra_max = BWFS_READAHEAD_MAX;
+
+// Estado por inodo que solo vive mientras el volumen está montado
+typedef struct {
+    uint64_t nlookup;       // referencias del kernel (lookup - forget)
+    uint32_t generation;    // sube cada vez que el inodo se libera
+    int orphan;             // sin entrada en ningún directorio: se libera en el último forget
+    uint32_t seen_mtime;    // mtime y tamaño en la última apertura (auto_cache)
+    uint32_t seen_size;
+} ino_state_t;
+
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+static ino_state_t *ino_state = NULL;
+static int ino_count = 0;
+
+// Timeouts de las respuestas; los fija setup_kernel_cache
+static double attr_timeout = BWFS_DEFAULT_TIMEOUT;
+static double entry_timeout = BWFS_DEFAULT_TIMEOUT;
+static double negative_timeout = 0;
+
+// Caché del kernel (mount -k/-K)
+static int kernel_caching = 0;
+static int auto_caching = 0;
+
+// Lecturas en espera de un hilo del pool de lectura
+typedef struct {
+    fuse_req_t req;
+    int ino;
+    size_t size;
+    off_t off;
+    bwfs_handle_t *h;
+    uint64_t t0;            // para la latencia: se mide hasta la respuesta
+} read_task_t;
+
+static pthread_mutex_t rd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rd_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t rd_threads[BWFS_READ_WORKERS];
+static int rd_nthreads = 0;
+static int rd_running = 0;
+static read_task_t rd_queue[BWFS_READ_QUEUE];
+static int rd_head = 0, rd_len = 0;
+
+// Números de inodo del kernel: la raíz es FUSE_ROOT_ID y el resto se
+// corre en 2 (el 0 no es válido y el 1 es de la raíz)
+static fuse_ino_t to_fuse(int ino) {
+    return ino == root_ino ? FUSE_ROOT_ID : (fuse_ino_t)ino + 2;
+}
 
-            stbuf->st_ctime = inodes[i].created_at;
-            stbuf->st_mtime = inodes[i].modified_at;
-            stbuf->st_atime = inodes[i].modified_at;
-            return 0;
-        }
-    }
+// Directorio de control (BWFS_CTL_NAME en la raíz): sus números de inodo
+// siguen a los de la tabla. Solo existe en memoria y no aparece al listar
+// la raíz.
+enum { CTL_DIR, CTL_STATS, CTL_LOG, CTL_COUNT };
+static const char *const ctl_names[CTL_COUNT] = { BWFS_CTL_NAME, "stats", "log" };
+static time_t mounted_at;
 
-    return -ENOENT;
+static fuse_ino_t ctl_ino(int k) {
+    return (fuse_ino_t)ino_count + 2 + k;
 }
 
-int bwfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-    off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+static int ctl_of(fuse_ino_t ino) {
+    return ino >= ctl_ino(0) && ino < ctl_ino(CTL_COUNT) ? (int)(ino - ctl_ino(0)) : -1;
+}
 
-    (void)offset;
-    (void)fi;
-    (void)flags;
+static int from_fuse(fuse_ino_t ino) {
+    if (ctl_of(ino) >= 0)
+        return -EACCES;     // solo lectura: nada de lo que pide un inodo real vale acá
+    if (ino == FUSE_ROOT_ID)
+        return root_ino >= 0 ? root_ino : -EIO;
+    if (ino < 2 || ino - 2 >= (fuse_ino_t)ino_count || (int)(ino - 2) == root_ino)
+        return -ESTALE;
+    return (int)(ino - 2);
+}
 
-    if (!bwfs_folder) {
-        fprintf(stderr, "❌ Error: bwfs_folder es NULL en readdir\n");
-        return -EIO;
-    }
+static bwfs_handle_t *handle_of(struct fuse_file_info *fi) {
+    return fi ? (bwfs_handle_t *)(uintptr_t)fi->fh : NULL;
+}
 
-    if (strcmp(path, "/") != 0)
-        return -ENOENT;
+static int handle_new(struct fuse_file_info *fi, int ino) {
+    bwfs_handle_t *h = calloc(1, sizeof(bwfs_handle_t));
+    if (!h)
+        return -ENOMEM;
+
+    pthread_mutex_init(&h->lock, NULL);
+    h->ino = ino;
+    h->flags = fi->flags;
+    h->last_block = -1;
+    h->write_first = h->write_last = -1;
+    fi->fh = (uint64_t)(uintptr_t)h;
+    return 0;
+}
 
-    // Entradas obligatorias
-    filler(buf, ".", NULL, 0, 0);
-    filler(buf, "..", NULL, 0, 0);
+// Inodo de la operación: el del handle si lo hay, si no el número del kernel
+static int resolve_inode(fuse_ino_t ino, struct fuse_file_info *fi) {
+    bwfs_handle_t *h = handle_of(fi);
+    if (h)
+        return h->ino;
+    return from_fuse(ino);
+}
 
-    // Cargar los inodos
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+static int check_name(const char *name) {
+    return strlen(name) >= BWFS_FILENAME ? -ENAMETOOLONG : 0;
+}
 
-    for (int i = 0; i < count; ++i) {
-        if (!inodes[i].used)
-            continue;
+// Resuelve los primeros `len` caracteres de la ruta componente por
+// componente desde la raíz, con ns_lock tomado. Inodo, o -ENOENT/-ENOTDIR.
+// Solo para la migración: el kernel pide por inodo.
+static int walk_path(const char *path, size_t len) {
+    inode_t *inodes = inode_table_get(NULL);
+    char name[BWFS_DIR_NAME_SIZE];
+    int ino = root_ino;
+    size_t pos = 0;
+
+    while (ino >= 0) {
+        while (pos < len && path[pos] == '/')
+            pos++;
+        if (pos == len)
+            return ino;
+
+        size_t end = pos;
+        while (end < len && path[end] != '/')
+            end++;
+        if (end - pos >= BWFS_FILENAME)
+            return -ENAMETOOLONG;
+        if (!inodes[ino].is_directory)
+            return -ENOTDIR;
+
+        memcpy(name, path + pos, end - pos);
+        name[end - pos] = '\0';
+        ino = dir_lookup(&inodes[ino], name);
+        pos = end;
+    }
+    return ino < 0 ? ino : -ENOENT;
+}
 
-        // Forzar terminación segura
-        inodes[i].filename[BWFS_FILENAME - 1] = '\0';
+static void init_inode(inode_t *inode, const char *name, int is_dir) {
+    memset(inode, 0, sizeof(inode_t));
+    snprintf(inode->filename, BWFS_FILENAME, "%.*s", BWFS_FILENAME - 1, name);
+    inode->used = 1;
+    inode->is_directory = is_dir;
+    inode->created_at = time(NULL);
+    inode->modified_at = inode->created_at;
+    for (int i = 0; i < BWFS_DIRECT_BLOCKS; ++i)
+        inode->blocks[i] = -1;
+}
 
-        // Ignorar strings vacíos
-        if (strlen(inodes[i].filename) == 0)
-            continue;
+static int cmp_name_len(const void *a, const void *b) {
+    inode_t *inodes = inode_table_get(NULL);
+    return (int)strlen(inodes[*(const int *)a].filename) -
+           (int)strlen(inodes[*(const int *)b].filename);
+}
 
-        // Validar caracteres imprimibles
-        int valido = 1;
-        for (int j = 0; j < strlen(inodes[i].filename); ++j) {
-            if (!isprint((unsigned char)inodes[i].filename[j])) {
-                valido = 0;
-                break;
-            }
+// Volumen de espacio de nombres plano (filename = ruta completa): crea la
+// raíz y mete cada inodo en su directorio, padres antes que hijos. Los
+// nombres quedan como el último componente de la ruta.
+static int upgrade_flat_namespace(superblock_t *sb) {
+    int count;
+    inode_t *inodes = inode_table_get(&count);
+
+    int root = alloc_inode();
+    if (root < 0)
+        return -1;
+    init_inode(&inodes[root], "", 1);
+    save_inode(bwfs_folder, root, &inodes[root]);
+    root_ino = root;
+
+    int *order = malloc((count ? count : 1) * sizeof(int));
+    if (!order)
+        return -1;
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        if (i != root && inodes[i].used && inodes[i].filename[0] != '\0')
+            order[n++] = i;
+    }
+    qsort(order, n, sizeof(int), cmp_name_len);
+
+    for (int k = 0; k < n; ++k) {
+        int i = order[k];
+        char leaf[BWFS_DIR_NAME_SIZE];
+        const char *name = inodes[i].filename;
+        const char *slash = strrchr(name, '/');
+
+        int parent = slash ? walk_path(name, slash - name) : root;
+        if (parent >= 0 && inodes[parent].is_directory) {
+            strcpy(leaf, slash ? slash + 1 : name);
+        } else {
+            // Huérfano: queda en la raíz con la ruta aplanada
+            parent = root;
+            strcpy(leaf, name);
+            for (char *c = leaf; *c; ++c)
+                if (*c == '/')
+                    *c = '_';
         }
 
-        if (!valido)
+        int r = dir_add(&inodes[parent], leaf, i);
+        if (r == -EEXIST || r == -EINVAL) {
+            snprintf(leaf, sizeof(leaf), "%.200s~%d", slash ? slash + 1 : name, i);
+            r = dir_add(&inodes[parent], leaf, i);
+        }
+        if (r != 0) {
+            LOG_ERROR("❌ No se pudo migrar el inodo %d (%s)", i, name);
             continue;
-
-        // Mostrar entrada válida
-        filler(buf, inodes[i].filename, NULL, 0, 0);
+        }
+        strcpy(inodes[i].filename, leaf);
+        save_inode(bwfs_folder, i, &inodes[i]);
+        save_inode(bwfs_folder, parent, &inodes[parent]);
     }
-
-    return 0;
+    free(order);
+
+    // El superbloque se actualiza último: si algo falla antes, el próximo
+    // montaje vuelve a migrar desde la tabla de inodos. La migración no
+    // pasa por el journal (todavía no está abierto).
+    if (checkpoint() != 0)
+        return -1;
+    sb->features |= BWFS_FEATURE_DIRS;
+    sb->root_inode = root;
+    return update_superblock(bwfs_folder, sb);
 }
 
-int bwfs_mkdir(const char *path, mode_t mode) {
-    (void) mode;
+// Atributos del inodo, con su lock tomado
+static void fill_stat(int i, struct stat *stbuf) {
+    inode_t *inodes = inode_table_get(NULL);
 
-    if (!bwfs_folder) {
-        fprintf(stderr, "❌ Error: bwfs_folder es NULL en mkdir\n");
-        return -EIO;
-    }
-
-    printf("📁 mkdir: %s\n", path);
-
-    if (strcmp(path, "/") == 0)
-        return -EEXIST;
-
-    const char *name = path + 1;
-
-    int idx = find_free_inode(bwfs_folder);
-    printf("🔍 Resultado de find_free_inode(): %d\n", idx);
-    if (idx < 0) return -ENOSPC;
-
-    inode_t new_inode = {0};
-
-    strncpy(new_inode.filename, name, BWFS_FILENAME - 1);
-    new_inode.filename[BWFS_FILENAME - 1] = '\0';
-
-    new_inode.used = 1;
-    new_inode.is_directory = 1;
-    new_inode.size = 0;
-    new_inode.created_at = time(NULL);
-    new_inode.modified_at = time(NULL);
-
-    save_inode(bwfs_folder, idx, &new_inode);
-    printf("📌 Asignando inodo #%d para %s\n", idx, name);
-
-    char bpath[256];
-    snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", bwfs_folder, 1 + INODE_BLOCKS);
-    
-    FILE *f = fopen(bpath, "r+b");
-    if (!f) {
-        perror("❌ No se pudo abrir el archivo del bitmap de inodos");
-        return -EIO;
-    }
-    
-    // Determinar offset exacto del bitmap de inodos (al final del archivo)
-    fseek(f, 0, SEEK_END);
-    long filesize = ftell(f);
-    long offset_inodo_bitmap = filesize - BWFS_INODES;
-    
-    if (offset_inodo_bitmap < 0) {
-        fprintf(stderr, "❌ Archivo %s demasiado pequeño para contener bitmap\n", bpath);
-        fclose(f);
-        return -EIO;
-    }
-    
-    // Leer, modificar, y sobrescribir bitmap
-    fseek(f, offset_inodo_bitmap, SEEK_SET);
-    uint8_t bitmap[BWFS_INODES];
-    fread(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    
-    bitmap[idx] = 1;  // Marcar inodo como usado
-    
-    fseek(f, offset_inodo_bitmap, SEEK_SET);
-    fwrite(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    fclose(f);
-    
-}
-
-
-int bwfs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
-    (void) fi;
-    (void) mode;
-    printf("📝 create: %s\n", path);
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = to_fuse(i);
+    if (inodes[i].is_directory) {
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    } else {
+        stbuf->st_mode = S_IFREG | 0644;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = inodes[i].size;
+    }
 
-    if (strcmp(path, "/") == 0)
-        return -EEXIST;
+    stbuf->st_ctime = inodes[i].created_at;
+    stbuf->st_mtime = inodes[i].modified_at;
+    stbuf->st_atime = inodes[i].modified_at;
+}
 
-    const char *name = path + 1;
+// Entrada para lookup/mkdir/create/readdirplus, con el lock del inodo tomado
+static void fill_entry(int i, struct fuse_entry_param *e) {
+    memset(e, 0, sizeof(*e));
+    e->ino = to_fuse(i);
+    e->generation = ino_state[i].generation;
+    e->attr_timeout = attr_timeout;
+    e->entry_timeout = entry_timeout;
+    fill_stat(i, &e->attr);
+}
 
-    int idx = find_free_inode(bwfs_folder);
-    printf("🔍 Resultado de find_free_inode(): %d\n", idx);
-    if (idx < 0)
-        return -ENOSPC;
+// El kernel guardó una referencia al inodo (se devuelve con forget)
+static void remember(int i) {
+    pthread_mutex_lock(&lookup_lock);
+    ino_state[i].nlookup++;
+    pthread_mutex_unlock(&lookup_lock);
+}
 
-    inode_t new_inode = {0};  // limpia todo
+// Libera los bloques y el inodo. Con ns_lock tomado y nadie más usándolo.
+static void release_inode(int i) {
+    inode_t *inodes = inode_table_get(NULL);
 
-    strncpy(new_inode.filename, name, BWFS_FILENAME - 1);
-    new_inode.filename[BWFS_FILENAME - 1] = '\0';  // asegurá null-terminado
+    inode_wrlock(i);
+    block_map_free(&inodes[i]);
+    memset(&inodes[i], 0, sizeof(inode_t));
+    save_inode(bwfs_folder, i, &inodes[i]);
+    inode_unlock(i);
 
-    new_inode.used = 1;
-    new_inode.is_directory = 0;
-    new_inode.size = 0;
-    new_inode.created_at = time(NULL);
-    new_inode.modified_at = time(NULL);
-    for (int i = 0; i < 12; ++i) new_inode.blocks[i] = -1;
+    pthread_mutex_lock(&lookup_lock);
+    ino_state[i].generation++;
+    ino_state[i].seen_mtime = ino_state[i].seen_size = 0;
+    pthread_mutex_unlock(&lookup_lock);
 
-    save_inode(bwfs_folder, idx, &new_inode);
-    printf("📌 Asignando inodo #%d para archivo %s\n", idx, name);
+    free_inode(i);
+    LOG_DEBUG("🗑️ Inodo %d limpiado", i);
+}
 
-    char bpath[256];
-    snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", bwfs_folder, 1 + INODE_BLOCKS);
+// El inodo ya no está en ningún directorio: se libera ahora si el kernel
+// no lo conoce, si no en el último forget
+static void drop_inode(int i) {
+    pthread_mutex_lock(&lookup_lock);
+    int busy = ino_state[i].nlookup > 0;
+    if (busy)
+        ino_state[i].orphan = 1;
+    pthread_mutex_unlock(&lookup_lock);
+
+    if (busy)
+        LOG_DEBUG("👻 Inodo %d sin entrada; se libera al soltarlo el kernel", i);
+    else
+        release_inode(i);
+}
 
-    FILE *f = fopen(bpath, "r+b");
-    if (!f)
-    {
-        perror("No se pudo abrir el archivo del bitmap de inodos");
-        return -EIO;
+static void ctl_stat(int k, struct stat *stbuf) {
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = ctl_ino(k);
+    if (k == CTL_DIR) {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+    } else {
+        // Tamaño 0: el contenido se genera al abrir y se lee con direct_io
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
     }
+    stbuf->st_ctime = stbuf->st_mtime = stbuf->st_atime = mounted_at;
+}
 
-    // Determinar offset exacto del bitmap de inodos (al final del archivo)
-    fseek(f, 0, SEEK_END);
-    long filesize = ftell(f);
-    long offset_inodo_bitmap = filesize - BWFS_INODES;
+static void ctl_entry(int k, struct fuse_entry_param *e) {
+    memset(e, 0, sizeof(*e));
+    e->ino = ctl_ino(k);
+    e->attr_timeout = attr_timeout;
+    e->entry_timeout = entry_timeout;
+    ctl_stat(k, &e->attr);
+}
 
-    if (offset_inodo_bitmap < 0)
-    {
-        fprintf(stderr, "Archivo %s demasiado pequeño para contener bitmap\n", bpath);
-        fclose(f);
-        return -EIO;
+// Archivo de control que busca lookup, o -1 si el nombre es de un inodo real
+static int ctl_lookup(fuse_ino_t parent, const char *name) {
+    if (parent == FUSE_ROOT_ID)
+        return strcmp(name, BWFS_CTL_NAME) == 0 ? CTL_DIR : -1;
+    if (ctl_of(parent) != CTL_DIR)
+        return -1;
+    for (int k = CTL_STATS; k < CTL_COUNT; ++k) {
+        if (strcmp(name, ctl_names[k]) == 0)
+            return k;
     }
+    return -ENOENT;
+}
 
-    // Leer, modificar, y sobrescribir bitmap
-    fseek(f, offset_inodo_bitmap, SEEK_SET);
-    uint8_t bitmap[BWFS_INODES];
-    fread(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-
-    bitmap[idx] = 1; // Marcar inodo como usado
+// Fija el contenido del archivo de control en el handle: las lecturas por
+// partes ven todas la misma versión
+static int ctl_snapshot(int k, bwfs_handle_t *h) {
+    size_t (*render)(char *, size_t) = k == CTL_STATS ? metrics_json : bwfs_log_dump;
+
+    // Con margen: entre las dos llamadas el contenido puede crecer
+    size_t cap = render(NULL, 0) + 4096;
+    h->snapshot = malloc(cap);
+    if (!h->snapshot)
+        return -ENOMEM;
+    size_t len = render(h->snapshot, cap);
+    h->snapshot_len = len < cap ? len : cap - 1;
+    return 0;
+}
 
-    fseek(f, offset_inodo_bitmap, SEEK_SET);
-    fwrite(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    fclose(f);
+// Modo de caché del kernel: por defecto todo pasa por BWFS; con
+// kernel_cache/auto_cache el kernel conserva páginas y atributos. Todo
+// cambio llega por una operación del kernel, así que su caché no queda
+// vieja: el daemon no cambia datos por su cuenta mientras está montado.
+static void setup_kernel_cache(const struct bwfs_config *conf) {
+    kernel_caching = conf->kernel_cache || conf->auto_cache;
+    auto_caching = conf->auto_cache;
+
+    double def = kernel_caching ? BWFS_KERNEL_CACHE_TIMEOUT : BWFS_DEFAULT_TIMEOUT;
+    attr_timeout = conf->attr_timeout >= 0 ? conf->attr_timeout : def;
+    entry_timeout = conf->entry_timeout >= 0 ? conf->entry_timeout : def;
+    negative_timeout = conf->negative_timeout >= 0 ? conf->negative_timeout
+                     : kernel_caching ? BWFS_KERNEL_CACHE_TIMEOUT : 0;
+
+    if (kernel_caching)
+        LOG_INFO("🧠 Caché del kernel: %s, atributos %.1fs, entradas %.1fs, negativas %.1fs",
+                 auto_caching ? "auto" : "fija", attr_timeout, entry_timeout, negative_timeout);
 }
-int bwfs_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi) {
-    (void)fi;
-    if (!bwfs_folder) {
-        fprintf(stderr, "❌ Error: bwfs_folder es NULL en utimens\n");
-        return -EIO;
-    }
 
-    if (strcmp(path, "/") == 0)
-        return 0;  // OK para la raíz
+static void serve_read(fuse_req_t req, int i, size_t size, off_t offset, bwfs_handle_t *h,
+                       uint64_t t0);
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+static void *read_main(void *arg) {
+    (void)arg;
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            inodes[i].modified_at = tv[1].tv_sec;
-            inodes[i].created_at = tv[0].tv_sec;
-            save_inode(bwfs_folder, i, &inodes[i]);
-            printf("⏱️ utimens aplicado a %s\n", name);
-            return 0;
+    pthread_mutex_lock(&rd_lock);
+    while (rd_running || rd_len) {
+        if (!rd_len) {
+            pthread_cond_wait(&rd_cond, &rd_lock);
+            continue;
         }
+        read_task_t t = rd_queue[rd_head];
+        rd_head = (rd_head + 1) % BWFS_READ_QUEUE;
+        rd_len--;
+        pthread_mutex_unlock(&rd_lock);
+
+        serve_read(t.req, t.ino, t.size, t.off, t.h, t.t0);
+        pthread_mutex_lock(&rd_lock);
     }
+    pthread_mutex_unlock(&rd_lock);
+    return NULL;
+}
 
-    return -ENOENT;
+// Encola una lectura para el pool; 0 si está lleno o apagado y hay que
+// atenderla en el hilo que la recibió
+static int read_queue_push(fuse_req_t req, int i, size_t size, off_t off, bwfs_handle_t *h,
+                           uint64_t t0) {
+    pthread_mutex_lock(&rd_lock);
+    int queued = rd_running && rd_len < BWFS_READ_QUEUE;
+    if (queued) {
+        rd_queue[(rd_head + rd_len) % BWFS_READ_QUEUE] = (read_task_t){ req, i, size, off, h, t0 };
+        rd_len++;
+        pthread_cond_signal(&rd_cond);
+    }
+    pthread_mutex_unlock(&rd_lock);
+    return queued;
 }
 
-int bwfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
-    printf("✏️ write: %s (offset: %ld, size: %ld)\n", path, offset, size);
+static int read_pool_start(int threads) {
+    if (threads > BWFS_READ_WORKERS)
+        threads = BWFS_READ_WORKERS;
+
+    rd_running = 1;
+    for (rd_nthreads = 0; rd_nthreads < threads; ++rd_nthreads) {
+        if (pthread_create(&rd_threads[rd_nthreads], NULL, read_main, NULL) != 0)
+            break;
+    }
+    if (rd_nthreads == 0) {
+        rd_running = 0;
+        return -1;
+    }
+    return 0;
+}
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+// Las lecturas encoladas se responden antes de que terminen los hilos
+static void read_pool_stop(void) {
+    pthread_mutex_lock(&rd_lock);
+    rd_running = 0;
+    pthread_cond_broadcast(&rd_cond);
+    pthread_mutex_unlock(&rd_lock);
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            const size_t block_size = 125000;
-            size_t written = 0;
-            size_t remaining = size;
-            off_t current_offset = offset;
-
-            while (remaining > 0) {
-                int block_idx = current_offset / block_size;
-                off_t block_offset = current_offset % block_size;
-                size_t chunk = (remaining > block_size - block_offset) ? (block_size - block_offset) : remaining;
-
-                if (block_idx >= 100)
-                    return -EFBIG;  // demasiados bloques
-
-                if (inodes[i].blocks[block_idx] == -1) {
-                    int newblock = find_free_block(bwfs_folder);
-                    if (newblock < 0) return -ENOSPC;
-                    inodes[i].blocks[block_idx] = newblock;
-                    update_bitmap_block(bwfs_folder, newblock, 1);
-                }
-
-                int blk = inodes[i].blocks[block_idx];
-                char filepath[256];
-                snprintf(filepath, sizeof(filepath), "%s/block_%03d.pbm", bwfs_folder, blk);
-
-                // Leer datos existentes
-                unsigned char data[block_size];
-                memset(data, 0, block_size);
-                
-                FILE *f = fopen(filepath, "r");
-                if (f) {
-                    char header[64];
-                    fgets(header, sizeof(header), f);
-                    fgets(header, sizeof(header), f);
-                    fgets(header, sizeof(header), f);
-
-                    int bit_index = 0;
-                    char ch;
-                    while (fscanf(f, " %c", &ch) == 1 && bit_index < block_size * 8) {
-                        if (ch != '0' && ch != '1') continue;
-                        int byte_idx = bit_index / 8;
-                        data[byte_idx] = (data[byte_idx] << 1) | (ch - '0');
-                        bit_index++;
-                    }
-                    fclose(f);
-                }
-
-                // Escribir los nuevos datos en memoria
-                memcpy(data + block_offset, buf + written, chunk);
-
-                // Escribir el bloque entero a disco
-                FILE *fw = fopen(filepath, "w");
-                if (!fw) return -EIO;
-
-                fprintf(fw, "P1\n# Bloque BWFS\n1000 1000\n");
-                int written_bits = 0;
-                for (int b = 0; b < block_size; ++b) {
-                    for (int j = 7; j >= 0 && written_bits < 1000000; --j) {
-                        int bit = (data[b] >> j) & 1;
-                        fprintf(fw, "%d ", bit);
-                        written_bits++;
-                        if (written_bits % 1000 == 0)
-                            fprintf(fw, "\n");
-                    }
-                }
-                fclose(fw);
-
-                written += chunk;
-                current_offset += chunk;
-                remaining -= chunk;
-            }
+    for (int k = 0; k < rd_nthreads; ++k)
+        pthread_join(rd_threads[k], NULL);
+    rd_nthreads = 0;
+}
 
-            inodes[i].size = (offset + size > inodes[i].size) ? (offset + size) : inodes[i].size;
-            inodes[i].modified_at = time(NULL);
-            save_inode(bwfs_folder, i, &inodes[i]);
+static void bwfs_init(void *userdata, struct fuse_conn_info *conn) {
+    (void) conn;
 
-            return size;
+    const struct bwfs_config *conf = userdata;
+    bwfs_folder = conf->folder;
+    bwfs_log_set_level(conf->log_level);
+    metrics_reset();
+    mounted_at = time(NULL);
+    setup_kernel_cache(conf);
+
+    // Formato de bloque: el que indique el superbloque, o el de la cabecera
+    // del bloque 0 si el superbloque es anterior a block_format
+    superblock_t sb = {0};
+    int format = -1;
+    if (read_superblock(bwfs_folder, &sb) == 0)
+        format = sb.block_format;
+    else {
+        sb.total_blocks = BLOCK_COUNT;
+        sb.data_block_start = 1 + INODE_BLOCKS + BITMAP_BLOCK;
+        sb.free_block_bitmap = 1 + INODE_BLOCKS;
+    }
+    if (format != BWFS_FORMAT_P1 && format != BWFS_FORMAT_P4) {
+        char path[256];
+        block_path(path, sizeof(path), bwfs_folder, 0);
+        format = pbm_detect_format(path);
+    }
+    if (format < 0)
+        format = BWFS_FORMAT_P1;
+    pbm_set_format(format);
+    sb.block_format = format;
+    LOG_INFO("🖼️ Formato de bloques: %s", format == BWFS_FORMAT_P4 ? "P4" : "P1");
+
+    // Todas las tablas en memoria se dimensionan con la geometría del volumen
+    bwfs_geometry_t geometry;
+    geometry_from_superblock(&sb, &geometry);
+    volume_set_geometry(&geometry);
+    LOG_INFO("📐 Geometría: %u bloques, %u inodos, imagen %ux%u", geometry.total_blocks,
+           geometry.total_inodes, geometry.image_width, geometry.image_height);
+
+    size_t cache_bytes = (conf->cache_mb ? conf->cache_mb : BWFS_CACHE_DEFAULT_MB) * 1024 * 1024;
+    if (block_store_init(bwfs_folder) != 0 || block_cache_init(cache_bytes) != 0)
+        LOG_ERROR("❌ No se pudo inicializar el almacén de bloques");
+
+    // La tabla de inodos se carga una sola vez y queda residente
+    int count = inode_table_init(bwfs_folder);
+    ino_state = calloc(count > 0 ? count : 1, sizeof(ino_state_t));
+    ino_count = ino_state && count > 0 ? count : 0;
+
+    // Bitmaps en memoria; solo se asignan bloques de datos existentes
+    if (bitmap_init(bwfs_folder, volume_geometry()) != 0)
+        LOG_ERROR("❌ No se pudieron cargar los bitmaps");
+    LOG_INFO("📚 Tabla de inodos cargada (%d inodos)", count);
+
+    // CRC32C por bloque. Los volúmenes con geometría que no tienen la
+    // tabla la reciben vacía: se completa a medida que se escriben bloques
+    // o con fsck.bwfs -r. La feature queda en el superbloque con set_clean.
+    checksum_set_verify(conf->verify);
+    if (sb.magic == BWFS_MAGIC && sb.total_inodes) {
+        if (!(sb.features & BWFS_FEATURE_CRC) || checksum_init(bwfs_folder, volume_geometry()) != 0) {
+            if (checksum_create(bwfs_folder, volume_geometry()) == 0 &&
+                checksum_init(bwfs_folder, volume_geometry()) == 0) {
+                sb.features |= BWFS_FEATURE_CRC;
+                LOG_INFO("🧮 Tabla de CRC32C creada");
+            } else {
+                sb.features &= ~BWFS_FEATURE_CRC;
+                LOG_WARN("⚠️ No se pudo crear la tabla de CRC32C: los bloques no se verifican");
+            }
         }
     }
+    LOG_INFO("🧮 CRC32C por bloque: %s (%s)",
+             checksum_verify_mode() == BWFS_VERIFY_OFF ? "sin verificar" :
+             checksum_verify_mode() == BWFS_VERIFY_ALWAYS ? "en cada lectura" : "al decodificar",
+             crc32c_impl_name());
+
+    // Compresión: -z la activa y deja la feature en el superbloque (con
+    // set_clean), así fsck acepta los clusters. Lo comprimido en montajes
+    // anteriores se lee y se expande aunque ahora esté apagada.
+    int compress = conf->compress && sb.magic == BWFS_MAGIC && sb.total_inodes;
+    if (conf->compress && !compress)
+        LOG_WARN("⚠️ El volumen no tiene superbloque con geometría: se monta sin compresión");
+    if (compress)
+        sb.features |= BWFS_FEATURE_COMPRESS;
+    compress_init((sb.features & BWFS_FEATURE_COMPRESS) != 0, compress);
+    if (compress)
+        LOG_INFO("🗜️ Compresión LZ por clusters de %d bloques", BWFS_CLUSTER_BLOCKS);
+
+    // Deduplicación: -D la activa y crea la tabla si falta. Con la feature
+    // la tabla se carga aunque esté apagada, así las referencias de los
+    // bloques compartidos se siguen respetando.
+    int dedup = conf->dedup && sb.magic == BWFS_MAGIC && sb.total_inodes;
+    if (conf->dedup && !dedup)
+        LOG_WARN("⚠️ El volumen no tiene superbloque con geometría: se monta sin deduplicación");
+    if (sb.features & BWFS_FEATURE_DEDUP) {
+        if (dedup_init(bwfs_folder, volume_geometry(), dedup) != 0)
+            LOG_ERROR("❌ No se pudo cargar la tabla de deduplicación (fsck.bwfs -r la rehace)");
+    } else if (dedup) {
+        if (dedup_create(bwfs_folder, volume_geometry()) == 0 &&
+            dedup_init(bwfs_folder, volume_geometry(), 1) == 0)
+            sb.features |= BWFS_FEATURE_DEDUP;
+        else
+            LOG_WARN("⚠️ No se pudo crear la tabla de deduplicación: se monta sin deduplicación");
+    }
+    // Transacciones que quedaron en el journal de un montaje interrumpido
+    int replayed = journal_replay(bwfs_folder, journal_apply, (void *)bwfs_folder);
+    if (replayed < 0)
+        LOG_ERROR("❌ No se pudo leer el journal");
+    else if (replayed > 0)
+        LOG_INFO("📓 Journal: %d transacciones rehechas", replayed);
+    if (dedup_enabled()) {
+        dedup_stats_t ds;
+        dedup_get_stats(&ds);
+        LOG_INFO("🔗 Deduplicación de bloques: %llu compartidos, %llu bloques ahorrados",
+                 (unsigned long long)ds.shared, (unsigned long long)ds.saved);
+    }
 
-    return -ENOENT;
+    // Directorios: la raíz sale del superbloque; los volúmenes planos se
+    // convierten una vez
+    root_ino = -1;
+    if (sb.features & BWFS_FEATURE_DIRS) {
+        if (sb.root_inode < (uint32_t)count && inode_table_get(NULL)[sb.root_inode].is_directory)
+            root_ino = sb.root_inode;
+    } else if (upgrade_flat_namespace(&sb) == 0) {
+        LOG_INFO("📂 Espacio de nombres convertido a directorios (raíz: inodo %d)", root_ino);
+    }
+    if (root_ino < 0)
+        LOG_ERROR("❌ El volumen no tiene directorio raíz");
+    volume_sb = sb;
+    if (set_clean(0) != 0)
+        LOG_WARN("⚠️ No se pudo marcar el volumen como montado");
+
+    // El checkpoint deja en su lugar lo rehecho y arranca con el journal vacío
+    if (journal_open(bwfs_folder) != 0 || checkpoint() != 0)
+        LOG_ERROR("❌ No se pudo abrir el journal");
+
+    // Readahead: la ventana no pasa de un cuarto de la caché
+    block_cache_stats_t cs;
+    block_cache_get_stats(&cs);
+    ra_max = cs.capacity / 4 < BWFS_READAHEAD_MAX ? (int)(cs.capacity / 4) : BWFS_READAHEAD_MAX;
+    if (block_cache_prefetch_start(BWFS_PREFETCH_THREADS) != 0)
+        LOG_ERROR("❌ No se pudieron iniciar los hilos de prefetch");
+
+    // Write-back en segundo plano: por defecto hasta la mitad de la caché sucia
+    size_t dirty_bytes = conf->dirty_mb ? conf->dirty_mb * 1024 * 1024 : cache_bytes / 2;
+    if (block_cache_writeback_start(dirty_bytes, conf->dirty_expire_ms) != 0)
+        LOG_ERROR("❌ No se pudo iniciar el hilo de write-back");
+
+    // Sin el pool, las lecturas se atienden en el hilo de libfuse
+    if (read_pool_start(BWFS_READ_WORKERS) != 0)
+        LOG_ERROR("❌ No se pudieron iniciar los hilos de lectura");
+
+    LOG_INFO("BWFS montado correctamente");
 }
 
-int bwfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
-    printf("📖 read: %s (offset: %ld, size: %zu)\n", path, offset, size);
+static void bwfs_destroy(void *userdata) {
+    (void) userdata;
 
-    if (!bwfs_folder)
-        return -EIO;
+    read_pool_stop();
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+    // Inodos borrados que el kernel no llegó a soltar
+    ns_wrlock();
+    for (int i = 0; i < ino_count; ++i) {
+        if (ino_state[i].orphan) {
+            ino_state[i].orphan = 0;
+            release_inode(i);
+        }
+    }
+    ns_unlock();
+
+    // Sin el hilo, lo que quede sucio se escribe acá
+    block_cache_prefetch_stop();
+    block_cache_writeback_stop();
+
+    block_cache_stats_t cs;
+    block_cache_get_stats(&cs);
+    LOG_INFO("📊 Caché de bloques: %llu aciertos, %llu fallos, %llu desalojos, %llu write-backs, "
+           "%llu esperas por sucios, %llu leídos por adelantado",
+           (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+           (unsigned long long)cs.evictions, (unsigned long long)cs.writebacks,
+           (unsigned long long)cs.throttled, (unsigned long long)cs.prefetched);
+    if (cs.corrupt)
+        LOG_WARN("⚠️ %llu lecturas de bloques con CRC inválido (fsck.bwfs -f para revisarlos)",
+                 (unsigned long long)cs.corrupt);
+
+    compress_stats_t zs;
+    compress_get_stats(&zs);
+    if (zs.compressed || zs.incompressible || zs.expanded)
+        LOG_INFO("🗜️ Compresión: %llu clusters comprimidos (%llu → %llu bytes), %llu en crudo, "
+                 "%llu expandidos, %lld bloques ahorrados",
+                 (unsigned long long)zs.compressed, (unsigned long long)zs.raw_bytes,
+                 (unsigned long long)zs.packed_bytes, (unsigned long long)zs.incompressible,
+                 (unsigned long long)zs.expanded, (long long)zs.blocks_saved);
+
+    dedup_stats_t ds;
+    dedup_get_stats(&ds);
+    if (ds.deduped || ds.unique || ds.copied)
+        LOG_INFO("🔗 Deduplicación: %llu bloques deduplicados, %llu únicos, %llu copiados al "
+                 "escribirlos; %llu compartidos, %llu bloques ahorrados",
+                 (unsigned long long)ds.deduped, (unsigned long long)ds.unique,
+                 (unsigned long long)ds.copied, (unsigned long long)ds.shared,
+                 (unsigned long long)ds.saved);
+
+    if (bwfs_folder && (block_cache_flush() != 0 || checkpoint() != 0))
+        LOG_ERROR("❌ Error escribiendo los metadatos al desmontar");
+    else if (bwfs_folder && set_clean(1) != 0)
+        LOG_WARN("⚠️ No se pudo marcar el volumen como desmontado limpio");
+    journal_close();
+    block_cache_destroy();
+    block_store_close();
+    checksum_close();
+    compress_shutdown();
+    dedup_close();
+
+    free(ino_state);
+    ino_state = NULL;
+    ino_count = 0;
+
+    LOG_INFO("BWFS desmontado");
+}
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            if (offset >= inodes[i].size)
-                return 0;
-
-            const size_t block_size = 125000;
-            size_t remaining = (offset + size > inodes[i].size) ? (inodes[i].size - offset) : size;
-            size_t read_bytes = 0;
-            off_t current_offset = offset;
-
-            while (remaining > 0) {
-                int block_idx = current_offset / block_size;
-                off_t block_offset = current_offset % block_size;
-                size_t chunk = (remaining > block_size - block_offset) ? (block_size - block_offset) : remaining;
-
-                if (block_idx >= 100)
-                    break;
-
-                int blk = inodes[i].blocks[block_idx];
-                if (blk < 0 || blk >= BLOCK_COUNT)
-                    break;
-
-                char filepath[256];
-                snprintf(filepath, sizeof(filepath), "%s/block_%03d.pbm", bwfs_folder, blk);
-
-                FILE *f = fopen(filepath, "r");
-                if (!f) break;
-
-                char line[64];
-                fgets(line, sizeof(line), f);
-                fgets(line, sizeof(line), f);
-                fgets(line, sizeof(line), f);
-
-                unsigned char data[block_size];
-                memset(data, 0, block_size);
-                int bit_index = 0;
-                char ch;
-                while (fscanf(f, " %c", &ch) == 1 && bit_index < block_size * 8) {
-                    if (ch != '0' && ch != '1') continue;
-                    int byte_idx = bit_index / 8;
-                    data[byte_idx] = (data[byte_idx] << 1) | (ch - '0');
-                    bit_index++;
-                }
-                fclose(f);
-
-                memcpy(buf + read_bytes, data + block_offset, chunk);
-
-                read_bytes += chunk;
-                current_offset += chunk;
-                remaining -= chunk;
-            }
+static void bwfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    inode_t *inodes = inode_table_get(NULL);
+    struct fuse_entry_param e;
+    uint64_t t0 = metrics_now();
+
+    int i = ctl_lookup(parent, name);
+    if (i >= 0) {
+        ctl_entry(i, &e);
+        metrics_op(BWFS_OP_LOOKUP, t0, 0);
+        fuse_reply_entry(req, &e);
+        return;
+    }
 
-            printf("✅ Se leyeron %zu bytes\n", read_bytes);
-            return read_bytes;
+    if (i != -ENOENT) {
+        ns_rdlock();
+        int p = from_fuse(parent);
+        i = p < 0 ? p : check_name(name);
+        if (i == 0)
+            i = inodes[p].is_directory ? dir_lookup(&inodes[p], name) : -ENOTDIR;
+        if (i >= 0) {
+            inode_rdlock(i);
+            fill_entry(i, &e);
+            inode_unlock(i);
+            remember(i);
         }
+        ns_unlock();
+    }
+    metrics_op(BWFS_OP_LOOKUP, t0, i < 0 && i != -ENOENT);
+
+    // Un nombre que no existe también se cachea si hay timeout de negativas
+    if (i == -ENOENT && negative_timeout > 0) {
+        memset(&e, 0, sizeof(e));
+        e.entry_timeout = negative_timeout;
+        fuse_reply_entry(req, &e);
+    } else if (i < 0) {
+        fuse_reply_err(req, -i);
+    } else {
+        fuse_reply_entry(req, &e);
     }
+}
 
-    return -ENOENT;
+// Descuenta `n` referencias del kernel: 1 si el inodo quedó huérfano y
+// sin referencias, y hay que liberarlo
+static int unref(int i, uint64_t n) {
+    pthread_mutex_lock(&lookup_lock);
+    ino_state_t *s = &ino_state[i];
+    s->nlookup = s->nlookup > n ? s->nlookup - n : 0;
+    int drop = s->nlookup == 0 && s->orphan;
+    if (drop)
+        s->orphan = 0;
+    pthread_mutex_unlock(&lookup_lock);
+    return drop;
 }
 
-int bwfs_unlink(const char *path) {
-    printf("❌ unlink: %s\n", path);
+// El kernel suelta `n` referencias; un inodo borrado se libera en la última
+static void forget_one(fuse_ino_t ino, uint64_t n) {
+    int i = from_fuse(ino);
+    if (i < 0 || i == root_ino)
+        return;
 
-    if (!bwfs_folder) {
-        fprintf(stderr, "❌ Error: bwfs_folder es NULL en unlink\n");
-        return -EIO;
+    if (unref(i, n)) {
+        ns_rdlock();
+        release_inode(i);
+        ns_unlock();
     }
+}
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+static void bwfs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    uint64_t t0 = metrics_now();
+    forget_one(ino, nlookup);
+    metrics_op(BWFS_OP_FORGET, t0, 0);
+    fuse_reply_none(req);
+}
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && !inodes[i].is_directory && strcmp(inodes[i].filename, name) == 0) {
-            int block = inodes[i].blocks[0];
+static void bwfs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+    uint64_t t0 = metrics_now();
+    for (size_t k = 0; k < count; ++k)
+        forget_one(forgets[k].ino, forgets[k].nlookup);
+    metrics_op(BWFS_OP_FORGET, t0, 0);
+    fuse_reply_none(req);
+}
+
+static void bwfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    struct stat stbuf;
+    uint64_t t0 = metrics_now();
+
+    int i = ctl_of(ino);
+    if (i >= 0) {
+        ctl_stat(i, &stbuf);
+    } else {
+        ns_rdlock();
+        i = resolve_inode(ino, fi);
+        if (i >= 0) {
+            inode_rdlock(i);
+            fill_stat(i, &stbuf);
+            inode_unlock(i);
+        }
+        ns_unlock();
+    }
+    metrics_op(BWFS_OP_GETATTR, t0, i < 0);
+
+    if (i < 0)
+        fuse_reply_err(req, -i);
+    else
+        fuse_reply_attr(req, &stbuf, attr_timeout);
+}
 
-            // iberar bloque si existe
-            if (block >= 0 && block < BLOCK_COUNT) {
-                update_bitmap_block(bwfs_folder, block, 0);
-                printf("🧹 Bloque %d liberado\n", block);
+// Solo tiempos: no hay permisos ni dueños, y el tamaño no se puede cambiar
+// (no hay truncate)
+static void bwfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                         struct fuse_file_info *fi) {
+    inode_t *inodes = inode_table_get(NULL);
+    struct stat stbuf;
+    uint64_t t0 = metrics_now();
+
+    int r = 0;
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+        r = -ENOSYS;
+
+    if (r == 0) {
+        ns_rdlock();
+        int i = resolve_inode(ino, fi);
+        r = i < 0 ? i : 0;
+        if (i >= 0) {
+            inode_wrlock(i);
+            if ((to_set & FUSE_SET_ATTR_SIZE) && (uint64_t)attr->st_size != inodes[i].size)
+                r = -ENOSYS;
+            if (r == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+                time_t now = time(NULL);
+                if (to_set & FUSE_SET_ATTR_MTIME)
+                    inodes[i].modified_at = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? now : attr->st_mtime;
+                if (to_set & FUSE_SET_ATTR_ATIME)
+                    inodes[i].created_at = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? now : attr->st_atime;
+                save_inode(bwfs_folder, i, &inodes[i]);
+                LOG_DEBUG("⏱️ utimens aplicado al inodo %d", i);
             }
+            fill_stat(i, &stbuf);
+            inode_unlock(i);
+        }
+        ns_unlock();
+    }
+    metrics_op(BWFS_OP_SETATTR, t0, r < 0);
 
-            // Limpiar el inodo
-            memset(&inodes[i], 0, sizeof(inode_t));
-            save_inode(bwfs_folder, i, &inodes[i]);
-            printf("🗑️ Inodo %d limpiado\n", i);
+    if (r < 0)
+        fuse_reply_err(req, -r);
+    else
+        fuse_reply_attr(req, &stbuf, attr_timeout);
+}
 
-            // Actualizar bitmap de inodos
-            char bpath[256];
-            snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", bwfs_folder, 1 + INODE_BLOCKS);
-            FILE *f = fopen(bpath, "r+b");
-            if (!f)
-                return -EIO;
+typedef struct {
+    fuse_req_t req;
+    char *buf;
+    size_t size;            // capacidad del buffer de respuesta
+    size_t used;
+    int plus;               // readdirplus: atributos y referencia por entrada
+} readdir_ctx_t;
+
+// Agrega una entrada a la respuesta; 1 si no entra (sigue en la próxima llamada)
+static int readdir_put(readdir_ctx_t *rc, const char *name, const struct fuse_entry_param *e,
+                       off_t next) {
+    size_t room = rc->size - rc->used;
+    size_t len = rc->plus
+        ? fuse_add_direntry_plus(rc->req, rc->buf + rc->used, room, name, e, next)
+        : fuse_add_direntry(rc->req, rc->buf + rc->used, room, name, &e->attr, next);
+    if (len > room)
+        return 1;
+    rc->used += len;
+    return 0;
+}
 
-            fseek(f, -BWFS_INODES, SEEK_END);
-            uint8_t bitmap[BWFS_INODES];
-            fread(bitmap, sizeof(uint8_t), BWFS_INODES, f);
+// Los offsets de readdir: 1 y 2 después de "." y "..", y para las entradas
+// 2 + la posición que devuelve dir_list, que sigue valiendo aunque el
+// directorio cambie entre llamadas
+static int readdir_add(readdir_ctx_t *rc, const char *name, int ino, off_t next) {
+    struct fuse_entry_param e;
+
+    if (rc->plus) {
+        inode_rdlock(ino);
+        fill_entry(ino, &e);
+        inode_unlock(ino);
+    } else {
+        memset(&e, 0, sizeof(e));
+        e.attr.st_ino = to_fuse(ino);
+        e.attr.st_mode = inode_table_get(NULL)[ino].is_directory ? S_IFDIR : S_IFREG;
+    }
+    return readdir_put(rc, name, &e, next);
+}
 
-            bitmap[i] = 0;
+static int readdir_fill(void *ctx, const char *name, int ino, long next) {
+    readdir_ctx_t *rc = ctx;
+    if (readdir_add(rc, name, ino, 2 + next) != 0)
+        return 1;
+    // El kernel cuenta un lookup por cada entrada de readdirplus salvo . y ..
+    if (rc->plus)
+        remember(ino);
+    return 0;
+}
 
-            fseek(f, -BWFS_INODES, SEEK_END);
-            fwrite(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-            fclose(f);
+// Directorio de control: ".", ".." y sus archivos, con offsets 1, 2, 3...
+static void ctl_readdir(readdir_ctx_t *rc, off_t off) {
+    struct fuse_entry_param e;
+
+    for (int k = off; k < CTL_COUNT + 1; ++k) {
+        const char *name = k == 0 ? "." : k == 1 ? ".." : ctl_names[k - 1];
+        if (k == 1) {
+            memset(&e, 0, sizeof(e));
+            inode_rdlock(root_ino);
+            fill_stat(root_ino, &e.attr);
+            inode_unlock(root_ino);
+        } else {
+            ctl_entry(k == 0 ? CTL_DIR : k - 1, &e);
+        }
+        if (readdir_put(rc, name, &e, k + 1) != 0)
+            break;
+    }
+}
 
-            printf("✅ Archivo '%s' eliminado correctamente\n", name);
-            return 0;
+static void do_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, int plus) {
+    inode_t *inodes = inode_table_get(NULL);
+    uint64_t t0 = metrics_now();
+
+    readdir_ctx_t rc = { req, malloc(size ? size : 1), size, 0, plus };
+    if (!rc.buf) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    int r = 0;
+    int k = ctl_of(ino);
+    if (k == CTL_DIR) {
+        ctl_readdir(&rc, off);
+    } else if (k >= 0) {
+        r = -ENOTDIR;
+    } else {
+        ns_rdlock();
+        int i = from_fuse(ino);
+        r = i;
+        if (i >= 0 && !inodes[i].is_directory)
+            r = -ENOTDIR;
+        if (r >= 0) {
+            // El padre no se guarda en el inodo: ".." lleva el número del propio
+            // directorio, el kernel no lo usa
+            r = 0;
+            if (off < 1 && readdir_add(&rc, ".", i, 1) != 0)
+                r = 1;
+            if (r == 0 && off < 2 && readdir_add(&rc, "..", i, 2) != 0)
+                r = 1;
+            if (r == 0)
+                r = dir_list(&inodes[i], off > 2 ? off - 2 : 0, readdir_fill, &rc);
         }
+        ns_unlock();
     }
+    metrics_op(BWFS_OP_READDIR, t0, r < 0);
+    metrics_bytes(BWFS_OP_READDIR, rc.used);
+
+    if (r < 0)
+        fuse_reply_err(req, -r);
+    else
+        fuse_reply_buf(req, rc.buf, rc.used);
+    free(rc.buf);
+}
 
-    return -ENOENT;
+static void bwfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                         struct fuse_file_info *fi) {
+    (void)fi;
+    do_readdir(req, ino, size, off, 0);
 }
-int bwfs_rmdir(const char *path) {
-    printf("🧺 rmdir: %s\n", path);
 
-    if (!bwfs_folder) {
-        fprintf(stderr, "❌ Error: bwfs_folder es NULL en rmdir\n");
-        return -EIO;
-    }
+static void bwfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                             struct fuse_file_info *fi) {
+    (void)fi;
+    do_readdir(req, ino, size, off, 1);
+}
 
-    if (strcmp(path, "/") == 0)
-        return -EBUSY;  // no se puede eliminar la raíz
+// Saca `name` de su directorio y devuelve el inodo, con ns_lock de escritura
+static int unlink_entry(int p, const char *name) {
+    inode_t *inodes = inode_table_get(NULL);
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
-    int target = -1;
+    inode_wrlock(p);
+    int i = dir_remove(&inodes[p], name);
+    inodes[p].modified_at = time(NULL);
+    save_inode(bwfs_folder, p, &inodes[p]);
+    inode_unlock(p);
+    return i;
+}
 
-    // Buscar el directorio por nombre
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && inodes[i].is_directory &&
-            strcmp(inodes[i].filename, name) == 0) {
-            target = i;
-            break;
-        }
+// Deshace make_node cuando la respuesta no llega al kernel: la entrada sale
+// del directorio antes de liberar el inodo. Si entretanto otra operación
+// la movió o la borró, solo se descuenta el lookup de make_node.
+static void unmake_node(fuse_ino_t parent, const char *name, int idx) {
+    inode_t *inodes = inode_table_get(NULL);
+
+    ns_wrlock();
+    int drop = unref(idx, 1);
+    int p = from_fuse(parent);
+    if (p >= 0 && inodes[p].is_directory && dir_lookup(&inodes[p], name) == idx) {
+        unlink_entry(p, name);
+        drop_inode(idx);
+    } else if (drop) {
+        release_inode(idx);
     }
+    ns_unlock();
+}
 
-    if (target == -1)
-        return -ENOENT;
+// Crea un archivo o directorio vacío, lo enlaza en su directorio padre y
+// llena la entrada de la respuesta (ya contada como lookup)
+static int make_node(fuse_ino_t parent, const char *name, int is_dir, struct fuse_entry_param *e) {
+    inode_t *inodes = inode_table_get(NULL);
+
+    ns_wrlock();
+    int p = from_fuse(parent);
+    int r = p < 0 ? p : check_name(name);
+    if (r == 0 && !inodes[p].is_directory)
+        r = -ENOTDIR;
+    if (r == 0 && (ctl_lookup(parent, name) >= 0 || dir_lookup(&inodes[p], name) >= 0))
+        r = -EEXIST;
+    if (r < 0) {
+        ns_unlock();
+        return r;
+    }
 
-    // Verificar que esté vacío (sin archivos o subdirectorios asociados)
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && i != target &&
-            strcmp(inodes[i].filename, name) == 0) {
-            return -ENOTEMPTY;
-        }
+    int idx = alloc_inode();
+    LOG_DEBUG("🔍 Inodo libre: %d", idx);
+    if (idx < 0) {
+        ns_unlock();
+        return -ENOSPC;
     }
 
-    // Borrar el inodo
-    memset(&inodes[target], 0, sizeof(inode_t));
-    save_inode(bwfs_folder, target, &inodes[target]);
-    printf("🧽 Inodo %d del directorio '%s' eliminado\n", target, name);
+    inode_wrlock(idx);
+    init_inode(&inodes[idx], name, is_dir);
+    save_inode(bwfs_folder, idx, &inodes[idx]);
+    inode_unlock(idx);
 
-    // Actualizar bitmap de inodos
-    char bpath[256];
-    snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", bwfs_folder, 1 + INODE_BLOCKS);
-    FILE *f = fopen(bpath, "r+b");
-    if (!f)
-        return -EIO;
+    inode_wrlock(p);
+    r = dir_add(&inodes[p], name, idx);
+    if (r == 0) {
+        inodes[p].modified_at = time(NULL);
+        save_inode(bwfs_folder, p, &inodes[p]);
+    }
+    inode_unlock(p);
+
+    if (r < 0) {
+        inode_wrlock(idx);
+        memset(&inodes[idx], 0, sizeof(inode_t));
+        save_inode(bwfs_folder, idx, &inodes[idx]);
+        inode_unlock(idx);
+        free_inode(idx);
+    } else {
+        inode_rdlock(idx);
+        fill_entry(idx, e);
+        inode_unlock(idx);
+        remember(idx);
+    }
+    ns_unlock();
 
-    fseek(f, -BWFS_INODES, SEEK_END);
-    uint8_t bitmap[BWFS_INODES];
-    fread(bitmap, sizeof(uint8_t), BWFS_INODES, f);
+    if (r == 0)
+        LOG_DEBUG("📌 Asignando inodo #%d para %s%s", idx, is_dir ? "" : "archivo ", name);
+    return r < 0 ? r : idx;
+}
 
-    bitmap[target] = 0;
+static void bwfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    (void) mode;
+    LOG_DEBUG("📁 mkdir: %s", name);
+    uint64_t t0 = metrics_now();
 
-    fseek(f, -BWFS_INODES, SEEK_END);
-    fwrite(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    fclose(f);
+    struct fuse_entry_param e;
+    int idx = make_node(parent, name, 1, &e);
+    metrics_op(BWFS_OP_MKDIR, t0, idx < 0);
+    if (idx < 0)
+        fuse_reply_err(req, -idx);
+    else
+        fuse_reply_entry(req, &e);
+}
 
-    printf("✅ Carpeta '%s' eliminada correctamente\n", name);
-    return 0;
+static void bwfs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                        struct fuse_file_info *fi) {
+    (void) mode;
+    LOG_DEBUG("📝 create: %s", name);
+    uint64_t t0 = metrics_now();
+
+    struct fuse_entry_param e;
+    int idx = make_node(parent, name, 0, &e);
+    int r = idx < 0 ? idx : handle_new(fi, idx);
+    metrics_op(BWFS_OP_CREATE, t0, r < 0);
+    if (r < 0) {
+        // Sin handle no hay archivo: se deshace la creación
+        if (idx >= 0)
+            unmake_node(parent, name, idx);
+        fuse_reply_err(req, -r);
+        return;
+    }
+    fi->keep_cache = kernel_caching;
+    fuse_reply_create(req, &e, fi);
 }
-int bwfs_rename(const char *from, const char *to, unsigned int flags) {
-    (void)flags;
-    printf("✏️ rename: %s → %s\n", from, to);
 
-    if (!bwfs_folder)
-        return -EIO;
+// Cuerpo de bwfs_write, con el lock de escritura del inodo tomado
+static int write_data(int i, const char *buf, size_t size, off_t offset, bwfs_handle_t *h) {
+    inode_t *inodes = inode_table_get(NULL);
 
-    if (strcmp(from, "/") == 0)
-        return -EBUSY;
+    const size_t block_size = pbm_payload_size();
+    size_t written = 0;
+    size_t remaining = size;
+    off_t current_offset = offset;
 
-    const char *name_from = from + 1;
-    const char *name_to = to + 1;
+    if (size == 0)
+        return 0;
 
-    if (strlen(name_to) == 0 || strlen(name_to) >= BWFS_FILENAME)
-        return -EINVAL;
+    if ((uint64_t)offset + size > UINT32_MAX)
+        return -EFBIG;  // inode_t.size es de 32 bits
+
+    // Los clusters comprimidos del rango vuelven a crudo y los bloques
+    // compartidos pasan a ser propios; después se reservan de una vez
+    // (contiguos si se puede) los bloques que faltan, incluido el bloque
+    // índice si el archivo pasa de los 12 directos
+    int first_idx = offset / block_size;
+    int last_idx = (offset + size - 1) / block_size;
+    int r = compress_expand(&inodes[i], first_idx, last_idx);
+    if (r >= 0) {
+        int copied = dedup_unshare(&inodes[i], offset, size);
+        r = copied < 0 ? copied : r + copied;
+    }
+    if (r > 0)
+        save_inode(bwfs_folder, i, &inodes[i]);
+    if (r >= 0)
+        r = block_map_reserve(&inodes[i], first_idx, last_idx);
+    if (r < 0)
+        return r;
+
+    while (remaining > 0) {
+        int block_idx = current_offset / block_size;
+        off_t block_offset = current_offset % block_size;
+        size_t chunk = (remaining > block_size - block_offset) ? (block_size - block_offset) : remaining;
+
+        // Queda sucio en la caché: lo escribe el hilo de write-back, flush o fsync
+        int blk = block_map_get(&inodes[i], block_idx);
+        if (blk < 0 || block_cache_write(blk, block_offset, chunk,
+                              (const unsigned char *)buf + written) != 0)
+            return -EIO;
+
+        written += chunk;
+        current_offset += chunk;
+        remaining -= chunk;
+    }
 
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+    inodes[i].size = (offset + size > inodes[i].size) ? (offset + size) : inodes[i].size;
+    inodes[i].modified_at = time(NULL);
+    save_inode(bwfs_folder, i, &inodes[i]);
+
+    if (h) {
+        pthread_mutex_lock(&h->lock);
+        h->last_block = last_idx;
+        pthread_mutex_unlock(&h->lock);
+        if (h->write_first < 0 || first_idx < h->write_first)
+            h->write_first = first_idx;
+        if (last_idx > h->write_last)
+            h->write_last = last_idx;
+    }
+    return size;
+}
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name_from) == 0) {
+static void bwfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset,
+                       struct fuse_file_info *fi) {
+    bwfs_handle_t *h = handle_of(fi);
+    uint64_t t0 = metrics_now();
+
+    ns_rdlock();
+    int i = resolve_inode(ino, fi);
+    int r = i;
+    if (i >= 0) {
+        LOG_DEBUG("✏️ write: inodo %d (offset: %ld, size: %zu)", i, offset, size);
+        inode_wrlock(i);
+        r = write_data(i, buf, size, offset, h);
+        inode_unlock(i);
+    }
+    ns_unlock();
+    release_deferred();
+
+    metrics_op(BWFS_OP_WRITE, t0, r < 0);
+    if (r < 0)
+        fuse_reply_err(req, -r);
+    else {
+        metrics_bytes(BWFS_OP_WRITE, r);
+        fuse_reply_write(req, r);
+    }
+}
 
-            // Verificar que no exista otro archivo con el nombre nuevo
-            for (int j = 0; j < count; ++j) {
-                if (inodes[j].used && strcmp(inodes[j].filename, name_to) == 0)
-                    return -EEXIST;
-            }
+// Readahead por apertura: una lectura que sigue a la anterior duplica la
+// ventana y pide al prefetch los bloques de la ventana que faltan; un salto
+// la reduce a la mitad y no pide nada
+static void readahead(int i, bwfs_handle_t *h, int first, int last) {
+    inode_t *inodes = inode_table_get(NULL);
+    size_t block_size = pbm_payload_size();
+    int nblocks = (inodes[i].size + block_size - 1) / block_size;
+
+    // La ventana se ajusta con el lock del handle; el prefetch se pide sin él
+    pthread_mutex_lock(&h->lock);
+    if (first != h->last_block && first != h->last_block + 1) {
+        h->ra_window /= 2;
+        h->ra_next = last + 1;
+        pthread_mutex_unlock(&h->lock);
+        return;
+    }
+    h->ra_window = h->ra_window ? h->ra_window * 2 : BWFS_READAHEAD_MIN;
+    if (h->ra_window > ra_max)
+        h->ra_window = ra_max;
+
+    int start = h->ra_next > last + 1 ? h->ra_next : last + 1;
+    int end = last + h->ra_window;
+    if (end >= nblocks)
+        end = nblocks - 1;
+    if (start <= end)
+        h->ra_next = end + 1;
+    pthread_mutex_unlock(&h->lock);
+    if (start > end)
+        return;
+
+    int blocks[BWFS_READAHEAD_MAX];
+    int n = 0;
+    for (int k = start; k <= end && n < BWFS_READAHEAD_MAX; ++k) {
+        int blk = block_map_get(&inodes[i], k);
+        if (blk >= 0)
+            blocks[n++] = blk;
+    }
+    block_cache_prefetch(blocks, n);
+}
 
-            // Renombrar
-            strncpy(inodes[i].filename, name_to, BWFS_FILENAME);
-            inodes[i].filename[BWFS_FILENAME - 1] = '\0';
-            inodes[i].modified_at = time(NULL);
-            save_inode(bwfs_folder, i, &inodes[i]);
+// Cuerpo de bwfs_read, con el lock de lectura del inodo tomado: varios
+// lectores del mismo archivo avanzan en paralelo
+static int read_data(int i, char *buf, size_t size, off_t offset, bwfs_handle_t *h) {
+    inode_t *inodes = inode_table_get(NULL);
 
-            printf("✅ Renombrado inodo %d: %s → %s\n", i, name_from, name_to);
-            return 0;
+    if (offset >= inodes[i].size)
+        return 0;
+
+    const size_t block_size = pbm_payload_size();
+    size_t remaining = (offset + size > inodes[i].size) ? (size_t)(inodes[i].size - offset) : size;
+    size_t read_bytes = 0;
+    off_t current_offset = offset;
+    int last_read = -1;
+
+    // Los bloques siguientes se decodifican en paralelo con esta lectura
+    if (h && remaining > 0)
+        readahead(i, h, offset / block_size, (offset + remaining - 1) / block_size);
+
+    while (remaining > 0) {
+        int block_idx = current_offset / block_size;
+        off_t block_offset = current_offset % block_size;
+        size_t chunk = (remaining > block_size - block_offset) ? (block_size - block_offset) : remaining;
+
+        // Servido desde la caché; en un fallo se decodifica el bloque entero.
+        // Un índice sin bloque es un hueco y se lee como ceros; uno de un
+        // cluster comprimido sale del cluster descomprimido.
+        if (compress_read(&inodes[i], block_idx, block_offset, chunk,
+                          (unsigned char *)buf + read_bytes) != 0) {
+            // Bloque ilegible o con CRC distinto: lectura corta, o EIO si
+            // es el primero (0 bytes se confundiría con el fin del archivo)
+            if (read_bytes == 0)
+                return -EIO;
+            break;
         }
+
+        last_read = block_idx;
+        read_bytes += chunk;
+        current_offset += chunk;
+        remaining -= chunk;
     }
 
-    return -ENOENT;
+    if (h) {
+        pthread_mutex_lock(&h->lock);
+        h->last_block = last_read;
+        pthread_mutex_unlock(&h->lock);
+    }
+    return read_bytes;
 }
-int bwfs_opendir(const char *path, struct fuse_file_info *fi) {
-    if (!bwfs_folder)
-        return -EIO;
 
-    if (strcmp(path, "/") == 0)
-        return 0;  // raíz siempre válida
+// Si la lectura sale entera de la caché (o de huecos), sin decodificar nada
+static int blocks_cached(int i, size_t size, off_t offset) {
+    inode_t *inodes = inode_table_get(NULL);
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+    if (size == 0 || offset >= inodes[i].size)
+        return 1;
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used &&
-            inodes[i].is_directory &&
-            strcmp(inodes[i].filename, name) == 0) {
-            return 0;  // Directorio válido
-        }
+    const size_t block_size = pbm_payload_size();
+    off_t end = (offset + size > inodes[i].size) ? inodes[i].size : offset + size;
+    for (int k = offset / block_size; k <= (end - 1) / (off_t)block_size; ++k) {
+        int blk = block_map_get(&inodes[i], k);
+        if (blk == BWFS_MAP_COMPRESSED || (blk >= 0 && !block_cache_contains(blk)))
+            return 0;
+    }
+    return 1;
+}
+
+// Lee y responde; en el hilo de libfuse o en uno del pool de lectura. El
+// inodo sigue siendo el mismo: el kernel tiene el archivo abierto.
+static void serve_read(fuse_req_t req, int i, size_t size, off_t offset, bwfs_handle_t *h,
+                       uint64_t t0) {
+    char *buf = malloc(size ? size : 1);
+    if (!buf) {
+        metrics_op(BWFS_OP_READ, t0, 1);
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
 
-    return -ENOENT;  // No encontrado
+    ns_rdlock();
+    inode_rdlock(i);
+    int r = read_data(i, buf, size, offset, h);
+    inode_unlock(i);
+    ns_unlock();
+
+    metrics_op(BWFS_OP_READ, t0, r < 0);
+    if (r < 0)
+        fuse_reply_err(req, -r);
+    else {
+        metrics_bytes(BWFS_OP_READ, r);
+        fuse_reply_buf(req, buf, r);
+    }
+    free(buf);
 }
-int bwfs_statfs(const char *path, struct statvfs *stbuf) {
-    (void)path;  // no lo usamos directamente
-    printf("📊 statfs solicitado\n");
 
-    if (!bwfs_folder)
-        return -EIO;
+static void bwfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                      struct fuse_file_info *fi) {
+    if (!bwfs_folder) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
 
-    memset(stbuf, 0, sizeof(struct statvfs));
+    bwfs_handle_t *h = handle_of(fi);
+    uint64_t t0 = metrics_now();
+
+    // Archivo de control: se lee de lo que quedó fijado al abrir
+    if (h && h->snapshot) {
+        size_t n = (size_t)offset < h->snapshot_len ? h->snapshot_len - offset : 0;
+        n = n < size ? n : size;
+        metrics_op(BWFS_OP_READ, t0, 0);
+        metrics_bytes(BWFS_OP_READ, n);
+        fuse_reply_buf(req, h->snapshot + (n ? offset : 0), n);
+        return;
+    }
 
-    // Cargar el superbloque
-    char superpath[256];
-    snprintf(superpath, sizeof(superpath), "%s/block_000.pbm", bwfs_folder);
-    FILE *f = fopen(superpath, "rb");
-    if (!f)
-        return -EIO;
+    ns_rdlock();
+    int i = resolve_inode(ino, fi);
+    int cached = 1;
+    if (i >= 0) {
+        LOG_DEBUG("📖 read: inodo %d (offset: %ld, size: %zu)", i, offset, size);
+        inode_rdlock(i);
+        cached = blocks_cached(i, size, offset);
+        inode_unlock(i);
+    }
+    ns_unlock();
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, size - sizeof(superblock_t), SEEK_SET);
-    superblock_t sb;
-    fread(&sb, sizeof(superblock_t), 1, f);
-    fclose(f);
+    if (i < 0) {
+        metrics_op(BWFS_OP_READ, t0, 1);
+        fuse_reply_err(req, -i);
+        return;
+    }
 
-    // Asumimos bloques de 125000 bytes útiles (1000x1000 bits)
-    stbuf->f_bsize = 125000;             // Tamaño de bloque
-    stbuf->f_frsize = 125000;            // Tamaño de fragmento
-    stbuf->f_blocks = sb.total_blocks;   // Total de bloques
-    stbuf->f_bfree = 0;                  // Lo calculamos ahora
+    // Lo que hay que decodificar responde desde el pool: este hilo vuelve a
+    // atender peticiones
+    if (!cached && read_queue_push(req, i, size, offset, h, t0))
+        return;
+    serve_read(req, i, size, offset, h, t0);
+}
 
-    // Cargar bitmap para contar bloques libres
-    char bmpath[256];
-    snprintf(bmpath, sizeof(bmpath), "%s/block_%03d.pbm", bwfs_folder, 1 + INODE_BLOCKS);
-    f = fopen(bmpath, "rb");
-    if (!f)
-        return -EIO;
+static void bwfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    LOG_DEBUG("❌ unlink: %s", name);
+    uint64_t t0 = metrics_now();
+
+    inode_t *inodes = inode_table_get(NULL);
+
+    ns_wrlock();
+    int p = from_fuse(parent);
+    int i = p < 0 ? p : check_name(name);
+    if (i == 0)
+        i = inodes[p].is_directory ? dir_lookup(&inodes[p], name) : -ENOTDIR;
+    if (i >= 0 && inodes[i].is_directory)
+        i = -EISDIR;
+    if (i >= 0) {
+        // Solo se escribe un bloque del directorio; los bloques del archivo
+        // se liberan con el inodo
+        unlink_entry(p, name);
+        drop_inode(i);
+    }
+    ns_unlock();
+
+    metrics_op(BWFS_OP_UNLINK, t0, i < 0);
+    if (i >= 0)
+        LOG_DEBUG("✅ Archivo '%s' eliminado correctamente", name);
+    fuse_reply_err(req, i < 0 ? -i : 0);
+}
 
-    fseek(f, 0, SEEK_END);
-    size = ftell(f);
-    if (size < BWFS_MAX_BLOCKS + BWFS_INODES) {
-        fclose(f);
-        return -EIO;
+static void bwfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    LOG_DEBUG("🧺 rmdir: %s", name);
+    uint64_t t0 = metrics_now();
+
+    inode_t *inodes = inode_table_get(NULL);
+
+    // Buscar el directorio en su padre
+    ns_wrlock();
+    int p = from_fuse(parent);
+    int target = p < 0 ? p : check_name(name);
+    if (target == 0)
+        target = inodes[p].is_directory ? dir_lookup(&inodes[p], name) : -ENOTDIR;
+    if (target >= 0 && !inodes[target].is_directory)
+        target = -ENOTDIR;
+
+    // Verificar que esté vacío: el inodo lleva la cuenta de entradas
+    if (target >= 0 && inodes[target].size != 0)
+        target = -ENOTEMPTY;
+    if (target >= 0) {
+        unlink_entry(p, name);
+        drop_inode(target);
     }
+    ns_unlock();
+
+    metrics_op(BWFS_OP_RMDIR, t0, target < 0);
+    if (target >= 0)
+        LOG_DEBUG("✅ Carpeta '%s' eliminada correctamente", name);
+    fuse_reply_err(req, target < 0 ? -target : 0);
+}
+
+typedef struct {
+    int target;
+    int found;
+} subtree_ctx_t;
+
+static int subtree_fill(void *ctx, const char *name, int ino, long next) {
+    (void)name;
+    (void)next;
+    subtree_ctx_t *sc = ctx;
+    inode_t *inodes = inode_table_get(NULL);
+
+    if (ino == sc->target)
+        sc->found = 1;
+    else if (inodes[ino].is_directory)
+        dir_list(&inodes[ino], 0, subtree_fill, sc);
+    return sc->found;
+}
 
-    fseek(f, size - (BWFS_MAX_BLOCKS + BWFS_INODES), SEEK_SET);
-    uint8_t block_bitmap[BWFS_MAX_BLOCKS];
-    fread(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
-    fclose(f);
+// Si `target` está dentro del directorio `dir` (a cualquier profundidad).
+// Los inodos no guardan su padre: se recorre el subárbol, con ns_lock.
+static int in_subtree(int dir, int target) {
+    subtree_ctx_t sc = { target, dir == target };
+    if (!sc.found)
+        dir_list(&inode_table_get(NULL)[dir], 0, subtree_fill, &sc);
+    return sc.found;
+}
 
-    int free_blocks = 0;
-    for (int i = 0; i < sb.total_blocks; ++i) {
-        if (block_bitmap[i] == 0)
-            free_blocks++;
+// Si `newname` ya existe se reemplaza, como rename(2): un archivo solo por
+// otro archivo y un directorio solo por otro vacío. Todo pasa en la misma
+// transacción del journal. RENAME_NOREPLACE no reemplaza; RENAME_EXCHANGE
+// y RENAME_WHITEOUT no se soportan.
+static void bwfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                        fuse_ino_t newparent, const char *newname, unsigned int flags) {
+    LOG_DEBUG("✏️ rename: %s → %s", name, newname);
+    uint64_t t0 = metrics_now();
+
+    inode_t *inodes = inode_table_get(NULL);
+
+    if (flags & ~RENAME_NOREPLACE) {
+        metrics_op(BWFS_OP_RENAME, t0, 1);
+        fuse_reply_err(req, EINVAL);
+        return;
     }
 
-    stbuf->f_bfree = free_blocks;
-    stbuf->f_bavail = free_blocks;
+    ns_wrlock();
+    int src = from_fuse(parent);
+    int dst = src < 0 ? src : from_fuse(newparent);
+    int i = dst < 0 ? dst : check_name(name);
+    if (i == 0)
+        i = check_name(newname);
+    if (i == 0 && (!inodes[src].is_directory || !inodes[dst].is_directory))
+        i = -ENOTDIR;
+    if (i == 0)
+        i = dir_lookup(&inodes[src], name);
+
+    // El destino: los archivos de control no se pisan
+    int old = -ENOENT;
+    if (i >= 0 && ctl_lookup(newparent, newname) >= 0)
+        i = (flags & RENAME_NOREPLACE) ? -EEXIST : -EACCES;
+    if (i >= 0)
+        old = dir_lookup(&inodes[dst], newname);
+    if (old >= 0 && (flags & RENAME_NOREPLACE))
+        i = -EEXIST;
+    else if (old >= 0 && old != i) {
+        if (inodes[i].is_directory && !inodes[old].is_directory)
+            i = -ENOTDIR;
+        else if (!inodes[i].is_directory && inodes[old].is_directory)
+            i = -EISDIR;
+        else if (inodes[old].is_directory && inodes[old].size != 0)
+            i = -ENOTEMPTY;
+    }
 
-    // Inodos
-    stbuf->f_files = BWFS_INODES;
-    stbuf->f_ffree = 0;
+    // Un directorio no puede moverse adentro de sí mismo
+    if (i >= 0 && inodes[i].is_directory && src != dst && in_subtree(i, dst))
+        i = -EINVAL;
+    if (i < 0 || old == i) {
+        // old == i: el mismo archivo con el mismo nombre, no hay nada que hacer
+        ns_unlock();
+        metrics_op(BWFS_OP_RENAME, t0, i < 0);
+        fuse_reply_err(req, i < 0 ? -i : 0);
+        return;
+    }
 
-    for (int i = 0; i < BWFS_INODES; ++i) {
-        if (i >= sizeof(block_bitmap)) break;  // seguridad
-        if (block_bitmap[i] == 0)
-            stbuf->f_ffree++;
+    // Alta en el destino antes de la baja en el origen: se tocan solo los
+    // bloques de la entrada en cada directorio. La entrada reemplazada sale
+    // primero y vuelve si el alta falla.
+    inode_wrlock(dst);
+    if (old >= 0)
+        dir_remove(&inodes[dst], newname);
+    int r = dir_add(&inodes[dst], newname, i);
+    if (r != 0 && old >= 0)
+        dir_add(&inodes[dst], newname, old);
+    if (r == 0) {
+        inodes[dst].modified_at = time(NULL);
+        save_inode(bwfs_folder, dst, &inodes[dst]);
     }
+    inode_unlock(dst);
 
-    return 0;
-}
+    if (r == 0) {
+        unlink_entry(src, name);
 
-int bwfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
-    (void)isdatasync;
-    (void)fi;
-    printf("🔃 fsync: %s\n", path);
+        inode_wrlock(i);
+        strncpy(inodes[i].filename, newname, BWFS_FILENAME);
+        inodes[i].filename[BWFS_FILENAME - 1] = '\0';
+        inodes[i].modified_at = time(NULL);
+        save_inode(bwfs_folder, i, &inodes[i]);
+        inode_unlock(i);
 
-    if (!bwfs_folder)
-        return -EIO;
+        // Como unlink: se libera ahora o en el último forget
+        if (old >= 0)
+            drop_inode(old);
+    }
+    ns_unlock();
 
-    return 0;
+    metrics_op(BWFS_OP_RENAME, t0, r != 0);
+    if (r == 0)
+        LOG_DEBUG("✅ Renombrado inodo %d: %s → %s%s", i, name, newname,
+                  old >= 0 ? " (reemplazó al anterior)" : "");
+    fuse_reply_err(req, -r);
 }
-    // Como no usamos buffering, no hay nada que hacer realmente.
 
-int bwfs_flush(const char *path, struct fuse_file_info *fi) {
-    (void)fi;
-    printf("🧹 flush: %s\n", path);
+static void bwfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    inode_t *inodes = inode_table_get(NULL);
+    uint64_t t0 = metrics_now();
+
+    int k = ctl_of(ino);
+    int i = k == CTL_DIR ? 0 : k >= 0 ? -ENOTDIR : -1;
+    if (k < 0) {
+        ns_rdlock();
+        i = from_fuse(ino);
+        if (i >= 0 && !inodes[i].is_directory)
+            i = -ENOTDIR;
+        ns_unlock();
+    }
 
-    return 0;
+    // Sin estado por apertura: readdir sigue desde el offset
+    fi->fh = 0;
+    metrics_op(BWFS_OP_OPENDIR, t0, i < 0);
+    if (i < 0)
+        fuse_reply_err(req, -i);
+    else
+        fuse_reply_open(req, fi);
 }
 
+static void bwfs_statfs(fuse_req_t req, fuse_ino_t ino) {
+    (void)ino;
+    LOG_DEBUG("📊 statfs solicitado");
+    uint64_t t0 = metrics_now();
 
-int bwfs_access(const char *path, int mask) {
-    printf("🔐 access: %s (mask: %d)\n", path, mask);
+    struct statvfs stbuf;
+    memset(&stbuf, 0, sizeof(struct statvfs));
 
-    if (!bwfs_folder)
-        return -EIO;
+    // Bloques de ancho x alto bits útiles según la geometría del volumen
+    stbuf.f_bsize = pbm_payload_size();   // Tamaño de bloque
+    stbuf.f_frsize = pbm_payload_size();  // Tamaño de fragmento
+    stbuf.f_blocks = volume_sb.total_blocks;
 
-    if (strcmp(path, "/") == 0)
-        return 0;  // raíz siempre accesible
+    // Contadores incrementales del asignador: sin I/O
+    stbuf.f_bfree = bitmap_free_blocks();
+    stbuf.f_bavail = stbuf.f_bfree;
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+    // Inodos
+    stbuf.f_files = volume_geometry()->total_inodes;
+    stbuf.f_ffree = bitmap_free_inodes();
+    stbuf.f_namemax = BWFS_FILENAME - 1;
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            return 0;
-        }
+    metrics_op(BWFS_OP_STATFS, t0, 0);
+    fuse_reply_statfs(req, &stbuf);
+}
+
+// Escribe los bloques sucios de este archivo, sin esperar al write-back
+// ni tocar los de los demás
+static int write_file_blocks(fuse_ino_t ino, struct fuse_file_info *fi) {
+    inode_t *inodes = inode_table_get(NULL);
+
+    ns_rdlock();
+    int i = resolve_inode(ino, fi);
+    int r = i < 0 ? i : 0;
+    if (i >= 0 && !inodes[i].is_directory) {
+        // Un solo lote: las entradas de CRC de todos se ponen en 0 juntas
+        inode_rdlock(i);
+        size_t block_size = pbm_payload_size();
+        int nblocks = (inodes[i].size + block_size - 1) / block_size;
+        int *map = malloc((nblocks ? nblocks : 1) * sizeof(int));
+        if (!map || block_map_get_range(&inodes[i], 0, nblocks, map) != 0 ||
+            block_cache_sync_blocks(map, nblocks) != 0)
+            r = -EIO;
+        free(map);
+        inode_unlock(i);
     }
+    ns_unlock();
+    return r;
+}
 
-    return -ENOENT;
+static void bwfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    (void)datasync;
+    LOG_DEBUG("🔃 fsync: inodo %lu", (unsigned long)ino);
+    uint64_t t0 = metrics_now();
+
+    // Datos a disco y el journal durable: los metadatos del archivo ya están
+    // en el journal, el checkpoint los lleva a su lugar más tarde. Los
+    // archivos de control no tienen nada que escribir.
+    bwfs_handle_t *h = handle_of(fi);
+    int r = h && h->snapshot ? 0 : write_file_blocks(ino, fi);
+    if (r == 0 && !(h && h->snapshot) && (block_store_sync() != 0 || journal_commit(1) != 0))
+        r = -EIO;
+
+    metrics_op(BWFS_OP_FSYNC, t0, r != 0);
+    fuse_reply_err(req, -r);
 }
 
-off_t bwfs_lseek(const char *path, off_t offset, int whence, struct fuse_file_info *fi) {
-    (void)fi;
-    printf("📍 lseek: %s (offset: %ld, whence: %d)\n", path, offset, whence);
+static void bwfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    LOG_DEBUG("🧹 flush: inodo %lu", (unsigned long)ino);
+    uint64_t t0 = metrics_now();
 
-    if (!bwfs_folder)
-        return -EIO;
+    bwfs_handle_t *h = handle_of(fi);
+    int r = 0;
+    if (!(h && h->snapshot)) {
+        r = write_file_blocks(ino, fi);
+        if (r == 0 && journal_commit(0) != 0)
+            r = -EIO;
+    }
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+    metrics_op(BWFS_OP_FLUSH, t0, r != 0);
+    fuse_reply_err(req, -r);
+}
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used && strcmp(inodes[i].filename, name) == 0) {
-            off_t result = 0;
-
-            switch (whence) {
-                case SEEK_SET:
-                    result = offset;
-                    break;
-                case SEEK_CUR:
-                    result = fi->fh + offset;
-                    break;
-                case SEEK_END:
-                    result = inodes[i].size + offset;
-                    break;
-                default:
-                    return -EINVAL;
-            }
+static void bwfs_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+    LOG_DEBUG("🔐 access: inodo %lu (mask: %d)", (unsigned long)ino, mask);
 
-            if (result < 0)
-                return -EINVAL;
+    uint64_t t0 = metrics_now();
 
-            return result;
+    // Los archivos de control son de solo lectura
+    int i = ctl_of(ino) < 0 ? from_fuse(ino) : (mask & W_OK) ? -EACCES : 0;
+    metrics_op(BWFS_OP_ACCESS, t0, i < 0);
+    fuse_reply_err(req, i < 0 ? -i : 0);
+}
+
+// SEEK_DATA/SEEK_HOLE sobre el mapa de bloques (el kernel resuelve solo
+// los demás whence): un índice sin bloque es hueco, uno cubierto por un
+// cluster comprimido tiene datos. Detrás del tamaño hay un hueco implícito.
+static off_t seek_data_hole(const inode_t *inode, off_t offset, int whence) {
+    if (offset < 0 || (uint64_t)offset >= inode->size)
+        return -ENXIO;
+
+    size_t payload = pbm_payload_size();
+    int nblocks = (inode->size + payload - 1) / payload;
+    int map[BWFS_SEEK_BATCH];
+    for (int b0 = offset / payload; b0 < nblocks; b0 += BWFS_SEEK_BATCH) {
+        int n = nblocks - b0 < BWFS_SEEK_BATCH ? nblocks - b0 : BWFS_SEEK_BATCH;
+        if (block_map_get_range(inode, b0, n, map) != 0)
+            return -EIO;
+        for (int k = 0; k < n; ++k) {
+            int data = map[k] >= 0 || map[k] == BWFS_MAP_COMPRESSED;
+            if (data != (whence == SEEK_DATA))
+                continue;
+            off_t pos = (off_t)(b0 + k) * payload;
+            return pos > offset ? pos : offset;
         }
     }
-
-    return -ENOENT;
+    return whence == SEEK_DATA ? -ENXIO : (off_t)inode->size;
 }
-int bwfs_open(const char *path, struct fuse_file_info *fi) {
-    printf("📂 open: %s\n", path);
 
-    if (!bwfs_folder)
-        return -EIO;
+static void bwfs_lseek(fuse_req_t req, fuse_ino_t ino, off_t offset, int whence,
+                       struct fuse_file_info *fi) {
+    LOG_DEBUG("📍 lseek: inodo %lu (offset: %ld, whence: %d)", (unsigned long)ino, offset, whence);
+
+    inode_t *inodes = inode_table_get(NULL);
+    uint64_t t0 = metrics_now();
+
+    ns_rdlock();
+    int i = resolve_inode(ino, fi);
+    off_t result = i;
+    if (i >= 0) {
+        inode_rdlock(i);
+        if (inodes[i].is_directory || (whence != SEEK_DATA && whence != SEEK_HOLE))
+            result = -EINVAL;
+        else
+            result = seek_data_hole(&inodes[i], offset, whence);
+        inode_unlock(i);
+    }
+    ns_unlock();
+
+    metrics_op(BWFS_OP_LSEEK, t0, result < 0);
+    if (result < 0)
+        fuse_reply_err(req, (int)-result);
+    else
+        fuse_reply_lseek(req, result);
+}
 
-    if (strcmp(path, "/") == 0)
+// Abre stats o log: el contenido se fija en el handle y se lee sin pasar
+// por las páginas del kernel, así el tamaño 0 de getattr no lo corta
+static int open_ctl(int k, struct fuse_file_info *fi) {
+    if (k == CTL_DIR)
         return -EISDIR;
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EACCES;
+
+    int r = handle_new(fi, -EACCES);
+    if (r == 0) {
+        r = ctl_snapshot(k, handle_of(fi));
+        if (r < 0) {
+            free(handle_of(fi));
+            fi->fh = 0;
+        }
+    }
+    fi->direct_io = 1;
+    fi->keep_cache = 0;
+    return r;
+}
 
-    const char *name = path + 1;
-    inode_t inodes[BWFS_INODES];
-    int count = load_inodes(bwfs_folder, inodes);
+static void bwfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    inode_t *inodes = inode_table_get(NULL);
+    uint64_t t0 = metrics_now();
+
+    int k = ctl_of(ino);
+    if (k >= 0) {
+        int r = open_ctl(k, fi);
+        metrics_op(BWFS_OP_OPEN, t0, r < 0);
+        if (r < 0)
+            fuse_reply_err(req, -r);
+        else
+            fuse_reply_open(req, fi);
+        return;
+    }
 
-    for (int i = 0; i < count; ++i) {
-        if (inodes[i].used &&
-            strcmp(inodes[i].filename, name) == 0 &&
-            !inodes[i].is_directory) {
-            // Podés guardar info en fi->fh si lo necesitás luego
-            return 0;
+    ns_rdlock();
+    int i = from_fuse(ino);
+    int keep = kernel_caching;
+    if (i >= 0 && inodes[i].is_directory)
+        i = -EISDIR;
+    if (i >= 0) {
+        LOG_DEBUG("📂 open: inodo %d", i);
+
+        // auto_cache: las páginas del kernel sirven si el archivo no cambió
+        // desde la apertura anterior
+        if (auto_caching) {
+            inode_rdlock(i);
+            pthread_mutex_lock(&lookup_lock);
+            ino_state_t *s = &ino_state[i];
+            keep = s->seen_mtime == inodes[i].modified_at && s->seen_size == inodes[i].size;
+            s->seen_mtime = inodes[i].modified_at;
+            s->seen_size = inodes[i].size;
+            pthread_mutex_unlock(&lookup_lock);
+            inode_unlock(i);
         }
     }
+    ns_unlock();
 
-    return -ENOENT;
+    int r = i < 0 ? i : handle_new(fi, i);
+    metrics_op(BWFS_OP_OPEN, t0, r < 0);
+    if (r < 0) {
+        fuse_reply_err(req, -r);
+        return;
+    }
+    fi->keep_cache = keep;
+    fuse_reply_open(req, fi);
+}
+
+// Comprime los clusters que escribió una apertura y después busca
+// duplicados entre los bloques que quedaron (también los comprimidos). El
+// kernel no espera la respuesta de release, así que close() no lo paga.
+static void pack_written(bwfs_handle_t *h) {
+    inode_t *inodes = inode_table_get(NULL);
+    int i = h->ino;
+
+    ns_rdlock();
+    inode_wrlock(i);
+    if (inodes[i].used && !inodes[i].is_directory) {
+        int r = compress_range(&inodes[i], h->write_first, h->write_last);
+        if (r < 0)
+            LOG_WARN("⚠️ No se pudo comprimir el inodo %d: %s", i, strerror(-r));
+        else if (r > 0)
+            LOG_DEBUG("🗜️ Inodo %d: %d clusters comprimidos", i, r);
+        int d = dedup_range(&inodes[i], h->write_first, h->write_last);
+        if (d < 0)
+            LOG_WARN("⚠️ No se pudo deduplicar el inodo %d: %s", i, strerror(-d));
+        else if (d > 0)
+            LOG_DEBUG("🔗 Inodo %d: %d bloques deduplicados", i, d);
+        if (r != 0 || d != 0)
+            save_inode(bwfs_folder, i, &inodes[i]);
+    }
+    inode_unlock(i);
+    ns_unlock();
+    release_deferred();
+}
+
+static void bwfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    (void)ino;
+    uint64_t t0 = metrics_now();
+
+    bwfs_handle_t *h = handle_of(fi);
+    if (h && h->write_last >= 0 && (compress_enabled() || dedup_enabled()))
+        pack_written(h);
+    if (h) {
+        free(h->snapshot);
+        pthread_mutex_destroy(&h->lock);
+    }
+    free(h);
+    fi->fh = 0;
+    metrics_op(BWFS_OP_RELEASE, t0, 0);
+    fuse_reply_err(req, 0);
 }
+
+const struct fuse_lowlevel_ops bwfs_ll_ops = {
+    .init = bwfs_init,
+    .destroy = bwfs_destroy,
+    .lookup = bwfs_lookup,
+    .forget = bwfs_forget,
+    .forget_multi = bwfs_forget_multi,
+    .getattr = bwfs_getattr,
+    .setattr = bwfs_setattr,
+    .readdir = bwfs_readdir,
+    .readdirplus = bwfs_readdirplus,
+    .mkdir = bwfs_mkdir,
+    .create = bwfs_create,
+    .write = bwfs_write,
+    .read = bwfs_read,
+    .unlink = bwfs_unlink,
+    .rmdir = bwfs_rmdir,
+    .rename = bwfs_rename,
+    .opendir = bwfs_opendir,
+    .statfs = bwfs_statfs,
+    .access = bwfs_access,
+    .lseek = bwfs_lseek,
+    .open = bwfs_open,
+    .release = bwfs_release,
+    .flush = bwfs_flush,
+    .fsync = bwfs_fsync,
+};
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "../includes/journal.h"
+#include "../includes/utils.h"
+#include "../includes/bitmap.h"
+#include "../includes/block_cache.h"
+#include "../includes/dedup.h"
+
+#define BWFS_JOURNAL_MAGIC 0x4a574642  // 'BFWJ'
+
+// Cabecera de cada transacción en el archivo
+typedef struct {
+    uint32_t magic;
+    uint32_t len;           // bytes de registros que siguen
+    uint64_t seq;
+    uint32_t checksum;      // de los registros
+    uint32_t nrec;
+} journal_txn_t;
+
+// Transacción en curso del hilo
+static __thread unsigned char *tx_buf = NULL;
+static __thread size_t tx_len = 0, tx_cap = 0;
+static __thread uint32_t tx_nrec = 0;
+static __thread int tx_depth = 0;
+
+// jlock protege la cola, los contadores y el archivo. Quien escribe la
+// cola (committing) lo hace sin el lock; los demás esperan en jcond y,
+// si su transacción ya salió en esa escritura, no escriben nada.
+static pthread_mutex_t jlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jcond = PTHREAD_COND_INITIALIZER;
+static int journal_fd = -1;
+static unsigned char *pending = NULL;
+static size_t pending_len = 0, pending_cap = 0;
+static uint64_t next_seq = 0;       // última transacción encolada
+static uint64_t written_seq = 0;    // última escrita en el archivo
+static uint64_t durable_seq = 0;    // última con fdatasync
+static size_t journal_bytes = 0;    // tamaño del archivo desde el último reset
+static int committing = 0;
+
+static uint32_t checksum(const unsigned char *p, size_t len) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int reserve(unsigned char **buf, size_t *cap, size_t need) {
+    if (need <= *cap)
+        return 0;
+    size_t cap2 = *cap ? *cap : 4096;
+    while (cap2 < need)
+        cap2 *= 2;
+    unsigned char *p = realloc(*buf, cap2);
+    if (!p)
+        return -1;
+    *buf = p;
+    *cap = cap2;
+    return 0;
+}
+
+static void journal_path(char *out, size_t size, const char *folder) {
+    snprintf(out, size, "%s/%s", folder, BWFS_JOURNAL_FILE);
+}
+
+int journal_open(const char *folder) {
+    char path[256];
+    journal_path(path, sizeof(path), folder);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    pthread_mutex_lock(&jlock);
+    __atomic_store_n(&journal_fd, fd, __ATOMIC_RELEASE);
+    journal_bytes = fstat(fd, &st) == 0 ? st.st_size : 0;
+    written_seq = durable_seq = next_seq;
+    pthread_mutex_unlock(&jlock);
+    return 0;
+}
+
+void journal_close(void) {
+    pthread_mutex_lock(&jlock);
+    if (journal_fd >= 0)
+        close(journal_fd);
+    __atomic_store_n(&journal_fd, -1, __ATOMIC_RELEASE);
+    free(pending);
+    pending = NULL;
+    pending_len = pending_cap = 0;
+    pthread_mutex_unlock(&jlock);
+}
+
+void journal_begin(void) {
+    tx_depth++;
+}
+
+// Encola la transacción del hilo entera: la cola solo tiene transacciones
+// completas, así cualquier escritura de la cola es un prefijo consistente
+int journal_end(void) {
+    if (tx_depth > 0 && --tx_depth > 0)
+        return 0;
+    if (tx_len == 0)
+        return 0;
+
+    journal_txn_t txn = { BWFS_JOURNAL_MAGIC, (uint32_t)tx_len, 0,
+                          checksum(tx_buf, tx_len), tx_nrec };
+
+    int queued = 0;
+    pthread_mutex_lock(&jlock);
+    if (journal_fd >= 0 &&
+        reserve(&pending, &pending_cap, pending_len + sizeof(txn) + tx_len) == 0) {
+        txn.seq = ++next_seq;
+        memcpy(pending + pending_len, &txn, sizeof(txn));
+        memcpy(pending + pending_len + sizeof(txn), tx_buf, tx_len);
+        pending_len += sizeof(txn) + tx_len;
+        queued = 1;
+    }
+    pthread_mutex_unlock(&jlock);
+
+    tx_len = 0;
+    tx_nrec = 0;
+    if (tx_cap > 1024 * 1024) {
+        free(tx_buf);
+        tx_buf = NULL;
+        tx_cap = 0;
+    }
+    return queued;
+}
+
+static void log_record(uint32_t type, uint32_t target, uint32_t offset,
+                       const void *data, size_t len) {
+    if (__atomic_load_n(&journal_fd, __ATOMIC_ACQUIRE) < 0)
+        return;
+
+    // Fuera de una operación el registro va solo en su transacción
+    journal_begin();
+    journal_rec_t rec = { type, target, offset, (uint32_t)len };
+    if (reserve(&tx_buf, &tx_cap, tx_len + sizeof(rec) + len) == 0) {
+        memcpy(tx_buf + tx_len, &rec, sizeof(rec));
+        if (len)
+            memcpy(tx_buf + tx_len + sizeof(rec), data, len);
+        tx_len += sizeof(rec) + len;
+        tx_nrec++;
+    }
+    journal_end();
+}
+
+void journal_log_inode(int ino, const inode_t *inode) {
+    log_record(JREC_INODE, ino, 0, inode, sizeof(inode_t));
+}
+
+void journal_log_bit(int type, int index, int used) {
+    log_record(type, index, used ? 1 : 0, NULL, 0);
+}
+
+void journal_log_block(int block, size_t offset, size_t len, const void *data) {
+    log_record(JREC_BLOCK, block, offset, data, len);
+}
+
+void journal_log_zero(int block) {
+    log_record(JREC_ZERO, block, 0, NULL, 0);
+}
+
+void journal_log_dedup(int block, uint32_t refs, uint32_t fingerprint) {
+    log_record(JREC_DEDUP, block, refs, &fingerprint, sizeof(fingerprint));
+}
+
+static int write_all(int fd, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Escribe todo lo encolado hasta ahora. Un solo hilo escribe a la vez; los
+// que llegan mientras tanto esperan y lo más probable es que su
+// transacción ya haya salido con la del que estaba escribiendo.
+int journal_commit(int durable) {
+    pthread_mutex_lock(&jlock);
+    if (journal_fd < 0) {
+        pthread_mutex_unlock(&jlock);
+        return 0;
+    }
+
+    uint64_t target = next_seq;
+    for (;;) {
+        if ((durable ? durable_seq : written_seq) >= target) {
+            pthread_mutex_unlock(&jlock);
+            return 0;
+        }
+        if (!committing)
+            break;
+        pthread_cond_wait(&jcond, &jlock);
+    }
+
+    committing = 1;
+    unsigned char *buf = pending;
+    size_t len = pending_len;
+    uint64_t upto = next_seq;
+    pending = NULL;
+    pending_len = pending_cap = 0;
+    int fd = journal_fd;
+    pthread_mutex_unlock(&jlock);
+
+    int r = write_all(fd, buf, len);
+    if (r == 0 && durable)
+        r = fdatasync(fd);
+
+    pthread_mutex_lock(&jlock);
+    if (r == 0) {
+        written_seq = upto;
+        if (durable)
+            durable_seq = upto;
+        journal_bytes += len;
+        free(buf);
+    } else if (buf) {
+        // Vuelve al frente de la cola para el próximo intento
+        unsigned char *merged = malloc(len + pending_len);
+        if (merged) {
+            memcpy(merged, buf, len);
+            if (pending_len)
+                memcpy(merged + len, pending, pending_len);
+            free(pending);
+            pending = merged;
+            pending_len += len;
+            pending_cap = pending_len;
+        }
+        free(buf);
+    }
+    committing = 0;
+    pthread_cond_broadcast(&jcond);
+    pthread_mutex_unlock(&jlock);
+    return r == 0 ? 0 : -1;
+}
+
+int journal_needs_checkpoint(void) {
+    pthread_mutex_lock(&jlock);
+    int r = journal_fd >= 0 && journal_bytes + pending_len > BWFS_JOURNAL_CHECKPOINT_BYTES;
+    pthread_mutex_unlock(&jlock);
+    return r;
+}
+
+// Tras un checkpoint completo: todo lo del journal ya está en su lugar
+int journal_reset(void) {
+    pthread_mutex_lock(&jlock);
+    int r = 0;
+    if (journal_fd >= 0) {
+        r = ftruncate(journal_fd, 0) == 0 && fdatasync(journal_fd) == 0 ? 0 : -1;
+        if (r == 0)
+            journal_bytes = 0;
+    }
+    pthread_mutex_unlock(&jlock);
+    return r;
+}
+
+typedef struct {
+    uint32_t block;
+    uint32_t txn;           // índice de la última transacción que lo liberó
+} revoke_t;
+
+static int cmp_revoke(const void *a, const void *b) {
+    const revoke_t *x = a, *y = b;
+    if (x->block != y->block)
+        return x->block < y->block ? -1 : 1;
+    return x->txn < y->txn ? -1 : x->txn > y->txn;
+}
+
+// Última liberación del bloque, o -1
+static long last_revoke(const revoke_t *v, size_t n, uint32_t block) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (v[mid].block <= block)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && v[lo - 1].block == block ? (long)v[lo - 1].txn : -1;
+}
+
+int journal_replay(const char *folder, journal_apply_t fn, void *ctx) {
+    char path[256];
+    journal_path(path, sizeof(path), folder);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return errno == ENOENT ? 0 : -1;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *all = size > 0 ? malloc(size) : NULL;
+    if (size > 0 && (!all || fread(all, 1, size, f) != (size_t)size)) {
+        free(all);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    // Prefijo válido: se corta en la primera transacción incompleta o con
+    // checksum inválido (escritura interrumpida)
+    size_t valid = 0;
+    uint32_t ntxn = 0;
+    size_t nrevoke = 0;
+    while (valid + sizeof(journal_txn_t) <= (size_t)size) {
+        journal_txn_t txn;
+        memcpy(&txn, all + valid, sizeof(txn));
+        if (txn.magic != BWFS_JOURNAL_MAGIC ||
+            txn.len > (size_t)size - valid - sizeof(txn) ||
+            checksum(all + valid + sizeof(txn), txn.len) != txn.checksum)
+            break;
+        if (txn.seq > next_seq)
+            next_seq = txn.seq;
+        valid += sizeof(txn) + txn.len;
+        nrevoke += txn.nrec;
+        ntxn++;
+    }
+
+    revoke_t *revokes = malloc((nrevoke ? nrevoke : 1) * sizeof(revoke_t));
+    if (!revokes) {
+        free(all);
+        return -1;
+    }
+
+    // Primera pasada: bloques liberados y en qué transacción
+    size_t n = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t pos = 0;
+        for (uint32_t t = 0; t < ntxn; ++t) {
+            journal_txn_t txn;
+            memcpy(&txn, all + pos, sizeof(txn));
+            size_t p = pos + sizeof(txn), end = p + txn.len;
+            while (p + sizeof(journal_rec_t) <= end) {
+                journal_rec_t rec;
+                memcpy(&rec, all + p, sizeof(rec));
+                const unsigned char *data = all + p + sizeof(rec);
+                if (rec.len > end - p - sizeof(rec))
+                    break;
+                p += sizeof(rec) + rec.len;
+
+                if (pass == 0) {
+                    if (rec.type == JREC_BLOCK_BIT && rec.offset == 0)
+                        revokes[n++] = (revoke_t){ rec.target, t };
+                    continue;
+                }
+                if ((rec.type == JREC_BLOCK || rec.type == JREC_ZERO) &&
+                    last_revoke(revokes, n, rec.target) > (long)t)
+                    continue;
+                fn(&rec, data, ctx);
+            }
+            pos = end;
+        }
+        if (pass == 0)
+            qsort(revokes, n, sizeof(revoke_t), cmp_revoke);
+    }
+
+    free(revokes);
+    free(all);
+    return (int)ntxn;
+}
+
+void journal_apply(const journal_rec_t *rec, const void *data, void *ctx) {
+    const char *folder = ctx;
+    int count;
+    inode_t *inodes = inode_table_get(&count);
+
+    switch (rec->type) {
+        case JREC_INODE:
+            if (rec->target < (uint32_t)count && rec->len == sizeof(inode_t)) {
+                memcpy(&inodes[rec->target], data, sizeof(inode_t));
+                save_inode(folder, rec->target, &inodes[rec->target]);
+            }
+            break;
+        case JREC_BLOCK_BIT:
+        case JREC_INODE_BIT:
+            bitmap_restore(rec->type == JREC_INODE_BIT, rec->target, rec->offset);
+            break;
+        case JREC_BLOCK:
+            if (rec->target < volume_geometry()->total_blocks)
+                block_cache_write_meta(rec->target, rec->offset, rec->len, data);
+            break;
+        case JREC_ZERO:
+            if (rec->target < volume_geometry()->total_blocks)
+                block_cache_zero_meta(rec->target);
+            break;
+        case JREC_DEDUP:
+            if (rec->len == sizeof(uint32_t)) {
+                uint32_t fingerprint;
+                memcpy(&fingerprint, data, sizeof(fingerprint));
+                dedup_restore(rec->target, rec->offset, fingerprint);
+            }
+            break;
+    }
+}
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "../includes/ll_client.h"
+
+// Lado del kernel sin libfuse: las fuse_reply_* y fuse_add_direntry* que
+// usa fuse_ops.c. Cada petición espera su respuesta, que puede llegar
+// desde otro hilo (las lecturas del pool de lectura).
+
+#define LL_READDIR_BUF 65536
+
+struct fuse_req {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    int done;
+    int err;
+    struct fuse_entry_param e;
+    struct fuse_file_info fi;
+    size_t count;           // write: bytes escritos; read: bytes copiados
+    char *out;              // read: destino de fuse_reply_buf
+    size_t out_size;
+    int entries;            // readdir: entradas que entraron en el buffer
+    off_t last_off;
+};
+
+/* ---------- Lado del kernel ---------- */
+
+static void req_init(struct fuse_req *r) {
+    memset(r, 0, sizeof(*r));
+    pthread_mutex_init(&r->m, NULL);
+    pthread_cond_init(&r->c, NULL);
+}
+
+static void req_done(struct fuse_req *r) {
+    pthread_mutex_lock(&r->m);
+    r->done = 1;
+    pthread_cond_signal(&r->c);
+    pthread_mutex_unlock(&r->m);
+}
+
+// Espera la respuesta; 0 o -errno
+static int req_wait(struct fuse_req *r) {
+    pthread_mutex_lock(&r->m);
+    while (!r->done)
+        pthread_cond_wait(&r->c, &r->m);
+    pthread_mutex_unlock(&r->m);
+    pthread_mutex_destroy(&r->m);
+    pthread_cond_destroy(&r->c);
+    return -r->err;
+}
+
+int fuse_reply_err(fuse_req_t req, int err) {
+    req->err = err;
+    req_done(req);
+    return 0;
+}
+
+void fuse_reply_none(fuse_req_t req) {
+    req_done(req);
+}
+
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e) {
+    req->e = *e;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                      const struct fuse_file_info *fi) {
+    req->e = *e;
+    req->fi = *fi;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_attr(fuse_req_t req, const struct stat *attr, double attr_timeout) {
+    (void)attr_timeout;
+    req->e.attr = *attr;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi) {
+    req->fi = *fi;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_write(fuse_req_t req, size_t count) {
+    req->count = count;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size) {
+    if (req->out) {
+        req->count = size < req->out_size ? size : req->out_size;
+        memcpy(req->out, buf, req->count);
+    }
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_statfs(fuse_req_t req, const struct statvfs *stbuf) {
+    (void)stbuf;
+    req_done(req);
+    return 0;
+}
+
+int fuse_reply_lseek(fuse_req_t req, off_t off) {
+    req->last_off = off;
+    req_done(req);
+    return 0;
+}
+
+// Mismo tamaño que las entradas de libfuse (cabecera + nombre, alineado a
+// 8), así readdir corta el buffer donde lo cortaría con el kernel
+static size_t add_entry(fuse_req_t req, size_t header, size_t bufsize, const char *name,
+                        off_t off) {
+    size_t len = (header + strlen(name) + 7) & ~(size_t)7;
+    if (len <= bufsize) {
+        req->entries++;
+        req->last_off = off;
+    }
+    return len;
+}
+
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize, const char *name,
+                         const struct stat *stbuf, off_t off) {
+    (void)buf;
+    (void)stbuf;
+    return add_entry(req, 24, bufsize, name, off);
+}
+
+size_t fuse_add_direntry_plus(fuse_req_t req, char *buf, size_t bufsize, const char *name,
+                              const struct fuse_entry_param *e, off_t off) {
+    (void)buf;
+    (void)e;
+    return add_entry(req, 24 + 128, bufsize, name, off);
+}
+
+/* ---------- Operaciones como las pediría el kernel ---------- */
+
+int ll_create(fuse_ino_t parent, const char *name, fuse_ino_t *ino, uint64_t *fh) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .flags = O_RDWR | O_CREAT };
+    req_init(&r);
+    bwfs_ll_ops.create(&r, parent, name, 0644, &fi);
+    int err = req_wait(&r);
+    *ino = r.e.ino;
+    *fh = r.fi.fh;
+    return err;
+}
+
+int ll_mkdir(fuse_ino_t parent, const char *name, fuse_ino_t *ino) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.mkdir(&r, parent, name, 0755);
+    int err = req_wait(&r);
+    *ino = r.e.ino;
+    return err;
+}
+
+int ll_lookup(fuse_ino_t parent, const char *name, fuse_ino_t *ino) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.lookup(&r, parent, name);
+    int err = req_wait(&r);
+    *ino = r.e.ino;
+    return err ? err : r.e.ino ? 0 : -ENOENT;
+}
+
+void ll_forget(fuse_ino_t ino, uint64_t nlookup) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.forget(&r, ino, nlookup);
+    req_wait(&r);
+}
+
+int ll_getattr(fuse_ino_t ino, struct stat *st) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.getattr(&r, ino, NULL);
+    int err = req_wait(&r);
+    if (st)
+        *st = r.e.attr;
+    return err;
+}
+
+int ll_open(fuse_ino_t ino, int flags, uint64_t *fh) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .flags = flags };
+    req_init(&r);
+    bwfs_ll_ops.open(&r, ino, &fi);
+    int err = req_wait(&r);
+    *fh = r.fi.fh;
+    return err;
+}
+
+int ll_release(fuse_ino_t ino, uint64_t fh) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .fh = fh };
+    req_init(&r);
+    bwfs_ll_ops.release(&r, ino, &fi);
+    return req_wait(&r);
+}
+
+int ll_fsync(fuse_ino_t ino, uint64_t fh) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .fh = fh };
+    req_init(&r);
+    bwfs_ll_ops.fsync(&r, ino, 0, &fi);
+    return req_wait(&r);
+}
+
+// Bytes escritos o leídos, o -errno
+long ll_write(fuse_ino_t ino, uint64_t fh, const char *buf, size_t size, off_t off) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .fh = fh };
+    req_init(&r);
+    bwfs_ll_ops.write(&r, ino, buf, size, off, &fi);
+    int err = req_wait(&r);
+    return err ? err : (long)r.count;
+}
+
+long ll_read(fuse_ino_t ino, uint64_t fh, char *buf, size_t size, off_t off) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .fh = fh };
+    req_init(&r);
+    r.out = buf;
+    r.out_size = size;
+    bwfs_ll_ops.read(&r, ino, size, off, &fi);
+    int err = req_wait(&r);
+    return err ? err : (long)r.count;
+}
+
+off_t ll_lseek(fuse_ino_t ino, uint64_t fh, off_t off, int whence) {
+    struct fuse_req r;
+    struct fuse_file_info fi = { .fh = fh };
+    req_init(&r);
+    bwfs_ll_ops.lseek(&r, ino, off, whence, &fi);
+    int err = req_wait(&r);
+    return err ? err : r.last_off;
+}
+
+int ll_unlink(fuse_ino_t parent, const char *name) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.unlink(&r, parent, name);
+    return req_wait(&r);
+}
+
+int ll_rmdir(fuse_ino_t parent, const char *name) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.rmdir(&r, parent, name);
+    return req_wait(&r);
+}
+
+int ll_rename(fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname,
+              unsigned int flags) {
+    struct fuse_req r;
+    req_init(&r);
+    bwfs_ll_ops.rename(&r, parent, name, newparent, newname, flags);
+    return req_wait(&r);
+}
+
+// Lista el directorio entero como lo haría ls (sin . ni ..); entradas o -errno
+long ll_readdir(fuse_ino_t ino) {
+    struct fuse_file_info fi = { 0 };
+    long total = 0;
+    off_t off = 0;
+
+    for (;;) {
+        struct fuse_req r;
+        req_init(&r);
+        bwfs_ll_ops.readdir(&r, ino, LL_READDIR_BUF, off, &fi);
+        int err = req_wait(&r);
+        if (err)
+            return err;
+        if (r.entries == 0)
+            break;
+        total += r.entries;
+        off = r.last_off;
+    }
+    return total > 2 ? total - 2 : 0;
+}
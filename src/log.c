@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../includes/log.h"
+
+// Anillo sin lock: cada mensaje toma su número con un fetch_add y escribe
+// su línea. seq = número + 1 cuando la línea está completa, 0 mientras se
+// escribe; quien lee descarta las líneas que cambiaron mientras copiaba.
+typedef struct {
+    uint64_t seq;
+    char text[BWFS_LOG_LINE_SIZE];
+} log_line_t;
+
+static log_line_t ring[BWFS_LOG_RING_LINES];
+static uint64_t next_line = 0;
+static int out_level = BWFS_LOG_INFO;
+
+static const char level_tag[] = "?EWID";
+
+void bwfs_log_set_level(int level) {
+    if (level < BWFS_LOG_ERROR || level > BWFS_LOG_DEBUG)
+        level = BWFS_LOG_INFO;
+    __atomic_store_n(&out_level, level, __ATOMIC_RELAXED);
+}
+
+void bwfs_log(int level, const char *fmt, ...) {
+    char msg[BWFS_LOG_LINE_SIZE];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    if (level <= __atomic_load_n(&out_level, __ATOMIC_RELAXED)) {
+        FILE *f = level <= BWFS_LOG_WARN ? stderr : stdout;
+        fprintf(f, "%s\n", msg);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct tm tm;
+    localtime_r(&ts.tv_sec, &tm);
+
+    uint64_t n = __atomic_fetch_add(&next_line, 1, __ATOMIC_RELAXED);
+    log_line_t *l = &ring[n % BWFS_LOG_RING_LINES];
+    __atomic_store_n(&l->seq, 0, __ATOMIC_RELEASE);
+    // Prefijo de hora y nivel; el mensaje se corta si no entra en la línea
+    int w = snprintf(l->text, sizeof(l->text), "%02d:%02d:%02d.%03ld %c ", tm.tm_hour % 24,
+                     tm.tm_min % 60, tm.tm_sec % 61, ts.tv_nsec / 1000000,
+                     level_tag[level >= 1 && level <= 4 ? level : 0]);
+    size_t used = w > 0 && (size_t)w < sizeof(l->text) ? (size_t)w : 0;
+    size_t mlen = strnlen(msg, sizeof(l->text) - used - 1);
+    memcpy(l->text + used, msg, mlen);
+    l->text[used + mlen] = '\0';
+    __atomic_store_n(&l->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+size_t bwfs_log_dump(char *out, size_t size) {
+    uint64_t end = __atomic_load_n(&next_line, __ATOMIC_RELAXED);
+    uint64_t start = end > BWFS_LOG_RING_LINES ? end - BWFS_LOG_RING_LINES : 0;
+    char text[BWFS_LOG_LINE_SIZE];
+    size_t len = 0;
+
+    for (uint64_t n = start; n < end; ++n) {
+        log_line_t *l = &ring[n % BWFS_LOG_RING_LINES];
+        if (__atomic_load_n(&l->seq, __ATOMIC_ACQUIRE) != n + 1)
+            continue;
+        memcpy(text, l->text, sizeof(text));
+        if (__atomic_load_n(&l->seq, __ATOMIC_ACQUIRE) != n + 1)
+            continue;
+        text[sizeof(text) - 1] = '\0';
+
+        int w = snprintf(out ? out + (len < size ? len : size) : NULL,
+                         len < size ? size - len : 0, "%s\n", text);
+        if (w > 0)
+            len += w;
+    }
+    return len;
+}
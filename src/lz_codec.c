@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../includes/lz_codec.h"
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5         // los últimos 5 bytes van siempre como literales
+#define MATCH_LIMIT   12        // un match no empieza en los últimos 12 bytes
+#define MAX_OFFSET    65535
+#define HASH_LOG      14
+#define SKIP_TRIGGER  6         // cada 2^6 fallos seguidos se avanza un byte más
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Bytes iguales desde p y q, sin pasar de `limit` (de a 8 mientras se pueda)
+static size_t common_length(const unsigned char *p, const unsigned char *q,
+                            const unsigned char *limit) {
+    const unsigned char *start = p;
+    while (p + 8 <= limit) {
+        uint64_t diff = read64(p) ^ read64(q);
+        if (diff)
+            return p - start + (__builtin_ctzll(diff) >> 3);
+        p += 8;
+        q += 8;
+    }
+    while (p < limit && *p == *q) {
+        p++;
+        q++;
+    }
+    return p - start;
+}
+
+// Extensión de un largo: bytes de 255 mientras siga y el resto
+static unsigned char *put_length(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// Peor caso de una secuencia con `lit` literales y un match de `mlen`
+static size_t sequence_bound(size_t lit, size_t mlen) {
+    return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+static unsigned char *put_literals(unsigned char *op, unsigned char *token,
+                                   const unsigned char *from, size_t lit) {
+    *token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15)
+        op = put_length(op, lit - 15);
+    memcpy(op, from, lit);
+    return op + lit;
+}
+
+size_t lz_compress(const unsigned char *in, size_t len, unsigned char *out, size_t cap) {
+    const unsigned char *ip = in, *anchor = in;
+    const unsigned char *const end = in + len;
+    unsigned char *op = out;
+    unsigned char *const op_end = out + cap;
+
+    if (len > MATCH_LIMIT) {
+        uint32_t *table = calloc((size_t)1 << HASH_LOG, sizeof(uint32_t));
+        if (!table)
+            return 0;
+        const unsigned char *const match_start_limit = end - MATCH_LIMIT;
+        const unsigned char *const match_end_limit = end - LAST_LITERALS;
+        unsigned attempts = 1u << SKIP_TRIGGER;
+
+        table[hash4(read32(ip))] = 0;
+        ip++;
+        while (ip < match_start_limit) {
+            uint32_t h = hash4(read32(ip));
+            const unsigned char *ref = in + table[h];
+            table[h] = (uint32_t)(ip - in);
+            if (ip - ref > MAX_OFFSET || read32(ref) != read32(ip)) {
+                // Sin match: en datos incompresibles el paso crece solo
+                ip += attempts++ >> SKIP_TRIGGER;
+                continue;
+            }
+            attempts = 1u << SKIP_TRIGGER;
+
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t mlen = common_length(ip + MIN_MATCH, ref + MIN_MATCH, match_end_limit);
+            size_t lit = ip - anchor;
+            if ((size_t)(op_end - op) < sequence_bound(lit, mlen)) {
+                free(table);
+                return 0;
+            }
+
+            unsigned char *token = op++;
+            op = put_literals(op, token, anchor, lit);
+            size_t offset = ip - ref;
+            *op++ = (unsigned char)offset;
+            *op++ = (unsigned char)(offset >> 8);
+            *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15)
+                op = put_length(op, mlen - 15);
+
+            ip += MIN_MATCH + mlen;
+            anchor = ip;
+            if (ip < match_start_limit)
+                table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - in);
+        }
+        free(table);
+    }
+
+    size_t lit = end - anchor;
+    if ((size_t)(op_end - op) < sequence_bound(lit, 0) - 3)
+        return 0;
+    unsigned char *token = op++;
+    op = put_literals(op, token, anchor, lit);
+    return op - out;
+}
+
+// Largo extendido: suma bytes mientras valgan 255; -1 si se corta
+static int get_length(const unsigned char **ip, const unsigned char *end, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+long lz_decompress(const unsigned char *in, size_t len, unsigned char *out, size_t cap) {
+    const unsigned char *ip = in;
+    const unsigned char *const end = in + len;
+    unsigned char *op = out;
+    unsigned char *const op_end = out + cap;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && get_length(&ip, end, &lit) != 0)
+            return -1;
+        if (lit > (size_t)(end - ip) || lit > (size_t)(op_end - op))
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end)
+            break;      // última secuencia: solo literales
+
+        if (end - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out))
+            return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(&ip, end, &mlen) != 0)
+            return -1;
+        mlen += MIN_MATCH;
+        if (mlen > (size_t)(op_end - op))
+            return -1;
+
+        // Con offset < largo el match se repite a sí mismo: se copia en
+        // tramos que no se solapan y que se duplican cada vez
+        const unsigned char *ref = op - offset;
+        while (mlen > 0) {
+            size_t n = (size_t)(op - ref) < mlen ? (size_t)(op - ref) : mlen;
+            memcpy(op, ref, n);
+            op += n;
+            mlen -= n;
+        }
+    }
+    return op - out;
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "../includes/metrics.h"
+#include "../includes/block_cache.h"
+#include "../includes/bitmap.h"
+#include "../includes/compress.h"
+#include "../includes/dedup.h"
+#include "../includes/utils.h"
+
+// Una línea de caché por contador: hilos que miden operaciones distintas
+// no se pisan
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;             // operaciones: bytes movidos; codec: payload
+    uint64_t backing;           // codec: bytes del archivo de imagen
+    uint64_t total_ns;
+    uint64_t hist[BWFS_HIST_BUCKETS];
+} __attribute__((aligned(64))) op_stats_t;
+
+static op_stats_t ops[BWFS_OP_COUNT];
+static op_stats_t codec[BWFS_CODEC_COUNT];
+static uint64_t started_at = 0;
+
+static const char *const op_names[BWFS_OP_COUNT] = {
+    "lookup", "forget", "getattr", "setattr", "readdir", "mkdir", "create",
+    "open", "read", "write", "unlink", "rmdir", "rename", "opendir",
+    "statfs", "access", "lseek", "flush", "fsync", "release",
+};
+
+static const char *const codec_names[BWFS_CODEC_COUNT] = { "decode", "encode" };
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void metrics_reset(void) {
+    memset(ops, 0, sizeof(ops));
+    memset(codec, 0, sizeof(codec));
+    started_at = metrics_now();
+}
+
+static int bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (us == 0)
+        return 0;
+    int k = 64 - __builtin_clzll(us);
+    return k < BWFS_HIST_BUCKETS ? k : BWFS_HIST_BUCKETS - 1;
+}
+
+static void record(op_stats_t *s, uint64_t start, int err) {
+    uint64_t ns = metrics_now() - start;
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->hist[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    if (err)
+        __atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_op(bwfs_op_t op, uint64_t start, int err) {
+    if ((unsigned)op < BWFS_OP_COUNT)
+        record(&ops[op], start, err);
+}
+
+void metrics_bytes(bwfs_op_t op, size_t bytes) {
+    if ((unsigned)op < BWFS_OP_COUNT)
+        __atomic_fetch_add(&ops[op].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void metrics_codec(int kind, uint64_t start, size_t payload, size_t backing) {
+    if ((unsigned)kind >= BWFS_CODEC_COUNT)
+        return;
+    record(&codec[kind], start, 0);
+    __atomic_fetch_add(&codec[kind].bytes, payload, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&codec[kind].backing, backing, __ATOMIC_RELAXED);
+}
+
+static uint64_t percentile(const op_stats_t *s, double q) {
+    uint64_t hist[BWFS_HIST_BUCKETS], total = 0;
+    for (int k = 0; k < BWFS_HIST_BUCKETS; ++k) {
+        hist[k] = __atomic_load_n(&s->hist[k], __ATOMIC_RELAXED);
+        total += hist[k];
+    }
+    if (total == 0)
+        return 0;
+
+    // Límite superior del bucket donde cae la operación número ceil(q * total)
+    uint64_t target = (uint64_t)(q * total + 0.999999);
+    if (target == 0)
+        target = 1;
+    uint64_t seen = 0;
+    for (int k = 0; k < BWFS_HIST_BUCKETS; ++k) {
+        seen += hist[k];
+        if (seen >= target)
+            return 1ull << k;
+    }
+    return 1ull << (BWFS_HIST_BUCKETS - 1);
+}
+
+uint64_t metrics_percentile_us(bwfs_op_t op, double q) {
+    return (unsigned)op < BWFS_OP_COUNT ? percentile(&ops[op], q) : 0;
+}
+
+const char *metrics_op_name(bwfs_op_t op) {
+    return (unsigned)op < BWFS_OP_COUNT ? op_names[op] : "?";
+}
+
+uint64_t metrics_op_count(bwfs_op_t op) {
+    return (unsigned)op < BWFS_OP_COUNT ? __atomic_load_n(&ops[op].count, __ATOMIC_RELAXED) : 0;
+}
+
+void metrics_codec_bytes(int kind, uint64_t *payload, uint64_t *backing) {
+    int ok = (unsigned)kind < BWFS_CODEC_COUNT;
+    *payload = ok ? __atomic_load_n(&codec[kind].bytes, __ATOMIC_RELAXED) : 0;
+    *backing = ok ? __atomic_load_n(&codec[kind].backing, __ATOMIC_RELAXED) : 0;
+}
+
+// Salida acumulada al estilo snprintf: len sigue contando aunque no entre
+typedef struct {
+    char *out;
+    size_t size;
+    size_t len;
+} json_buf_t;
+
+static void jprintf(json_buf_t *j, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void jprintf(json_buf_t *j, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = j->len < j->size ? j->size - j->len : 0;
+    int w = vsnprintf(room ? j->out + j->len : NULL, room, fmt, ap);
+    va_end(ap);
+    if (w > 0)
+        j->len += w;
+}
+
+static void json_stats(json_buf_t *j, const char *name, const op_stats_t *s, int is_codec) {
+    uint64_t count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    uint64_t total_ns = __atomic_load_n(&s->total_ns, __ATOMIC_RELAXED);
+
+    jprintf(j, "    \"%s\": {\"count\": %llu, ", name, (unsigned long long)count);
+    if (is_codec)
+        jprintf(j, "\"payload_bytes\": %llu, \"backing_bytes\": %llu, ",
+                (unsigned long long)__atomic_load_n(&s->bytes, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&s->backing, __ATOMIC_RELAXED));
+    else
+        jprintf(j, "\"errors\": %llu, \"bytes\": %llu, ",
+                (unsigned long long)__atomic_load_n(&s->errors, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&s->bytes, __ATOMIC_RELAXED));
+    jprintf(j, "\"avg_us\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, \"hist_us\": [",
+            count ? total_ns / 1000.0 / count : 0.0, (unsigned long long)percentile(s, 0.50),
+            (unsigned long long)percentile(s, 0.99));
+
+    // Sin los buckets vacíos del final
+    int last = BWFS_HIST_BUCKETS - 1;
+    while (last >= 0 && __atomic_load_n(&s->hist[last], __ATOMIC_RELAXED) == 0)
+        last--;
+    for (int k = 0; k <= last; ++k)
+        jprintf(j, "%s%llu", k ? ", " : "",
+                (unsigned long long)__atomic_load_n(&s->hist[k], __ATOMIC_RELAXED));
+    jprintf(j, "]}");
+}
+
+size_t metrics_json(char *out, size_t size) {
+    json_buf_t j = { out, size, 0 };
+
+    jprintf(&j, "{\n  \"uptime_s\": %.3f,\n  \"ops\": {\n",
+            started_at ? (metrics_now() - started_at) / 1e9 : 0.0);
+    for (int op = 0; op < BWFS_OP_COUNT; ++op) {
+        json_stats(&j, op_names[op], &ops[op], 0);
+        jprintf(&j, op + 1 < BWFS_OP_COUNT ? ",\n" : "\n");
+    }
+    jprintf(&j, "  },\n  \"codec\": {\n");
+    for (int k = 0; k < BWFS_CODEC_COUNT; ++k) {
+        json_stats(&j, codec_names[k], &codec[k], 1);
+        jprintf(&j, k + 1 < BWFS_CODEC_COUNT ? ",\n" : "\n");
+    }
+
+    block_cache_stats_t cs;
+    block_cache_get_stats(&cs);
+    jprintf(&j, "  },\n  \"cache\": {\"hits\": %llu, \"misses\": %llu, \"evictions\": %llu, "
+                "\"writebacks\": %llu, \"capacity\": %zu, \"resident\": %zu, \"dirty\": %zu, "
+                "\"throttled\": %llu, \"prefetched\": %llu, \"corrupt\": %llu},\n",
+            (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+            (unsigned long long)cs.evictions, (unsigned long long)cs.writebacks, cs.capacity,
+            cs.resident, cs.dirty, (unsigned long long)cs.throttled,
+            (unsigned long long)cs.prefetched, (unsigned long long)cs.corrupt);
+
+    compress_stats_t zs;
+    compress_get_stats(&zs);
+    jprintf(&j, "  \"compression\": {\"enabled\": %d, \"compressed\": %llu, \"incompressible\": %llu, "
+                "\"expanded\": %llu, \"decompressed\": %llu, \"raw_bytes\": %llu, "
+                "\"packed_bytes\": %llu, \"blocks_saved\": %lld},\n",
+            compress_enabled(), (unsigned long long)zs.compressed,
+            (unsigned long long)zs.incompressible, (unsigned long long)zs.expanded,
+            (unsigned long long)zs.decompressed, (unsigned long long)zs.raw_bytes,
+            (unsigned long long)zs.packed_bytes, (long long)zs.blocks_saved);
+
+    dedup_stats_t ds;
+    dedup_get_stats(&ds);
+    jprintf(&j, "  \"dedup\": {\"enabled\": %d, \"deduped\": %llu, \"unique\": %llu, "
+                "\"mismatched\": %llu, \"copied\": %llu, \"shared_blocks\": %llu, "
+                "\"blocks_saved\": %llu},\n",
+            dedup_enabled(), (unsigned long long)ds.deduped, (unsigned long long)ds.unique,
+            (unsigned long long)ds.mismatched, (unsigned long long)ds.copied,
+            (unsigned long long)ds.shared, (unsigned long long)ds.saved);
+
+    const bwfs_geometry_t *g = volume_geometry();
+    jprintf(&j, "  \"allocator\": {\"total_blocks\": %u, \"free_blocks\": %d, "
+                "\"total_inodes\": %u, \"free_inodes\": %d}\n}\n",
+            g->total_blocks, bitmap_free_blocks(), g->total_inodes, bitmap_free_inodes());
+    return j.len;
+}
@@ -1,85 +1,198 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "../includes/bwfs.h"
-
-#define INODE_BLOCKS 4    // bloques reservados para inodos
-#define BITMAP_BLOCK 1    // bloque reservado para bitmaps
+#include "../includes/pbm.h"
+#include "../includes/utils.h"
+#include "../includes/block_map.h"
 
 void write_blank_block(const char *path, int block_num) {
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s/block_%03d.pbm", path, block_num);
+    block_path(filename, sizeof(filename), path, block_num);
 
-    FILE *f = fopen(filename, "w");
-    if (!f) {
+    // Imagen PBM del tamaño del volumen en el formato elegido (P1 texto o P4 binario)
+    if (pbm_write_blank(filename, pbm_get_format(), block_num) != 0) {
         perror("Error creando bloque");
         exit(1);
     }
+}
 
-    // Imagen PBM en modo texto P1
-    fprintf(f, "P1\n");
-    fprintf(f, "# Bloque BWFS %d\n", block_num);
-    fprintf(f, "1000 1000\n");  // tamaño de bloque: 1000x1000 px
-    for (int i = 0; i < 1000 * 1000; ++i)
-        fprintf(f, "0%c", ((i + 1) % 100 == 0) ? '\n' : ' ');
-    fclose(f);
+// Bloques en blanco: el bloque 0 se genera con el codec y sirve de
+// plantilla; los demás copian su cuerpo con copy_file_range (reflink en los
+// FS que lo soportan) desde varios hilos, cada uno con su propia cabecera
+typedef struct {
+    const char *folder;
+    int src_fd;             // bloque 0
+    off_t body_off;         // primer byte del cuerpo en el bloque 0
+    size_t body_len;
+    const char *body;       // copia en memoria, si copy_file_range no sirve
+    int next;               // próximo bloque a crear (atómico)
+    int last;               // último bloque a crear
+    int failed;
+} stamp_job_t;
+
+static int stamp_block(const stamp_job_t *job, int block) {
+    char filename[256], header[PBM_HEADER_MAX];
+    block_path(filename, sizeof(filename), job->folder, block);
+    int header_len = pbm_header(header, sizeof(header), pbm_get_format(), block);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int ok = pwrite(fd, header, header_len, 0) == header_len;
+    loff_t in_off = job->body_off, out_off = header_len;
+    size_t left = job->body_len;
+    while (ok && left > 0) {
+        ssize_t n = copy_file_range(job->src_fd, &in_off, fd, &out_off, left, 0);
+        if (n <= 0)
+            break;
+        left -= n;
+    }
+
+    // Kernel sin copy_file_range o carpeta en otro FS: copia desde memoria
+    if (ok && left > 0)
+        ok = pwrite(fd, job->body + (job->body_len - left), left, out_off) == (ssize_t)left;
+
+    if (close(fd) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+static void *stamp_worker(void *arg) {
+    stamp_job_t *job = arg;
+    for (;;) {
+        int block = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (block > job->last || __atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+            break;
+        if (stamp_block(job, block) != 0) {
+            fprintf(stderr, "❌ Error creando bloque %d\n", block);
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// Crea los bloques [0, last]
+void write_blank_blocks(const char *path, int last) {
+    write_blank_block(path, 0);
+    if (last < 1)
+        return;
+
+    char filename[256], header[PBM_HEADER_MAX];
+    block_path(filename, sizeof(filename), path, 0);
+    stamp_job_t job = {0};
+    job.folder = path;
+    job.body_off = pbm_header(header, sizeof(header), pbm_get_format(), 0);
+    job.body_len = pbm_get_format() == BWFS_FORMAT_P4 ? pbm_payload_size() : pbm_p1_text_size();
+    job.next = 1;
+    job.last = last;
+
+    char *body = malloc(job.body_len);
+    job.src_fd = open(filename, O_RDONLY);
+    if (!body || job.src_fd < 0 ||
+        pread(job.src_fd, body, job.body_len, job.body_off) != (ssize_t)job.body_len) {
+        perror("Error leyendo el bloque plantilla");
+        exit(1);
+    }
+    job.body = body;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = cpus < 1 ? 1 : cpus > 16 ? 16 : (int)cpus;
+    if (nthreads > last)
+        nthreads = last;
+
+    pthread_t threads[16];
+    int started = 0;
+    for (; started < nthreads; ++started) {
+        if (pthread_create(&threads[started], NULL, stamp_worker, &job) != 0)
+            break;
+    }
+    stamp_worker(&job);     // el hilo principal también trabaja
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    close(job.src_fd);
+    free(body);
+    if (job.failed)
+        exit(1);
 }
 
 void write_superblock(const char *path) {
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s/block_000.pbm", path);
+    block_path(filename, sizeof(filename), path, 0);
     FILE *f = fopen(filename, "ab");
     if (!f) {
         perror("Error abriendo bloque 0");
         exit(1);
     }
 
-    const long offset_binario = 2000000;  // 2 MB: suficiente espacio después de imagen
-    fseek(f, offset_binario, SEEK_SET);
-
+    // Modo "ab": el superbloque queda al final del bloque 0
     superblock_t sb;
-    sb.magic = BWFS_MAGIC;
-    sb.total_blocks = BLOCK_COUNT;
-    sb.inode_table_start = 1;
-    sb.data_block_start = 1 + INODE_BLOCKS + BITMAP_BLOCK;
-    sb.free_block_bitmap = 1 + INODE_BLOCKS;
-    sb.free_inode_bitmap = 1 + INODE_BLOCKS;
+    geometry_to_superblock(volume_geometry(), pbm_get_format(), &sb);
+    sb.features = BWFS_FEATURE_DIRS | BWFS_FEATURE_CRC;
+    sb.root_inode = BWFS_ROOT_INODE;
+    sb.state = BWFS_STATE_CLEAN;
 
     fwrite(&sb, sizeof(superblock_t), 1, f);
     fclose(f);
 }
 
 void write_inode_table(const char *path) {
-    inode_t empty_inode;
-    memset(&empty_inode, 0, sizeof(inode_t));
+    const bwfs_geometry_t *g = volume_geometry();
+    inode_t *empty = calloc(g->inodes_per_block, sizeof(inode_t));
+    if (!empty) {
+        perror("Error escribiendo inodos");
+        exit(1);
+    }
+
+    const long offset_binario = metadata_offset();
 
-    int inodes_per_block = BWFS_BLOCK_SIZE / sizeof(inode_t);
-    const long offset_binario = 2000000;
+    for (uint32_t i = 0; i < g->inode_blocks; ++i) {
+        uint32_t first = i * g->inodes_per_block;
+        uint32_t n = g->total_inodes - first < g->inodes_per_block ?
+                     g->total_inodes - first : g->inodes_per_block;
 
-    for (int i = 0; i < INODE_BLOCKS; ++i) {
         char filename[256];
-        snprintf(filename, sizeof(filename), "%s/block_%03d.pbm", path, 1 + i);
+        block_path(filename, sizeof(filename), path, 1 + i);
         FILE *f = fopen(filename, "r+b");
         if (!f) {
             perror("Error escribiendo inodos");
             exit(1);
         }
 
-        fseek(f, offset_binario, SEEK_SET);
-        for (int j = 0; j < inodes_per_block; ++j)
-            fwrite(&empty_inode, sizeof(inode_t), 1, f);
+        // El inodo 0 es el directorio raíz, todavía sin entradas
+        if (i == 0) {
+            empty[0].used = 1;
+            empty[0].is_directory = 1;
+            empty[0].created_at = empty[0].modified_at = time(NULL);
+            for (int b = 0; b < BWFS_DIRECT_BLOCKS; ++b)
+                empty[0].blocks[b] = (uint32_t)-1;
+        }
 
+        fseek(f, offset_binario, SEEK_SET);
+        fwrite(empty, sizeof(inode_t), n, f);
         fclose(f);
+        memset(empty, 0, sizeof(inode_t));
     }
 
-    printf("✅ Tabla de inodos inicializada (%d inodos).\n", BWFS_INODES);
+    free(empty);
+    printf("✅ Tabla de inodos inicializada (%u inodos en %u bloques).\n",
+           g->total_inodes, g->inode_blocks);
 }
 
 void write_bitmaps(const char *path) {
+    const bwfs_geometry_t *g = volume_geometry();
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s/block_%03d.pbm", path, 1 + INODE_BLOCKS);
+    block_path(filename, sizeof(filename), path, g->bitmap_block);
 
     FILE *f = fopen(filename, "r+b");
     if (!f) {
@@ -87,22 +200,25 @@ void write_bitmaps(const char *path) {
         exit(1);
     }
 
-    const long offset_binario = 2000000;  // igual que el superblock
-    fseek(f, offset_binario, SEEK_SET);
-
-    uint8_t block_bitmap[BWFS_MAX_BLOCKS] = {0};
-    for (int i = 0; i <= 1 + INODE_BLOCKS; ++i)
-        block_bitmap[i] = 1;
-
-    uint8_t inode_bitmap[BWFS_INODES] = {0};
+    // Un byte por entrada: bloques y después inodos
+    uint8_t *bitmaps = calloc(g->block_bitmap_len + g->inode_bitmap_len, 1);
+    if (!bitmaps) {
+        perror("Error escribiendo bitmaps");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < g->data_block_start; ++i)
+        bitmaps[i] = 1;
+    bitmaps[g->block_bitmap_len + BWFS_ROOT_INODE] = 1;
 
-    fseek(f, 0, SEEK_END);
-    size_t written1 = fwrite(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
-    size_t written2 = fwrite(inode_bitmap, sizeof(uint8_t), BWFS_INODES, f);
+    // Antes, en meta_offset, la tabla de CRC por bloque: en cero
+    // (desconocidos) y sin ocupar disco hasta que se escriba
+    fseek(f, metadata_offset() + (long)g->total_blocks * sizeof(uint32_t), SEEK_SET);
+    size_t written = fwrite(bitmaps, sizeof(uint8_t), g->block_bitmap_len + g->inode_bitmap_len, f);
 
     fclose(f);
+    free(bitmaps);
 
-    if (written1 != BWFS_MAX_BLOCKS || written2 != BWFS_INODES) {
+    if (written != g->block_bitmap_len + g->inode_bitmap_len) {
         fprintf(stderr, "❌ Error: no se escribieron correctamente los bitmaps\n");
         exit(1);
     }
@@ -110,25 +226,97 @@ void write_bitmaps(const char *path) {
     printf("✅ Bitmaps de bloques e inodos inicializados correctamente.\n");
 }
 
+// Subcarpetas de los bloques [1, total_blocks) en volúmenes grandes
+static void make_shard_dirs(const char *path) {
+    const bwfs_geometry_t *g = volume_geometry();
+    if (!g->shard_size)
+        return;
+
+    for (uint32_t s = 0; s <= (g->total_blocks - 1) / g->shard_size; ++s) {
+        char dir[256];
+        shard_path(dir, sizeof(dir), path, s);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            perror("Error creando subcarpeta de bloques");
+            exit(1);
+        }
+    }
+}
+
+static void usage(void) {
+    printf("Uso: mkfs.bwfs [-f p1|p4] [-l] [-b bloques] [-i inodos] [-s ANCHOxALTO] <carpeta_destino>\n");
+    printf("  -l  perezoso: los bloques de datos se crean al escribirlos por primera vez\n");
+    printf("  -b  bloques totales del volumen (por omisión %d)\n", BLOCK_COUNT);
+    printf("  -i  inodos de la tabla (por omisión %d)\n", BWFS_INODES);
+    printf("  -s  dimensiones de la imagen de cada bloque (por omisión %dx%d)\n",
+           PBM_WIDTH, PBM_HEIGHT);
+}
+
+static int parse_count(const char *text, unsigned long *out) {
+    char *end;
+    errno = 0;
+    *out = strtoul(text, &end, 10);
+    return errno == 0 && end != text && *end == '\0' && *out > 0 && *out <= UINT32_MAX ? 0 : -1;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Uso: mkfs.bwfs <carpeta_destino>\n");
+    int format = BWFS_FORMAT_P1;
+    int lazy = 0;
+    unsigned long blocks = BLOCK_COUNT, inodes = BWFS_INODES;
+    unsigned width = PBM_WIDTH, height = PBM_HEIGHT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:lb:i:s:")) != -1) {
+        if (opt == 'f' && strcmp(optarg, "p1") == 0)
+            format = BWFS_FORMAT_P1;
+        else if (opt == 'f' && strcmp(optarg, "p4") == 0)
+            format = BWFS_FORMAT_P4;
+        else if (opt == 'l')
+            lazy = 1;
+        else if (opt == 'b' && parse_count(optarg, &blocks) == 0)
+            ;
+        else if (opt == 'i' && parse_count(optarg, &inodes) == 0)
+            ;
+        else if (opt == 's' && sscanf(optarg, "%ux%u", &width, &height) == 2)
+            ;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    bwfs_geometry_t geometry;
+    if (geometry_new(&geometry, format, blocks, inodes, width, height) != 0) {
+        fprintf(stderr, "❌ Geometría inválida: %lu bloques, %lu inodos, imagen %ux%u "
+                "(ancho múltiplo de 8, máximo %d bloques)\n",
+                blocks, inodes, width, height, BWFS_MAX_VOLUME_BLOCKS);
         return 1;
     }
 
-    const char *folder = argv[1];
+    const char *folder = argv[optind];
     mkdir(folder, 0755);
+    pbm_set_format(format);
+    volume_set_geometry(&geometry);
 
-    printf("🛠️ Creando sistema de archivos BWFS en: %s\n", folder);
+    printf("🛠️ Creando sistema de archivos BWFS (%s) en: %s\n",
+           format == BWFS_FORMAT_P4 ? "P4" : "P1", folder);
+    printf("📐 %u bloques de %ux%u, %u inodos\n", geometry.total_blocks,
+           geometry.image_width, geometry.image_height, geometry.total_inodes);
 
-    // Crear todos los bloques del sistema
-    for (int i = 0; i < BLOCK_COUNT; ++i)
-        write_blank_block(folder, i);
+    // Crear los bloques del sistema; en modo perezoso solo los de metadatos
+    make_shard_dirs(folder);
+    write_blank_blocks(folder, lazy ? (int)geometry.data_block_start - 1
+                                    : (int)geometry.total_blocks - 1);
 
     write_superblock(folder);
     write_inode_table(folder);
     write_bitmaps(folder);
 
-    printf("✅ Sistema de archivos creado con %d bloques.\n", BLOCK_COUNT);
+    printf("✅ Sistema de archivos creado con %u bloques%s.\n", geometry.total_blocks,
+           lazy ? " (datos sin materializar)" : "");
     return 0;
 }
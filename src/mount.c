@@ -2,20 +2,72 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>    
+#include <unistd.h>
 #include "../includes/fuse_ops.h"
+#include "../includes/checksum.h"
 #include <linux/limits.h>
 
 // Estructura de configuración compartida
 static struct bwfs_config conf;
 
+static void usage(void) {
+    fprintf(stderr, "Uso: mount.bwfs [-c cache_mb] [-d dirty_mb] [-e expire_ms] [-k] [-K] "
+                    "[-A attr_s] [-E entry_s] [-N negative_s] [-l nivel] [-V modo] [-z] [-D] "
+                    "<carpeta_fs> <punto_de_montaje>\n"
+                    "  -k  caché del kernel (páginas y atributos)\n"
+                    "  -K  caché del kernel, invalidada al reabrir si cambió mtime o tamaño\n"
+                    "  -l  nivel de log: 1 errores, 2 avisos, 3 info (por defecto), 4 debug\n"
+                    "  -V  CRC de los bloques: 0 sin verificar, 1 al decodificar (por defecto),\n"
+                    "      2 también en cada acierto de la caché\n"
+                    "  -z  comprimir los datos de los archivos al cerrarlos\n"
+                    "  -D  deduplicar los bloques de los archivos al cerrarlos\n"
+                    "Métricas en <punto_de_montaje>/" BWFS_CTL_NAME "/stats y log reciente en "
+                    "<punto_de_montaje>/" BWFS_CTL_NAME "/log\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Uso: mount.bwfs <carpeta_fs> <punto_de_montaje>\n");
+    int opt;
+
+    conf.attr_timeout = conf.entry_timeout = conf.negative_timeout = -1;
+    while ((opt = getopt(argc, argv, "c:d:e:kKA:E:N:l:V:zD")) != -1) {
+        if (opt == 'c' && atoi(optarg) > 0) {
+            conf.cache_mb = atoi(optarg);
+        } else if (opt == 'd' && atoi(optarg) > 0) {
+            conf.dirty_mb = atoi(optarg);
+        } else if (opt == 'e' && atoi(optarg) > 0) {
+            conf.dirty_expire_ms = atoi(optarg);
+        } else if (opt == 'k') {
+            conf.kernel_cache = 1;
+        } else if (opt == 'K') {
+            conf.auto_cache = 1;
+        } else if (opt == 'A' && atof(optarg) >= 0) {
+            conf.attr_timeout = atof(optarg);
+        } else if (opt == 'E' && atof(optarg) >= 0) {
+            conf.entry_timeout = atof(optarg);
+        } else if (opt == 'N' && atof(optarg) >= 0) {
+            conf.negative_timeout = atof(optarg);
+        } else if (opt == 'l' && atoi(optarg) >= 1 && atoi(optarg) <= 4) {
+            conf.log_level = atoi(optarg);
+        } else if (opt == 'V' && strlen(optarg) == 1 && optarg[0] >= '0' && optarg[0] <= '2') {
+            const int modes[] = { BWFS_VERIFY_OFF, BWFS_VERIFY_LOAD, BWFS_VERIFY_ALWAYS };
+            conf.verify = modes[optarg[0] - '0'];
+        } else if (opt == 'z') {
+            conf.compress = 1;
+        } else if (opt == 'D') {
+            conf.dedup = 1;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc - 2) {
+        usage();
         return 1;
     }
 
-    const char *fs_folder = argv[1];
-    const char *mountpoint = argv[2];
+    const char *fs_folder = argv[optind];
+    const char *mountpoint = argv[optind + 1];
 
     // Obtener ruta absoluta del folder del FS
     static char abs_path[PATH_MAX];
@@ -28,34 +80,25 @@ int main(int argc, char *argv[]) {
 
     printf("Ruta de canvas/: %s\n", conf.folder);
 
-    static struct fuse_operations ops = {
-        .init = bwfs_init,
-        .getattr = bwfs_getattr,
-        .readdir = bwfs_readdir,
-        .mkdir = bwfs_mkdir,
-        .create = bwfs_create,
-        .utimens = bwfs_utimens,
-        .write = bwfs_write,
-        .read = bwfs_read,
-        .unlink = bwfs_unlink,
-        .rmdir = bwfs_rmdir,
-        .rename = bwfs_rename,
-        .opendir = bwfs_opendir,
-        .statfs = bwfs_statfs,
-        .access = bwfs_access,
-        .lseek = bwfs_lseek,
-        .open = bwfs_open,
-        .flush = bwfs_flush,
-        .fsync = bwfs_fsync,
-
-    };
-
-    char *fuse_argv[] = {
-        argv[0],
-        (char *)mountpoint,
-        "-f" 
-    };
-
-    struct fuse_args args = FUSE_ARGS_INIT(3, fuse_argv);
-    return fuse_main(args.argc, args.argv, &ops, &conf);
+    // Sesión de bajo nivel: las operaciones llegan por número de inodo y
+    // libfuse no lleva rutas ni locks propios. En primer plano, como antes
+    // con -f; cada petición en un hilo del pool de libfuse.
+    char *fuse_argv[] = { argv[0] };
+    struct fuse_args args = FUSE_ARGS_INIT(1, fuse_argv);
+    struct fuse_session *se = fuse_session_new(&args, &bwfs_ll_ops, sizeof(bwfs_ll_ops), &conf);
+    if (!se) {
+        fprintf(stderr, "❌ No se pudo crear la sesión FUSE\n");
+        return 1;
+    }
+
+    int r = 1;
+    if (fuse_set_signal_handlers(se) == 0) {
+        if (fuse_session_mount(se, mountpoint) == 0) {
+            r = fuse_session_loop_mt(se, 0);
+            fuse_session_unmount(se);
+        }
+        fuse_remove_signal_handlers(se);
+    }
+    fuse_session_destroy(se);
+    return r ? 1 : 0;
 }
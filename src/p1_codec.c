@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../includes/p1_codec.h"
+#include "../includes/pbm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define P1_HAVE_X86 1
+#endif
+
+// Escritor de bits MSB primero, con la misma semántica que el decodificador
+// original: un byte final incompleto queda alineado a la derecha
+typedef struct {
+    unsigned char *out;
+    size_t max_bits;
+    size_t bits;
+    unsigned cur;
+} bit_writer_t;
+
+static inline int put_bit(bit_writer_t *w, unsigned bit) {
+    if (w->bits >= w->max_bits)
+        return 0;
+    w->cur = (w->cur << 1) | bit;
+    if (++w->bits % 8 == 0) {
+        w->out[w->bits / 8 - 1] = (unsigned char)w->cur;
+        w->cur = 0;
+    }
+    return 1;
+}
+
+// Caracteres [0, n) de una máscara: bit k de `digits` = el carácter k es un dígito
+static inline void put_mask(bit_writer_t *w, uint32_t digits, uint32_t ones) {
+    while (digits) {
+        int k = __builtin_ctz(digits);
+        if (!put_bit(w, (ones >> k) & 1))
+            return;
+        digits &= digits - 1;
+    }
+}
+
+static unsigned char rev8[256];     // bits de cada byte en orden inverso
+
+// Bits pares de x (0, 2, 4, ...) juntados en la mitad baja
+static inline uint32_t even_bits(uint32_t x) {
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    x = (x | (x >> 8)) & 0x0000FFFF;
+    return x;
+}
+
+// --- Escalar ---
+
+// Las variantes de encode escriben solo dígito + ' '; los saltos de línea
+// se ponen después en p1_encode_range
+static void encode_scalar(const unsigned char *in, size_t len, char *text) {
+    for (size_t b = 0; b < len; ++b) {
+        for (int k = 0; k < 8; ++k) {
+            *text++ = '0' + ((in[b] >> (7 - k)) & 1);
+            *text++ = ' ';
+        }
+    }
+}
+
+static void decode_scalar(const char *text, size_t len, unsigned char *out) {
+    for (size_t b = 0; b < len; ++b, text += PBM_P1_CHARS_PER_BYTE) {
+        unsigned char v = 0;
+        for (int k = 0; k < 8; ++k)
+            v = (v << 1) | (text[2 * k] & 1);
+        out[b] = v;
+    }
+}
+
+static void scan_scalar(const char *text, size_t len, bit_writer_t *w) {
+    for (size_t i = 0; i < len && w->bits < w->max_bits; ++i) {
+        if (text[i] == '0' || text[i] == '1')
+            put_bit(w, text[i] - '0');
+    }
+}
+
+#ifdef P1_HAVE_X86
+
+// --- SSE2: un byte del payload por cada 16 caracteres ---
+
+__attribute__((target("sse2")))
+static void encode_sse2(const unsigned char *in, size_t len, char *text) {
+    const __m128i bit = _mm_setr_epi8((char)0x80, 0, 0x40, 0, 0x20, 0, 0x10, 0,
+                                      0x08, 0, 0x04, 0, 0x02, 0, 0x01, 0);
+    const __m128i one = _mm_set1_epi16(0x0001);
+    const __m128i base = _mm_set1_epi16(('0') | (' ' << 8));
+
+    for (size_t b = 0; b < len; ++b) {
+        __m128i v = _mm_and_si128(_mm_set1_epi8((char)in[b]), bit);
+        v = _mm_and_si128(_mm_cmpeq_epi8(v, bit), one);     // 1 en el dígito si el bit está
+        _mm_storeu_si128((__m128i *)(text + b * 16), _mm_add_epi8(v, base));
+    }
+}
+
+__attribute__((target("sse2")))
+static void decode_sse2(const char *text, size_t len, unsigned char *out) {
+    const __m128i one = _mm_set1_epi16(0x0001);
+    size_t b = 0;
+
+    // El bit 0 de cada dígito (carácter par) va al bit 7 de un byte y
+    // movemask junta 16 píxeles; rev8 los deja MSB primero
+    for (; b + 2 <= len; b += 2) {
+        __m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i *)(text + b * 16)), one);
+        __m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i *)(text + b * 16 + 16)), one);
+        __m128i px = _mm_slli_epi16(_mm_packus_epi16(lo, hi), 7);
+        unsigned m = (unsigned)_mm_movemask_epi8(px);
+        out[b] = rev8[m & 0xFF];
+        out[b + 1] = rev8[m >> 8];
+    }
+    decode_scalar(text + b * 16, len - b, out + b);
+}
+
+__attribute__((target("sse2")))
+static void scan_sse2(const char *text, size_t len, bit_writer_t *w) {
+    const __m128i c0 = _mm_set1_epi8('0');
+    const __m128i c1 = _mm_set1_epi8('1');
+    size_t i = 0;
+
+    for (; i + 16 <= len && w->bits < w->max_bits; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i is1 = _mm_cmpeq_epi8(c, c1);
+        uint32_t digits = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, c0), is1));
+        uint32_t ones = (uint32_t)_mm_movemask_epi8(is1);
+
+        // Caso canónico: dígito y separador alternados, un byte entero
+        if (digits == 0x5555 && w->bits % 8 == 0 && w->bits + 8 <= w->max_bits) {
+            w->out[w->bits / 8] = rev8[even_bits(ones)];
+            w->bits += 8;
+        } else {
+            put_mask(w, digits, ones);
+        }
+    }
+    scan_scalar(text + i, len - i, w);
+}
+
+// --- AVX2: dos bytes por vector al codificar, cuatro al decodificar ---
+
+__attribute__((target("avx2")))
+static void encode_avx2(const unsigned char *in, size_t len, char *text) {
+    const __m256i bit = _mm256_setr_epi8((char)0x80, 0, 0x40, 0, 0x20, 0, 0x10, 0,
+                                         0x08, 0, 0x04, 0, 0x02, 0, 0x01, 0,
+                                         (char)0x80, 0, 0x40, 0, 0x20, 0, 0x10, 0,
+                                         0x08, 0, 0x04, 0, 0x02, 0, 0x01, 0);
+    const __m256i one = _mm256_set1_epi16(0x0001);
+    const __m256i base = _mm256_set1_epi16(('0') | (' ' << 8));
+    size_t b = 0;
+
+    for (; b + 2 <= len; b += 2) {
+        __m256i v = _mm256_set_m128i(_mm_set1_epi8((char)in[b + 1]), _mm_set1_epi8((char)in[b]));
+        v = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, bit), bit), one);
+        _mm256_storeu_si256((__m256i *)(text + b * 16), _mm256_add_epi8(v, base));
+    }
+    encode_sse2(in + b, len - b, text + b * 16);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(const char *text, size_t len, unsigned char *out) {
+    const __m256i one = _mm256_set1_epi16(0x0001);
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t b = 0;
+
+    for (; b + 4 <= len; b += 4) {
+        __m256i lo = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(text + b * 16)), one);
+        __m256i hi = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(text + b * 16 + 32)), one);
+        // packus trabaja por carril de 128 bits: reordenar a bytes 0,1,2,3
+        __m256i px = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        px = _mm256_slli_epi16(_mm256_shuffle_epi8(px, reverse), 7);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(px);
+        memcpy(out + b, &m, sizeof(m));
+    }
+    decode_sse2(text + b * 16, len - b, out + b);
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const char *text, size_t len, bit_writer_t *w) {
+    const __m256i c0 = _mm256_set1_epi8('0');
+    const __m256i c1 = _mm256_set1_epi8('1');
+    size_t i = 0;
+
+    for (; i + 32 <= len && w->bits < w->max_bits; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i is1 = _mm256_cmpeq_epi8(c, c1);
+        uint32_t digits = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c, c0), is1));
+        uint32_t ones = (uint32_t)_mm256_movemask_epi8(is1);
+
+        if (digits == 0x55555555 && w->bits % 8 == 0 && w->bits + 16 <= w->max_bits) {
+            uint32_t px = even_bits(ones);
+            w->out[w->bits / 8] = rev8[px & 0xFF];
+            w->out[w->bits / 8 + 1] = rev8[px >> 8];
+            w->bits += 16;
+        } else {
+            put_mask(w, digits, ones);
+        }
+    }
+    scan_sse2(text + i, len - i, w);
+}
+
+#endif // P1_HAVE_X86
+
+// --- Selección en tiempo de ejecución ---
+
+typedef struct {
+    const char *name;
+    void (*encode)(const unsigned char *in, size_t len, char *text);
+    void (*decode)(const char *text, size_t len, unsigned char *out);
+    void (*scan)(const char *text, size_t len, bit_writer_t *w);
+} p1_impl_t;
+
+static const p1_impl_t impl_scalar = { "scalar", encode_scalar, decode_scalar, scan_scalar };
+#ifdef P1_HAVE_X86
+static const p1_impl_t impl_sse2 = { "sse2", encode_sse2, decode_sse2, scan_sse2 };
+static const p1_impl_t impl_avx2 = { "avx2", encode_avx2, decode_avx2, scan_avx2 };
+#endif
+
+static const p1_impl_t *impl = &impl_scalar;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static void select_impl(void) {
+    for (int i = 0; i < 256; ++i) {
+        unsigned char r = 0;
+        for (int k = 0; k < 8; ++k)
+            r |= ((i >> k) & 1) << (7 - k);
+        rev8[i] = r;
+    }
+
+    const char *forced = getenv("BWFS_P1_CODEC");
+    impl = &impl_scalar;
+#ifdef P1_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        impl = &impl_sse2;
+    if (__builtin_cpu_supports("avx2") && (!forced || strcmp(forced, "avx2") == 0))
+        impl = &impl_avx2;
+    if (forced && strcmp(forced, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        impl = &impl_sse2;
+#endif
+    if (forced && strcmp(forced, "scalar") == 0)
+        impl = &impl_scalar;
+}
+
+static const p1_impl_t *codec(void) {
+    pthread_once(&impl_once, select_impl);
+    return impl;
+}
+
+const char *p1_codec_name(void) {
+    return codec()->name;
+}
+
+void p1_encode_range(const unsigned char *in, size_t offset, size_t len, char *text) {
+    codec()->encode(in, len, text);
+
+    // Salto de línea tras cada píxel 100k - 1
+    size_t first = offset * 8;
+    size_t end = first + len * 8;
+    for (size_t p = first / PBM_P1_PIXELS_PER_LINE * PBM_P1_PIXELS_PER_LINE +
+                    PBM_P1_PIXELS_PER_LINE - 1; p < end; p += PBM_P1_PIXELS_PER_LINE)
+        text[2 * (p - first) + 1] = '\n';
+}
+
+void p1_decode_range(const char *text, size_t len, unsigned char *out) {
+    codec()->decode(text, len, out);
+}
+
+size_t p1_decode_text(const char *text, size_t len, unsigned char *out, size_t out_len) {
+    bit_writer_t w = { out, out_len * 8, 0, 0 };
+    memset(out, 0, out_len);
+    codec()->scan(text, len, &w);
+    if (w.bits % 8)
+        out[w.bits / 8] = (unsigned char)w.cur;
+    return w.bits;
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../includes/pbm.h"
+#include "../includes/p1_codec.h"
+
+// Formato e imagen de los bloques del volumen montado
+static int volume_format = BWFS_FORMAT_P1;
+static int image_width = PBM_WIDTH;
+static int image_height = PBM_HEIGHT;
+
+void pbm_set_format(int format) {
+    volume_format = format;
+}
+
+int pbm_get_format(void) {
+    return volume_format;
+}
+
+void pbm_set_image_size(int width, int height) {
+    image_width = width;
+    image_height = height;
+}
+
+size_t pbm_payload_size(void) {
+    return (size_t)image_width / 8 * image_height;
+}
+
+size_t pbm_p1_text_size(void) {
+    return (size_t)image_width * image_height * 2;
+}
+
+size_t pbm_p4_data_offset(void) {
+    char header[PBM_HEADER_MAX];
+    return snprintf(header, sizeof(header), PBM_P4_HEADER_FMT, 0, image_width, image_height);
+}
+
+// Devuelve el offset donde empiezan los píxeles (tras "Px", comentarios,
+// ancho, alto y el único separador que sigue), o -1 si la cabecera no es válida
+static long pbm_data_offset(const char *buf, size_t len) {
+    if (len < 2 || buf[0] != 'P' || (buf[1] != '1' && buf[1] != '4'))
+        return -1;
+
+    size_t pos = 2;
+    int numbers = 0;
+    while (numbers < 2) {
+        while (pos < len && (buf[pos] == ' ' || buf[pos] == '\t' ||
+                             buf[pos] == '\r' || buf[pos] == '\n'))
+            pos++;
+        if (pos < len && buf[pos] == '#') {
+            while (pos < len && buf[pos] != '\n')
+                pos++;
+            continue;
+        }
+        if (pos >= len || buf[pos] < '0' || buf[pos] > '9')
+            return -1;
+        while (pos < len && buf[pos] >= '0' && buf[pos] <= '9')
+            pos++;
+        numbers++;
+    }
+
+    if (pos >= len)
+        return -1;
+    return (long)pos + 1;
+}
+
+int pbm_detect_format(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    char magic[2];
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    if (n != sizeof(magic) || magic[0] != 'P')
+        return -1;
+    if (magic[1] == '1')
+        return BWFS_FORMAT_P1;
+    if (magic[1] == '4')
+        return BWFS_FORMAT_P4;
+    return -1;
+}
+
+// Abre un bloque P1 y, si tiene el layout canónico de ancho fijo, devuelve
+// el fd y el offset del primer píxel; si no, -1 (hay que reescribirlo entero)
+static int p1_open_fixed(const char *path, int flags, long *data_off) {
+    int fd = open(path, flags);
+    if (fd < 0)
+        return -1;
+
+    char header[256];
+    struct stat st;
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    long off = n > 0 ? pbm_data_offset(header, n) : -1;
+    if (off < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size != off + pbm_p1_text_size()) {
+        close(fd);
+        return -1;
+    }
+
+    *data_off = off;
+    return fd;
+}
+
+int pbm_write_blank(const char *path, int format, int block_num) {
+    unsigned char *zero = calloc(1, pbm_payload_size());
+    if (!zero)
+        return -1;
+    int r = pbm_write_block(path, format, block_num, zero);
+    free(zero);
+    return r;
+}
+
+int pbm_read_block(const char *path, int format, unsigned char *data) {
+    if (format == BWFS_FORMAT_P4)
+        return pbm_read_range(path, 0, pbm_payload_size(), data);
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    // Cabecera + texto de píxeles; lo que haya después no es imagen
+    size_t cap = pbm_p1_text_size() + 256;
+    char *text = malloc(cap);
+    if (!text) {
+        fclose(f);
+        return -1;
+    }
+    size_t len = fread(text, 1, cap, f);
+    fclose(f);
+
+    long start = pbm_data_offset(text, len);
+    if (start < 0) {
+        free(text);
+        return -1;
+    }
+
+    p1_decode_text(text + start, len - start, data, pbm_payload_size());
+    free(text);
+    return 0;
+}
+
+int pbm_header(char *out, size_t size, int format, int block_num) {
+    if (format == BWFS_FORMAT_P4)
+        return snprintf(out, size, PBM_P4_HEADER_FMT, block_num, image_width, image_height);
+    return snprintf(out, size, PBM_P1_HEADER_FMT, block_num, image_width, image_height);
+}
+
+int pbm_write_block(const char *path, int format, int block_num, const unsigned char *data) {
+    if (format == BWFS_FORMAT_P4) {
+        char header[PBM_HEADER_MAX];
+        int header_len = pbm_header(header, sizeof(header), format, block_num);
+        size_t payload = pbm_payload_size();
+
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            return -1;
+        int ok = pwrite(fd, header, header_len, 0) == header_len &&
+                 pwrite(fd, data, payload, header_len) == (ssize_t)payload;
+        close(fd);
+        return ok ? 0 : -1;
+    }
+
+    // P1: se arma todo el texto en memoria y se escribe de una vez
+    char *text = malloc(pbm_p1_text_size());
+    if (!text)
+        return -1;
+    p1_encode_range(data, 0, pbm_payload_size(), text);
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        free(text);
+        return -1;
+    }
+    fprintf(f, PBM_P1_HEADER_FMT, block_num, image_width, image_height);
+    size_t n = fwrite(text, 1, pbm_p1_text_size(), f);
+    int err = fclose(f);
+    free(text);
+    return (n == pbm_p1_text_size() && err == 0) ? 0 : -1;
+}
+
+int pbm_read_range(const char *path, size_t offset, size_t len, unsigned char *out) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    if (volume_format == BWFS_FORMAT_P4) {
+        // Payload crudo en offset fijo: un pread, sin parseo
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return -1;
+        ssize_t n = pread(fd, out, len, pbm_p4_data_offset() + offset);
+        close(fd);
+        if (n < 0)
+            return -1;
+        if ((size_t)n < len)
+            memset(out + n, 0, len - n);
+        return 0;
+    }
+
+    // P1 de ancho fijo: leer y decodificar solo los caracteres del rango
+    long data_off;
+    int fd = p1_open_fixed(path, O_RDONLY, &data_off);
+    if (fd >= 0) {
+        size_t text_len = len * PBM_P1_CHARS_PER_BYTE;
+        char *text = malloc(text_len);
+        ssize_t n = text ? pread(fd, text, text_len,
+                                 data_off + offset * PBM_P1_CHARS_PER_BYTE) : -1;
+        close(fd);
+        if (n != (ssize_t)text_len) {
+            free(text);
+            return -1;
+        }
+        p1_decode_range(text, len, out);
+        free(text);
+        return 0;
+    }
+
+    unsigned char *data = malloc(pbm_payload_size());
+    if (!data)
+        return -1;
+    int r = pbm_read_block(path, BWFS_FORMAT_P1, data);
+    if (r == 0)
+        memcpy(out, data + offset, len);
+    free(data);
+    return r;
+}
+
+int pbm_write_range(const char *path, int block_num, size_t offset, size_t len,
+                    const unsigned char *in) {
+    if (offset + len > pbm_payload_size())
+        return -1;
+
+    if (volume_format == BWFS_FORMAT_P4) {
+        int fd = open(path, O_WRONLY);
+        if (fd < 0)
+            return -1;
+        ssize_t n = pwrite(fd, in, len, pbm_p4_data_offset() + offset);
+        close(fd);
+        return (n == (ssize_t)len) ? 0 : -1;
+    }
+
+    // P1 de ancho fijo: cada byte son 16 caracteres en un offset calculable,
+    // así que basta un pwrite de los píxeles tocados (separadores incluidos,
+    // con los saltos de línea en su lugar). El archivo nunca se trunca.
+    long data_off;
+    int fd = p1_open_fixed(path, O_WRONLY, &data_off);
+    if (fd >= 0) {
+        size_t text_len = len * PBM_P1_CHARS_PER_BYTE;
+        char *text = malloc(text_len);
+        if (!text) {
+            close(fd);
+            return -1;
+        }
+        p1_encode_range(in, offset, len, text);
+        ssize_t n = pwrite(fd, text, text_len, data_off + offset * PBM_P1_CHARS_PER_BYTE);
+        close(fd);
+        free(text);
+        return (n == (ssize_t)text_len) ? 0 : -1;
+    }
+
+    // Layout viejo o desconocido: leer, modificar en memoria y reescribir
+    // el bloque entero, que queda en el layout canónico
+    unsigned char *data = malloc(pbm_payload_size());
+    if (!data)
+        return -1;
+    if (pbm_read_block(path, BWFS_FORMAT_P1, data) != 0)
+        memset(data, 0, pbm_payload_size());
+    memcpy(data + offset, in, len);
+    int r = pbm_write_block(path, BWFS_FORMAT_P1, block_num, data);
+    free(data);
+    return r;
+}
@@ -1,33 +1,246 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "../includes/utils.h"
+#include "../includes/pbm.h"
+#include "../includes/journal.h"
+
+// Geometría activa; hasta que se lee un superbloque vale la de los
+// volúmenes anteriores (meta_offset 0 = el fijo según el formato)
+static bwfs_geometry_t geometry = {
+    BLOCK_COUNT,
+    INODE_BLOCKS * (BWFS_BLOCK_SIZE / sizeof(inode_t)),
+    INODE_BLOCKS,
+    BWFS_BLOCK_SIZE / sizeof(inode_t),
+    1 + INODE_BLOCKS,
+    1 + INODE_BLOCKS + BITMAP_BLOCK,
+    BWFS_MAX_BLOCKS,
+    BWFS_INODES,
+    PBM_WIDTH,
+    PBM_HEIGHT,
+    0,
+    0,
+};
+
+// Tabla de inodos residente: se carga una vez al montar y se escribe de
+// vuelta solo lo que cambió (ver inode_table_sync)
+static inode_t *inode_table = NULL;
+static uint8_t *inode_dirty = NULL;
+static int inode_table_count = -1;
+
+// Inodos sucios en orden de llegada: el sync no recorre toda la tabla
+static int *dirty_list = NULL;
+static int dirty_count = 0;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Un rwlock por inodo: protege su contenido. Quien
+// modifica un inodo residente (y llama a save_inode) tiene el de escritura.
+static pthread_rwlock_t *inode_locks = NULL;
+static int inode_locks_count = 0;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t round_up(uint32_t x, uint32_t to) {
+    return (x + to - 1) / to * to;
+}
+
+void geometry_from_superblock(const superblock_t *sb, bwfs_geometry_t *g) {
+    memset(g, 0, sizeof(*g));
+    g->total_blocks = sb->total_blocks;
+    g->data_block_start = sb->data_block_start;
+    g->bitmap_block = sb->free_block_bitmap;
+
+    if (sb->total_inodes == 0) {
+        // Volumen anterior: tabla de 4 bloques y bitmaps de tamaño fijo
+        g->inodes_per_block = BWFS_BLOCK_SIZE / sizeof(inode_t);
+        g->inode_blocks = INODE_BLOCKS;
+        g->total_inodes = g->inode_blocks * g->inodes_per_block;
+        g->block_bitmap_len = BWFS_MAX_BLOCKS;
+        g->inode_bitmap_len = BWFS_INODES;
+        g->image_width = PBM_WIDTH;
+        g->image_height = PBM_HEIGHT;
+        g->meta_offset = sb->block_format == BWFS_FORMAT_P4 ? BWFS_P4_META_OFFSET
+                                                            : BWFS_P1_META_OFFSET;
+        return;
+    }
+
+    g->total_inodes = sb->total_inodes;
+    g->inodes_per_block = sb->inodes_per_block;
+    g->inode_blocks = (sb->total_inodes + sb->inodes_per_block - 1) / sb->inodes_per_block;
+    g->block_bitmap_len = sb->total_blocks;
+    g->inode_bitmap_len = sb->total_inodes;
+    g->image_width = sb->image_width;
+    g->image_height = sb->image_height;
+    g->shard_size = sb->shard_size;
+    g->meta_offset = sb->meta_offset;
+}
+
+uint32_t geometry_meta_offset(int format, uint32_t width, uint32_t height) {
+    size_t image = format == BWFS_FORMAT_P4 ? (size_t)width / 8 * height
+                                            : (size_t)width * height * 2;
+    return round_up(PBM_HEADER_MAX + image, 65536);
+}
+
+int geometry_new(bwfs_geometry_t *g, int format, uint32_t blocks, uint32_t inodes,
+                 uint32_t width, uint32_t height) {
+    // Cada bloque tiene que poder guardar al menos una entrada de directorio
+    if (width == 0 || width % 8 != 0 || height == 0 ||
+        (uint64_t)width * height < 8 * 512 ||
+        (uint64_t)width * height > 64ULL * 1024 * 1024 || inodes == 0 ||
+        blocks > BWFS_MAX_VOLUME_BLOCKS)
+        return -1;
+
+    memset(g, 0, sizeof(*g));
+    g->total_blocks = blocks;
+    g->total_inodes = inodes;
+    g->inodes_per_block = inodes < BWFS_INODES_PER_BLOCK ? inodes : BWFS_INODES_PER_BLOCK;
+    g->inode_blocks = (inodes + g->inodes_per_block - 1) / g->inodes_per_block;
+    g->bitmap_block = 1 + g->inode_blocks;
+    g->data_block_start = g->bitmap_block + BITMAP_BLOCK;
+    g->block_bitmap_len = blocks;
+    g->inode_bitmap_len = inodes;
+    g->image_width = width;
+    g->image_height = height;
+    g->shard_size = blocks > BWFS_SHARD_SIZE ? BWFS_SHARD_SIZE : 0;
+    g->meta_offset = geometry_meta_offset(format, width, height);
+
+    // Al menos un bloque de datos
+    return blocks > g->data_block_start ? 0 : -1;
+}
+
+void geometry_to_superblock(const bwfs_geometry_t *g, int format, superblock_t *sb) {
+    memset(sb, 0, sizeof(*sb));
+    sb->magic = BWFS_MAGIC;
+    sb->total_blocks = g->total_blocks;
+    sb->inode_table_start = 1;
+    sb->data_block_start = g->data_block_start;
+    sb->free_block_bitmap = g->bitmap_block;
+    sb->free_inode_bitmap = g->bitmap_block;
+    sb->block_format = format;
+    sb->total_inodes = g->total_inodes;
+    sb->inodes_per_block = g->inodes_per_block;
+    sb->image_width = g->image_width;
+    sb->image_height = g->image_height;
+    sb->shard_size = g->shard_size;
+    sb->meta_offset = g->meta_offset;
+}
+
+void volume_set_geometry(const bwfs_geometry_t *g) {
+    geometry = *g;
+    pbm_set_image_size(g->image_width, g->image_height);
+}
+
+const bwfs_geometry_t *volume_geometry(void) {
+    return &geometry;
+}
+
+// El bloque 0 siempre queda en la raíz: ahí se lee la geometría
+void block_path(char *out, size_t size, const char *folder, int block) {
+    if (geometry.shard_size && block > 0)
+        snprintf(out, size, "%s/%04u/block_%03d.pbm", folder,
+                 (unsigned)block / geometry.shard_size, block);
+    else
+        snprintf(out, size, "%s/block_%03d.pbm", folder, block);
+}
+
+void shard_path(char *out, size_t size, const char *folder, int shard) {
+    snprintf(out, size, "%s/%04d", folder, shard);
+}
+
+long metadata_offset(void) {
+    if (geometry.meta_offset)
+        return geometry.meta_offset;
+    return pbm_get_format() == BWFS_FORMAT_P4 ? BWFS_P4_META_OFFSET : BWFS_P1_META_OFFSET;
+}
+
+// El superbloque está al final del bloque 0. Los volúmenes anteriores lo
+// tienen más corto: sin state, sin features, sin geometría, o además sin
+// block_format (P1). Devuelve el largo con que está escrito, o -1.
+static long find_superblock(FILE *f, superblock_t *sb) {
+    const long sizes[] = { sizeof(superblock_t), offsetof(superblock_t, state),
+                           offsetof(superblock_t, features),
+                           offsetof(superblock_t, total_inodes),
+                           offsetof(superblock_t, block_format) };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        memset(sb, 0, sizeof(superblock_t));
+        if (fseek(f, -sizes[k], SEEK_END) == 0 &&
+            fread(sb, sizes[k], 1, f) == 1 && sb->magic == BWFS_MAGIC) {
+            if (sizes[k] <= (long)offsetof(superblock_t, block_format))
+                sb->block_format = BWFS_FORMAT_P1;
+            return sizes[k];
+        }
+    }
+    return -1;
+}
+
+int read_superblock(const char *folder, superblock_t *sb) {
+    char path[256];
+    block_path(path, sizeof(path), folder, 0);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    long len = find_superblock(f, sb);
+    fclose(f);
+    return len < 0 ? -1 : 0;
+}
+
+// Reemplaza el superbloque del bloque 0, de cualquier versión, por `sb`
+// con el tamaño actual de superblock_t
+int update_superblock(const char *folder, const superblock_t *sb) {
+    char path[256];
+    block_path(path, sizeof(path), folder, 0);
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+        return -1;
+
+    superblock_t old;
+    long len = find_superblock(f, &old);
+    int ok = len >= 0 && fseek(f, 0, SEEK_END) == 0;
+    long end = ok ? ftell(f) : -1;
+    ok = ok && end >= len && ftruncate(fileno(f), end - len) == 0 &&
+         fseek(f, 0, SEEK_END) == 0 && fwrite(sb, sizeof(*sb), 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+// Carga la tabla completa en `inodes` (geometry.total_inodes entradas);
+// el inodo i está siempre en la posición i aunque falte un bloque
 int load_inodes(const char *folder, inode_t *inodes) {
     int index = 0;
-    int inodes_per_block = BWFS_BLOCK_SIZE / sizeof(inode_t);
-    const long offset_binario = 2000000;
+    int inodes_per_block = geometry.inodes_per_block;
+    const long offset_binario = metadata_offset();
+
+    for (uint32_t b = 0; b < geometry.inode_blocks; ++b) {
+        int first = b * inodes_per_block;
+        int n = geometry.total_inodes - first < (uint32_t)inodes_per_block ?
+                (int)(geometry.total_inodes - first) : inodes_per_block;
 
-    for (int i = 0; i < INODE_BLOCKS; ++i) {
         char path[256];
-        snprintf(path, sizeof(path), "%s/block_%03d.pbm", folder, 1 + i);
+        block_path(path, sizeof(path), folder, 1 + b);
         FILE *f = fopen(path, "rb");
         if (!f) continue;
 
         fseek(f, offset_binario, SEEK_SET);
-        int read = fread(&inodes[index], sizeof(inode_t), inodes_per_block, f);
-        index += read;
+        int read = fread(&inodes[first], sizeof(inode_t), n, f);
+        index = first + read;
         fclose(f);
     }
     return index;
 }
-int save_inode(const char *folder, int index, const inode_t *inode) {
-    int inodes_per_block = BWFS_BLOCK_SIZE / sizeof(inode_t);
+static int write_inode_disk(const char *folder, int index, const inode_t *inode) {
+    int inodes_per_block = geometry.inodes_per_block;
     int block = index / inodes_per_block;
     int offset = index % inodes_per_block;
-    const long offset_binario = 2000000;
+    const long offset_binario = metadata_offset();
 
     char path[256];
-    snprintf(path, sizeof(path), "%s/block_%03d.pbm", folder, 1 + block);
+    block_path(path, sizeof(path), folder, 1 + block);
     FILE *f = fopen(path, "r+b");
     if (!f) return -1;
 
@@ -37,85 +250,156 @@ int save_inode(const char *folder, int index, const inode_t *inode) {
     fclose(f);
     return 0;
 }
-
-int find_free_inode(const char *folder) {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/block_%03d.pbm", folder, 1 + INODE_BLOCKS);
-    FILE *f = fopen(path, "rb");
-    if (!f) {
-        perror("❌ No se pudo abrir el archivo de bitmap");
-        return -1;
+int save_inode(const char *folder, int index, const inode_t *inode) {
+    // Con la tabla residente cargada, solo se actualiza la memoria y el
+    // inodo queda marcado como sucio hasta el próximo inode_table_sync()
+    if (inode_table_count >= 0) {
+        if (index < 0 || index >= inode_table_count)
+            return -1;
+        if (&inode_table[index] != inode)
+            inode_table[index] = *inode;
+        journal_log_inode(index, inode);
+        pthread_mutex_lock(&dirty_lock);
+        if (!inode_dirty[index]) {
+            inode_dirty[index] = 1;
+            dirty_list[dirty_count++] = index;
+        }
+        pthread_mutex_unlock(&dirty_lock);
+        return 0;
     }
+    return write_inode_disk(folder, index, inode);
+}
 
-    // Leer desde el offset exacto al final del archivo
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    long offset = size - BWFS_INODES;
+static void free_inode_table(void) {
+    for (int i = 0; i < inode_locks_count; ++i)
+        pthread_rwlock_destroy(&inode_locks[i]);
+    free(inode_locks);
+    free(inode_table);
+    free(inode_dirty);
+    free(dirty_list);
+    inode_locks = NULL;
+    inode_table = NULL;
+    inode_dirty = NULL;
+    dirty_list = NULL;
+    dirty_count = 0;
+    inode_locks_count = 0;
+    inode_table_count = -1;
+}
 
-    if (offset < 0) {
-        fprintf(stderr, "❌ Archivo %s demasiado pequeño para bitmap\n", path);
-        fclose(f);
+// Dimensionada con la geometría activa (volume_set_geometry antes de llamarla)
+int inode_table_init(const char *folder) {
+    free_inode_table();
+
+    int total = geometry.total_inodes;
+    inode_table = calloc(total, sizeof(inode_t));
+    inode_dirty = calloc(total, 1);
+    dirty_list = malloc(total * sizeof(int));
+    inode_locks = malloc(total * sizeof(pthread_rwlock_t));
+    if (!inode_table || !inode_dirty || !dirty_list || !inode_locks) {
+        free_inode_table();
         return -1;
     }
+    for (; inode_locks_count < total; ++inode_locks_count)
+        pthread_rwlock_init(&inode_locks[inode_locks_count], NULL);
 
-    fseek(f, offset, SEEK_SET);
-    uint8_t bitmap[BWFS_INODES];
-    fread(bitmap, sizeof(uint8_t), BWFS_INODES, f);
-    fclose(f);
+    inode_table_count = load_inodes(folder, inode_table);
+    return inode_table_count;
+}
 
-    printf("🧾 Bitmap leído: ");
-    for (int i = 0; i < 10; ++i) printf("%d", bitmap[i]);
-    printf("\n");
+inode_t *inode_table_get(int *count) {
+    if (count)
+        *count = inode_table_count < 0 ? 0 : inode_table_count;
+    return inode_table;
+}
 
-    for (int i = 0; i < BWFS_INODES; ++i)
-        if (bitmap[i] == 0)
-            return i;
+void inode_rdlock(int index) {
+    pthread_rwlock_rdlock(&inode_locks[index]);
+}
 
-    return -1;
+void inode_wrlock(int index) {
+    pthread_rwlock_wrlock(&inode_locks[index]);
 }
 
+void inode_unlock(int index) {
+    pthread_rwlock_unlock(&inode_locks[index]);
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
 
-int find_free_block(const char *folder) {
-    uint8_t block_bitmap[BWFS_MAX_BLOCKS];
-    const long offset_binario = 2000000;
+// Se llama sin locks de inodo tomados: toma el de lectura de cada inodo
+// sucio mientras lo copia al disco. La marca se borra antes de copiar, así
+// una modificación concurrente vuelve a encolarlo para el próximo sync.
+int inode_table_sync(const char *folder) {
+    int inodes_per_block = geometry.inodes_per_block;
+    const long offset_binario = metadata_offset();
+    int errors = 0;
 
-    char bpath[256];
-    snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", folder, 1 + INODE_BLOCKS);
-    FILE *f = fopen(bpath, "rb");
-    if (!f) {
-        perror("Error abriendo archivo de bitmap de bloques");
+    pthread_mutex_lock(&sync_lock);
+    pthread_mutex_lock(&dirty_lock);
+    int n = dirty_count;
+    int *pending = n ? malloc(n * sizeof(int)) : NULL;
+    if (pending) {
+        memcpy(pending, dirty_list, n * sizeof(int));
+        dirty_count = 0;
+    }
+    pthread_mutex_unlock(&dirty_lock);
+    if (n && !pending) {
+        pthread_mutex_unlock(&sync_lock);
         return -1;
     }
 
-    fseek(f, offset_binario, SEEK_SET);  // bloque bitmap empieza desde offset_binario
-    fread(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
-    fclose(f);
-
-    for (int i = 6; i < BWFS_MAX_BLOCKS; ++i) {
-        if (block_bitmap[i] == 0)
-            return i;
-    }
-    return -1;
-}
-void update_bitmap_block(const char *folder, int block, int used) {
-    uint8_t block_bitmap[BWFS_MAX_BLOCKS];
-    const long offset_binario = 2000000;
+    // Ordenados por número: un solo fopen por bloque de inodos
+    qsort(pending, n, sizeof(int), cmp_int);
+    FILE *f = NULL;
+    int open_block = -1;
+    for (int k = 0; k < n; ++k) {
+        int index = pending[k];
+        int block = index / inodes_per_block;
 
-    char bpath[256];
-    snprintf(bpath, sizeof(bpath), "%s/block_%03d.pbm", folder, 1 + INODE_BLOCKS);
-    FILE *f = fopen(bpath, "r+b");
-    if (!f) {
-        perror("Error actualizando bitmap de bloques");
-        return;
-    }
+        inode_rdlock(index);
+        pthread_mutex_lock(&dirty_lock);
+        inode_dirty[index] = 0;
+        pthread_mutex_unlock(&dirty_lock);
 
-    fseek(f, offset_binario, SEEK_SET);
-    fread(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
+        if (block != open_block) {
+            if (f)
+                fclose(f);
+            char path[256];
+            block_path(path, sizeof(path), folder, 1 + block);
+            f = fopen(path, "r+b");
+            open_block = block;
+        }
 
-    block_bitmap[block] = used;
+        if (!f || fseek(f, offset_binario + (index % inodes_per_block) * sizeof(inode_t), SEEK_SET) != 0 ||
+            fwrite(&inode_table[index], sizeof(inode_t), 1, f) != 1) {
+            // Queda sucio para el próximo intento
+            pthread_mutex_lock(&dirty_lock);
+            if (!inode_dirty[index]) {
+                inode_dirty[index] = 1;
+                dirty_list[dirty_count++] = index;
+            }
+            pthread_mutex_unlock(&dirty_lock);
+            errors++;
+        }
+        inode_unlock(index);
+    }
+    if (f && fclose(f) != 0)
+        errors++;
 
-    fseek(f, offset_binario, SEEK_SET);
-    fwrite(block_bitmap, sizeof(uint8_t), BWFS_MAX_BLOCKS, f);
-    fclose(f);
+    free(pending);
+    pthread_mutex_unlock(&sync_lock);
+    return errors ? -1 : 0;
 }
 
+// Baja a disco todo lo escrito en los archivos del volumen (bloques, tabla
+// de inodos, bitmaps); en un checkpoint va antes de vaciar el journal
+int volume_sync(const char *folder) {
+    int fd = open(folder, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int r = syncfs(fd);
+    close(fd);
+    return r;
+}
@@ -0,0 +1,138 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "test.h"
+#include "../includes/pbm.h"
+#include "../includes/compress.h"
+#include "../includes/bitmap.h"
+
+// Compresión (mount.bwfs -z): los clusters se comprimen al cerrar el
+// archivo y una escritura parcial los vuelve a crudo. Primero dos cortes:
+// uno después de fsync y del cierre que comprime, otro después de una
+// escritura sin fsync sobre el cluster comprimido. Lo que ya estaba en
+// disco tiene que leerse igual al montar de nuevo.
+
+static size_t payload;
+
+#define SIZE (payload * 4 + 1000)     // un cluster entero y un bloque más
+#define PATCH "ZZZZ"
+#define PATCH_OFFSET 200000
+
+static char pattern(size_t off) {
+    return (char)('a' + (off / 100) % 26);
+}
+
+static int write_pattern(fuse_ino_t ino, uint64_t fh, size_t size) {
+    char *buf = malloc(size);
+    int r = buf ? 0 : -1;
+    for (size_t k = 0; buf && k < size; ++k)
+        buf[k] = pattern(k);
+    if (buf && ll_write(ino, fh, buf, size, 0) != (long)size)
+        r = -1;
+    free(buf);
+    return r;
+}
+
+// El archivo tiene que ser el patrón, salvo PATCH en PATCH_OFFSET si `patched`
+static int check_file(fuse_ino_t ino, size_t size, int patched) {
+    uint64_t fh;
+    char *buf = malloc(size + 1);
+    int r = buf && ll_open(ino, O_RDONLY, &fh) == 0 ? 0 : -1;
+    if (r == 0) {
+        if (ll_read(ino, fh, buf, size + 1, 0) != (long)size)
+            r = -1;
+        ll_release(ino, fh);
+    }
+    for (size_t k = 0; r == 0 && k < size; ++k) {
+        int in_patch = patched && k >= PATCH_OFFSET && k < PATCH_OFFSET + strlen(PATCH);
+        char want = in_patch ? PATCH[k - PATCH_OFFSET] : pattern(k);
+        if (buf[k] != want) {
+            fprintf(stderr, "byte %zu = 0x%02x, se esperaba 0x%02x\n", k, (unsigned char)buf[k],
+                    (unsigned char)want);
+            r = -1;
+        }
+    }
+    free(buf);
+    return r;
+}
+
+// Corte 1: escrito, fsync y cerrado (se comprime al cerrar)
+static void crash_after_pack(void) {
+    fuse_ino_t ino;
+    uint64_t fh;
+    payload = pbm_payload_size();
+    CHECK(ll_create(FUSE_ROOT_ID, "crash", &ino, &fh) == 0, "create crash");
+    CHECK(write_pattern(ino, fh, SIZE) == 0, "write crash");
+    CHECK(ll_fsync(ino, fh) == 0, "fsync crash");
+    ll_release(ino, fh);
+
+    compress_stats_t zs;
+    compress_get_stats(&zs);
+    CHECK(zs.compressed == 1, "crash: %llu clusters comprimidos", (unsigned long long)zs.compressed);
+}
+
+// Corte 2: unos bytes en el medio del cluster comprimido, sin fsync, y
+// después otra operación que lleva el journal al archivo
+static void crash_after_expand(void) {
+    fuse_ino_t ino, dir;
+    uint64_t fh;
+    payload = pbm_payload_size();
+    CHECK(ll_lookup(FUSE_ROOT_ID, "crash", &ino) == 0, "lookup crash");
+    CHECK(ll_open(ino, O_RDWR, &fh) == 0, "open crash");
+    CHECK(ll_write(ino, fh, PATCH, strlen(PATCH), PATCH_OFFSET) == (long)strlen(PATCH), "write patch");
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "later", &dir) == 0, "mkdir later");
+
+    compress_stats_t zs;
+    compress_get_stats(&zs);
+    CHECK(zs.expanded == 1, "crash: %llu clusters expandidos", (unsigned long long)zs.expanded);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: compress <carpeta_del_volumen>\n");
+        return 2;
+    }
+    test_conf.compress = 1;
+
+    CHECK(test_crash(argv[1], crash_after_pack) == 0, "corte después de comprimir");
+    CHECK(test_crash(argv[1], crash_after_expand) == 0, "corte después de expandir");
+
+    // La escritura sin fsync pudo quedar o no, pero el resto sí
+    test_mount(argv[1]);
+    payload = pbm_payload_size();
+    fuse_ino_t ino, dir;
+    CHECK(ll_lookup(FUSE_ROOT_ID, "later", &dir) == 0, "el corte perdió el mkdir ya en el journal");
+    if (ll_lookup(FUSE_ROOT_ID, "crash", &ino) == 0)
+        CHECK(check_file(ino, SIZE, 0) == 0 || check_file(ino, SIZE, 1) == 0, "crash tras el corte");
+    else
+        CHECK(0, "lookup crash tras el corte");
+
+    // Se comprime al cerrar: el cluster entero entra en un bloque
+    fuse_ino_t a;
+    uint64_t fh;
+    int free_before = bitmap_free_blocks();
+    CHECK(ll_create(FUSE_ROOT_ID, "a", &a, &fh) == 0, "create a");
+    CHECK(write_pattern(a, fh, SIZE) == 0, "write a");
+    ll_release(a, fh);
+    compress_stats_t zs;
+    compress_get_stats(&zs);
+    CHECK(zs.compressed == 1 && zs.blocks_saved >= 2, "a: %llu clusters, %lld bloques ahorrados",
+          (unsigned long long)zs.compressed, (long long)zs.blocks_saved);
+    CHECK(free_before - bitmap_free_blocks() <= 3, "a ocupa %d bloques",
+          free_before - bitmap_free_blocks());
+    CHECK(check_file(a, SIZE, 0) == 0, "a comprimido");
+
+    // Una escritura parcial lo vuelve a crudo; al cerrar se comprime otra vez
+    CHECK(ll_open(a, O_RDWR, &fh) == 0, "open a");
+    CHECK(ll_write(a, fh, PATCH, strlen(PATCH), PATCH_OFFSET) == (long)strlen(PATCH), "patch a");
+    compress_get_stats(&zs);
+    CHECK(zs.expanded == 1, "a: %llu clusters expandidos", (unsigned long long)zs.expanded);
+    CHECK(check_file(a, SIZE, 1) == 0, "a expandido");
+    ll_release(a, fh);
+    compress_get_stats(&zs);
+    CHECK(zs.compressed == 2, "a: %llu clusters comprimidos", (unsigned long long)zs.compressed);
+
+    test_remount();
+    CHECK(check_file(a, SIZE, 1) == 0, "a tras montar");
+    return test_finish("compress");
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "test.h"
+#include "../includes/pbm.h"
+#include "../includes/dedup.h"
+#include "../includes/bitmap.h"
+
+// Deduplicación (mount.bwfs -d): al cerrar un archivo sus bloques pasan a
+// otros con el mismo contenido, y una escritura sobre un bloque compartido
+// le da una copia propia. Las referencias las compara fsck -f con los
+// punteros en tests/run.sh. Primero un corte después de copiar un bloque
+// compartido sin fsync: el otro dueño no cambia y el copiado se lee entero.
+
+static size_t payload;
+static char base = 'A';     // letra del primer bloque: otra después del corte
+
+#define NBLOCKS 3
+#define SIZE (payload * NBLOCKS)
+#define PATCH "ZZZZ"
+#define PATCH_OFFSET 10
+
+// Cada bloque lleno con su letra: distintos entre sí, iguales entre archivos
+static char pattern(size_t off) {
+    return (char)(base + off / payload);
+}
+
+static int make_file(const char *name, int durable, fuse_ino_t *ino) {
+    uint64_t fh;
+    char *buf = malloc(SIZE);
+    int r = buf ? ll_create(FUSE_ROOT_ID, name, ino, &fh) : -ENOMEM;
+    if (r == 0) {
+        for (size_t k = 0; k < SIZE; ++k)
+            buf[k] = pattern(k);
+        if (ll_write(*ino, fh, buf, SIZE, 0) != (long)SIZE || (durable && ll_fsync(*ino, fh) != 0))
+            r = -EIO;
+        ll_release(*ino, fh);
+    }
+    free(buf);
+    return r;
+}
+
+// El patrón, con PATCH en PATCH_OFFSET si `patched` y el bloque `filled`
+// entero en 'Q' (-1 = ninguno)
+static int check_file(fuse_ino_t ino, int patched, int filled) {
+    uint64_t fh;
+    char *buf = malloc(SIZE + 1);
+    int r = buf && ll_open(ino, O_RDONLY, &fh) == 0 ? 0 : -1;
+    if (r == 0) {
+        if (ll_read(ino, fh, buf, SIZE + 1, 0) != (long)SIZE)
+            r = -1;
+        ll_release(ino, fh);
+    }
+    for (size_t k = 0; r == 0 && k < SIZE; ++k) {
+        char want = pattern(k);
+        if (patched && k >= PATCH_OFFSET && k < PATCH_OFFSET + strlen(PATCH))
+            want = PATCH[k - PATCH_OFFSET];
+        else if ((int)(k / payload) == filled)
+            want = 'Q';
+        if (buf[k] != want) {
+            fprintf(stderr, "byte %zu = 0x%02x, se esperaba 0x%02x\n", k, (unsigned char)buf[k],
+                    (unsigned char)want);
+            r = -1;
+        }
+    }
+    free(buf);
+    return r;
+}
+
+// Corte: x e y iguales y en disco; después unos bytes sobre el primer
+// bloque de y, sin fsync, y otra operación que lleva el journal al archivo
+static void crash_after_unshare(void) {
+    fuse_ino_t x, y, dir;
+    uint64_t fh;
+    payload = pbm_payload_size();
+    CHECK(make_file("x", 1, &x) == 0, "crear x");
+    CHECK(make_file("y", 1, &y) == 0, "crear y");
+    dedup_stats_t ds;
+    dedup_get_stats(&ds);
+    CHECK(ds.deduped == NBLOCKS, "y: %llu bloques deduplicados", (unsigned long long)ds.deduped);
+
+    CHECK(ll_open(y, O_RDWR, &fh) == 0, "open y");
+    CHECK(ll_write(y, fh, PATCH, strlen(PATCH), PATCH_OFFSET) == (long)strlen(PATCH), "patch y");
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "later", &dir) == 0, "mkdir later");
+    dedup_get_stats(&ds);
+    CHECK(ds.copied == 1, "y: %llu bloques copiados", (unsigned long long)ds.copied);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: dedup <carpeta_del_volumen>\n");
+        return 2;
+    }
+    test_conf.dedup = 1;
+
+    CHECK(test_crash(argv[1], crash_after_unshare) == 0, "corte después de copiar");
+
+    // La escritura sin fsync pudo quedar o no, pero el resto sí
+    test_mount(argv[1]);
+    payload = pbm_payload_size();
+    fuse_ino_t ino;
+    CHECK(ll_lookup(FUSE_ROOT_ID, "later", &ino) == 0, "el corte perdió el mkdir ya en el journal");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "x", &ino) == 0 && check_file(ino, 0, -1) == 0, "x tras el corte");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "y", &ino) == 0 &&
+          (check_file(ino, 0, -1) == 0 || check_file(ino, 1, -1) == 0), "y tras el corte");
+
+    // Dos archivos iguales: b no ocupa bloques propios
+    base = 'a';
+    fuse_ino_t a, b;
+    uint64_t fh;
+    dedup_stats_t ds;
+    dedup_get_stats(&ds);
+    uint64_t shared = ds.shared;
+    CHECK(make_file("a", 0, &a) == 0, "crear a");
+    int free_before = bitmap_free_blocks();
+    CHECK(make_file("b", 0, &b) == 0, "crear b");
+    CHECK(bitmap_free_blocks() == free_before, "b ocupa %d bloques",
+          free_before - bitmap_free_blocks());
+    dedup_get_stats(&ds);
+    CHECK(ds.deduped == NBLOCKS && ds.shared == shared + NBLOCKS,
+          "a y b: %llu deduplicados, %llu compartidos", (unsigned long long)ds.deduped,
+          (unsigned long long)(ds.shared - shared));
+
+    // Parcial sobre el bloque 0 de b y entero sobre el 1: copias propias,
+    // a no cambia
+    char *fill = malloc(payload);
+    CHECK(fill != NULL, "malloc");
+    if (fill)
+        memset(fill, 'Q', payload);
+    CHECK(ll_open(b, O_RDWR, &fh) == 0, "open b");
+    CHECK(ll_write(b, fh, PATCH, strlen(PATCH), PATCH_OFFSET) == (long)strlen(PATCH), "patch b");
+    CHECK(fill && ll_write(b, fh, fill, payload, payload) == (long)payload, "bloque 1 de b");
+    ll_release(b, fh);
+    free(fill);
+    dedup_get_stats(&ds);
+    CHECK(ds.copied == 2 && ds.shared == shared + 1, "b: %llu copiados, %llu compartidos",
+          (unsigned long long)ds.copied, (unsigned long long)(ds.shared - shared));
+    CHECK(check_file(a, 0, -1) == 0, "a tras escribir b");
+    CHECK(check_file(b, 1, 1) == 0, "b escrito");
+
+    // Sin a, el bloque que compartían queda solo para b
+    CHECK(ll_unlink(FUSE_ROOT_ID, "a") == 0, "unlink a");
+    ll_forget(a, 1);
+    dedup_get_stats(&ds);
+    CHECK(ds.shared == shared, "sin a: %llu compartidos", (unsigned long long)(ds.shared - shared));
+    CHECK(check_file(b, 1, 1) == 0, "b sin a");
+
+    test_remount();
+    CHECK(check_file(b, 1, 1) == 0, "b tras montar");
+    return test_finish("dedup");
+}
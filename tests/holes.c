@@ -0,0 +1,101 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include "test.h"
+#include "../includes/pbm.h"
+
+// Bloques reciclados: un archivo llena el volumen con 'A' y se borra; otro
+// escribe unos pocos bytes dentro de cada bloque que queda libre. Lo que no
+// escribió tiene que leerse en cero, antes y después de desmontar. Al
+// final, SEEK_DATA/SEEK_HOLE sobre un archivo con huecos entre bloques.
+
+#define MARK "hello"
+#define MARK_OFFSET 1000
+
+static int check_file(fuse_ino_t ino, int blocks, size_t payload, const char *when) {
+    uint64_t fh;
+    char *buf = malloc(payload);
+    int bad = 0;
+    if (!buf || ll_open(ino, O_RDONLY, &fh) != 0)
+        return 1;
+    for (int b = 0; b < blocks && !bad; ++b) {
+        size_t len = b == blocks - 1 ? MARK_OFFSET + strlen(MARK) : payload;
+        CHECK(ll_read(ino, fh, buf, len, (off_t)b * payload) == (long)len,
+              "%s: lectura corta del bloque %d", when, b);
+        for (size_t k = 0; k < len && !bad; ++k) {
+            char want = k >= MARK_OFFSET && k < MARK_OFFSET + strlen(MARK) ? MARK[k - MARK_OFFSET] : 0;
+            if (buf[k] != want) {
+                CHECK(0, "%s: bloque %d byte %zu = 0x%02x, se esperaba 0x%02x", when, b, k,
+                      (unsigned char)buf[k], (unsigned char)want);
+                bad = 1;
+            }
+        }
+    }
+    ll_release(ino, fh);
+    free(buf);
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: holes <carpeta_del_volumen>\n");
+        return 2;
+    }
+    test_mount(argv[1]);
+    size_t payload = pbm_payload_size();
+    char *buf = malloc(payload);
+    if (!buf)
+        return 1;
+
+    // Todo el volumen con datos de otro archivo
+    fuse_ino_t ino;
+    uint64_t fh;
+    CHECK(ll_create(FUSE_ROOT_ID, "old", &ino, &fh) == 0, "no se pudo crear old");
+    memset(buf, 'A', payload);
+    int blocks = 0;
+    while (ll_write(ino, fh, buf, payload, (off_t)blocks * payload) == (long)payload)
+        blocks++;
+    CHECK(blocks > 2, "el volumen no dio lugar para old (%d bloques)", blocks);
+    CHECK(ll_fsync(ino, fh) == 0, "fsync de old");
+    ll_release(ino, fh);
+    CHECK(ll_unlink(FUSE_ROOT_ID, "old") == 0, "unlink de old");
+    ll_forget(ino, 1);
+
+    // Unos bytes en cada bloque: el resto de cada uno es un hueco. Quedan
+    // dos bloques para el índice y los metadatos.
+    blocks -= 2;
+    CHECK(ll_create(FUSE_ROOT_ID, "new", &ino, &fh) == 0, "no se pudo crear new");
+    for (int b = 0; b < blocks; ++b)
+        CHECK(ll_write(ino, fh, MARK, strlen(MARK), (off_t)b * payload + MARK_OFFSET) ==
+                  (long)strlen(MARK),
+              "escritura en el bloque %d", b);
+    ll_release(ino, fh);
+
+    check_file(ino, blocks, payload, "en caché");
+    test_remount();
+    check_file(ino, blocks, payload, "después de montar");
+
+    // Bloques 1 y 3 con datos, 0 y 2 huecos
+    CHECK(ll_unlink(FUSE_ROOT_ID, "new") == 0, "unlink de new");
+    ll_forget(ino, 1);
+    CHECK(ll_create(FUSE_ROOT_ID, "sparse", &ino, &fh) == 0, "no se pudo crear sparse");
+    for (int b = 1; b <= 3; b += 2)
+        CHECK(ll_write(ino, fh, MARK, strlen(MARK), (off_t)b * payload + MARK_OFFSET) ==
+                  (long)strlen(MARK),
+              "escritura en el bloque %d de sparse", b);
+    off_t p = payload, size = 3 * p + MARK_OFFSET + strlen(MARK);
+    CHECK(ll_lseek(ino, fh, 0, SEEK_DATA) == p, "SEEK_DATA desde 0");
+    CHECK(ll_lseek(ino, fh, p + 10, SEEK_DATA) == p + 10, "SEEK_DATA dentro de datos");
+    CHECK(ll_lseek(ino, fh, 2 * p, SEEK_DATA) == 3 * p, "SEEK_DATA desde un hueco");
+    CHECK(ll_lseek(ino, fh, size, SEEK_DATA) == -ENXIO, "SEEK_DATA en el final");
+    CHECK(ll_lseek(ino, fh, 0, SEEK_HOLE) == 0, "SEEK_HOLE desde 0");
+    CHECK(ll_lseek(ino, fh, p, SEEK_HOLE) == 2 * p, "SEEK_HOLE desde datos");
+    CHECK(ll_lseek(ino, fh, 3 * p, SEEK_HOLE) == size, "SEEK_HOLE en el último bloque");
+    CHECK(ll_lseek(ino, fh, size, SEEK_HOLE) == -ENXIO, "SEEK_HOLE en el final");
+    CHECK(ll_lseek(ino, fh, 0, SEEK_SET) == -EINVAL, "SEEK_SET lo resuelve el kernel");
+    ll_release(ino, fh);
+
+    free(buf);
+    return test_finish("holes");
+}
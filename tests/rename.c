@@ -0,0 +1,104 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include "test.h"
+#include "../includes/pbm.h"
+
+// rename sobre un destino que ya existe: se reemplaza como en rename(2),
+// salvo con RENAME_NOREPLACE; RENAME_EXCHANGE no se soporta. Los bloques
+// del archivo reemplazado quedan libres (lo mira fsck en tests/run.sh).
+
+static int make_file(fuse_ino_t parent, const char *name, char c, size_t size, fuse_ino_t *ino) {
+    uint64_t fh;
+    char *buf = malloc(size);
+    int r = buf ? ll_create(parent, name, ino, &fh) : -ENOMEM;
+    if (r == 0) {
+        memset(buf, c, size);
+        if (ll_write(*ino, fh, buf, size, 0) != (long)size)
+            r = -EIO;
+        ll_release(*ino, fh);
+    }
+    free(buf);
+    return r;
+}
+
+static int check_content(fuse_ino_t parent, const char *name, char c, size_t size) {
+    fuse_ino_t ino;
+    uint64_t fh;
+    char *buf = malloc(size + 1);
+    int r = buf ? ll_lookup(parent, name, &ino) : -ENOMEM;
+    if (r == 0 && (r = ll_open(ino, O_RDONLY, &fh)) == 0) {
+        if (ll_read(ino, fh, buf, size + 1, 0) != (long)size)
+            r = -EIO;
+        for (size_t k = 0; r == 0 && k < size; ++k)
+            if (buf[k] != c)
+                r = -EIO;
+        ll_release(ino, fh);
+        ll_forget(ino, 1);
+    }
+    free(buf);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: rename <carpeta_del_volumen>\n");
+        return 2;
+    }
+    test_mount(argv[1]);
+    size_t payload = pbm_payload_size();
+    size_t size_a = payload + 100, size_b = payload * 2 + 7;
+
+    fuse_ino_t a, b, c, d1, d2, d3, x, ino;
+    CHECK(make_file(FUSE_ROOT_ID, "a", 'A', size_a, &a) == 0, "crear a");
+    CHECK(make_file(FUSE_ROOT_ID, "b", 'B', size_b, &b) == 0, "crear b");
+    CHECK(make_file(FUSE_ROOT_ID, "c", 'C', 10, &c) == 0, "crear c");
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "d1", &d1) == 0, "mkdir d1");
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "d2", &d2) == 0, "mkdir d2");
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "d3", &d3) == 0, "mkdir d3");
+    CHECK(make_file(d2, "x", 'X', 10, &x) == 0, "crear d2/x");
+
+    // Un archivo reemplaza a otro: b pasa a ser el inodo de a
+    CHECK(ll_rename(FUSE_ROOT_ID, "a", FUSE_ROOT_ID, "b", 0) == 0, "a sobre b");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "a", &ino) == -ENOENT, "a sigue después del rename");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "b", &ino) == 0 && ino == a, "b no es el inodo de a");
+    ll_forget(ino, 1);
+    CHECK(check_content(FUSE_ROOT_ID, "b", 'A', size_a) == 0, "contenido de b tras el rename");
+    // El b anterior sigue vivo mientras el kernel lo conoce
+    CHECK(ll_getattr(b, NULL) == 0, "getattr del b reemplazado");
+    ll_forget(b, 1);
+
+    // El mismo archivo con el mismo nombre no cambia nada
+    CHECK(ll_rename(FUSE_ROOT_ID, "b", FUSE_ROOT_ID, "b", 0) == 0, "b sobre b");
+
+    CHECK(ll_rename(FUSE_ROOT_ID, "c", FUSE_ROOT_ID, "b", RENAME_NOREPLACE) == -EEXIST,
+          "NOREPLACE sobre b");
+    CHECK(ll_rename(FUSE_ROOT_ID, "c", FUSE_ROOT_ID, "z", RENAME_NOREPLACE) == 0,
+          "NOREPLACE a un nombre libre");
+    CHECK(ll_rename(FUSE_ROOT_ID, "z", FUSE_ROOT_ID, "b", RENAME_EXCHANGE) == -EINVAL,
+          "EXCHANGE");
+    CHECK(ll_rename(FUSE_ROOT_ID, "z", FUSE_ROOT_ID, "b", RENAME_WHITEOUT) == -EINVAL,
+          "WHITEOUT");
+
+    // Directorios: solo reemplazan a otro vacío, y nunca a un archivo
+    CHECK(ll_rename(FUSE_ROOT_ID, "d1", FUSE_ROOT_ID, "d2", 0) == -ENOTEMPTY, "d1 sobre d2");
+    CHECK(ll_rename(FUSE_ROOT_ID, "z", FUSE_ROOT_ID, "d1", 0) == -EISDIR, "z sobre d1");
+    CHECK(ll_rename(FUSE_ROOT_ID, "d1", FUSE_ROOT_ID, "z", 0) == -ENOTDIR, "d1 sobre z");
+    CHECK(ll_rename(FUSE_ROOT_ID, "d1", FUSE_ROOT_ID, "d3", 0) == 0, "d1 sobre d3");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "d3", &ino) == 0 && ino == d1, "d3 no es el inodo de d1");
+    ll_forget(ino, 1);
+    ll_forget(d3, 1);
+
+    // Entre directorios, reemplazando
+    CHECK(ll_rename(FUSE_ROOT_ID, "z", d2, "x", 0) == 0, "z sobre d2/x");
+    ll_forget(x, 1);
+    CHECK(check_content(d2, "x", 'C', 10) == 0, "contenido de d2/x");
+
+    test_remount();
+    CHECK(ll_readdir(FUSE_ROOT_ID) == 3, "la raíz no tiene b, d2 y d3");
+    CHECK(ll_readdir(d2) == 1, "d2 no tiene solo x");
+    CHECK(check_content(FUSE_ROOT_ID, "b", 'A', size_a) == 0, "b tras montar");
+    CHECK(check_content(d2, "x", 'C', 10) == 0, "d2/x tras montar");
+    return test_finish("rename");
+}
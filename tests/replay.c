@@ -0,0 +1,102 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "test.h"
+#include "../includes/pbm.h"
+#include "../includes/journal.h"
+
+// Replay del journal: un corte del daemon después de varias operaciones
+// de nombres e inodos, sin desmontar ni checkpoint. Al montar de nuevo el
+// journal las rehace: el árbol, los tamaños y lo escrito con fsync tienen
+// que estar como los dejó el hijo (fsck -f lo revisa en tests/run.sh).
+
+static size_t payload;
+
+#define SIZE_H (payload * 2 + 300)      // con fsync: el contenido tiene que quedar
+#define SIZE_G (payload + 17)           // sin fsync: solo el tamaño
+
+static int write_fill(fuse_ino_t ino, uint64_t fh, char c, size_t size) {
+    char *buf = malloc(size);
+    int r = buf ? 0 : -ENOMEM;
+    if (buf) {
+        memset(buf, c, size);
+        if (ll_write(ino, fh, buf, size, 0) != (long)size)
+            r = -EIO;
+    }
+    free(buf);
+    return r;
+}
+
+static int check_fill(fuse_ino_t ino, char c, size_t size) {
+    uint64_t fh;
+    char *buf = malloc(size + 1);
+    int r = buf && ll_open(ino, O_RDONLY, &fh) == 0 ? 0 : -1;
+    if (r == 0) {
+        if (ll_read(ino, fh, buf, size + 1, 0) != (long)size)
+            r = -1;
+        ll_release(ino, fh);
+    }
+    for (size_t k = 0; r == 0 && k < size; ++k)
+        if (buf[k] != c)
+            r = -1;
+    free(buf);
+    return r;
+}
+
+// mkdir d, d/f con fsync, g sin fsync, gone creado y borrado, d/f → d/h
+static void crash_after_ops(void) {
+    fuse_ino_t d, f, g, gone;
+    uint64_t fh;
+    payload = pbm_payload_size();
+    CHECK(ll_mkdir(FUSE_ROOT_ID, "d", &d) == 0, "mkdir d");
+    CHECK(ll_create(d, "f", &f, &fh) == 0, "create d/f");
+    CHECK(write_fill(f, fh, 'F', SIZE_H) == 0, "write d/f");
+    CHECK(ll_fsync(f, fh) == 0, "fsync d/f");
+    ll_release(f, fh);
+
+    CHECK(ll_create(FUSE_ROOT_ID, "g", &g, &fh) == 0, "create g");
+    CHECK(write_fill(g, fh, 'G', SIZE_G) == 0, "write g");
+    ll_release(g, fh);
+
+    CHECK(ll_create(FUSE_ROOT_ID, "gone", &gone, &fh) == 0, "create gone");
+    ll_release(gone, fh);
+    CHECK(ll_unlink(FUSE_ROOT_ID, "gone") == 0, "unlink gone");
+    ll_forget(gone, 1);
+
+    CHECK(ll_rename(d, "f", d, "h", 0) == 0, "rename d/f a d/h");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: replay <carpeta_del_volumen>\n");
+        return 2;
+    }
+    CHECK(test_crash(argv[1], crash_after_ops) == 0, "corte después de las operaciones");
+
+    // Sin journal pendiente el montaje no tendría nada que rehacer
+    char path[512];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", argv[1], BWFS_JOURNAL_FILE);
+    CHECK(stat(path, &st) == 0 && st.st_size > 0, "el corte no dejó el journal pendiente");
+
+    test_mount(argv[1]);
+    payload = pbm_payload_size();
+    fuse_ino_t d, h, g, ino;
+    CHECK(ll_readdir(FUSE_ROOT_ID) == 2, "la raíz no tiene solo d y g");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "gone", &ino) == -ENOENT, "gone sigue después del replay");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "d", &d) == 0, "lookup d");
+    CHECK(ll_getattr(d, &st) == 0 && S_ISDIR(st.st_mode), "d no es un directorio");
+    CHECK(ll_readdir(d) == 1, "d no tiene solo h");
+    CHECK(ll_lookup(d, "f", &ino) == -ENOENT, "d/f sigue después del rename");
+    CHECK(ll_lookup(d, "h", &h) == 0, "lookup d/h");
+    CHECK(ll_getattr(h, &st) == 0 && (size_t)st.st_size == SIZE_H, "tamaño de d/h");
+    CHECK(check_fill(h, 'F', SIZE_H) == 0, "contenido de d/h");
+    CHECK(ll_lookup(FUSE_ROOT_ID, "g", &g) == 0, "lookup g");
+    CHECK(ll_getattr(g, &st) == 0 && (size_t)st.st_size == SIZE_G, "tamaño de g");
+
+    // Un montaje más sobre lo rehecho no cambia nada
+    test_remount();
+    CHECK(ll_readdir(FUSE_ROOT_ID) == 2, "la raíz tras montar otra vez");
+    CHECK(check_fill(h, 'F', SIZE_H) == 0, "d/h tras montar otra vez");
+    return test_finish("replay");
+}
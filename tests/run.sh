@@ -0,0 +1,102 @@
+#!/bin/sh
+# Corre las pruebas de tests/ (make test). Cada una arranca con un volumen
+# nuevo de mkfs.bwfs y el volumen tiene que pasar fsck.bwfs -f después.
+#   BUILD    carpeta con los programas y build/tests (por omisión build)
+#   FORMATS  formatos de bloque a probar (por omisión "p4 p1")
+#   LEGACY   mkfs.bwfs original, para los volúmenes anteriores (por omisión
+#            el de la raíz del repositorio; vacío para no probarlos)
+
+BUILD=${BUILD:-build}
+FORMATS=${FORMATS:-"p4 p1"}
+LEGACY=${LEGACY-./mkfs.bwfs}
+failed=0
+
+volume() {
+    dir=$(mktemp -d "${TMPDIR:-/tmp}/bwfs-test-XXXXXX") || exit 1
+    echo "$dir"
+}
+
+# $1 = prueba, $2 = formato, resto = opciones de mkfs
+run() {
+    name=$1 format=$2
+    shift 2
+    dir=$(volume)
+    if ! "$BUILD/mkfs.bwfs" -f "$format" "$@" "$dir" >/dev/null; then
+        echo "❌ $name ($format): falló mkfs.bwfs"
+        failed=$((failed + 1))
+    elif ! "$BUILD/tests/$name" "$dir"; then
+        echo "❌ $name ($format)"
+        failed=$((failed + 1))
+    elif ! "$BUILD/fsck.bwfs" -f "$dir" >"$dir.fsck" 2>&1; then
+        cat "$dir.fsck"
+        echo "❌ $name ($format): fsck.bwfs encontró errores"
+        failed=$((failed + 1))
+    fi
+    rm -rf "$dir" "$dir.fsck"
+}
+
+for format in $FORMATS; do
+    run holes "$format" -b 64
+    run stress "$format" -b 128
+    run rename "$format" -b 64
+    run compress "$format" -b 64
+    run dedup "$format" -b 64
+    run replay "$format" -b 64
+done
+
+# Cluster comprimido dañado (P4: se busca la cabecera 'BWZ1' en el payload):
+# fsck -f lo ve, -r lo deja como hueco y después el volumen pasa
+dir=$(volume)
+if ! "$BUILD/mkfs.bwfs" -f p4 -b 64 "$dir" >/dev/null || ! "$BUILD/tests/compress" "$dir" 2>/dev/null; then
+    echo "❌ cluster: no se pudo preparar el volumen"
+    failed=$((failed + 1))
+else
+    for f in $(grep -l BWZ1 "$dir"/block_*.pbm); do
+        off=$(grep -oba BWZ1 "$f" | head -n 1 | cut -d: -f1)
+        printf '\377\377\377\377\377\377\377\377' |
+            dd of="$f" bs=1 seek=$((off + 40)) conv=notrunc 2>/dev/null
+    done
+    # El CRC del bloque también cambia: tiene que ser el cluster el que falle
+    "$BUILD/fsck.bwfs" -f "$dir" >"$dir.fsck" 2>&1
+    if ! grep -q "cluster comprimido" "$dir.fsck"; then
+        echo "❌ cluster: fsck.bwfs no vio el cluster dañado"
+        failed=$((failed + 1))
+    elif ! "$BUILD/fsck.bwfs" -f -r "$dir" >"$dir.fsck" 2>&1 ||
+         ! "$BUILD/fsck.bwfs" -f "$dir" >"$dir.fsck" 2>&1; then
+        cat "$dir.fsck"
+        echo "❌ cluster: fsck.bwfs -r no lo corrigió"
+        failed=$((failed + 1))
+    else
+        echo "✅ cluster"
+    fi
+fi
+rm -rf "$dir" "$dir.fsck"
+
+# Volumen anterior (P1, meta_offset fijo): recién creado pasa fsck; con un
+# bloque de metadatos cortado antes de meta_offset, no
+if [ -n "$LEGACY" ]; then
+    dir=$(volume)
+    if ! "$LEGACY" "$dir" >/dev/null; then
+        echo "❌ legacy: falló $LEGACY"
+        failed=$((failed + 1))
+    elif ! "$BUILD/fsck.bwfs" -f "$dir" >"$dir.fsck" 2>&1; then
+        cat "$dir.fsck"
+        echo "❌ legacy: fsck.bwfs encontró errores en un volumen recién creado"
+        failed=$((failed + 1))
+    else
+        truncate -s 1000000 "$dir/block_001.pbm"
+        if "$BUILD/fsck.bwfs" -f "$dir" >"$dir.fsck" 2>&1; then
+            echo "❌ legacy: fsck.bwfs no vio el bloque 1 truncado"
+            failed=$((failed + 1))
+        else
+            echo "✅ legacy"
+        fi
+    fi
+    rm -rf "$dir" "$dir.fsck"
+fi
+
+if [ "$failed" -ne 0 ]; then
+    echo "❌ $failed pruebas fallaron"
+    exit 1
+fi
+echo "✅ Todas las pruebas pasaron"
@@ -0,0 +1,230 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "test.h"
+#include "../includes/pbm.h"
+
+// Operaciones en paralelo sobre el mismo volumen: cada escritor crea,
+// escribe, relee y borra sus archivos; sobre un archivo compartido un hilo
+// reescribe rangos al azar (siempre con el mismo contenido) mientras otros
+// lo leen de corrido, dos de ellos con el mismo handle; otro hilo lista y
+// hace getattr. Al final se relee todo después de montar de nuevo.
+
+#define WRITERS 4
+#define ROUNDS 12
+#define READ_PASSES 6
+#define SHARED_BLOCKS 4
+#define CHUNK_MAX 70000
+
+static size_t payload;
+static fuse_ino_t shared_ino;
+static volatile int stop_misc = 0;
+
+static char pattern(unsigned seed, size_t off) {
+    return (char)(seed * 31 + off * 7 + off / 251);
+}
+
+static void fill(char *buf, unsigned seed, size_t off, size_t len) {
+    for (size_t k = 0; k < len; ++k)
+        buf[k] = pattern(seed, off + k);
+}
+
+static int verify(const char *buf, unsigned seed, size_t off, size_t len) {
+    for (size_t k = 0; k < len; ++k)
+        if (buf[k] != pattern(seed, off + k))
+            return -1;
+    return 0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// Escribe el archivo entero en pedazos de tamaño al azar
+static int write_file(fuse_ino_t ino, uint64_t fh, unsigned seed, size_t size, uint64_t *rnd) {
+    char *buf = malloc(CHUNK_MAX);
+    int r = 0;
+    for (size_t off = 0; buf && r == 0 && off < size;) {
+        size_t len = 1 + next_random(rnd) % CHUNK_MAX;
+        if (len > size - off)
+            len = size - off;
+        fill(buf, seed, off, len);
+        if (ll_write(ino, fh, buf, len, off) != (long)len)
+            r = -1;
+        off += len;
+    }
+    free(buf);
+    return buf ? r : -1;
+}
+
+static int read_file(fuse_ino_t ino, uint64_t fh, unsigned seed, size_t size) {
+    char *buf = malloc(size ? size : 1);
+    int r = buf ? 0 : -1;
+    for (size_t off = 0; buf && r == 0 && off < size;) {
+        size_t len = size - off < 32768 ? size - off : 32768;
+        long n = ll_read(ino, fh, buf + off, len, off);
+        if (n <= 0)
+            r = -1;
+        else
+            off += n;
+    }
+    if (r == 0 && verify(buf, seed, 0, size) != 0)
+        r = -1;
+    free(buf);
+    return r;
+}
+
+static size_t file_size(unsigned seed) {
+    // De unos bytes a casi tres bloques
+    return 1 + (seed * 2654435761u) % (payload * 3 - payload / 4);
+}
+
+static void *writer_main(void *arg) {
+    int id = (int)(intptr_t)arg;
+    uint64_t rnd = 0x9E3779B97F4A7C15ull * (id + 1);
+    char dirname[32], name[32];
+    fuse_ino_t dir;
+    snprintf(dirname, sizeof(dirname), "w%d", id);
+    CHECK(ll_mkdir(FUSE_ROOT_ID, dirname, &dir) == 0, "mkdir %s", dirname);
+
+    for (int r = 0; r < ROUNDS; ++r) {
+        unsigned seed = id * 1000 + r;
+        size_t size = file_size(seed);
+        fuse_ino_t ino;
+        uint64_t fh;
+        snprintf(name, sizeof(name), "f%d", r);
+        if (ll_create(dir, name, &ino, &fh) != 0) {
+            CHECK(0, "create %s/%s", dirname, name);
+            continue;
+        }
+        CHECK(write_file(ino, fh, seed, size, &rnd) == 0, "write %s/%s", dirname, name);
+        CHECK(read_file(ino, fh, seed, size) == 0, "releer %s/%s", dirname, name);
+        ll_release(ino, fh);
+
+        // Se quedan los de las vueltas impares: a la otra mitad se la borra
+        if (r % 2 == 0) {
+            CHECK(ll_unlink(dir, name) == 0, "unlink %s/%s", dirname, name);
+            ll_forget(ino, 1);
+        } else {
+            CHECK(ll_open(ino, O_RDONLY, &fh) == 0, "open %s/%s", dirname, name);
+            CHECK(read_file(ino, fh, seed, size) == 0, "reabrir %s/%s", dirname, name);
+            ll_release(ino, fh);
+        }
+    }
+    return NULL;
+}
+
+// Reescribe rangos del archivo compartido con lo mismo que ya tenía
+static void *rewriter_main(void *arg) {
+    (void)arg;
+    uint64_t rnd = 42, fh;
+    size_t size = payload * SHARED_BLOCKS;
+    char *buf = malloc(CHUNK_MAX);
+    if (!buf || ll_open(shared_ino, O_RDWR, &fh) != 0) {
+        CHECK(0, "open shared para escribir");
+        free(buf);
+        return NULL;
+    }
+    for (int k = 0; k < 200; ++k) {
+        size_t off = next_random(&rnd) % size;
+        size_t len = 1 + next_random(&rnd) % CHUNK_MAX;
+        if (len > size - off)
+            len = size - off;
+        fill(buf, 7, off, len);
+        CHECK(ll_write(shared_ino, fh, buf, len, off) == (long)len, "write shared");
+    }
+    ll_release(shared_ino, fh);
+    free(buf);
+    return NULL;
+}
+
+// Lecturas secuenciales (disparan el readahead) con un handle propio o con
+// el que se pasa
+static void *reader_main(void *arg) {
+    uint64_t *shared_fh = arg, fh;
+    if (shared_fh)
+        fh = *shared_fh;
+    else if (ll_open(shared_ino, O_RDONLY, &fh) != 0) {
+        CHECK(0, "open shared para leer");
+        return NULL;
+    }
+    for (int p = 0; p < READ_PASSES; ++p)
+        CHECK(read_file(shared_ino, fh, 7, payload * SHARED_BLOCKS) == 0, "leer shared");
+    if (!shared_fh)
+        ll_release(shared_ino, fh);
+    return NULL;
+}
+
+static void *misc_main(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&stop_misc, __ATOMIC_RELAXED)) {
+        CHECK(ll_readdir(FUSE_ROOT_ID) >= 1, "readdir /");
+        CHECK(ll_getattr(shared_ino, NULL) == 0, "getattr shared");
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: stress <carpeta_del_volumen>\n");
+        return 2;
+    }
+    test_mount(argv[1]);
+    payload = pbm_payload_size();
+
+    uint64_t fh, shared_fh;
+    uint64_t rnd = 1;
+    CHECK(ll_create(FUSE_ROOT_ID, "shared", &shared_ino, &fh) == 0, "create shared");
+    CHECK(write_file(shared_ino, fh, 7, payload * SHARED_BLOCKS, &rnd) == 0, "write shared");
+    ll_release(shared_ino, fh);
+    CHECK(ll_open(shared_ino, O_RDONLY, &shared_fh) == 0, "open shared");
+
+    pthread_t writers[WRITERS], readers[3], rewriter, misc;
+    for (int t = 0; t < WRITERS; ++t)
+        pthread_create(&writers[t], NULL, writer_main, (void *)(intptr_t)t);
+    pthread_create(&readers[0], NULL, reader_main, &shared_fh);
+    pthread_create(&readers[1], NULL, reader_main, &shared_fh);
+    pthread_create(&readers[2], NULL, reader_main, NULL);
+    pthread_create(&rewriter, NULL, rewriter_main, NULL);
+    pthread_create(&misc, NULL, misc_main, NULL);
+
+    for (int t = 0; t < WRITERS; ++t)
+        pthread_join(writers[t], NULL);
+    for (int t = 0; t < 3; ++t)
+        pthread_join(readers[t], NULL);
+    pthread_join(rewriter, NULL);
+    __atomic_store_n(&stop_misc, 1, __ATOMIC_RELAXED);
+    pthread_join(misc, NULL);
+    ll_release(shared_ino, shared_fh);
+
+    // Lo que quedó tiene que leerse igual desde el volumen
+    test_remount();
+    CHECK(ll_open(shared_ino, O_RDONLY, &fh) == 0, "open shared tras montar");
+    CHECK(read_file(shared_ino, fh, 7, payload * SHARED_BLOCKS) == 0, "shared tras montar");
+    ll_release(shared_ino, fh);
+    for (int t = 0; t < WRITERS; ++t) {
+        char dirname[32], name[32];
+        fuse_ino_t dir, ino;
+        snprintf(dirname, sizeof(dirname), "w%d", t);
+        CHECK(ll_lookup(FUSE_ROOT_ID, dirname, &dir) == 0, "lookup %s", dirname);
+        CHECK(ll_readdir(dir) == ROUNDS / 2, "%s no tiene %d archivos", dirname, ROUNDS / 2);
+        for (int r = 1; r < ROUNDS; r += 2) {
+            unsigned seed = t * 1000 + r;
+            snprintf(name, sizeof(name), "f%d", r);
+            if (ll_lookup(dir, name, &ino) != 0 || ll_open(ino, O_RDONLY, &fh) != 0) {
+                CHECK(0, "%s/%s tras montar", dirname, name);
+                continue;
+            }
+            CHECK(read_file(ino, fh, seed, file_size(seed)) == 0, "%s/%s tras montar", dirname,
+                  name);
+            ll_release(ino, fh);
+        }
+    }
+    return test_finish("stress");
+}
@@ -0,0 +1,71 @@
+#ifndef BWFS_TEST_H
+#define BWFS_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../includes/fuse_ops.h"
+#include "../includes/ll_client.h"
+#include "../includes/log.h"
+
+// Cada prueba es un programa que recibe la carpeta de un volumen recién
+// creado con mkfs.bwfs, lo monta sin kernel (ll_client.h) y devuelve 0 si
+// todo dio bien. tests/run.sh pasa fsck.bwfs -f sobre el volumen después.
+
+static struct bwfs_config test_conf;
+static struct fuse_conn_info test_conn;
+static int test_failures = 0;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "❌ %s:%d: ", __FILE__, __LINE__);                  \
+            fprintf(stderr, __VA_ARGS__);                                       \
+            fprintf(stderr, "\n");                                              \
+            __atomic_add_fetch(&test_failures, 1, __ATOMIC_RELAXED);            \
+        }                                                                       \
+    } while (0)
+
+static inline void test_mount(const char *folder) {
+    test_conf.folder = folder;
+    test_conf.log_level = BWFS_LOG_WARN;
+    test_conf.attr_timeout = test_conf.entry_timeout = test_conf.negative_timeout = -1;
+    bwfs_ll_ops.init(&test_conf, &test_conn);
+}
+
+// Desmontar y volver a montar: lo que siga se lee del volumen, no de la caché
+static inline void test_remount(void) {
+    bwfs_ll_ops.destroy(&test_conf);
+    bwfs_ll_ops.init(&test_conf, &test_conn);
+}
+
+// Un corte del daemon: `fn` corre en un proceso hijo que monta el volumen
+// y termina con _exit sin desmontar. Lo que quedó solo en la caché se
+// pierde; lo que llegó a los archivos del volumen (journal incluido) queda
+// para el próximo montaje, que rehace el journal. Llamar sin el volumen
+// montado; devuelve 0 si el hijo terminó y sus comprobaciones dieron bien.
+static inline int test_crash(const char *folder, void (*fn)(void)) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        test_mount(folder);
+        fn();
+        _exit(test_failures ? 1 : 0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static inline int test_finish(const char *name) {
+    bwfs_ll_ops.destroy(&test_conf);
+    if (test_failures)
+        fprintf(stderr, "❌ %s: %d comprobaciones fallaron\n", name, test_failures);
+    else
+        fprintf(stderr, "✅ %s\n", name);
+    return test_failures ? 1 : 0;
+}
+
+#endif // BWFS_TEST_H